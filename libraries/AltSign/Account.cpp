@@ -66,6 +66,11 @@ Account::Account(plist_t plist) /* throws */
     _lastName = lastName;
 }
 
+Account::Account(std::string appleID, std::string identifier, std::string firstName, std::string lastName) :
+    _appleID(appleID), _identifier(identifier), _firstName(firstName), _lastName(lastName)
+{
+}
+
 Account::Account()
 {
 }
@@ -25,6 +25,7 @@ public:
     ~Account();
     
 	Account(plist_t plist); /* throws */
+    Account(std::string appleID, std::string identifier, std::string firstName, std::string lastName);
     
     std::string appleID() const;
     std::string identifier() const;
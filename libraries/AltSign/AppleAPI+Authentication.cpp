@@ -3,6 +3,7 @@
 #include "AppleAPI.hpp"
 
 #include "AnisetteData.h"
+#include "Tracer.hpp"
 
 // Core Crypto
 extern "C" {
@@ -351,6 +352,9 @@ pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>
 		auto salt = DataFromBytes((const char*)saltBytes, saltSize);
 		auto B_data = DataFromBytes((const char*)B_bytes, B_size);
 
+		TraceSpan srpSpan("auth", "SRP challenge");
+		srpSpan.set("iterations", iterations);
+
 		auto passwordKey = ALTPBKDF2SRP(di_info, isS2K, password, salt, iterations);
 		if (passwordKey == ::nullopt)
 		{
@@ -364,6 +368,8 @@ pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>
 			throw APIError(APIErrorCode::AuthenticationHandshakeFailed);
 		}
 
+		srpSpan.End();
+
 		time_t time;
 		struct tm* tm;
 		char dateString[64];
@@ -649,8 +655,8 @@ pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>
 
 					*adsidValue = std::string(adsid);
 					return this->FetchAuthToken(parameters, sk, anisetteData)
-					.then([=](std::string token) {
-						auto session = std::make_shared<AppleAPISession>(*adsidValue, token, anisetteData);
+					.then([=](std::pair<std::string, std::optional<time_t>> token) {
+						auto session = std::make_shared<AppleAPISession>(*adsidValue, token.first, token.second, anisetteData);
 						*sessionValue = *session;
 
 						return this->FetchAccount(session);
@@ -664,7 +670,7 @@ pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>
 	return task;
 }
 
-pplx::task<std::string> AppleAPI::FetchAuthToken(std::map<std::string, plist_t> requestParameters, std::vector<unsigned char> sk, std::shared_ptr<AnisetteData> anisetteData)
+pplx::task<std::pair<std::string, std::optional<time_t>>> AppleAPI::FetchAuthToken(std::map<std::string, plist_t> requestParameters, std::vector<unsigned char> sk, std::shared_ptr<AnisetteData> anisetteData)
 {
 	auto apps = requestParameters["app"];
 	auto appNode = plist_array_get_item(apps, 0);
@@ -730,7 +736,19 @@ pplx::task<std::string> AppleAPI::FetchAuthToken(std::map<std::string, plist_t>
 
 		odslog("Got token for " << app << "!\nValue : " << token);
 
-		return std::string(token);
+		// Milliseconds since 1970.
+		std::optional<time_t> expirationDate = std::nullopt;
+
+		auto expiryNode = plist_dict_get_item(tokenDictionary, "expiry");
+		if (expiryNode != nullptr && plist_get_node_type(expiryNode) == PLIST_UINT)
+		{
+			uint64_t expiry = 0;
+			plist_get_uint_val(expiryNode, &expiry);
+
+			expirationDate = (time_t)(expiry / 1000);
+		}
+
+		return std::make_pair(std::string(token), expirationDate);
 	});
 }
 
@@ -744,8 +762,7 @@ pplx::task<bool> AppleAPI::RequestTwoFactorCode(
 	auto encodedURI = web::uri::encode_uri(url);
 	uri_builder builder(encodedURI);
 
-	http_request request(methods::GET);
-	request.set_request_uri(builder.to_string());
+	auto requestURI = builder.to_string();
 
 	time_t time;
 	struct tm* tm;
@@ -782,17 +799,24 @@ pplx::task<bool> AppleAPI::RequestTwoFactorCode(
 		{"X-Apple-I-TimeZone", (anisetteData->timeZone()) },
 	};
 
-	for (auto& pair : headers)
-	{
-		if (request.headers().has(pair.first))
+	auto makeRequest = [requestURI, headers]() {
+		http_request request(methods::GET);
+		request.set_request_uri(requestURI);
+
+		for (auto& pair : headers)
 		{
-			request.headers().remove(pair.first);
+			if (request.headers().has(pair.first))
+			{
+				request.headers().remove(pair.first);
+			}
+
+			request.headers().add(pair.first, pair.second);
 		}
 
-		request.headers().add(pair.first, pair.second);
-	}
+		return request;
+	};
 
-	auto task = this->gsaClient().request(request)
+	auto task = _scheduler.Schedule(this->gsaClient(), dsid, AppleAPIRequestPriority::Interactive, makeRequest)
 		.then([=](http_response response)
 			{
 				return response.content_ready();
@@ -806,7 +830,7 @@ pplx::task<bool> AppleAPI::RequestTwoFactorCode(
 					{
 						return verificationHandler();
 					})
-				.then([this, headers](std::optional<std::string> verificationCode) {
+				.then([this, headers, dsid](std::optional<std::string> verificationCode) {
 						if (!verificationCode.has_value())
 						{
 							throw APIError(APIErrorCode::RequiresTwoFactorAuthentication);
@@ -817,22 +841,26 @@ pplx::task<bool> AppleAPI::RequestTwoFactorCode(
 						auto encodedURI = web::uri::encode_uri(url);
 						uri_builder builder(encodedURI);
 
-						http_request request(methods::GET);
-						request.set_request_uri(builder.to_string());
+						auto requestURI = builder.to_string();
+						auto securityCode = *verificationCode;
 
-						for (auto& pair : headers)
-						{
-							if (request.headers().has(pair.first))
-							{
-								request.headers().remove(pair.first);
-							}
+						return _scheduler.Schedule(this->gsaClient(), dsid, AppleAPIRequestPriority::Interactive, [requestURI, headers, securityCode]() {
+							http_request request(methods::GET);
+							request.set_request_uri(requestURI);
 
-							request.headers().add(pair.first, pair.second);
-						}
+							for (auto& pair : headers)
+							{
+								if (request.headers().has(pair.first))
+								{
+									request.headers().remove(pair.first);
+								}
 
-						request.headers().add("security-code", (*verificationCode));
+								request.headers().add(pair.first, pair.second);
+							}
 
-						return this->gsaClient().request(request);
+							request.headers().add("security-code", securityCode);
+							return request;
+						});
 					})
 				.then([=](http_response response)
 					{
@@ -966,21 +994,29 @@ pplx::task<plist_t> AppleAPI::SendAuthenticationRequest(std::map<std::string, pl
 
 	uri_builder builder(U("/grandslam/GsService2"));
 
-	http_request request(methods::POST);
-	request.set_request_uri(builder.to_string());
-	request.set_body(plistXML);
+	auto requestURI = builder.to_string();
+	std::string body(plistXML);
 
-	for (auto& pair : headers)
-	{
-		if (request.headers().has(pair.first))
+	// The account isn't known until sign-in finishes, so these only count against gsa.apple.com's limit.
+	auto makeRequest = [requestURI, body, headers]() {
+		http_request request(methods::POST);
+		request.set_request_uri(requestURI);
+		request.set_body(body);
+
+		for (auto& pair : headers)
 		{
-			request.headers().remove(pair.first);
+			if (request.headers().has(pair.first))
+			{
+				request.headers().remove(pair.first);
+			}
+
+			request.headers().add(pair.first, pair.second);
 		}
 
-		request.headers().add(pair.first, pair.second);
-	}
+		return request;
+	};
 
-	auto task = this->gsaClient().request(request)
+	auto task = _scheduler.Schedule(this->gsaClient(), "", AppleAPIRequestPriority::Interactive, makeRequest)
 		.then([=](http_response response)
 			{
 				return response.content_ready();
@@ -9,6 +9,7 @@
 #include "altsign_common.h"
 #include <iostream>
 #include <bitset>
+#include <algorithm>
 
 /* The classes below are exported */
 
@@ -105,12 +106,28 @@ AppleAPI* AppleAPI::getInstance()
     return instance_;
 }
 
-AppleAPI::AppleAPI() : _servicesClient(U("https://developerservices2.apple.com/services/v1")), _client(U("https://developerservices2.apple.com/services/QH65B2")), _gsaClient(U("https://gsa.apple.com"))
+// Certificates are the list most likely to be changed by another machine (e.g. another AltServer
+// revoking ours), so they expire soonest.
+#define TEAMS_CACHE_LIFETIME 600
+#define DEVICES_CACHE_LIFETIME 300
+#define CERTIFICATES_CACHE_LIFETIME 60
+#define APP_IDS_CACHE_LIFETIME 300
+#define APP_GROUPS_CACHE_LIFETIME 300
+
+#define GSA_REQUESTS_PER_SECOND 2
+#define GSA_BURST 5
+
+#define DEVELOPER_SERVICES_URL "https://developerservices2.apple.com/services"
+#define GSA_URL "https://gsa.apple.com"
+
+AppleAPI::AppleAPI() : _servicesClient(U(DEVELOPER_SERVICES_URL "/v1")), _client(U(DEVELOPER_SERVICES_URL "/QH65B2")), _gsaClient(U(GSA_URL)),
+    _teamsCache(std::chrono::seconds(TEAMS_CACHE_LIFETIME)),
+    _devicesCache(std::chrono::seconds(DEVICES_CACHE_LIFETIME)),
+    _certificatesCache(std::chrono::seconds(CERTIFICATES_CACHE_LIFETIME)),
+    _appIDsCache(std::chrono::seconds(APP_IDS_CACHE_LIFETIME)),
+    _appGroupsCache(std::chrono::seconds(APP_GROUPS_CACHE_LIFETIME))
 {
-	http_client_config config;
-	config.set_validate_certificates(false);
-
-	_gsaClient = web::http::client::http_client(U("https://gsa.apple.com"), config);
+	this->setGSAURL(GSA_URL);
 
 //    volatile long response_counter = 0;
 //    auto response_count_handler =
@@ -134,10 +151,118 @@ AppleAPI::AppleAPI() : _servicesClient(U("https://developerservices2.apple.com/s
 	OpenSSL_add_all_algorithms();
 }
 
+#pragma mark - Coalescing -
+
+// Identifies a call by its arguments; the separator can't appear in any of them.
+static std::string CoalescingKey(std::initializer_list<std::string> parts)
+{
+    std::string key;
+    for (auto& part : parts)
+    {
+        key += part;
+        key += '\x1f';
+    }
+
+    return key;
+}
+
+AppleAPICoalescerStatistics AppleAPI::coalescerStatistics()
+{
+    return _coalescer.statistics();
+}
+
+#pragma mark - Cache -
+
+// Applies one of our own successful mutations to the cached list. After a failure we can't tell
+// what state the server is in, so the list is dropped instead.
+template <typename T, typename Result>
+static pplx::task<Result> UpdateCache(pplx::task<Result> task, AppleAPICache<T>& cache, std::string key, std::function<void(std::vector<std::shared_ptr<T>>&, Result)> handler)
+{
+    return task.then([&cache, key, handler](pplx::task<Result> task) {
+        try
+        {
+            auto result = task.get();
+            cache.update(key, [&](std::vector<std::shared_ptr<T>>& values) {
+                handler(values, result);
+            });
+
+            return result;
+        }
+        catch (...)
+        {
+            cache.invalidate(key);
+            throw;
+        }
+    });
+}
+
+std::chrono::seconds AppleAPI::cacheLifetime(AppleAPIResource resource)
+{
+    switch (resource)
+    {
+    case AppleAPIResource::Teams: return _teamsCache.lifetime();
+    case AppleAPIResource::Devices: return _devicesCache.lifetime();
+    case AppleAPIResource::Certificates: return _certificatesCache.lifetime();
+    case AppleAPIResource::AppIDs: return _appIDsCache.lifetime();
+    case AppleAPIResource::AppGroups: return _appGroupsCache.lifetime();
+    }
+
+    return std::chrono::seconds(0);
+}
+
+void AppleAPI::setCacheLifetime(AppleAPIResource resource, std::chrono::seconds lifetime)
+{
+    switch (resource)
+    {
+    case AppleAPIResource::Teams: _teamsCache.setLifetime(lifetime); break;
+    case AppleAPIResource::Devices: _devicesCache.setLifetime(lifetime); break;
+    case AppleAPIResource::Certificates: _certificatesCache.setLifetime(lifetime); break;
+    case AppleAPIResource::AppIDs: _appIDsCache.setLifetime(lifetime); break;
+    case AppleAPIResource::AppGroups: _appGroupsCache.setLifetime(lifetime); break;
+    }
+}
+
+AppleAPICacheStatistics AppleAPI::cacheStatistics(AppleAPIResource resource)
+{
+    switch (resource)
+    {
+    case AppleAPIResource::Teams: return _teamsCache.statistics();
+    case AppleAPIResource::Devices: return _devicesCache.statistics();
+    case AppleAPIResource::Certificates: return _certificatesCache.statistics();
+    case AppleAPIResource::AppIDs: return _appIDsCache.statistics();
+    case AppleAPIResource::AppGroups: return _appGroupsCache.statistics();
+    }
+
+    return AppleAPICacheStatistics();
+}
+
+void AppleAPI::InvalidateCache()
+{
+    _teamsCache.invalidateAll();
+    _devicesCache.invalidateAll();
+    _certificatesCache.invalidateAll();
+    _appIDsCache.invalidateAll();
+    _appGroupsCache.invalidateAll();
+}
+
 #pragma mark - Teams -
 
-pplx::task<std::vector<std::shared_ptr<Team>>> AppleAPI::FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session)
+pplx::task<std::vector<std::shared_ptr<Team>>> AppleAPI::FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache)
+{
+    // Uncached calls mustn't share a result that came from the cache.
+    return _coalescer.Perform<std::vector<std::shared_ptr<Team>>>(CoalescingKey({ session->dsid(), usesCache ? "FetchTeams" : "FetchTeams (uncached)", account->identifier() }), [=]() {
+        return this->_FetchTeams(account, session, usesCache);
+    });
+}
+
+pplx::task<std::vector<std::shared_ptr<Team>>> AppleAPI::_FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache)
 {
+    auto cachedTeams = usesCache ? _teamsCache.get(account->identifier()) : std::nullopt;
+    if (cachedTeams.has_value())
+    {
+        return pplx::task_from_result(*cachedTeams);
+    }
+
 	std::map<std::string, std::string> parameters = {};
     auto task = this->SendRequest("listTeams.action", parameters, session, nullptr)
     .then([=](plist_t plist)
@@ -172,6 +297,8 @@ pplx::task<std::vector<std::shared_ptr<Team>>> AppleAPI::FetchTeams(std::shared_
                                                                                      {
                                                                                          return std::nullopt;
                                                                                      });
+
+              _teamsCache.set(account->identifier(), teams);
               return teams;
           });
     
@@ -180,13 +307,45 @@ pplx::task<std::vector<std::shared_ptr<Team>>> AppleAPI::FetchTeams(std::shared_
 
 #pragma mark - Devices -
 
+// Devices of every type are cached together; callers' type filters are applied afterwards.
+static vector<shared_ptr<Device>> FilterDevices(const vector<shared_ptr<Device>>& devices, Device::Type types)
+{
+    vector<shared_ptr<Device>> filteredDevices;
+
+    for (auto& device : devices)
+    {
+        if ((types & device->type()) != device->type())
+        {
+            // Device type doesn't match the ones we requested, so ignore it.
+            continue;
+        }
+
+        filteredDevices.push_back(device);
+    }
+
+    return filteredDevices;
+}
+
 pplx::task<vector<shared_ptr<Device>>> AppleAPI::FetchDevices(shared_ptr<Team> team, Device::Type types, std::shared_ptr<AppleAPISession> session)
 {
+    return _coalescer.Perform<vector<shared_ptr<Device>>>(CoalescingKey({ session->dsid(), team->identifier(), "FetchDevices", std::to_string((int)types) }), [=]() {
+        return this->_FetchDevices(team, types, session);
+    });
+}
+
+pplx::task<vector<shared_ptr<Device>>> AppleAPI::_FetchDevices(shared_ptr<Team> team, Device::Type types, std::shared_ptr<AppleAPISession> session)
+{
+    auto cachedDevices = _devicesCache.get(team->identifier());
+    if (cachedDevices.has_value())
+    {
+        return pplx::task_from_result(FilterDevices(*cachedDevices, types));
+    }
+
 	std::map<std::string, std::string> parameters = {};
     auto task = this->SendRequest("ios/listDevices.action", parameters, session, team)
     .then([=](plist_t plist)
           {
-              auto devices = this->ProcessResponse<vector<shared_ptr<Device>>>(plist, [types](auto plist)
+              auto devices = this->ProcessResponse<vector<shared_ptr<Device>>>(plist, [](auto plist)
                                                                                      {
                                                                                          auto node = plist_dict_get_item(plist, "devices");
                                                                                          if (node == nullptr)
@@ -202,13 +361,6 @@ pplx::task<vector<shared_ptr<Device>>> AppleAPI::FetchDevices(shared_ptr<Team> t
                                                                                              plist_t plist = plist_array_get_item(node, i);
                                                                                              
                                                                                              auto device = make_shared<Device>(plist);
-
-																							 if ((types & device->type()) != device->type())
-																							 {
-																								 // Device type doesn't match the ones we requested, so ignore it.
-																								 continue;
-																							 }
-
                                                                                              devices.push_back(device);
                                                                                          }
                                                                                          
@@ -218,13 +370,24 @@ pplx::task<vector<shared_ptr<Device>>> AppleAPI::FetchDevices(shared_ptr<Team> t
                                                                                      {
                                                                                          return nullopt;
                                                                                      });
-              return devices;
+
+              _devicesCache.set(team->identifier(), devices);
+              return FilterDevices(devices, types);
           });
     
     return task;
 }
 
 pplx::task<shared_ptr<Device>> AppleAPI::RegisterDevice(string name, string identifier, Device::Type type, shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Perform<shared_ptr<Device>>(CoalescingKey({ session->dsid(), team->identifier(), "RegisterDevice", name, identifier, std::to_string((int)type) }), [=]() {
+        return _coalescer.Serialize<shared_ptr<Device>>(CoalescingKey({ team->identifier(), "Device", identifier }), [=]() {
+            return this->_RegisterDevice(name, identifier, type, team, session);
+        });
+    });
+}
+
+pplx::task<shared_ptr<Device>> AppleAPI::_RegisterDevice(string name, string identifier, Device::Type type, shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
     map<string, string> parameters = {
         {"name", name},
@@ -267,13 +430,28 @@ pplx::task<shared_ptr<Device>> AppleAPI::RegisterDevice(string name, string iden
               return devices;
           });
     
-    return task;
+    return UpdateCache<Device, shared_ptr<Device>>(task, _devicesCache, team->identifier(), [](auto& devices, auto device) {
+        devices.push_back(make_shared<Device>(*device));
+    });
 }
 
 #pragma mark - Certificates -
 
 pplx::task<std::vector<std::shared_ptr<Certificate>>> AppleAPI::FetchCertificates(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
+    return _coalescer.Perform<std::vector<std::shared_ptr<Certificate>>>(CoalescingKey({ session->dsid(), team->identifier(), "FetchCertificates" }), [=]() {
+        return this->_FetchCertificates(team, session);
+    });
+}
+
+pplx::task<std::vector<std::shared_ptr<Certificate>>> AppleAPI::_FetchCertificates(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+	auto cachedCertificates = _certificatesCache.get(team->identifier());
+	if (cachedCertificates.has_value())
+	{
+		return pplx::task_from_result(*cachedCertificates);
+	}
+
 	auto task = this->SendServicesRequest("certificates", "GET", {std::make_pair("filter[certificateType]", "IOS_DEVELOPMENT")}, session, team)
     .then([=](web::json::value json)
           {
@@ -299,6 +477,8 @@ pplx::task<std::vector<std::shared_ptr<Certificate>>> AppleAPI::FetchCertificate
 					{
 						return nullopt;
 					});
+
+              _certificatesCache.set(team->identifier(), certificates);
               return certificates;
           });
     
@@ -306,6 +486,15 @@ pplx::task<std::vector<std::shared_ptr<Certificate>>> AppleAPI::FetchCertificate
 }
 
 pplx::task<std::shared_ptr<Certificate>> AppleAPI::AddCertificate(std::string machineName, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Perform<std::shared_ptr<Certificate>>(CoalescingKey({ session->dsid(), team->identifier(), "AddCertificate", machineName }), [=]() {
+        return _coalescer.Serialize<std::shared_ptr<Certificate>>(CoalescingKey({ team->identifier(), "Certificates" }), [=]() {
+            return this->_AddCertificate(machineName, team, session);
+        });
+    });
+}
+
+pplx::task<std::shared_ptr<Certificate>> AppleAPI::_AddCertificate(std::string machineName, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
     CertificateRequest request;
 
@@ -344,10 +533,23 @@ pplx::task<std::shared_ptr<Certificate>> AppleAPI::AddCertificate(std::string ma
               return certificate;
           });
 
-    return task;
+    // The submitted certificate lacks the services identifier needed to revoke it later, so refetch the list instead of appending it.
+    return task.then([=](pplx::task<shared_ptr<Certificate>> task) {
+        _certificatesCache.invalidate(team->identifier());
+        return task.get();
+    });
 }
 
 pplx::task<bool> AppleAPI::RevokeCertificate(std::shared_ptr<Certificate> certificate, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Perform<bool>(CoalescingKey({ session->dsid(), team->identifier(), "RevokeCertificate", certificate->serialNumber() }), [=]() {
+        return _coalescer.Serialize<bool>(CoalescingKey({ team->identifier(), "Certificates" }), [=]() {
+            return this->_RevokeCertificate(certificate, team, session);
+        });
+    });
+}
+
+pplx::task<bool> AppleAPI::_RevokeCertificate(std::shared_ptr<Certificate> certificate, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
 	std::ostringstream ss;
 	ss << "certificates/" << *(certificate->identifier());
@@ -372,13 +574,30 @@ pplx::task<bool> AppleAPI::RevokeCertificate(std::shared_ptr<Certificate> certif
               return success;
           });
     
-    return task;
+    return UpdateCache<Certificate, bool>(task, _certificatesCache, team->identifier(), [certificate](auto& certificates, bool success) {
+        certificates.erase(std::remove_if(certificates.begin(), certificates.end(), [&](auto& cachedCertificate) {
+            return cachedCertificate->serialNumber() == certificate->serialNumber();
+        }), certificates.end());
+    });
 }
 
 #pragma mark - App IDs -
 
 pplx::task<std::vector<std::shared_ptr<AppID>>> AppleAPI::FetchAppIDs(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
+    return _coalescer.Perform<std::vector<std::shared_ptr<AppID>>>(CoalescingKey({ session->dsid(), team->identifier(), "FetchAppIDs" }), [=]() {
+        return this->_FetchAppIDs(team, session);
+    });
+}
+
+pplx::task<std::vector<std::shared_ptr<AppID>>> AppleAPI::_FetchAppIDs(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    auto cachedAppIDs = _appIDsCache.get(team->identifier());
+    if (cachedAppIDs.has_value())
+    {
+        return pplx::task_from_result(*cachedAppIDs);
+    }
+
 	std::map<std::string, std::string> parameters = {};
     auto task = this->SendRequest("ios/listAppIds.action", parameters, session, team)
     .then([=](plist_t plist)
@@ -408,6 +627,8 @@ pplx::task<std::vector<std::shared_ptr<AppID>>> AppleAPI::FetchAppIDs(std::share
                                                                                          {
                                                                                              return nullopt;
                                                                                          });
+
+              _appIDsCache.set(team->identifier(), appIDs);
               return appIDs;
           });
     
@@ -415,6 +636,15 @@ pplx::task<std::vector<std::shared_ptr<AppID>>> AppleAPI::FetchAppIDs(std::share
 }
 
 pplx::task<std::shared_ptr<AppID>> AppleAPI::AddAppID(std::string name, std::string bundleIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Perform<std::shared_ptr<AppID>>(CoalescingKey({ session->dsid(), team->identifier(), "AddAppID", name, bundleIdentifier }), [=]() {
+        return _coalescer.Serialize<std::shared_ptr<AppID>>(CoalescingKey({ team->identifier(), "AppID", bundleIdentifier }), [=]() {
+            return this->_AddAppID(name, bundleIdentifier, team, session);
+        });
+    });
+}
+
+pplx::task<std::shared_ptr<AppID>> AppleAPI::_AddAppID(std::string name, std::string bundleIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
     map<string, string> parameters = {
         { "name", name },
@@ -455,10 +685,20 @@ pplx::task<std::shared_ptr<AppID>> AppleAPI::AddAppID(std::string name, std::str
               return appID;
           });
     
-    return task;
+    return UpdateCache<AppID, shared_ptr<AppID>>(task, _appIDsCache, team->identifier(), [](auto& appIDs, auto appID) {
+        appIDs.push_back(make_shared<AppID>(*appID));
+    });
 }
 
 pplx::task<std::shared_ptr<AppID>> AppleAPI::UpdateAppID(std::shared_ptr<AppID> appID, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    // Only serialized: two updates of one App ID usually differ in the features they set.
+    return _coalescer.Serialize<std::shared_ptr<AppID>>(CoalescingKey({ team->identifier(), "AppID", appID->bundleIdentifier() }), [=]() {
+        return this->_UpdateAppID(appID, team, session);
+    });
+}
+
+pplx::task<std::shared_ptr<AppID>> AppleAPI::_UpdateAppID(std::shared_ptr<AppID> appID, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
 	map<string, plist_t> parameters = {
 		{ "appIdId", plist_new_string(appID->identifier().c_str()) },
@@ -503,13 +743,34 @@ pplx::task<std::shared_ptr<AppID>> AppleAPI::UpdateAppID(std::shared_ptr<AppID>
 				return appID;
 			});
 
-	return task;
+	return UpdateCache<AppID, shared_ptr<AppID>>(task, _appIDsCache, team->identifier(), [](auto& appIDs, auto appID) {
+		for (auto& cachedAppID : appIDs)
+		{
+			if (cachedAppID->identifier() == appID->identifier())
+			{
+				cachedAppID = make_shared<AppID>(*appID);
+			}
+		}
+	});
 }
 
 #pragma mark - App Groups -
 
 pplx::task<std::vector<std::shared_ptr<AppGroup>>> AppleAPI::FetchAppGroups(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
+    return _coalescer.Perform<std::vector<std::shared_ptr<AppGroup>>>(CoalescingKey({ session->dsid(), team->identifier(), "FetchAppGroups" }), [=]() {
+        return this->_FetchAppGroups(team, session);
+    });
+}
+
+pplx::task<std::vector<std::shared_ptr<AppGroup>>> AppleAPI::_FetchAppGroups(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+	auto cachedGroups = _appGroupsCache.get(team->identifier());
+	if (cachedGroups.has_value())
+	{
+		return pplx::task_from_result(*cachedGroups);
+	}
+
 	map<string, string> additionalParameters = {};
 	auto task = this->SendRequest("ios/listApplicationGroups.action", additionalParameters, session, team)
 		.then([=](plist_t plist)
@@ -539,6 +800,8 @@ pplx::task<std::vector<std::shared_ptr<AppGroup>>> AppleAPI::FetchAppGroups(std:
 					{
 						return nullopt;
 					});
+
+				_appGroupsCache.set(team->identifier(), groups);
 				return groups;
 			});
 
@@ -546,6 +809,15 @@ pplx::task<std::vector<std::shared_ptr<AppGroup>>> AppleAPI::FetchAppGroups(std:
 }
 
 pplx::task<std::shared_ptr<AppGroup>> AppleAPI::AddAppGroup(std::string name, std::string groupIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Perform<std::shared_ptr<AppGroup>>(CoalescingKey({ session->dsid(), team->identifier(), "AddAppGroup", name, groupIdentifier }), [=]() {
+        return _coalescer.Serialize<std::shared_ptr<AppGroup>>(CoalescingKey({ team->identifier(), "AppGroup", groupIdentifier }), [=]() {
+            return this->_AddAppGroup(name, groupIdentifier, team, session);
+        });
+    });
+}
+
+pplx::task<std::shared_ptr<AppGroup>> AppleAPI::_AddAppGroup(std::string name, std::string groupIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
 	map<string, string> parameters = {
 		{ "name", name },
@@ -580,10 +852,27 @@ pplx::task<std::shared_ptr<AppGroup>> AppleAPI::AddAppGroup(std::string name, st
 				return group;
 			});
 
-	return task;
+	return UpdateCache<AppGroup, shared_ptr<AppGroup>>(task, _appGroupsCache, team->identifier(), [](auto& groups, auto group) {
+		groups.push_back(make_shared<AppGroup>(*group));
+	});
 }
 
 pplx::task<bool> AppleAPI::AssignAppIDToGroups(std::shared_ptr<AppID> appID, std::vector<std::shared_ptr<AppGroup>> groups, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    std::string groupIdentifiers;
+    for (auto& group : groups)
+    {
+        groupIdentifiers += group->identifier() + ",";
+    }
+
+    return _coalescer.Perform<bool>(CoalescingKey({ session->dsid(), team->identifier(), "AssignAppIDToGroups", appID->identifier(), groupIdentifiers }), [=]() {
+        return _coalescer.Serialize<bool>(CoalescingKey({ team->identifier(), "AppID", appID->bundleIdentifier() }), [=]() {
+            return this->_AssignAppIDToGroups(appID, groups, team, session);
+        });
+    });
+}
+
+pplx::task<bool> AppleAPI::_AssignAppIDToGroups(std::shared_ptr<AppID> appID, std::vector<std::shared_ptr<AppGroup>> groups, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
 	map<string, plist_t> parameters = {
 		{ "appIdId", plist_new_string(appID->identifier().c_str()) }
@@ -634,6 +923,15 @@ pplx::task<bool> AppleAPI::AssignAppIDToGroups(std::shared_ptr<AppID> appID, std
 #pragma mark - Provisioning Profiles -
 
 pplx::task<std::shared_ptr<ProvisioningProfile>> AppleAPI::FetchProvisioningProfile(std::shared_ptr<AppID> appID, Device::Type deviceType, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    // Only serialized: Apple builds the profile from the devices registered when it's requested, so a fetch
+    // already in flight may not include a device registered since.
+    return _coalescer.Serialize<std::shared_ptr<ProvisioningProfile>>(CoalescingKey({ team->identifier(), "ProvisioningProfile", appID->bundleIdentifier() }), [=]() {
+        return this->_FetchProvisioningProfile(appID, deviceType, team, session);
+    });
+}
+
+pplx::task<std::shared_ptr<ProvisioningProfile>> AppleAPI::_FetchProvisioningProfile(std::shared_ptr<AppID> appID, Device::Type deviceType, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
     map<string, string> parameters = {
         { "appIdId", appID->identifier() },
@@ -686,6 +984,13 @@ pplx::task<std::shared_ptr<ProvisioningProfile>> AppleAPI::FetchProvisioningProf
 }
 
 pplx::task<bool> AppleAPI::DeleteProvisioningProfile(std::shared_ptr<ProvisioningProfile> profile, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
+{
+    return _coalescer.Serialize<bool>(CoalescingKey({ team->identifier(), "ProvisioningProfile", profile->bundleIdentifier() }), [=]() {
+        return this->_DeleteProvisioningProfile(profile, team, session);
+    });
+}
+
+pplx::task<bool> AppleAPI::_DeleteProvisioningProfile(std::shared_ptr<ProvisioningProfile> profile, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session)
 {
     if (!profile->identifier().has_value())
     {
@@ -789,9 +1094,8 @@ pplx::task<plist_t> AppleAPI::SendRequest(std::string uri,
 	auto encodedURI = web::uri::encode_uri(wideURI);
 	uri_builder builder(encodedURI);
 
-	http_request request(methods::POST);
-	request.set_request_uri(builder.to_string());
-	request.set_body(plistXML);
+	auto requestURI = builder.to_string();
+	std::string body(plistXML);
 
 	time_t time;
 	struct tm* tm;
@@ -823,17 +1127,26 @@ pplx::task<plist_t> AppleAPI::SendRequest(std::string uri,
 		{"X-Apple-I-TimeZone", (session->anisetteData()->timeZone()) },
 	};
 
-	for (auto& pair : headers)
-	{
-		if (request.headers().has(pair.first))
+	// Rebuilt for every attempt, since the scheduler may have to send it again.
+	auto makeRequest = [requestURI, body, headers]() {
+		http_request request(methods::POST);
+		request.set_request_uri(requestURI);
+		request.set_body(body);
+
+		for (auto& pair : headers)
 		{
-			request.headers().remove(pair.first);
+			if (request.headers().has(pair.first))
+			{
+				request.headers().remove(pair.first);
+			}
+
+			request.headers().add(pair.first, pair.second);
 		}
 
-		request.headers().add(pair.first, pair.second);
-	}
+		return request;
+	};
 
-	auto task = this->client().request(request)
+	auto task = _scheduler.Schedule(this->client(), session->dsid(), session->requestPriority(), makeRequest)
 		.then([=](http_response response)
 			{
 				return response.content_ready();
@@ -907,9 +1220,7 @@ pplx::task<json::value> AppleAPI::SendServicesRequest(std::string uri,
 	auto encodedURI = web::uri::encode_uri(uri);
 	uri_builder builder(encodedURI);
 
-	http_request request(methods::POST);
-	request.set_request_uri(builder.to_string());
-	request.set_body(jsonString);
+	auto requestURI = builder.to_string();
 
 	time_t time;
 	struct tm* tm;
@@ -942,17 +1253,25 @@ pplx::task<json::value> AppleAPI::SendServicesRequest(std::string uri,
 		{"X-Apple-I-TimeZone", (session->anisetteData()->timeZone()) },
 	};
 
-	for (auto& pair : headers)
-	{
-		if (request.headers().has(pair.first))
+	auto makeRequest = [requestURI, jsonString, headers]() {
+		http_request request(methods::POST);
+		request.set_request_uri(requestURI);
+		request.set_body(jsonString);
+
+		for (auto& pair : headers)
 		{
-			request.headers().remove(pair.first);
+			if (request.headers().has(pair.first))
+			{
+				request.headers().remove(pair.first);
+			}
+
+			request.headers().add(pair.first, pair.second);
 		}
 
-		request.headers().add(pair.first, pair.second);
-	}
+		return request;
+	};
 
-	auto task = this->servicesClient().request(request)
+	auto task = _scheduler.Schedule(this->servicesClient(), session->dsid(), session->requestPriority(), makeRequest)
 		.then([=](http_response response)
 			{
 				return response.content_ready();
@@ -996,3 +1315,42 @@ web::http::client::http_client AppleAPI::gsaClient()
 {
 	return this->_gsaClient;
 }
+
+std::string AppleAPI::developerServicesURL()
+{
+	auto url = this->_client.base_uri().to_string();
+	return url.substr(0, url.rfind('/'));
+}
+
+void AppleAPI::setDeveloperServicesURL(std::string url)
+{
+	while (!url.empty() && url.back() == '/')
+	{
+		url.pop_back();
+	}
+
+	_servicesClient = web::http::client::http_client(U(url + "/v1"));
+	_client = web::http::client::http_client(U(url + "/QH65B2"));
+}
+
+std::string AppleAPI::gsaURL()
+{
+	return this->_gsaClient.base_uri().to_string();
+}
+
+void AppleAPI::setGSAURL(std::string url)
+{
+	http_client_config config;
+	config.set_validate_certificates(false);
+
+	_gsaClient = web::http::client::http_client(U(url), config);
+
+	// Sign-in requests are few and Apple locks accounts out quickly, so the GSA host gets a tighter limit than developer services.
+	// The scheduler limits by host, so a stand-in serving both needs two host names (e.g. localhost and 127.0.0.1).
+	_scheduler.setEndpointRateLimit(_gsaClient.base_uri().host(), { GSA_REQUESTS_PER_SECOND, GSA_BURST });
+}
+
+AppleAPIScheduler& AppleAPI::scheduler()
+{
+	return _scheduler;
+}
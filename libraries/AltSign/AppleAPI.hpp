@@ -25,6 +25,9 @@
 #include "Error.hpp"
 
 #include "AppleAPISession.h"
+#include "AppleAPICache.hpp"
+#include "AppleAPIScheduler.hpp"
+#include "AppleAPICoalescer.hpp"
 
 
 #define BOOST_STACKTRACE_GNU_SOURCE_NOT_REQUIRED
@@ -42,7 +45,8 @@ public:
 		std::optional<std::function <pplx::task<std::optional<std::string>>(void)>> verificationHandler);
     
     // Teams
-	pplx::task<std::vector<std::shared_ptr<Team>>> FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session);
+    // With usesCache false the request is always sent, e.g. to find out whether a saved session is still accepted.
+	pplx::task<std::vector<std::shared_ptr<Team>>> FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache = true);
     
     // Devices
     pplx::task<std::vector<std::shared_ptr<Device>>> FetchDevices(std::shared_ptr<Team> team, Device::Type types, std::shared_ptr<AppleAPISession> session);
@@ -66,6 +70,26 @@ public:
     // Provisioning Profiles
     pplx::task<std::shared_ptr<ProvisioningProfile>> FetchProvisioningProfile(std::shared_ptr<AppID> appID, Device::Type deviceType, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
     pplx::task<bool> DeleteProvisioningProfile(std::shared_ptr<ProvisioningProfile> profile, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+
+    // Response cache for the Fetch* list requests above. A lifetime of 0 disables caching for that resource.
+    std::chrono::seconds cacheLifetime(AppleAPIResource resource);
+    void setCacheLifetime(AppleAPIResource resource, std::chrono::seconds lifetime);
+    AppleAPICacheStatistics cacheStatistics(AppleAPIResource resource);
+    void InvalidateCache();
+
+    // Every request to Apple goes through the scheduler, which rate limits and retries them.
+    AppleAPIScheduler& scheduler();
+
+    // Identical concurrent calls share one request; coalescedCalls counts the duplicates avoided.
+    AppleAPICoalescerStatistics coalescerStatistics();
+
+    // Where requests go, e.g. a local stand-in instead of Apple. Change them before sending any requests.
+    // The developer services URL is the parent of the QH65B2 (plist) and v1 (JSON) APIs.
+    std::string developerServicesURL();
+    void setDeveloperServicesURL(std::string url);
+
+    std::string gsaURL();
+    void setGSAURL(std::string url);
     
 private:
     AppleAPI();
@@ -80,6 +104,36 @@ private:
     
     web::http::client::http_client _client;
     web::http::client::http_client client();
+
+    AppleAPICache<Team> _teamsCache;
+    AppleAPICache<Device> _devicesCache;
+    AppleAPICache<Certificate> _certificatesCache;
+    AppleAPICache<AppID> _appIDsCache;
+    AppleAPICache<AppGroup> _appGroupsCache;
+
+    AppleAPIScheduler _scheduler;
+    AppleAPICoalescer _coalescer;
+
+    // The calls behind the public methods above, which coalesce and serialize them.
+	pplx::task<std::vector<std::shared_ptr<Team>>> _FetchTeams(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache);
+
+    pplx::task<std::vector<std::shared_ptr<Device>>> _FetchDevices(std::shared_ptr<Team> team, Device::Type types, std::shared_ptr<AppleAPISession> session);
+    pplx::task<std::shared_ptr<Device>> _RegisterDevice(std::string name, std::string identifier, Device::Type type, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+
+    pplx::task<std::vector<std::shared_ptr<Certificate>>> _FetchCertificates(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+    pplx::task<std::shared_ptr<Certificate>> _AddCertificate(std::string machineName, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+    pplx::task<bool> _RevokeCertificate(std::shared_ptr<Certificate> certificate, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+
+    pplx::task<std::vector<std::shared_ptr<AppID>>> _FetchAppIDs(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+    pplx::task<std::shared_ptr<AppID>> _AddAppID(std::string name, std::string bundleIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+	pplx::task<std::shared_ptr<AppID>> _UpdateAppID(std::shared_ptr<AppID> appID, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+
+	pplx::task<std::vector<std::shared_ptr<AppGroup>>> _FetchAppGroups(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+	pplx::task<std::shared_ptr<AppGroup>> _AddAppGroup(std::string name, std::string groupIdentifier, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+	pplx::task<bool> _AssignAppIDToGroups(std::shared_ptr<AppID> appID, std::vector<std::shared_ptr<AppGroup>> groups, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+
+    pplx::task<std::shared_ptr<ProvisioningProfile>> _FetchProvisioningProfile(std::shared_ptr<AppID> appID, Device::Type deviceType, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
+    pplx::task<bool> _DeleteProvisioningProfile(std::shared_ptr<ProvisioningProfile> profile, std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
     
 	pplx::task<plist_t> SendRequest(std::string uri,
 		std::map<std::string, std::string> additionalParameters,
@@ -100,7 +154,7 @@ private:
 		std::shared_ptr<AppleAPISession> session,
 		std::shared_ptr<Team> team);
 
-	pplx::task<std::string> FetchAuthToken(std::map<std::string, plist_t> requestParameters, std::vector<unsigned char> sk, std::shared_ptr<AnisetteData> anisetteData);
+	pplx::task<std::pair<std::string, std::optional<time_t>>> FetchAuthToken(std::map<std::string, plist_t> requestParameters, std::vector<unsigned char> sk, std::shared_ptr<AnisetteData> anisetteData);
 	pplx::task<std::shared_ptr<Account>> FetchAccount(std::shared_ptr<AppleAPISession> session);
 
 	pplx::task<bool> RequestTwoFactorCode(
@@ -0,0 +1,170 @@
+//
+//  AppleAPICache.hpp
+//  AltSign
+//
+//  Time-limited cache for developer services list responses, keyed by team
+//  (or account, for teams). AppleAPI keeps it current with its own mutations.
+//
+
+#ifndef AppleAPICache_hpp
+#define AppleAPICache_hpp
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+enum class AppleAPIResource
+{
+    Teams,
+    Devices,
+    Certificates,
+    AppIDs,
+    AppGroups,
+};
+
+struct AppleAPICacheStatistics
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t updates = 0;
+    uint64_t invalidations = 0;
+
+    double hitRate() const
+    {
+        return (hits + misses) == 0 ? 0 : (double)hits / (hits + misses);
+    }
+};
+
+template <typename T>
+class AppleAPICache
+{
+public:
+    AppleAPICache(std::chrono::seconds lifetime) : _lifetime(lifetime)
+    {
+    }
+
+    // Values are handed out as copies, so callers can modify what they get back
+    // (e.g. attach a private key) without touching the cache.
+    std::optional<std::vector<std::shared_ptr<T>>> get(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto iterator = _entries.find(key);
+        if (iterator == _entries.end() || std::chrono::steady_clock::now() - iterator->second.date >= _lifetime)
+        {
+            _statistics.misses++;
+            return std::nullopt;
+        }
+
+        _statistics.hits++;
+        return Copy(iterator->second.values);
+    }
+
+    void set(const std::string& key, const std::vector<std::shared_ptr<T>>& values)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_lifetime.count() == 0)
+        {
+            return;
+        }
+
+        Entry entry;
+        entry.date = std::chrono::steady_clock::now();
+        entry.values = Copy(values);
+        _entries[key] = entry;
+    }
+
+    // Applies a mutation we made ourselves to the cached list, if there is one. Doesn't extend its lifetime.
+    void update(const std::string& key, std::function<void(std::vector<std::shared_ptr<T>>&)> handler)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto iterator = _entries.find(key);
+        if (iterator == _entries.end())
+        {
+            return;
+        }
+
+        handler(iterator->second.values);
+        _statistics.updates++;
+    }
+
+    void invalidate(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_entries.erase(key) > 0)
+        {
+            _statistics.invalidations++;
+        }
+    }
+
+    void invalidateAll()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _statistics.invalidations += _entries.size();
+        _entries.clear();
+    }
+
+    std::chrono::seconds lifetime()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _lifetime;
+    }
+
+    void setLifetime(std::chrono::seconds lifetime)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _lifetime = lifetime;
+
+        if (_lifetime.count() == 0)
+        {
+            _entries.clear();
+        }
+    }
+
+    AppleAPICacheStatistics statistics()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _statistics;
+    }
+
+private:
+    struct Entry
+    {
+        std::chrono::steady_clock::time_point date;
+        std::vector<std::shared_ptr<T>> values;
+    };
+
+    std::mutex _mutex;
+    std::map<std::string, Entry> _entries;
+    std::chrono::seconds _lifetime;
+    AppleAPICacheStatistics _statistics;
+
+    static std::vector<std::shared_ptr<T>> Copy(const std::vector<std::shared_ptr<T>>& values)
+    {
+        std::vector<std::shared_ptr<T>> copies;
+        copies.reserve(values.size());
+
+        for (auto& value : values)
+        {
+            copies.push_back(std::make_shared<T>(*value));
+        }
+
+        return copies;
+    }
+};
+
+#pragma GCC visibility pop
+
+#endif /* AppleAPICache_hpp */
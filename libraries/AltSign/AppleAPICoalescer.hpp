@@ -0,0 +1,195 @@
+//
+//  AppleAPICoalescer.hpp
+//  AltSign
+//
+//  Single-flight for AppleAPI: identical calls made while one is already in
+//  flight share its network request and result, and mutations of the same
+//  resource run one at a time instead of racing each other.
+//
+
+#ifndef AppleAPICoalescer_hpp
+#define AppleAPICoalescer_hpp
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+struct AppleAPICoalescerStatistics
+{
+    uint64_t calls = 0;
+
+    // Calls that joined an identical call already in flight, i.e. duplicate requests avoided.
+    uint64_t coalescedCalls = 0;
+
+    // Mutations that waited for an earlier mutation of the same resource.
+    uint64_t serializedCalls = 0;
+};
+
+class AppleAPICoalescer
+{
+public:
+    // Runs operation unless a call with the same key is in flight, in which case its result is shared.
+    // Every caller gets its own copy of the result, so callers can't see each other's changes to it.
+    template <typename T>
+    pplx::task<T> Perform(const std::string& key, std::function<pplx::task<T>(void)> operation)
+    {
+        std::shared_ptr<pplx::task_completion_event<T>> flight;
+        bool isLeader = false;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _statistics.calls++;
+
+            auto iterator = _flights.find(key);
+            if (iterator != _flights.end())
+            {
+                flight = std::static_pointer_cast<pplx::task_completion_event<T>>(iterator->second);
+                _statistics.coalescedCalls++;
+            }
+            else
+            {
+                flight = std::make_shared<pplx::task_completion_event<T>>();
+                _flights[key] = flight;
+                isLeader = true;
+            }
+        }
+
+        if (isLeader)
+        {
+            pplx::task<T> task;
+            try
+            {
+                task = operation();
+            }
+            catch (...)
+            {
+                task = pplx::task_from_exception<T>(std::current_exception());
+            }
+
+            task.then([this, key, flight](pplx::task<T> task) {
+                {
+                    // Calls made from now on start a new request.
+                    std::lock_guard<std::mutex> lock(_mutex);
+
+                    auto iterator = _flights.find(key);
+                    if (iterator != _flights.end() && iterator->second == flight)
+                    {
+                        _flights.erase(iterator);
+                    }
+                }
+
+                try
+                {
+                    flight->set(task.get());
+                }
+                catch (...)
+                {
+                    flight->set_exception(std::current_exception());
+                }
+            });
+        }
+
+        return pplx::create_task(*flight).then([](T result) {
+            return AppleAPICoalescer::Duplicate(result);
+        });
+    }
+
+    // Runs operation once every earlier operation with the same key has finished, successfully or not.
+    template <typename T>
+    pplx::task<T> Serialize(const std::string& key, std::function<pplx::task<T>(void)> operation)
+    {
+        auto finished = std::make_shared<pplx::task_completion_event<void>>();
+
+        pplx::task<void> previousTask = pplx::task_from_result();
+        uint64_t generation = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            auto iterator = _queues.find(key);
+            if (iterator != _queues.end())
+            {
+                previousTask = iterator->second.tail;
+                _statistics.serializedCalls++;
+            }
+
+            generation = ++_generation;
+            _queues[key] = { pplx::create_task(*finished), generation };
+        }
+
+        return previousTask.then([operation]() {
+            return operation();
+        })
+        .then([this, key, generation, finished](pplx::task<T> task) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+
+                auto iterator = _queues.find(key);
+                if (iterator != _queues.end() && iterator->second.generation == generation)
+                {
+                    _queues.erase(iterator);
+                }
+            }
+
+            finished->set();
+            return task.get();
+        });
+    }
+
+    AppleAPICoalescerStatistics statistics()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _statistics;
+    }
+
+private:
+    struct Queue
+    {
+        pplx::task<void> tail;
+        uint64_t generation;
+    };
+
+    std::mutex _mutex;
+    std::map<std::string, std::shared_ptr<void>> _flights;
+    std::map<std::string, Queue> _queues;
+    uint64_t _generation = 0;
+
+    AppleAPICoalescerStatistics _statistics;
+
+    template <typename T>
+    static std::shared_ptr<T> Duplicate(const std::shared_ptr<T>& value)
+    {
+        return (value == nullptr) ? nullptr : std::make_shared<T>(*value);
+    }
+
+    template <typename T>
+    static std::vector<std::shared_ptr<T>> Duplicate(const std::vector<std::shared_ptr<T>>& values)
+    {
+        std::vector<std::shared_ptr<T>> copies;
+        copies.reserve(values.size());
+
+        for (auto& value : values)
+        {
+            copies.push_back(Duplicate(value));
+        }
+
+        return copies;
+    }
+
+    static bool Duplicate(bool value)
+    {
+        return value;
+    }
+};
+
+#pragma GCC visibility pop
+
+#endif /* AppleAPICoalescer_hpp */
@@ -0,0 +1,450 @@
+//
+//  AppleAPIScheduler.cpp
+//  AltSign
+//
+
+#include "AppleAPIScheduler.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <pplx/threadpool.h>
+
+#include "altsign_common.h"
+
+using namespace web::http;
+using namespace web::http::client;
+
+#define DEFAULT_MAXIMUM_CONCURRENT_REQUESTS 8
+#define DEFAULT_MAXIMUM_RETRY_COUNT 4
+
+#define DEFAULT_ENDPOINT_REQUESTS_PER_SECOND 10
+#define DEFAULT_ENDPOINT_BURST 20
+#define DEFAULT_ACCOUNT_REQUESTS_PER_SECOND 4
+#define DEFAULT_ACCOUNT_BURST 10
+
+// Retries back off exponentially from RETRY_BASE_DELAY, or wait as long as Retry-After asks,
+// plus jitter so requests throttled together don't come back together.
+#define RETRY_BASE_DELAY 1000
+#define RETRY_MAXIMUM_DELAY 30000
+
+#pragma mark - TokenBucket -
+
+void AppleAPIScheduler::TokenBucket::Refill(std::chrono::steady_clock::time_point now)
+{
+    auto elapsed = std::chrono::duration<double>(now - refillDate).count();
+    tokens = std::min(rateLimit.burst, tokens + elapsed * rateLimit.requestsPerSecond);
+    refillDate = now;
+}
+
+std::chrono::steady_clock::duration AppleAPIScheduler::TokenBucket::TimeUntilAvailable() const
+{
+    if (tokens >= 1 || rateLimit.requestsPerSecond <= 0)
+    {
+        return std::chrono::steady_clock::duration(0);
+    }
+
+    auto seconds = (1 - tokens) / rateLimit.requestsPerSecond;
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+#pragma mark - AppleAPIScheduler -
+
+AppleAPIScheduler::AppleAPIScheduler() : _activeRequests(0),
+    _maximumConcurrentRequests(DEFAULT_MAXIMUM_CONCURRENT_REQUESTS),
+    _maximumRetryCount(DEFAULT_MAXIMUM_RETRY_COUNT),
+    _defaultEndpointRateLimit({ DEFAULT_ENDPOINT_REQUESTS_PER_SECOND, DEFAULT_ENDPOINT_BURST }),
+    _accountRateLimit({ DEFAULT_ACCOUNT_REQUESTS_PER_SECOND, DEFAULT_ACCOUNT_BURST }),
+    _random(std::random_device()())
+{
+}
+
+pplx::task<http_response> AppleAPIScheduler::Schedule(http_client client, std::string account, AppleAPIRequestPriority priority,
+    std::function<http_request(void)> makeRequest)
+{
+    auto request = std::make_shared<Request>(client);
+    request->endpoint = client.base_uri().host();
+    request->account = account;
+    request->priority = priority;
+    request->makeRequest = makeRequest;
+    request->enqueueDate = std::chrono::steady_clock::now();
+
+    if (Tracer::isEnabled())
+    {
+        // Named after the action, e.g. listTeams.action, so each gets its own histogram.
+        auto path = makeRequest().request_uri().path();
+        auto name = path.substr(path.find_last_of('/') + 1);
+
+        request->span = std::make_shared<TraceSpan>("apple_api", name.empty() ? path : name);
+        request->span->set("endpoint", request->endpoint);
+        request->span->set("priority", priority == AppleAPIRequestPriority::Interactive ? "interactive" : "background");
+    }
+
+    this->Enqueue(request);
+    this->Dispatch();
+
+    return pplx::create_task(request->completionEvent);
+}
+
+void AppleAPIScheduler::Enqueue(std::shared_ptr<Request> request)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto& queue = (request->priority == AppleAPIRequestPriority::Interactive) ? _interactiveQueue : _backgroundQueue;
+    if (request->attempt == 0)
+    {
+        queue.push_back(request);
+    }
+    else
+    {
+        // Retries keep their place in line.
+        queue.push_front(request);
+    }
+
+    _statistics.queueDepth = _interactiveQueue.size() + _backgroundQueue.size();
+    _statistics.maximumQueueDepth = std::max(_statistics.maximumQueueDepth, _statistics.queueDepth);
+}
+
+void AppleAPIScheduler::Dispatch()
+{
+    std::vector<std::shared_ptr<Request>> requests;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto now = std::chrono::steady_clock::now();
+
+        bool isThrottled = false;
+        auto nextDispatchDelay = std::chrono::steady_clock::duration::max();
+
+        for (auto queue : { &_interactiveQueue, &_backgroundQueue })
+        {
+            // Requests blocked by their account's bucket don't hold up other accounts behind them.
+            for (auto iterator = queue->begin(); iterator != queue->end() && _activeRequests < (size_t)_maximumConcurrentRequests;)
+            {
+                auto request = *iterator;
+
+                auto& endpointBucket = this->EndpointBucket(request->endpoint);
+                endpointBucket.Refill(now);
+
+                TokenBucket* accountBucket = nullptr;
+                if (!request->account.empty())
+                {
+                    accountBucket = &this->AccountBucket(request->account);
+                    accountBucket->Refill(now);
+                }
+
+                auto delay = endpointBucket.TimeUntilAvailable();
+                if (accountBucket != nullptr)
+                {
+                    delay = std::max(delay, accountBucket->TimeUntilAvailable());
+                }
+
+                if (delay.count() > 0)
+                {
+                    isThrottled = true;
+                    nextDispatchDelay = std::min(nextDispatchDelay, delay);
+
+                    iterator++;
+                    continue;
+                }
+
+                endpointBucket.tokens -= 1;
+                if (accountBucket != nullptr)
+                {
+                    accountBucket->tokens -= 1;
+                }
+
+                if (request->attempt == 0)
+                {
+                    auto waitTime = std::chrono::duration_cast<std::chrono::milliseconds>(now - request->enqueueDate);
+                    _statistics.totalWaitTime += waitTime;
+                    _statistics.maximumWaitTime = std::max(_statistics.maximumWaitTime, waitTime);
+                }
+                else
+                {
+                    _statistics.retriedRequests++;
+                }
+
+                _statistics.sentRequests++;
+                _activeRequests++;
+
+                requests.push_back(request);
+                iterator = queue->erase(iterator);
+            }
+        }
+
+        _statistics.queueDepth = _interactiveQueue.size() + _backgroundQueue.size();
+        _statistics.activeRequests = _activeRequests;
+
+        // Otherwise the next finished request dispatches again.
+        if (isThrottled && _activeRequests < (size_t)_maximumConcurrentRequests)
+        {
+            this->ScheduleDispatch(nextDispatchDelay);
+        }
+    }
+
+    for (auto& request : requests)
+    {
+        this->Send(request);
+    }
+}
+
+void AppleAPIScheduler::Send(std::shared_ptr<Request> request)
+{
+    pplx::task<http_response> task;
+    try
+    {
+        task = request->client.request(request->makeRequest());
+    }
+    catch (...)
+    {
+        task = pplx::task_from_exception<http_response>(std::current_exception());
+    }
+
+    task.then([this, request](pplx::task<http_response> task) {
+        this->FinishRequest(request, task);
+    });
+}
+
+void AppleAPIScheduler::FinishRequest(std::shared_ptr<Request> request, pplx::task<http_response> task)
+{
+    http_response response;
+    std::exception_ptr error;
+
+    try
+    {
+        response = task.get();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    bool shouldRetry = false;
+    std::chrono::milliseconds retryDelay(0);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _activeRequests--;
+        _statistics.activeRequests = _activeRequests;
+
+        // Apple hasn't acted on throttled requests, so it's safe to send them again, even ones that change state.
+        if (error == nullptr && (response.status_code() == 429 || response.status_code() == status_codes::ServiceUnavailable))
+        {
+            _statistics.throttledResponses++;
+
+            // Keep everyone else from piling onto the endpoint until its bucket has refilled.
+            auto& endpointBucket = this->EndpointBucket(request->endpoint);
+            endpointBucket.tokens = std::min(endpointBucket.tokens, 0.0);
+
+            if (request->attempt < _maximumRetryCount)
+            {
+                request->attempt++;
+
+                shouldRetry = true;
+                retryDelay = this->RetryDelay(response, request->attempt);
+            }
+        }
+    }
+
+    if (!shouldRetry && request->span != nullptr)
+    {
+        request->span->set("attempts", request->attempt + 1);
+
+        if (error == nullptr)
+        {
+            request->span->set("status", (int)response.status_code());
+        }
+        else
+        {
+            request->span->set("error", true);
+        }
+
+        request->span->End();
+    }
+
+    if (shouldRetry)
+    {
+        odslog("[AppleAPI] " << request->endpoint << " responded " << response.status_code() << ", retrying in " << retryDelay.count() << " ms (attempt " << request->attempt << ")...");
+
+        auto& ioService = crossplat::threadpool::shared_instance().service();
+
+        auto timer = std::make_shared<boost::asio::steady_timer>(ioService, retryDelay);
+        timer->async_wait([this, request, timer](const boost::system::error_code& error) {
+            this->Enqueue(request);
+            this->Dispatch();
+        });
+    }
+    else if (error != nullptr)
+    {
+        request->completionEvent.set_exception(error);
+    }
+    else
+    {
+        request->completionEvent.set(response);
+    }
+
+    this->Dispatch();
+}
+
+std::chrono::milliseconds AppleAPIScheduler::RetryDelay(const http_response& response, int attempt)
+{
+    auto retryAfter = response.headers().find(header_names::retry_after);
+    if (retryAfter != response.headers().end())
+    {
+        auto seconds = atoi(retryAfter->second.c_str());
+        if (seconds > 0)
+        {
+            auto delay = std::min(seconds * 1000, RETRY_MAXIMUM_DELAY);
+            return std::chrono::milliseconds(delay + (int)(_random() % RETRY_BASE_DELAY));
+        }
+    }
+
+    auto delay = std::min(RETRY_BASE_DELAY << std::min(attempt - 1, 16), RETRY_MAXIMUM_DELAY);
+    return std::chrono::milliseconds(delay / 2 + (int)(_random() % (delay / 2 + 1)));
+}
+
+void AppleAPIScheduler::ScheduleDispatch(std::chrono::steady_clock::duration delay)
+{
+    auto dispatchDate = std::chrono::steady_clock::now() + delay;
+    if (_dispatchTimer != nullptr && _dispatchDate <= dispatchDate)
+    {
+        return;
+    }
+
+    if (_dispatchTimer != nullptr)
+    {
+        _dispatchTimer->cancel();
+    }
+
+    auto& ioService = crossplat::threadpool::shared_instance().service();
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(ioService, delay);
+    _dispatchTimer = timer;
+    _dispatchDate = dispatchDate;
+
+    timer->async_wait([this, timer](const boost::system::error_code& error) {
+        if (error)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_dispatchTimer == timer)
+            {
+                _dispatchTimer = nullptr;
+            }
+        }
+
+        this->Dispatch();
+    });
+}
+
+AppleAPIScheduler::TokenBucket& AppleAPIScheduler::EndpointBucket(const std::string& endpoint)
+{
+    auto iterator = _endpointBuckets.find(endpoint);
+    if (iterator != _endpointBuckets.end())
+    {
+        return iterator->second;
+    }
+
+    auto rateLimit = _defaultEndpointRateLimit;
+
+    auto limit = _endpointRateLimits.find(endpoint);
+    if (limit != _endpointRateLimits.end())
+    {
+        rateLimit = limit->second;
+    }
+
+    TokenBucket bucket = { rateLimit, rateLimit.burst, std::chrono::steady_clock::now() };
+    return _endpointBuckets.emplace(endpoint, bucket).first->second;
+}
+
+AppleAPIScheduler::TokenBucket& AppleAPIScheduler::AccountBucket(const std::string& account)
+{
+    auto iterator = _accountBuckets.find(account);
+    if (iterator != _accountBuckets.end())
+    {
+        return iterator->second;
+    }
+
+    TokenBucket bucket = { _accountRateLimit, _accountRateLimit.burst, std::chrono::steady_clock::now() };
+    return _accountBuckets.emplace(account, bucket).first->second;
+}
+
+#pragma mark - Configuration -
+
+int AppleAPIScheduler::maximumConcurrentRequests()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maximumConcurrentRequests;
+}
+
+void AppleAPIScheduler::setMaximumConcurrentRequests(int maximumConcurrentRequests)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _maximumConcurrentRequests = std::max(1, maximumConcurrentRequests);
+    }
+
+    this->Dispatch();
+}
+
+int AppleAPIScheduler::maximumRetryCount()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maximumRetryCount;
+}
+
+void AppleAPIScheduler::setMaximumRetryCount(int maximumRetryCount)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maximumRetryCount = std::max(0, maximumRetryCount);
+}
+
+void AppleAPIScheduler::setDefaultEndpointRateLimit(AppleAPIRateLimit rateLimit)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _defaultEndpointRateLimit = rateLimit;
+
+    for (auto& pair : _endpointBuckets)
+    {
+        if (_endpointRateLimits.count(pair.first) == 0)
+        {
+            pair.second.rateLimit = rateLimit;
+        }
+    }
+}
+
+void AppleAPIScheduler::setEndpointRateLimit(std::string endpoint, AppleAPIRateLimit rateLimit)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _endpointRateLimits[endpoint] = rateLimit;
+
+    auto iterator = _endpointBuckets.find(endpoint);
+    if (iterator != _endpointBuckets.end())
+    {
+        iterator->second.rateLimit = rateLimit;
+    }
+}
+
+void AppleAPIScheduler::setAccountRateLimit(AppleAPIRateLimit rateLimit)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _accountRateLimit = rateLimit;
+
+    for (auto& pair : _accountBuckets)
+    {
+        pair.second.rateLimit = rateLimit;
+    }
+}
+
+AppleAPISchedulerStatistics AppleAPIScheduler::statistics()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _statistics;
+}
@@ -0,0 +1,152 @@
+//
+//  AppleAPIScheduler.hpp
+//  AltSign
+//
+//  Queues requests to Apple's servers so concurrent installs share them
+//  politely: token buckets per endpoint (host) and per account, a cap on
+//  requests in flight, interactive before background requests, and jittered
+//  retries when Apple answers 429 or 503.
+//
+
+#ifndef AppleAPIScheduler_hpp
+#define AppleAPIScheduler_hpp
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include <cpprest/http_client.h>
+#include <boost/asio/steady_timer.hpp>
+
+#include "AppleAPISession.h"
+#include "Tracer.hpp"
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+struct AppleAPIRateLimit
+{
+    double requestsPerSecond;
+    double burst;
+};
+
+struct AppleAPISchedulerStatistics
+{
+    // Current state.
+    size_t queueDepth = 0;
+    size_t activeRequests = 0;
+
+    // Totals since launch.
+    size_t maximumQueueDepth = 0;
+    uint64_t sentRequests = 0;
+    uint64_t retriedRequests = 0;
+    uint64_t throttledResponses = 0;
+
+    std::chrono::milliseconds totalWaitTime = std::chrono::milliseconds(0);
+    std::chrono::milliseconds maximumWaitTime = std::chrono::milliseconds(0);
+
+    // Average time a request spent queued before it was sent (retries not included).
+    std::chrono::milliseconds averageWaitTime() const
+    {
+        auto firstAttempts = sentRequests - retriedRequests;
+        return std::chrono::milliseconds(firstAttempts == 0 ? 0 : totalWaitTime.count() / (int64_t)firstAttempts);
+    }
+};
+
+class AppleAPIScheduler
+{
+public:
+    AppleAPIScheduler();
+
+    // Sends the request returned by makeRequest to client once the endpoint and account have capacity.
+    // makeRequest is called again for every retry, since cpprest can't send an http_request twice.
+    // An empty account only counts against the endpoint's limit.
+    pplx::task<web::http::http_response> Schedule(web::http::client::http_client client, std::string account, AppleAPIRequestPriority priority,
+        std::function<web::http::http_request(void)> makeRequest);
+
+    int maximumConcurrentRequests();
+    void setMaximumConcurrentRequests(int maximumConcurrentRequests);
+
+    int maximumRetryCount();
+    void setMaximumRetryCount(int maximumRetryCount);
+
+    // Endpoints without their own limit use the default one.
+    void setDefaultEndpointRateLimit(AppleAPIRateLimit rateLimit);
+    void setEndpointRateLimit(std::string endpoint, AppleAPIRateLimit rateLimit);
+    void setAccountRateLimit(AppleAPIRateLimit rateLimit);
+
+    AppleAPISchedulerStatistics statistics();
+
+private:
+    struct TokenBucket
+    {
+        AppleAPIRateLimit rateLimit;
+        double tokens;
+        std::chrono::steady_clock::time_point refillDate;
+
+        void Refill(std::chrono::steady_clock::time_point now);
+        std::chrono::steady_clock::duration TimeUntilAvailable() const;
+    };
+
+    struct Request
+    {
+        web::http::client::http_client client;
+        std::string endpoint;
+        std::string account;
+        AppleAPIRequestPriority priority;
+        std::function<web::http::http_request(void)> makeRequest;
+
+        int attempt = 0;
+        std::chrono::steady_clock::time_point enqueueDate;
+        pplx::task_completion_event<web::http::http_response> completionEvent;
+
+        // From Schedule() until the last attempt finishes, so it includes time spent queued; nullptr while tracing is disabled.
+        std::shared_ptr<TraceSpan> span;
+
+        Request(web::http::client::http_client client) : client(client) {}
+    };
+
+    std::mutex _mutex;
+
+    std::deque<std::shared_ptr<Request>> _interactiveQueue;
+    std::deque<std::shared_ptr<Request>> _backgroundQueue;
+    size_t _activeRequests;
+
+    int _maximumConcurrentRequests;
+    int _maximumRetryCount;
+
+    AppleAPIRateLimit _defaultEndpointRateLimit;
+    AppleAPIRateLimit _accountRateLimit;
+    std::map<std::string, AppleAPIRateLimit> _endpointRateLimits;
+
+    std::map<std::string, TokenBucket> _endpointBuckets;
+    std::map<std::string, TokenBucket> _accountBuckets;
+
+    std::shared_ptr<boost::asio::steady_timer> _dispatchTimer;
+    std::chrono::steady_clock::time_point _dispatchDate;
+
+    std::mt19937 _random;
+
+    AppleAPISchedulerStatistics _statistics;
+
+    void Enqueue(std::shared_ptr<Request> request);
+    void Dispatch();
+    void Send(std::shared_ptr<Request> request);
+    void FinishRequest(std::shared_ptr<Request> request, pplx::task<web::http::http_response> task);
+
+    TokenBucket& EndpointBucket(const std::string& endpoint);
+    TokenBucket& AccountBucket(const std::string& account);
+
+    // Requires _mutex to be held.
+    void ScheduleDispatch(std::chrono::steady_clock::duration delay);
+    std::chrono::milliseconds RetryDelay(const web::http::http_response& response, int attempt);
+};
+
+#pragma GCC visibility pop
+
+#endif /* AppleAPIScheduler_hpp */
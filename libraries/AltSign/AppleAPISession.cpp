@@ -24,6 +24,11 @@ AppleAPISession::AppleAPISession(std::string dsid, std::string authToken, std::s
 {
 }
 
+AppleAPISession::AppleAPISession(std::string dsid, std::string authToken, std::optional<time_t> expirationDate, std::shared_ptr<AnisetteData> anisetteData) :
+	_dsid(dsid), _authToken(authToken), _expirationDate(expirationDate), _anisetteData(anisetteData)
+{
+}
+
 std::ostream& operator<<(std::ostream& os, const AppleAPISession& session)
 {
 	os << "DSID : " << session.dsid() <<
@@ -48,3 +53,17 @@ std::shared_ptr<AnisetteData> AppleAPISession::anisetteData() const
 	return _anisetteData;
 }
 
+std::optional<time_t> AppleAPISession::expirationDate() const
+{
+	return _expirationDate;
+}
+
+AppleAPIRequestPriority AppleAPISession::requestPriority() const
+{
+	return _requestPriority;
+}
+
+void AppleAPISession::setRequestPriority(AppleAPIRequestPriority priority)
+{
+	_requestPriority = priority;
+}
@@ -16,6 +16,14 @@ class AnisetteData;
 #include <optional>
 #include <string>
 #include <memory>
+#include <ctime>
+
+// Interactive requests are dispatched ahead of background ones when AppleAPI has to queue requests.
+enum class AppleAPIRequestPriority
+{
+	Interactive,
+	Background,
+};
 
 class AppleAPISession
 {
@@ -24,17 +32,27 @@ public:
 	~AppleAPISession();
 
 	AppleAPISession(std::string dsid, std::string authToken, std::shared_ptr<AnisetteData> anisetteData);
+	AppleAPISession(std::string dsid, std::string authToken, std::optional<time_t> expirationDate, std::shared_ptr<AnisetteData> anisetteData);
 
 	std::string dsid() const;
 	std::string authToken() const;
 	std::shared_ptr<AnisetteData> anisetteData() const;
 
+	// When Apple said the auth token expires, if it did.
+	std::optional<time_t> expirationDate() const;
+
+	// Priority of the requests sent with this session (default: Interactive).
+	AppleAPIRequestPriority requestPriority() const;
+	void setRequestPriority(AppleAPIRequestPriority priority);
+
 	friend std::ostream& operator<<(std::ostream& os, const AppleAPISession& session);
 
 private:
 	std::string _dsid;
 	std::string _authToken;
+	std::optional<time_t> _expirationDate;
 	std::shared_ptr<AnisetteData> _anisetteData;
+	AppleAPIRequestPriority _requestPriority = AppleAPIRequestPriority::Interactive;
 };
 
 #pragma GCC visibility pop
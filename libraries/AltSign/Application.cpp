@@ -11,6 +11,7 @@
 #include "Error.hpp"
 #include "ldid/ldid.hpp"
 
+#include <atomic>
 #include <fstream>
 #include <filesystem>
 #include "altsign_common.h"
@@ -19,16 +20,33 @@ extern std::vector<unsigned char> readFile(const char* filename);
 
 namespace fs = std::filesystem;
 
-Application::Application()
+static std::atomic<uint64_t> infoPlistParses(0);
+static std::atomic<uint64_t> extensionScans(0);
+static std::atomic<uint64_t> provisioningProfileReads(0);
+static std::atomic<uint64_t> entitlementQueries(0);
+
+Application::Contents::~Contents()
+{
+    if (infoPlist != nullptr)
+    {
+        plist_free(infoPlist);
+    }
+
+    if (entitlements.has_value())
+    {
+        for (auto& pair : *entitlements)
+        {
+            plist_free(pair.second);
+        }
+    }
+}
+
+Application::Application() : _contents(std::make_shared<Contents>())
 {
 }
 
 Application::~Application()
 {
-	for (auto& pair : _entitlements)
-	{
-		plist_free(pair.second);
-	}
 }
 
 Application::Application(const Application& app)
@@ -38,9 +56,8 @@ Application::Application(const Application& app)
 	_version = app.version();
 	_path = app.path();
 
-	// Don't assign _entitlementsString or _entitlements,
-	// since each copy will create its own entitlements lazily.
-	// Otherwise there might be duplicate frees in deconstructor.
+	// Shared rather than copied, so the bundle is only loaded once and plists are only freed by the last copy.
+	_contents = app._contents;
 }
 
 Application& Application::operator=(const Application& app)
@@ -54,16 +71,18 @@ Application& Application::operator=(const Application& app)
 	_bundleIdentifier = app.bundleIdentifier();
 	_version = app.version();
 	_path = app.path();
+	_contents = app._contents;
 
 	return *this;
 }
 
-Application::Application(std::string appBundlePath)
+Application::Application(std::string appBundlePath) : _contents(std::make_shared<Contents>())
 {
     fs::path path(appBundlePath);
     path.append("Info.plist");
 
 	auto plistData = readFile(path.string().c_str());
+	infoPlistParses++;
 
     plist_t plist = nullptr;
     plist_from_memory((const char *)plistData.data(), (int)plistData.size(), &plist);
@@ -72,6 +91,9 @@ Application::Application(std::string appBundlePath)
         throw SignError(SignErrorCode::InvalidApp);
     }
     
+    // Freed by Contents, even if we throw below.
+    _contents->infoPlist = plist;
+    
     auto nameNode = plist_dict_get_item(plist, "CFBundleName");
     auto bundleIdentifierNode = plist_dict_get_item(plist, "CFBundleIdentifier");
     auto versionNode = plist_dict_get_item(plist, "CFBundleShortVersionString");
@@ -94,6 +116,10 @@ Application::Application(std::string appBundlePath)
     _bundleIdentifier = bundleIdentifier;
     _version = version;
     _path = appBundlePath;
+
+    free(name);
+    free(bundleIdentifier);
+    free(version);
 }
 
 
@@ -129,71 +155,87 @@ std::string Application::path() const
 
 std::shared_ptr<ProvisioningProfile> Application::provisioningProfile()
 {
-	if (_provisioningProfile == NULL)
+	std::lock_guard<std::mutex> lock(_contents->mutex);
+
+	if (_contents->provisioningProfile == NULL)
 	{
 		fs::path path(this->path());
 		path.append("embedded.mobileprovision");
 
-		_provisioningProfile = std::make_shared<ProvisioningProfile>(path.string());
+		provisioningProfileReads++;
+		_contents->provisioningProfile = std::make_shared<ProvisioningProfile>(path.string());
 	}
 
-	return _provisioningProfile;
+	return _contents->provisioningProfile;
 }
 
 std::vector<std::shared_ptr<Application>> Application::appExtensions() const
 {
+	std::lock_guard<std::mutex> lock(_contents->mutex);
+
+	if (_contents->appExtensions.has_value())
+	{
+		return *_contents->appExtensions;
+	}
+
 	std::vector<std::shared_ptr<Application>> appExtensions;
 
 	fs::path plugInsPath(this->path());
 	plugInsPath.append("PlugIns");
 
-	if (!fs::exists(plugInsPath))
-	{
-		return appExtensions;
-	}
+	extensionScans++;
 
-	for (auto& file : fs::directory_iterator(plugInsPath))
+	if (fs::exists(plugInsPath))
 	{
-		if (file.path().extension() != ".appex")
+		for (auto& file : fs::directory_iterator(plugInsPath))
 		{
-			continue;
-		}
+			if (file.path().extension() != ".appex")
+			{
+				continue;
+			}
 
-		auto appExtension = std::make_shared<Application>(file.path().string());
-		if (appExtension == nullptr)
-		{
-			continue;
-		}
+			auto appExtension = std::make_shared<Application>(file.path().string());
+			if (appExtension == nullptr)
+			{
+				continue;
+			}
 
-		appExtensions.push_back(appExtension);
+			appExtensions.push_back(appExtension);
+		}
 	}
 
+	_contents->appExtensions = appExtensions;
 	return appExtensions;
 }
 
 std::string Application::entitlementsString()
 {
-	if (_entitlementsString == "")
+	if (!_contents->entitlementsString.has_value())
 	{
 		odslog("Querying entitlements for " << this->path() << " with ldid...");
-		_entitlementsString = ldid::Entitlements(this->path());
+
+		entitlementQueries++;
+		_contents->entitlementsString = ldid::Entitlements(this->path());
 	}
 
-	return _entitlementsString;
+	return *_contents->entitlementsString;
 }
 
 std::map<std::string, plist_t> Application::entitlements()
 {
-	if (_entitlements.size() == 0)
+	std::lock_guard<std::mutex> lock(_contents->mutex);
+
+	if (!_contents->entitlements.has_value())
 	{
 		auto rawEntitlements = this->entitlementsString();
 
+		std::map<std::string, plist_t> entitlements;
+
 		plist_t plist = nullptr;
 		plist_from_memory((const char*)rawEntitlements.data(), (int)rawEntitlements.size(), &plist);
 
 		if (plist != nullptr)
 		{
-			std::map<std::string, plist_t> entitlements;
 			char* key = NULL;
 			plist_t node = NULL;
 
@@ -213,20 +255,36 @@ std::map<std::string, plist_t> Application::entitlements()
 
 			free(it);
 			plist_free(plist);
-
-			_entitlements = entitlements;
 		}
 		else
 		{
 			odslog("Error parsing entitlements:\n" << rawEntitlements);
 		}
+
+		// Cached even if empty, so apps without entitlements aren't queried again.
+		_contents->entitlements = entitlements;
 	}
 
-	return _entitlements;
+	return *_contents->entitlements;
+}
+
+plist_t Application::infoPlist() const
+{
+	return _contents->infoPlist;
 }
 
 bool Application::isAltStoreApp() const
 {
 	auto isAltStoreApp = this->bundleIdentifier().find("com.rileytestut.AltStore") != std::string::npos;
 	return isAltStoreApp;
-}
\ No newline at end of file
+}
+
+ApplicationStatistics Application::statistics()
+{
+	ApplicationStatistics statistics;
+	statistics.infoPlistParses = infoPlistParses;
+	statistics.extensionScans = extensionScans;
+	statistics.provisioningProfileReads = provisioningProfileReads;
+	statistics.entitlementQueries = entitlementQueries;
+	return statistics;
+}
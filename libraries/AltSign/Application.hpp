@@ -16,11 +16,29 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include <plist/plist.h>
 
 #include "ProvisioningProfile.hpp"
 
+struct ApplicationStatistics
+{
+    // Info.plists read and parsed, i.e. Applications created from a path.
+    uint64_t infoPlistParses = 0;
+
+    // PlugIns directories enumerated for app extensions.
+    uint64_t extensionScans = 0;
+
+    uint64_t provisioningProfileReads = 0;
+
+    // Entitlements read from the executable with ldid.
+    uint64_t entitlementQueries = 0;
+};
+
+// Copies share one parsed bundle, so extensions, entitlements and the embedded
+// provisioning profile are only loaded once, when first requested.
 class Application
 {
 public:
@@ -42,8 +60,13 @@ public:
 
 	std::map<std::string, plist_t> entitlements();
 
+	// Info.plist as it was when the Application was created. Owned by the Application; copy it before modifying.
+	plist_t infoPlist() const;
+
 	bool isAltStoreApp() const;
     
+    static ApplicationStatistics statistics();
+    
     friend std::ostream& operator<<(std::ostream& os, const Application& app);
     
 private:
@@ -52,11 +75,24 @@ private:
     std::string _version;
     std::string _path;
 
-	std::shared_ptr<ProvisioningProfile> _provisioningProfile;
+    struct Contents
+    {
+        ~Contents();
+
+        std::mutex mutex;
+
+        plist_t infoPlist = nullptr;
+
+        std::optional<std::vector<std::shared_ptr<Application>>> appExtensions;
+        std::shared_ptr<ProvisioningProfile> provisioningProfile;
+
+        std::optional<std::string> entitlementsString;
+        std::optional<std::map<std::string, plist_t>> entitlements;
+    };
 
-	std::string _entitlementsString;
-	std::map<std::string, plist_t> _entitlements;
+    std::shared_ptr<Contents> _contents;
 
+	// Requires _contents->mutex to be held.
 	std::string entitlementsString();
 };
 
@@ -9,13 +9,21 @@
 #include <filesystem>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "Archiver.hpp"
 #include "Error.hpp"
+#include "Tracer.hpp"
 
 extern "C" {
 #include "zip.h"
 #include "unzip.h"
+#include "backend.h"
 }
 
 #ifdef _WIN32
@@ -28,6 +36,12 @@ extern "C" {
 #endif
 
 const int ALTReadBufferSize = 8192;
+const int ALTExtractBufferSize = 1 << 18;
+const int ALTExtractWholeEntryLimit = 16 << 20;
+const int ALTZipTrialSize = 1 << 16;
+const int ALTZipStoreThresholdPercent = 95;
+const int ALTZipBufferedEntryLimit = 32 << 20;
+const int ALTZipBufferedBytesLimit = 64 << 20;
 const int ALTMaxFilenameLength = 512;
 
 #include <sstream>
@@ -61,13 +75,16 @@ extern std::string replace_all(
 	const std::string& replace //      by 'replace'
 );
 
-std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
+struct ALTArchiveEntry
+{
+    unz_file_pos position;
+    fs::path filepath;
+    uLong permissions;
+    uLong uncompressedSize;
+};
+
+static void ExtractArchiveEntries(std::string filepath, std::vector<ALTArchiveEntry>& entries, std::atomic<size_t>& nextEntry, std::atomic<bool>& cancelled)
 {
-    if (outputDirectory[outputDirectory.size() - 1] != ALTDirectoryDeliminator)
-    {
-        outputDirectory += ALTDirectoryDeliminator;
-    }
-    
     unzFile zipFile = unzOpen(filepath.c_str());
     if (zipFile == NULL)
     {
@@ -87,6 +104,102 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
         unzClose(zipFile);
     };
     
+    std::vector<char> buffer(ALTExtractBufferSize);
+    
+    // Workers pull entries (largest first) until none are left, which keeps them evenly loaded.
+    for (size_t i = nextEntry++; i < entries.size() && !cancelled; i = nextEntry++)
+    {
+        auto& entry = entries[i];
+        
+        // Whole-buffer backends inflate an entry in one call when it fits the caller's buffer.
+        if (zbackendGet() != Z_BACKEND_ZLIB && entry.uncompressedSize > buffer.size() && entry.uncompressedSize <= ALTExtractWholeEntryLimit)
+        {
+            buffer.resize(entry.uncompressedSize);
+        }
+        
+        if (unzGoToFilePos(zipFile, &entry.position) != UNZ_OK || unzOpenCurrentFile(zipFile) != UNZ_OK)
+        {
+            finish();
+            throw ArchiveError(ArchiveErrorCode::Unknown);
+        }
+        
+        std::string narrowFilepath = entry.filepath.string();
+        
+        outputFile = fopen(narrowFilepath.c_str(), "wb");
+        if (outputFile == NULL)
+        {
+            finish();
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+        
+        // Reads are already large, so skip stdio's own buffering.
+        setvbuf(outputFile, NULL, _IONBF, 0);
+        
+        int result = UNZ_OK;
+        
+        do
+        {
+            result = unzReadCurrentFile(zipFile, buffer.data(), (unsigned int)buffer.size());
+            
+            if (result < 0)
+            {
+                finish();
+                throw ArchiveError(ArchiveErrorCode::Unknown);
+            }
+            
+            size_t count = fwrite(buffer.data(), result, 1, outputFile);
+            if (result > 0 && count != 1)
+            {
+                finish();
+                throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+            }
+            
+        } while (result > 0);
+        
+        short permissions = entry.permissions & 0x01FF;
+        chmod(narrowFilepath.c_str(), permissions);
+        
+        fclose(outputFile);
+        outputFile = NULL;
+        
+        // The CRC is only checked here, once the whole entry has been read.
+        int closeResult = unzCloseCurrentFile(zipFile);
+        if (closeResult != UNZ_OK)
+        {
+            odslog("Failed to extract " << narrowFilepath << (closeResult == UNZ_CRCERROR ? ", its CRC doesn't match." : "."));
+            
+            unzClose(zipFile);
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+    }
+    
+    unzClose(zipFile);
+}
+
+std::string UnzipAppBundle(std::string filepath, std::string outputDirectory, int threadCount)
+{
+    TraceSpan span("archive", "Unzip app");
+    
+    if (outputDirectory[outputDirectory.size() - 1] != ALTDirectoryDeliminator)
+    {
+        outputDirectory += ALTDirectoryDeliminator;
+    }
+    
+    unzFile zipFile = unzOpen(filepath.c_str());
+    if (zipFile == NULL)
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+    
+    auto finish = [&zipFile](void)
+    {
+        if (zipFile != nullptr)
+        {
+            unzClose(zipFile);
+            zipFile = nullptr;
+        }
+    };
+    
     unz_global_info zipInfo;
     if (unzGetGlobalInfo(zipFile, &zipInfo) != UNZ_OK)
     {
@@ -95,12 +208,10 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
     }
     
     fs::path payloadDirectoryPath = fs::path(outputDirectory).append("Payload");
-    if (!fs::exists(payloadDirectoryPath))
-    {
-        fs::create_directory(payloadDirectoryPath);
-    }
     
-    char buffer[ALTReadBufferSize];
+    // Single pass over the central directory: collect every file and the full set of directories.
+    std::vector<ALTArchiveEntry> entries;
+    std::set<fs::path> directories = { payloadDirectoryPath };
     
     for (int i = 0; i < zipInfo.number_entry; i++)
     {
@@ -114,86 +225,37 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
         }
         
         std::string filename(cFilename);
-        if (startsWith(filename, "__MACOSX"))
+        if (!startsWith(filename, "__MACOSX"))
         {
-            if (i + 1 < zipInfo.number_entry)
-            {
-                if (unzGoToNextFile(zipFile) != UNZ_OK)
-                {
-                    finish();
-                    throw ArchiveError(ArchiveErrorCode::Unknown);
-                }
-            }
+            std::replace(filename.begin(), filename.end(), '/', ALTDirectoryDeliminator);
+            filename = replace_all(filename, ":", "__colon__");
             
-            continue;
-        }
-
-		std::replace(filename.begin(), filename.end(), '/', ALTDirectoryDeliminator);
-		filename = replace_all(filename, ":", "__colon__");
-        
-		fs::path filepath = fs::path(outputDirectory).append(filename);
-		fs::path parentDirectory = (filename[filename.size() - 1] == ALTDirectoryDeliminator) ? filepath.parent_path().parent_path() : filepath.parent_path();
-        
-        if (!fs::exists(parentDirectory))
-        {
-            fs::create_directory(parentDirectory);
-        }
-        
-        if (filename[filename.size() - 1] == ALTDirectoryDeliminator)
-        {
-            // Directory
-            fs::create_directory(filepath);
-        }
-        else
-        {
-            // File
-            if (unzOpenCurrentFile(zipFile) != UNZ_OK)
-            {
-                finish();
-                throw ArchiveError(ArchiveErrorCode::Unknown);
-            }
-
-			std::string narrowFilepath = filepath.string();
+            fs::path filepath = fs::path(outputDirectory).append(filename);
             
-            outputFile = fopen(narrowFilepath.c_str(), "wb");
-            if (outputFile == NULL)
+            if (filename[filename.size() - 1] == ALTDirectoryDeliminator)
             {
-                finish();
-                throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+                // Directory
+                directories.insert(filepath.parent_path());
             }
-            
-            int result = UNZ_OK;
-            
-            do
+            else
             {
-                result = unzReadCurrentFile(zipFile, buffer, ALTReadBufferSize);
-                
-                if (result < 0)
+                // File
+                ALTArchiveEntry entry;
+                if (unzGetFilePos(zipFile, &entry.position) != UNZ_OK)
                 {
                     finish();
                     throw ArchiveError(ArchiveErrorCode::Unknown);
                 }
                 
-                size_t count = fwrite(buffer, result, 1, outputFile);
-                if (result > 0 && count != 1)
-                {
-                    finish();
-                    throw ArchiveError(ArchiveErrorCode::UnknownWrite);
-                }
+                entry.filepath = filepath;
+                entry.permissions = (info.external_fa >> 16);
+                entry.uncompressedSize = info.uncompressed_size;
+                entries.push_back(entry);
                 
-            } while (result > 0);
-
-			odslog("Extracted file:" << filepath);
-            
-            short permissions = (info.external_fa >> 16) & 0x01FF;
-            chmod(narrowFilepath.c_str(), permissions);
-            
-            fclose(outputFile);
-            outputFile = NULL;
+                directories.insert(filepath.parent_path());
+            }
         }
         
-        unzCloseCurrentFile(zipFile);
-                
         if (i + 1 < zipInfo.number_entry)
         {
             if (unzGoToNextFile(zipFile) != UNZ_OK)
@@ -204,6 +266,79 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
         }
     }
     
+    finish();
+    
+    for (auto& directory : directories)
+    {
+        fs::create_directories(directory);
+    }
+    
+    std::sort(entries.begin(), entries.end(), [](const ALTArchiveEntry& a, const ALTArchiveEntry& b) {
+        return a.uncompressedSize > b.uncompressedSize;
+    });
+    
+    if (threadCount <= 0)
+    {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    threadCount = std::max(1, std::min(threadCount, (int)entries.size()));
+    
+    if (span.isActive())
+    {
+        uint64_t uncompressedBytes = 0;
+        for (auto& entry : entries)
+        {
+            uncompressedBytes += entry.uncompressedSize;
+        }
+        
+        span.set("entries", entries.size());
+        span.set("bytes", uncompressedBytes);
+        span.set("threads", threadCount);
+    }
+    
+    std::atomic<size_t> nextEntry(0);
+    std::atomic<bool> cancelled(false);
+    
+    std::mutex errorMutex;
+    std::exception_ptr error = nullptr;
+    
+    auto extract = [&]() {
+        try
+        {
+            ExtractArchiveEntries(filepath, entries, nextEntry, cancelled);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error == nullptr)
+            {
+                error = std::current_exception();
+            }
+            
+            cancelled = true;
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(extract);
+    }
+    
+    extract();
+    
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    
+    if (error != nullptr)
+    {
+        std::rethrow_exception(error);
+    }
+    
+    odslog("Extracted " << entries.size() << " files from " << filepath << " using " << threadCount << " threads.");
+    
     for (auto & p : fs::directory_iterator(payloadDirectoryPath))
     {
         auto filename = p.path().filename().string();
@@ -231,8 +366,6 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
         
 		fs::rename(appBundlePath, outputPath);
         
-        finish();
-        
         // Operation not permitted on iSH
 		//fs::remove(payloadDirectoryPath);
         
@@ -243,101 +376,513 @@ std::string UnzipAppBundle(std::string filepath, std::string outputDirectory)
 }
 
 
-void WriteFileToZipFile(zipFile *zipFile, fs::path filepath, fs::path relativePath)
+struct ALTZipEntry
 {
-    bool isDirectory = fs::is_directory(filepath);
+    fs::path filepath;
+    std::string filename;
+    bool isDirectory = false;
+    uLong externalAttributes = 0;
+    uLong uncompressedSize = 0;
     
-    std::string filename = relativePath.string();
+    // Filled in by a worker before the entry is appended.
+    int method = Z_DEFLATED;
+    bool isCompressed = false; // data holds the raw deflate stream
+    std::vector<char> data; // compressed stream, or the whole content of a small stored file
+    uLong crc = 0;
     
-    zip_fileinfo fileInfo = {};
+    bool isReady = false;
+    std::exception_ptr error = nullptr;
     
-    char *bytes = nullptr;
-    unsigned int fileSize = 0;
+    // Counted against the queue's byte budget until the entry is appended.
+    size_t reservedBytes = 0;
+};
+
+struct ALTZipQueue
+{
+    std::vector<ALTZipEntry> entries;
+    size_t nextEntry = 0;
+    size_t committedEntries = 0;
+    size_t window = 0;
+    size_t reservedBytes = 0;
+    bool cancelled = false;
     
-    if (isDirectory)
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+
+// Formats that are already compressed; deflating them again only costs time.
+static const std::set<std::string> ALTIncompressibleExtensions = {
+    ".png", ".jpg", ".jpeg", ".gif", ".heic", ".webp", ".car",
+    ".zip", ".ipa", ".gz", ".bz2", ".xz", ".lzfse",
+    ".mp3", ".mp4", ".m4a", ".m4v", ".mov", ".aac", ".ogg", ".webm",
+};
+
+static bool IsIncompressibleFile(const fs::path& filepath)
+{
+    std::string extension = filepath.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    
+    return ALTIncompressibleExtensions.count(extension) > 0;
+}
+
+static void ReadFileChunk(std::ifstream& ifs, std::vector<char>& buffer, size_t size)
+{
+    buffer.resize(size);
+    
+    if (!ifs.read(buffer.data(), size))
     {
-        // Remove leading directory slash.
-        if (filename[0] == ALTDirectoryDeliminator)
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+}
+
+// Raw deflate of a single buffer; returns false if the result is no smaller than the input.
+static bool DeflateBuffer(const std::vector<char>& input, int level, std::vector<char>& output, zbackend_state *backend)
+{
+    output.clear();
+    
+    if (zbackendGet() != Z_BACKEND_ZLIB)
+    {
+        uLong bound = zbackend_deflate_bound(backend, level, input.size());
+        output.resize(bound);
+        
+        uLong compressedSize = zbackend_deflate(backend, level, input.data(), input.size(), output.data(), bound);
+        if (compressedSize == 0)
         {
-            filename = std::string(filename.begin() + 1, filename.end());
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
         }
         
-        // Add trailing directory slash.
-        if (filename[filename.size() - 1] != ALTDirectoryDeliminator)
+        output.resize(compressedSize);
+    }
+    else
+    {
+        z_stream stream = {};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+        
+        output.resize(deflateBound(&stream, input.size()));
+        
+        stream.next_in = (Bytef *)input.data();
+        stream.avail_in = (uInt)input.size();
+        stream.next_out = (Bytef *)output.data();
+        stream.avail_out = (uInt)output.size();
+        
+        int result = deflate(&stream, Z_FINISH);
+        deflateEnd(&stream);
+        
+        if (result != Z_STREAM_END)
         {
-            filename = filename + ALTDirectoryDeliminator;
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
         }
+        
+        output.resize(stream.total_out);
     }
-    else
+    
+    return output.size() < input.size();
+}
+
+// Streams the file through deflate in ALTExtractBufferSize chunks, keeping only the compressed output.
+static void DeflateFile(ALTZipEntry& entry)
+{
+    std::ifstream ifs(entry.filepath, std::ios::binary);
+    
+    z_stream stream = {};
+    if (!ifs.is_open() || deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     {
-        fs::file_status status = fs::status(filepath);
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+    
+    entry.data.resize(deflateBound(&stream, entry.uncompressedSize));
+    stream.next_out = (Bytef *)entry.data.data();
+    stream.avail_out = (uInt)entry.data.size();
+    
+    std::vector<char> buffer;
+    uLong remaining = entry.uncompressedSize;
+    
+    int result = Z_OK;
+    do
+    {
+        size_t chunkSize = std::min<uLong>(remaining, ALTExtractBufferSize);
+        try
+        {
+            ReadFileChunk(ifs, buffer, chunkSize);
+        }
+        catch (...)
+        {
+            deflateEnd(&stream);
+            throw;
+        }
         
-        short permissions = (short)status.permissions();
-        long shiftedPermissions = 0100000 + permissions;
+        remaining -= chunkSize;
+        entry.crc = crc32(entry.crc, (const Bytef *)buffer.data(), (uInt)chunkSize);
         
-        uLong permissionsLong = (uLong)shiftedPermissions;
+        stream.next_in = (Bytef *)buffer.data();
+        stream.avail_in = (uInt)chunkSize;
         
-        fileInfo.external_fa = (unsigned int)(permissionsLong << 16L);
+        // deflateBound guarantees the output never runs out of space.
+        result = deflate(&stream, remaining > 0 ? Z_NO_FLUSH : Z_FINISH);
+        
+    } while (remaining > 0 && result == Z_OK);
+    
+    deflateEnd(&stream);
+    
+    if (result != Z_STREAM_END)
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+    
+    entry.data.resize(stream.total_out);
+    entry.isCompressed = true;
+}
+
+static void PrepareZipEntry(ALTZipEntry& entry, zbackend_state *backend)
+{
+    if (entry.isDirectory)
+    {
+        entry.method = 0;
+        return;
+    }
+    
+    if (IsIncompressibleFile(entry.filepath))
+    {
+        // Streamed from disk when appended.
+        entry.method = 0;
+        return;
+    }
+    
+    std::ifstream ifs(entry.filepath, std::ios::binary);
+    if (!ifs.is_open())
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+    
+    std::vector<char> buffer;
+    ReadFileChunk(ifs, buffer, std::min<uLong>(entry.uncompressedSize, ALTZipTrialSize));
+    
+    if (entry.uncompressedSize <= ALTZipTrialSize)
+    {
+        // Small enough to compress in one go; keep whichever form is smaller.
+        entry.crc = crc32(0, (const Bytef *)buffer.data(), (uInt)buffer.size());
         
-        std::ifstream ifs(filepath.string());
-        std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        std::vector<char> compressedData;
+        if (DeflateBuffer(buffer, Z_DEFAULT_COMPRESSION, compressedData, backend))
+        {
+            entry.data = std::move(compressedData);
+            entry.isCompressed = true;
+        }
+        else
+        {
+            entry.data = std::move(buffer);
+            entry.method = 0;
+        }
         
-        bytes = data.data();
-        fileSize = (unsigned int)data.size();
+        return;
     }
+    
+    // Trial-compress the first chunk at the fastest level to detect content that won't shrink.
+    std::vector<char> trialData;
+    DeflateBuffer(buffer, 1, trialData, backend);
+    
+    if (trialData.size() * 100 >= buffer.size() * ALTZipStoreThresholdPercent)
+    {
+        entry.method = 0;
+        return;
+    }
+    
+    if (entry.uncompressedSize > ALTZipBufferedEntryLimit)
+    {
+        // Too large to hold compressed in memory; deflated while it is appended.
+        return;
+    }
+    
+    DeflateFile(entry);
+}
+
+// Most memory preparing the entry may hold until it is appended, before it is known whether it compresses.
+static size_t ZipEntryReservation(const ALTZipEntry& entry)
+{
+    if (entry.isDirectory || IsIncompressibleFile(entry.filepath))
+    {
+        return 0;
+    }
+    
+    if (entry.uncompressedSize > ALTZipBufferedEntryLimit)
+    {
+        return ALTZipTrialSize;
+    }
+    
+    return entry.uncompressedSize;
+}
 
-	std::replace(filename.begin(), filename.end(), ALTDirectoryDeliminator, '/');
+static void PrepareZipEntries(ALTZipQueue& queue)
+{
+    zbackend_state backend = NULL;
     
-    if (zipOpenNewFileInZip(*zipFile, (const char *)filename.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION) != ZIP_OK)
+    while (true)
+    {
+        size_t index = 0;
+        
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            
+            // Bound the memory held in prepared entries the writer hasn't appended yet, and how far workers may run ahead of it.
+            // Nothing is reserved once the writer waits for the next entry, so that entry is always let through.
+            queue.condition.wait(lock, [&queue]() {
+                if (queue.cancelled || queue.nextEntry >= queue.entries.size())
+                {
+                    return true;
+                }
+                
+                auto reservedBytes = ZipEntryReservation(queue.entries[queue.nextEntry]);
+                return queue.nextEntry < queue.committedEntries + queue.window &&
+                    (queue.reservedBytes == 0 || queue.reservedBytes + reservedBytes <= (size_t)ALTZipBufferedBytesLimit);
+            });
+            
+            if (queue.cancelled || queue.nextEntry >= queue.entries.size())
+            {
+                break;
+            }
+            
+            index = queue.nextEntry++;
+            
+            queue.entries[index].reservedBytes = ZipEntryReservation(queue.entries[index]);
+            queue.reservedBytes += queue.entries[index].reservedBytes;
+        }
+        
+        auto& entry = queue.entries[index];
+        
+        try
+        {
+            PrepareZipEntry(entry, &backend);
+        }
+        catch (...)
+        {
+            entry.error = std::current_exception();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            entry.isReady = true;
+            
+            // Compressed entries usually hold much less than reserved.
+            size_t heldBytes = std::min(entry.reservedBytes, entry.data.capacity());
+            queue.reservedBytes -= entry.reservedBytes - heldBytes;
+            entry.reservedBytes = heldBytes;
+        }
+        
+        queue.condition.notify_all();
+    }
+    
+    zbackend_free(backend);
+}
+
+static void WriteZipEntry(zipFile zipFile, ALTZipEntry& entry)
+{
+    zip_fileinfo fileInfo = {};
+    fileInfo.external_fa = entry.externalAttributes;
+    
+    int raw = entry.isCompressed ? 1 : 0;
+    
+    if (zipOpenNewFileInZip2(zipFile, entry.filename.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, entry.method, Z_DEFAULT_COMPRESSION, raw) != ZIP_OK)
     {
         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
     
-    if (zipWriteInFileInZip(*zipFile, bytes, fileSize) != ZIP_OK)
+    auto write = [&zipFile](const char *bytes, size_t size) {
+        if (zipWriteInFileInZip(zipFile, bytes, (unsigned int)size) != ZIP_OK)
+        {
+            zipCloseFileInZip(zipFile);
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+    };
+    
+    if (entry.isDirectory)
+    {
+        // No content.
+    }
+    else if (entry.isCompressed || !entry.data.empty())
+    {
+        write(entry.data.data(), entry.data.size());
+    }
+    else
+    {
+        std::ifstream ifs(entry.filepath, std::ios::binary);
+        if (!ifs.is_open())
+        {
+            zipCloseFileInZip(zipFile);
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+        
+        std::vector<char> buffer;
+        for (uLong remaining = entry.uncompressedSize; remaining > 0; remaining -= buffer.size())
+        {
+            try
+            {
+                ReadFileChunk(ifs, buffer, std::min<uLong>(remaining, ALTExtractBufferSize));
+            }
+            catch (...)
+            {
+                zipCloseFileInZip(zipFile);
+                throw;
+            }
+            
+            write(buffer.data(), buffer.size());
+        }
+    }
+    
+    int result = raw ? zipCloseFileInZipRaw(zipFile, entry.uncompressedSize, entry.crc) : zipCloseFileInZip(zipFile);
+    if (result != ZIP_OK)
     {
-        zipCloseFileInZip(*zipFile);
         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
 }
 
-std::string ZipAppBundle(std::string filepath)
+std::string ZipAppBundle(std::string filepath, int threadCount)
 {
+    TraceSpan span("archive", "Zip app");
+    
     fs::path appBundlePath = filepath;
+    if (!appBundlePath.has_filename())
+    {
+        appBundlePath = appBundlePath.parent_path();
+    }
     
-    auto appBundleFilename = appBundlePath.filename();
+    auto appBundleFilename = appBundlePath.filename().string();
     auto appName = appBundlePath.filename().stem().string();
     
     auto ipaName = appName + ".ipa";
-    auto ipaPath = appBundlePath.remove_filename().append(ipaName);
+    auto ipaPath = fs::path(appBundlePath).parent_path().append(ipaName);
     
     if (fs::exists(ipaPath))
     {
         fs::remove(ipaPath);
     }
     
+    ALTZipQueue queue;
+    
+    auto addEntry = [&queue](const fs::path& filepath, const std::string& filename, bool isDirectory) {
+        ALTZipEntry entry;
+        entry.filepath = filepath;
+        entry.filename = filename;
+        entry.isDirectory = isDirectory;
+        
+        if (isDirectory)
+        {
+            entry.filename += "/";
+        }
+        else
+        {
+            short permissions = (short)fs::status(filepath).permissions();
+            long shiftedPermissions = 0100000 + permissions;
+            
+            entry.externalAttributes = (uLong)shiftedPermissions << 16L;
+            entry.uncompressedSize = (uLong)fs::file_size(filepath);
+        }
+        
+        queue.entries.push_back(std::move(entry));
+    };
+    
+    std::string appBundleDirectory = "Payload/" + appBundleFilename;
+    
+    addEntry(fs::path(), "Payload", true);
+    addEntry(appBundlePath, appBundleDirectory, true);
+    
+    for (auto& entry: fs::recursive_directory_iterator(appBundlePath))
+    {
+        auto relativePath = fs::relative(entry.path(), appBundlePath).generic_string();
+        addEntry(entry.path(), appBundleDirectory + "/" + relativePath, entry.is_directory());
+    }
+    
+    if (threadCount <= 0)
+    {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    
+    // Secondary to the byte budget: keeps many small entries from running far ahead of the writer.
+    queue.window = std::max<size_t>(4 * threadCount, 16);
+    
     zipFile zipFile = zipOpen((const char *)ipaPath.string().c_str(), APPEND_STATUS_CREATE);
     if (zipFile == nullptr)
     {
         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
     
-    fs::path payloadDirectory = "Payload";
-    fs::path appBundleDirectory = payloadDirectory.append(appBundleFilename.string());
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadCount; i++)
+    {
+        workers.emplace_back(PrepareZipEntries, std::ref(queue));
+    }
     
-    fs::path rootPath = fs::relative("", appBundleDirectory);
+    auto finish = [&queue, &workers]() {
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.cancelled = true;
+        }
+        
+        queue.condition.notify_all();
+        
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    };
     
-    for (auto& entry: fs::recursive_directory_iterator(rootPath))
+    // Append entries in order as soon as they are ready.
+    try
     {
-        auto filepath = entry.path();
-        auto relativePath = entry.path().relative_path();
-        
-        WriteFileToZipFile(&zipFile, filepath, relativePath);
+        for (size_t i = 0; i < queue.entries.size(); i++)
+        {
+            auto& entry = queue.entries[i];
+            
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                queue.condition.wait(lock, [&entry]() { return entry.isReady; });
+            }
+            
+            if (entry.error != nullptr)
+            {
+                std::rethrow_exception(entry.error);
+            }
+            
+            WriteZipEntry(zipFile, entry);
+            
+            std::vector<char>().swap(entry.data);
+            
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.committedEntries = i + 1;
+                
+                queue.reservedBytes -= entry.reservedBytes;
+                entry.reservedBytes = 0;
+            }
+            
+            queue.condition.notify_all();
+        }
+    }
+    catch (...)
+    {
+        finish();
+        zipClose(zipFile, NULL);
+        fs::remove(ipaPath);
+        throw;
+    }
+    
+    finish();
+    
+    if (zipClose(zipFile, NULL) != ZIP_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
     
-    WriteFileToZipFile(&zipFile, payloadDirectory, payloadDirectory);
-    WriteFileToZipFile(&zipFile, appBundleDirectory, appBundleDirectory);
+    if (span.isActive())
+    {
+        span.set("entries", queue.entries.size());
+        span.set("bytes", (uint64_t)fs::file_size(ipaPath));
+        span.set("threads", threadCount);
+    }
     
-    zipClose(zipFile, NULL);
+    odslog("Zipped " << queue.entries.size() << " entries into " << ipaPath << " using " << threadCount << " threads.");
     
     return ipaPath.string();
 }
@@ -11,7 +11,8 @@
 
 #include <string>
 
-std::string UnzipAppBundle(std::string filepath, std::string outputDirectory);
-std::string ZipAppBundle(std::string filepath);
+// threadCount <= 0 uses one thread per available core.
+std::string UnzipAppBundle(std::string filepath, std::string outputDirectory, int threadCount = 0);
+std::string ZipAppBundle(std::string filepath, int threadCount = 0);
 
 #endif /* Archiver_hpp */
@@ -0,0 +1,364 @@
+//
+//  CertificateKeyPool.cpp
+//  AltSign
+//
+
+#include "CertificateKeyPool.hpp"
+#include "Digest.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+
+#include <pplx/pplxtasks.h>
+
+#include "altsign_common.h"
+
+namespace fs = std::filesystem;
+
+#define DEFAULT_CAPACITY 2
+#define KEY_BITS 2048
+
+#define KEY_FILE_EXTENSION ".key"
+
+CertificateKeyPool* CertificateKeyPool::_instance = nullptr;
+
+CertificateKeyPool* CertificateKeyPool::instance()
+{
+    if (_instance == 0)
+    {
+        _instance = new CertificateKeyPool();
+    }
+
+    return _instance;
+}
+
+CertificateKeyPool::CertificateKeyPool() : _capacity(DEFAULT_CAPACITY), _isRefilling(false),
+    _totalGenerationTime(std::chrono::milliseconds(0)), _generatedKeys(0)
+{
+}
+
+CertificateKeyPool::~CertificateKeyPool()
+{
+}
+
+#pragma mark - Keys -
+
+std::vector<unsigned char> CertificateKeyPool::TakeKey()
+{
+    std::optional<Key> key;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_keys.empty())
+        {
+            key = _keys.front();
+            _keys.pop_front();
+
+            // Keys loaded from storage count as taking as long as the keys generated since launch.
+            auto generationTime = key->generationTime.value_or(std::chrono::milliseconds(_generatedKeys == 0 ? 0 : _totalGenerationTime.count() / (int64_t)_generatedKeys));
+
+            _statistics.pooledKeys++;
+            _statistics.savedGenerationTime += generationTime;
+        }
+    }
+
+    if (key.has_value())
+    {
+        // Never hand out the same key twice, even after a restart.
+        if (key->filename.has_value())
+        {
+            this->RemoveKey(*key->filename);
+        }
+    }
+    else
+    {
+        key = this->GenerateKey();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _statistics.generatedOnDemandKeys++;
+        _statistics.onDemandGenerationTime += *key->generationTime;
+    }
+
+    this->Refill();
+
+    return key->privateKey;
+}
+
+void CertificateKeyPool::Refill()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_isRefilling || _keys.size() >= _capacity)
+        {
+            return;
+        }
+
+        _isRefilling = true;
+    }
+
+    pplx::create_task([this]() {
+        while (true)
+        {
+            try
+            {
+                auto key = this->GenerateKey();
+                key.filename = this->SaveKey(key.privateKey);
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                _keys.push_back(key);
+            }
+            catch (std::exception& e)
+            {
+                odslog("Failed to generate certificate key: " << e.what());
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                _isRefilling = false;
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_keys.size() >= _capacity)
+            {
+                _isRefilling = false;
+                return;
+            }
+        }
+    });
+}
+
+CertificateKeyPool::Key CertificateKeyPool::GenerateKey()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    BIGNUM *bignum = BN_new();
+    RSA *rsa = RSA_new();
+    BIO *privateKey = BIO_new(BIO_s_mem());
+
+    auto finish = [&bignum, &rsa, &privateKey]() {
+        BN_free(bignum);
+        RSA_free(rsa);
+        BIO_free_all(privateKey);
+    };
+
+    if (BN_set_word(bignum, RSA_F4) != 1 ||
+        RSA_generate_key_ex(rsa, KEY_BITS, bignum, NULL) != 1 ||
+        PEM_write_bio_RSAPrivateKey(privateKey, rsa, NULL, NULL, 0, NULL, NULL) != 1)
+    {
+        finish();
+        throw APIError(APIErrorCode::InvalidCertificateRequest);
+    }
+
+    char *privateKeyBuffer = NULL;
+    long privateKeyLength = BIO_get_mem_data(privateKey, &privateKeyBuffer);
+
+    Key key;
+    key.privateKey = std::vector<unsigned char>(privateKeyBuffer, privateKeyBuffer + privateKeyLength);
+
+    finish();
+
+    auto generationTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    key.generationTime = generationTime;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _totalGenerationTime += generationTime;
+    _generatedKeys++;
+
+    return key;
+}
+
+#pragma mark - Storage -
+
+void CertificateKeyPool::setStorage(std::string directoryPath, std::string passphrase)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _directoryPath = directoryPath;
+        _passphrase = passphrase;
+    }
+
+    this->LoadKeys();
+}
+
+void CertificateKeyPool::LoadKeys()
+{
+    std::string directoryPath;
+    std::string passphrase;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_directoryPath.has_value())
+        {
+            return;
+        }
+
+        directoryPath = *_directoryPath;
+        passphrase = _passphrase;
+    }
+
+    if (!fs::exists(directoryPath))
+    {
+        return;
+    }
+
+    std::vector<Key> keys;
+
+    for (auto& entry : fs::directory_iterator(directoryPath))
+    {
+        if (entry.path().extension() != KEY_FILE_EXTENSION)
+        {
+            continue;
+        }
+
+        auto filename = entry.path().filename().string();
+
+        BIO *file = BIO_new_file(entry.path().string().c_str(), "rb");
+        EVP_PKEY *pkey = (file == NULL) ? NULL : PEM_read_bio_PrivateKey(file, NULL, NULL, (void *)passphrase.c_str());
+        BIO_free_all(file);
+
+        RSA *rsa = (pkey == NULL) ? NULL : EVP_PKEY_get1_RSA(pkey);
+        BIO *privateKey = BIO_new(BIO_s_mem());
+
+        if (rsa != NULL && PEM_write_bio_RSAPrivateKey(privateKey, rsa, NULL, NULL, 0, NULL, NULL) == 1)
+        {
+            char *privateKeyBuffer = NULL;
+            long privateKeyLength = BIO_get_mem_data(privateKey, &privateKeyBuffer);
+
+            Key key;
+            key.privateKey = std::vector<unsigned char>(privateKeyBuffer, privateKeyBuffer + privateKeyLength);
+            key.filename = filename;
+            keys.push_back(key);
+        }
+        else
+        {
+            // Saved with another passphrase, or damaged.
+            odslog("Discarding unreadable certificate key " << filename);
+            this->RemoveKey(filename);
+        }
+
+        RSA_free(rsa);
+        EVP_PKEY_free(pkey);
+        BIO_free_all(privateKey);
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (auto& key : keys)
+    {
+        auto iterator = std::find_if(_keys.begin(), _keys.end(), [&key](const Key& pooledKey) {
+            return pooledKey.filename == key.filename;
+        });
+
+        if (iterator == _keys.end())
+        {
+            _keys.push_back(key);
+        }
+    }
+}
+
+std::optional<std::string> CertificateKeyPool::SaveKey(const std::vector<unsigned char>& privateKey)
+{
+    std::string directoryPath;
+    std::string passphrase;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_directoryPath.has_value())
+        {
+            return std::nullopt;
+        }
+
+        directoryPath = *_directoryPath;
+        passphrase = _passphrase;
+    }
+
+    unsigned char identifier[16];
+    RAND_bytes(identifier, sizeof(identifier));
+
+    auto filename = HexString(identifier, sizeof(identifier)) + KEY_FILE_EXTENSION;
+    auto path = fs::path(directoryPath).append(filename).string();
+    auto temporaryPath = path + ".tmp";
+
+    BIO *input = BIO_new_mem_buf(privateKey.data(), (int)privateKey.size());
+    RSA *rsa = PEM_read_bio_RSAPrivateKey(input, NULL, NULL, NULL);
+    BIO_free_all(input);
+
+    EVP_PKEY *pkey = EVP_PKEY_new();
+    if (rsa == NULL || EVP_PKEY_assign_RSA(pkey, rsa) != 1)
+    {
+        RSA_free(rsa);
+        EVP_PKEY_free(pkey);
+        return std::nullopt;
+    }
+
+    fs::create_directories(directoryPath);
+
+    BIO *output = BIO_new_file(temporaryPath.c_str(), "wb");
+    bool saved = (output != NULL) &&
+        PEM_write_bio_PKCS8PrivateKey(output, pkey, EVP_aes_256_cbc(), NULL, 0, NULL, (void *)passphrase.c_str()) == 1;
+    BIO_free_all(output);
+
+    // Also frees rsa.
+    EVP_PKEY_free(pkey);
+
+    if (!saved)
+    {
+        // The key is still usable, it just won't survive a restart.
+        odslog("Failed to save certificate key to " << directoryPath);
+
+        std::error_code error;
+        fs::remove(temporaryPath, error);
+        return std::nullopt;
+    }
+
+    fs::rename(temporaryPath, path);
+    return filename;
+}
+
+void CertificateKeyPool::RemoveKey(const std::string& filename)
+{
+    std::optional<std::string> directoryPath;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        directoryPath = _directoryPath;
+    }
+
+    if (!directoryPath.has_value())
+    {
+        return;
+    }
+
+    std::error_code error;
+    fs::remove(fs::path(*directoryPath).append(filename), error);
+}
+
+#pragma mark - Getters -
+
+size_t CertificateKeyPool::capacity()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _capacity;
+}
+
+void CertificateKeyPool::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+}
+
+CertificateKeyPoolStatistics CertificateKeyPool::statistics()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto statistics = _statistics;
+    statistics.availableKeys = _keys.size();
+    return statistics;
+}
@@ -0,0 +1,94 @@
+//
+//  CertificateKeyPool.hpp
+//  AltSign
+//
+//  Keeps 2048-bit RSA keys ready for certificate requests so installs don't
+//  wait for one to be generated. Keys are generated in the background and,
+//  once a storage directory is set, saved encrypted so they survive restarts.
+//
+
+#ifndef CertificateKeyPool_hpp
+#define CertificateKeyPool_hpp
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+struct CertificateKeyPoolStatistics
+{
+    size_t availableKeys = 0;
+
+    // Keys handed out from the pool, and keys that had to be generated while a caller waited.
+    uint64_t pooledKeys = 0;
+    uint64_t generatedOnDemandKeys = 0;
+
+    // Generation time callers didn't wait for because their key came from the pool.
+    std::chrono::milliseconds savedGenerationTime = std::chrono::milliseconds(0);
+
+    // Generation time callers did wait for.
+    std::chrono::milliseconds onDemandGenerationTime = std::chrono::milliseconds(0);
+};
+
+class CertificateKeyPool
+{
+public:
+    static CertificateKeyPool* instance();
+
+    // Returns a PEM encoded RSA private key, and starts generating a replacement in the background.
+    // If the pool is empty the key is generated before returning.
+    std::vector<unsigned char> TakeKey();
+
+    // Generates keys in the background until the pool holds capacity() of them.
+    void Refill();
+
+    size_t capacity();
+    void setCapacity(size_t capacity);
+
+    // Loads keys saved in directoryPath and saves new ones there, encrypted with passphrase.
+    // Keys that can't be decrypted with passphrase are discarded.
+    void setStorage(std::string directoryPath, std::string passphrase);
+
+    CertificateKeyPoolStatistics statistics();
+
+private:
+    CertificateKeyPool();
+    ~CertificateKeyPool();
+
+    static CertificateKeyPool* _instance;
+
+    struct Key
+    {
+        std::vector<unsigned char> privateKey;
+        std::optional<std::string> filename;
+
+        // Unknown for keys loaded from storage.
+        std::optional<std::chrono::milliseconds> generationTime;
+    };
+
+    std::mutex _mutex;
+    std::deque<Key> _keys;
+    size_t _capacity;
+    bool _isRefilling;
+
+    std::optional<std::string> _directoryPath;
+    std::string _passphrase;
+
+    CertificateKeyPoolStatistics _statistics;
+    std::chrono::milliseconds _totalGenerationTime;
+    uint64_t _generatedKeys;
+
+    Key GenerateKey();
+    void LoadKeys();
+    std::optional<std::string> SaveKey(const std::vector<unsigned char>& privateKey);
+    void RemoveKey(const std::string& filename);
+};
+
+#pragma GCC visibility pop
+
+#endif /* CertificateKeyPool_hpp */
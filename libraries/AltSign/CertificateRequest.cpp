@@ -8,6 +8,7 @@
 
 #include "CertificateRequest.hpp"
 #include "Error.hpp"
+#include "CertificateKeyPool.hpp"
 
 #include <optional>
 
@@ -19,7 +20,7 @@ CertificateRequest::CertificateRequest()
     std::optional<std::vector<unsigned char>> outputData = std::nullopt;
     std::optional<std::vector<unsigned char>> outputPrivateKey = std::nullopt;
     
-    BIGNUM *bignum = NULL;
+    BIO *pooledKey = NULL;
     RSA *rsa = NULL;
     
     X509_REQ *request = NULL;
@@ -28,7 +29,7 @@ CertificateRequest::CertificateRequest()
     BIO *csr = NULL;
     BIO *privateKey = NULL;
     
-    auto finish = [this, &bignum, &rsa, &request, &publicKey, &csr, &privateKey, &outputData, &outputPrivateKey](void) {
+    auto finish = [this, &pooledKey, &rsa, &request, &publicKey, &csr, &privateKey, &outputData, &outputPrivateKey](void) {
         if (publicKey != NULL)
         {
             // Also frees rsa, so we check if non-nil to prevent double free.
@@ -39,7 +40,7 @@ CertificateRequest::CertificateRequest()
             RSA_free(rsa);
         }
         
-        BN_free(bignum);
+        BIO_free_all(pooledKey);
         X509_REQ_free(request);
         
         BIO_free_all(csr);
@@ -56,17 +57,14 @@ CertificateRequest::CertificateRequest()
         }
     };
     
-    /* Generate RSA Key */
+    /* Take RSA Key */
     
-    bignum = BN_new();
-    if (BN_set_word(bignum, RSA_F4) != 1)
-    {
-        finish();
-        return;
-    }
+    // Generating a 2048-bit key takes long enough to notice, so the pool prepares them ahead of time.
+    auto keyData = CertificateKeyPool::instance()->TakeKey();
     
-    rsa = RSA_new();
-    if (RSA_generate_key_ex(rsa, 2048, bignum, NULL) != 1)
+    pooledKey = BIO_new_mem_buf(keyData.data(), (int)keyData.size());
+    rsa = PEM_read_bio_RSAPrivateKey(pooledKey, NULL, NULL, NULL);
+    if (rsa == NULL)
     {
         finish();
         return;
@@ -106,7 +104,7 @@ CertificateRequest::CertificateRequest()
     }
     
     // Sign request
-    if (X509_REQ_sign(request, publicKey, EVP_sha1()) <= 0)
+    if (X509_REQ_sign(request, publicKey, EVP_sha256()) <= 0)
     {
         finish();
         return;
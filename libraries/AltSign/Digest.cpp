@@ -0,0 +1,30 @@
+//
+//  Digest.cpp
+//  AltSign
+//
+
+#include "Digest.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#include <openssl/sha.h>
+
+std::string HexString(const unsigned char* bytes, size_t length)
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < length; i++)
+    {
+        ss << std::hex << std::setw(2) << std::setfill('0') << (int)bytes[i];
+    }
+
+    return ss.str();
+}
+
+std::string SHA256HexString(const std::string& data)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char*)data.data(), data.size(), digest);
+
+    return HexString(digest, sizeof(digest));
+}
@@ -0,0 +1,21 @@
+//
+//  Digest.hpp
+//  AltSign
+//
+//  Hex encoding and SHA-256 digests, for naming files after data that
+//  shouldn't (or can't) appear in a file name, and for random identifiers.
+//
+
+#ifndef Digest_hpp
+#define Digest_hpp
+
+#include <cstddef>
+#include <string>
+
+// Lowercase hex, two digits per byte.
+std::string HexString(const unsigned char* bytes, size_t length);
+
+// SHA-256 of data, as lowercase hex.
+std::string SHA256HexString(const std::string& data);
+
+#endif /* Digest_hpp */
@@ -0,0 +1,405 @@
+//
+//  Logger.cpp
+//  AltSign
+//
+
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define RING_BUFFER_CAPACITY 8192
+
+// How long records may sit in the buffer before the flusher writes them anyway.
+#define FLUSH_INTERVAL std::chrono::milliseconds(50)
+
+// Batches are written once they grow past this, so draining a full buffer doesn't build one huge string.
+#define MAXIMUM_BATCH_SIZE (64 * 1024)
+
+// How long a producer sleeps between attempts while the buffer is full.
+#define FULL_BUFFER_RETRY_INTERVAL std::chrono::microseconds(100)
+
+namespace
+{
+    const char* LevelName(LogLevel level)
+    {
+        switch (level)
+        {
+        case LogLevel::Trace: return "trace";
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warning: return "warning";
+        case LogLevel::Error: return "error";
+        case LogLevel::Off: return "off";
+        }
+
+        return "info";
+    }
+
+    long CurrentThreadID()
+    {
+        thread_local long threadID = (long)syscall(SYS_gettid);
+        return threadID;
+    }
+
+    void AppendJSONString(std::string& output, const std::string& string)
+    {
+        output += '"';
+
+        for (unsigned char c : string)
+        {
+            switch (c)
+            {
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\n': output += "\\n"; break;
+            case '\r': output += "\\r"; break;
+            case '\t': output += "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    output += escaped;
+                }
+                else
+                {
+                    output += (char)c;
+                }
+                break;
+            }
+        }
+
+        output += '"';
+    }
+}
+
+std::atomic<LogLevel> Logger::_level(LogLevel::Info);
+
+Logger* Logger::instance()
+{
+    // The first records may come from several threads at once.
+    static Logger* instance = new Logger();
+    return instance;
+}
+
+Logger::Logger() : _cells(new Cell[RING_BUFFER_CAPACITY]), _capacity(RING_BUFFER_CAPACITY), _enqueuePosition(0), _dequeuePosition(0),
+    _format(LogFormat::Text), _isAsynchronous(true), _fileDescriptor(STDOUT_FILENO),
+    _records(0), _droppedRecords(0), _waitedRecords(0), _writes(0), _bytesWritten(0)
+{
+    for (size_t i = 0; i < _capacity; i++)
+    {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    _flusherThread = std::thread([this]() {
+        this->RunFlusher();
+    });
+
+    std::atexit([]() {
+        Logger::instance()->Flush();
+    });
+}
+
+Logger::~Logger()
+{
+    _flusherThread.detach();
+}
+
+std::optional<LogLevel> Logger::LevelFromName(std::string name)
+{
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    for (auto level : { LogLevel::Trace, LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error, LogLevel::Off })
+    {
+        if (name == LevelName(level))
+        {
+            return level;
+        }
+    }
+
+    return std::nullopt;
+}
+
+#pragma mark - Logging -
+
+void Logger::Log(LogLevel level, std::string message)
+{
+    _records++;
+
+    Record record;
+    record.level = level;
+    record.date = std::chrono::system_clock::now();
+    record.threadID = CurrentThreadID();
+    record.message = std::move(message);
+
+    if (!this->isAsynchronous())
+    {
+        std::lock_guard<std::mutex> lock(_writeMutex);
+
+        // Keep order with records queued before switching to synchronous.
+        this->Drain();
+
+        std::string output;
+        this->FormatRecord(record, output);
+        this->Write(this->fileDescriptor(), output);
+        return;
+    }
+
+    if (this->TryEnqueue(record))
+    {
+        return;
+    }
+
+    if (level < LogLevel::Info)
+    {
+        _droppedRecords++;
+        return;
+    }
+
+    _waitedRecords++;
+
+    do
+    {
+        _flusherCondition.notify_one();
+        std::this_thread::sleep_for(FULL_BUFFER_RETRY_INTERVAL);
+    }
+    while (!this->TryEnqueue(record));
+}
+
+bool Logger::TryEnqueue(Record& record)
+{
+    size_t position = _enqueuePosition.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+
+    while (true)
+    {
+        cell = &_cells[position % _capacity];
+
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full: the consumer hasn't freed this cell since the last lap.
+            return false;
+        }
+        else
+        {
+            position = _enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    // The consumer may take the record as soon as the sequence is published.
+    auto level = record.level;
+
+    cell->record = std::move(record);
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    // Wake the flusher early once half the buffer is used, or for anything that should be seen promptly.
+    if (position - _dequeuePosition.load(std::memory_order_relaxed) == _capacity / 2 || level >= LogLevel::Warning)
+    {
+        _flusherCondition.notify_one();
+    }
+
+    return true;
+}
+
+bool Logger::TryDequeue(Record& record)
+{
+    size_t position = _dequeuePosition.load(std::memory_order_relaxed);
+    Cell& cell = _cells[position % _capacity];
+
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence != position + 1)
+    {
+        // Empty, or the producer that claimed this cell hasn't finished writing it.
+        return false;
+    }
+
+    record = std::move(cell.record);
+    cell.record.message.clear();
+
+    cell.sequence.store(position + _capacity, std::memory_order_release);
+    _dequeuePosition.store(position + 1, std::memory_order_relaxed);
+
+    return true;
+}
+
+#pragma mark - Writing -
+
+void Logger::Flush()
+{
+    std::lock_guard<std::mutex> lock(_writeMutex);
+    this->Drain();
+}
+
+void Logger::Prompt(std::string text)
+{
+    std::lock_guard<std::mutex> lock(_writeMutex);
+    this->Drain();
+    this->Write(STDOUT_FILENO, text);
+}
+
+void Logger::Drain()
+{
+    std::string output;
+    Record record;
+
+    while (this->TryDequeue(record))
+    {
+        this->FormatRecord(record, output);
+
+        if (output.size() >= MAXIMUM_BATCH_SIZE)
+        {
+            this->Write(this->fileDescriptor(), output);
+            output.clear();
+        }
+    }
+
+    if (!output.empty())
+    {
+        this->Write(this->fileDescriptor(), output);
+    }
+}
+
+void Logger::Write(int fileDescriptor, const std::string& output)
+{
+    size_t offset = 0;
+    while (offset < output.size())
+    {
+        ssize_t writtenBytes = ::write(fileDescriptor, output.data() + offset, output.size() - offset);
+        if (writtenBytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // Nowhere left to report it.
+            break;
+        }
+
+        offset += (size_t)writtenBytes;
+        _writes++;
+    }
+
+    _bytesWritten += offset;
+}
+
+void Logger::FormatRecord(const Record& record, std::string& output) const
+{
+    if (this->format() == LogFormat::Text)
+    {
+        if (record.level != LogLevel::Info)
+        {
+            output += "[";
+            output += LevelName(record.level);
+            output += "] ";
+        }
+
+        output += record.message;
+        output += '\n';
+        return;
+    }
+
+    auto time = std::chrono::system_clock::to_time_t(record.date);
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(record.date.time_since_epoch()).count() % 1000;
+
+    struct tm components;
+    gmtime_r(&time, &components);
+
+    char date[64];
+    size_t length = strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &components);
+    snprintf(date + length, sizeof(date) - length, ".%03dZ", (int)milliseconds);
+
+    output += "{\"time\":\"";
+    output += date;
+    output += "\",\"level\":\"";
+    output += LevelName(record.level);
+    output += "\",\"thread\":";
+    output += std::to_string(record.threadID);
+    output += ",\"message\":";
+    AppendJSONString(output, record.message);
+    output += "}\n";
+}
+
+void Logger::RunFlusher()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_flusherMutex);
+            _flusherCondition.wait_for(lock, FLUSH_INTERVAL);
+        }
+
+        this->Flush();
+    }
+}
+
+#pragma mark - Getters -
+
+LogLevel Logger::level() const
+{
+    return _level.load(std::memory_order_relaxed);
+}
+
+void Logger::setLevel(LogLevel level)
+{
+    _level.store(level, std::memory_order_relaxed);
+}
+
+LogFormat Logger::format() const
+{
+    return _format.load(std::memory_order_relaxed);
+}
+
+void Logger::setFormat(LogFormat format)
+{
+    _format.store(format, std::memory_order_relaxed);
+}
+
+bool Logger::isAsynchronous() const
+{
+    return _isAsynchronous.load(std::memory_order_relaxed);
+}
+
+void Logger::setAsynchronous(bool isAsynchronous)
+{
+    _isAsynchronous.store(isAsynchronous, std::memory_order_relaxed);
+}
+
+int Logger::fileDescriptor() const
+{
+    return _fileDescriptor.load(std::memory_order_relaxed);
+}
+
+void Logger::setFileDescriptor(int fileDescriptor)
+{
+    // Records already queued still go to the old destination.
+    this->Flush();
+    _fileDescriptor.store(fileDescriptor, std::memory_order_relaxed);
+}
+
+LoggerStatistics Logger::statistics() const
+{
+    LoggerStatistics statistics;
+    statistics.records = _records.load();
+    statistics.droppedRecords = _droppedRecords.load();
+    statistics.waitedRecords = _waitedRecords.load();
+    statistics.writes = _writes.load();
+    statistics.bytesWritten = _bytesWritten.load();
+    return statistics;
+}
@@ -0,0 +1,162 @@
+//
+//  Logger.hpp
+//  AltSign
+//
+//  Levelled logger behind odslog(). Messages are formatted by the calling
+//  thread, queued in a lock-free ring buffer and written to stdout in batches
+//  by a background thread, so logging neither costs a write per line nor
+//  makes threads wait for each other on the stream.
+//
+
+#ifndef Logger_hpp
+#define Logger_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+enum class LogLevel
+{
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
+
+enum class LogFormat
+{
+    // The message, prefixed with its level unless it is Info.
+    Text,
+
+    // One JSON object per line with time, level, thread and message.
+    JSON
+};
+
+struct LoggerStatistics
+{
+    uint64_t records = 0;
+
+    // Trace and Debug records are dropped rather than waited for when the buffer is full.
+    uint64_t droppedRecords = 0;
+
+    // Records that had to wait for the buffer to drain.
+    uint64_t waitedRecords = 0;
+
+    uint64_t writes = 0;
+    uint64_t bytesWritten = 0;
+};
+
+class Logger
+{
+public:
+    static Logger* instance();
+
+    // Cheap enough to check before formatting a message, which the log macros do.
+    static bool isEnabled(LogLevel level)
+    {
+        return level >= _level.load(std::memory_order_relaxed);
+    }
+
+    static std::optional<LogLevel> LevelFromName(std::string name);
+
+    void Log(LogLevel level, std::string message);
+
+    // Writes every record logged so far before returning. Called at exit.
+    void Flush();
+
+    // Writes text to stdout as is, after every record logged so far and before any logged later. For prompts.
+    void Prompt(std::string text);
+
+    LogLevel level() const;
+    void setLevel(LogLevel level);
+
+    LogFormat format() const;
+    void setFormat(LogFormat format);
+
+    // Synchronous loggers write each record before Log() returns, which keeps the last lines before a crash.
+    bool isAsynchronous() const;
+    void setAsynchronous(bool isAsynchronous);
+
+    // Defaults to stdout.
+    int fileDescriptor() const;
+    void setFileDescriptor(int fileDescriptor);
+
+    LoggerStatistics statistics() const;
+
+private:
+    Logger();
+    ~Logger();
+
+    static std::atomic<LogLevel> _level;
+
+    struct Record
+    {
+        LogLevel level;
+        std::chrono::system_clock::time_point date;
+        long threadID;
+        std::string message;
+    };
+
+    // Bounded multi-producer queue: each cell's sequence number says whether it is free for the
+    // producer claiming position n (sequence == n) or holds a record for the consumer (sequence == n + 1).
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _capacity;
+
+    alignas(64) std::atomic<size_t> _enqueuePosition;
+    alignas(64) std::atomic<size_t> _dequeuePosition;
+
+    std::atomic<LogFormat> _format;
+    std::atomic<bool> _isAsynchronous;
+    std::atomic<int> _fileDescriptor;
+
+    // Serializes consumers (the flusher thread and Flush()) and writes.
+    std::mutex _writeMutex;
+
+    std::mutex _flusherMutex;
+    std::condition_variable _flusherCondition;
+    std::thread _flusherThread;
+
+    std::atomic<uint64_t> _records;
+    std::atomic<uint64_t> _droppedRecords;
+    std::atomic<uint64_t> _waitedRecords;
+    std::atomic<uint64_t> _writes;
+    std::atomic<uint64_t> _bytesWritten;
+
+    bool TryEnqueue(Record& record);
+
+    // Require _writeMutex to be held.
+    bool TryDequeue(Record& record);
+    void Drain();
+    void Write(int fileDescriptor, const std::string& output);
+
+    void FormatRecord(const Record& record, std::string& output) const;
+
+    void RunFlusher();
+};
+
+#pragma GCC visibility pop
+
+#define odslog_level(level, msg) { if (Logger::isEnabled(level)) { std::ostringstream __odslog_stream; __odslog_stream << msg; Logger::instance()->Log(level, __odslog_stream.str()); } }
+
+// Per-file and per-chunk progress, off unless ALTSERVER_LOG_LEVEL=trace.
+#define odstrace(msg) odslog_level(LogLevel::Trace, msg)
+#define odsdebug(msg) odslog_level(LogLevel::Debug, msg)
+
+#endif /* Logger_hpp */
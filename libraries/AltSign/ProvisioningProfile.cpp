@@ -16,8 +16,12 @@
 #include <time.h>
 #include <sys/time.h>
 
+#include <cstring>
+#include <map>
 #include <sstream>
 
+#include <openssl/sha.h>
+
 #if SIZE_MAX == UINT_MAX
 typedef int ssize_t;        /* common 32 bit case */
 #elif SIZE_MAX == ULONG_MAX
@@ -30,10 +34,19 @@ typedef short ssize_t;      /* is this even possible? */
 #error platform has exotic SIZE_MAX
 #endif
 
+#define ASN1_INTEGER 0x02
+#define ASN1_OCTET_STRING 0x04
+#define ASN1_OBJECT_IDENTIFIER 0x06
+#define ASN1_CONSTRUCTED_OCTET_STRING 0x24
 #define ASN1_SEQUENCE 0x30
+#define ASN1_SET 0x31
 #define ASN1_CONTAINER 0xA0
-#define ASN1_OBJECT_IDENTIFIER 0x06
-#define ASN1_OCTET_STRING 0x04
+
+// Nesting allowed when finding the end of indefinite-length (BER) elements.
+#define ASN1_MAXIMUM_DEPTH 16
+
+// Parsed profiles kept, keyed by SHA-256 of their data.
+#define PARSED_PROFILE_CACHE_CAPACITY 256
 
 extern std::vector<unsigned char> readFile(const char* filename);
 
@@ -41,19 +54,186 @@ extern std::vector<unsigned char> readFile(const char* filename);
 
 #define SECONDS_FROM_1970_TO_APPLE_REFERENCE_DATE 978307200
 
-ProvisioningProfile::ProvisioningProfile()
+// 1.2.840.113549.1.7.2 and 1.2.840.113549.1.7.1
+static const unsigned char SignedDataObjectIdentifier[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02 };
+static const unsigned char DataObjectIdentifier[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x01 };
+
+static std::mutex cacheMutex;
+static std::map<std::string, std::pair<ProvisioningProfile, uint64_t>> cachedProfiles;
+static uint64_t cacheUseCount = 0;
+static ProvisioningProfileCacheStatistics profileCacheStatistics;
+
+#pragma mark - DER -
+
+namespace
 {
+
+// One BER/DER element, bounds-checked against the buffer it was read from.
+struct ASN1Element
+{
+    unsigned char tag = 0;
+    const unsigned char *contents = nullptr;
+    size_t length = 0;
+    
+    // Just past the element, including the end-of-contents octets of indefinite-length elements.
+    const unsigned char *end = nullptr;
+};
+
+bool ReadElement(const unsigned char *pointer, const unsigned char *limit, ASN1Element &element, int depth = 0);
+
+// Returns the end-of-contents octets of an indefinite-length element starting at pointer.
+const unsigned char *FindEndOfContents(const unsigned char *pointer, const unsigned char *limit, int depth)
+{
+    if (depth > ASN1_MAXIMUM_DEPTH)
+    {
+        return nullptr;
+    }
+    
+    while (limit - pointer >= 2)
+    {
+        if (pointer[0] == 0x00 && pointer[1] == 0x00)
+        {
+            return pointer;
+        }
+        
+        ASN1Element child;
+        if (!ReadElement(pointer, limit, child, depth + 1))
+        {
+            return nullptr;
+        }
+        
+        pointer = child.end;
+    }
+    
+    return nullptr;
 }
 
-ProvisioningProfile::~ProvisioningProfile()
+bool ReadElement(const unsigned char *pointer, const unsigned char *limit, ASN1Element &element, int depth)
+{
+    if (pointer == nullptr || limit - pointer < 2)
+    {
+        return false;
+    }
+    
+    element.tag = pointer[0];
+    if ((element.tag & 0x1F) == 0x1F)
+    {
+        // High tag numbers don't appear in CMS.
+        return false;
+    }
+    
+    unsigned char lengthByte = pointer[1];
+    pointer += 2;
+    
+    if (lengthByte == 0x80)
+    {
+        // Indefinite length, only valid for constructed elements.
+        if ((element.tag & 0x20) == 0)
+        {
+            return false;
+        }
+        
+        auto endOfContents = FindEndOfContents(pointer, limit, depth);
+        if (endOfContents == nullptr)
+        {
+            return false;
+        }
+        
+        element.contents = pointer;
+        element.length = endOfContents - pointer;
+        element.end = endOfContents + 2;
+        return true;
+    }
+    
+    size_t length = 0;
+    
+    if (lengthByte & 0x80)
+    {
+        size_t lengthSize = lengthByte & 0x7F;
+        if (lengthSize > sizeof(uint32_t) || (size_t)(limit - pointer) < lengthSize)
+        {
+            return false;
+        }
+        
+        for (size_t i = 0; i < lengthSize; i++)
+        {
+            length = (length << 8) | pointer[i];
+        }
+        
+        pointer += lengthSize;
+    }
+    else
+    {
+        length = lengthByte;
+    }
+    
+    if ((size_t)(limit - pointer) < length)
+    {
+        return false;
+    }
+    
+    element.contents = pointer;
+    element.length = length;
+    element.end = pointer + length;
+    return true;
+}
+
+// Reads the children of a constructed element in order.
+class ASN1Reader
+{
+public:
+    ASN1Reader(const ASN1Element &element) : _pointer(element.contents), _limit(element.contents + element.length)
+    {
+    }
+    
+    ASN1Element Next(unsigned char expectedTag)
+    {
+        ASN1Element element;
+        if (!ReadElement(_pointer, _limit, element) || element.tag != expectedTag)
+        {
+            throw SignError(SignErrorCode::InvalidProvisioningProfile);
+        }
+        
+        _pointer = element.end;
+        return element;
+    }
+    
+    bool isAtEnd() const
+    {
+        return _pointer >= _limit;
+    }
+    
+private:
+    const unsigned char *_pointer;
+    const unsigned char *_limit;
+};
+
+bool IsObjectIdentifier(const ASN1Element &element, const unsigned char *identifier, size_t length)
+{
+    return element.length == length && memcmp(element.contents, identifier, length) == 0;
+}
+
+}
+
+#pragma mark - Contents -
+
+ProvisioningProfile::Contents::~Contents()
 {
-    if (this->_entitlements != nullptr)
+    if (entitlements != nullptr)
     {
-        //plist_free(this->_entitlements);
+        plist_free(entitlements);
     }
 }
 
-ProvisioningProfile::ProvisioningProfile(plist_t plist)
+ProvisioningProfile::ProvisioningProfile() : _contents(std::make_shared<Contents>())
+{
+}
+
+ProvisioningProfile::~ProvisioningProfile()
+{
+}
+
+ProvisioningProfile::ProvisioningProfile(plist_t plist) : _contents(std::make_shared<Contents>())
 {
     auto identifierNode = plist_dict_get_item(plist, "provisioningProfileId");
     auto dataNode = plist_dict_get_item(plist, "encodedProfile");
@@ -67,12 +247,8 @@ ProvisioningProfile::ProvisioningProfile(plist_t plist)
     uint64_t length = 0;
     plist_get_data_val(dataNode, &bytes, &length);
 
-    std::vector<unsigned char> data;
-	data.reserve(length);
-    for (int i = 0; i < length; i++)
-    {
-        data.push_back(bytes[i]);
-    }
+    std::vector<unsigned char> data(bytes, bytes + length);
+    free(bytes);
     
     try
     {
@@ -87,153 +263,135 @@ ProvisioningProfile::ProvisioningProfile(plist_t plist)
     plist_get_string_val(identifierNode, &identifier);
     
     _identifier = identifier;
-    _data = data;
+    free(identifier);
 }
 
-ProvisioningProfile::ProvisioningProfile(std::string filepath) /* throws */
+ProvisioningProfile::ProvisioningProfile(std::string filepath) /* throws */ : _contents(std::make_shared<Contents>())
 {
     auto data = readFile(filepath.c_str());
     this->ParseData(data);
 }
 
-ProvisioningProfile::ProvisioningProfile(std::vector<unsigned char>& data) /* throws */
+ProvisioningProfile::ProvisioningProfile(std::vector<unsigned char>& data) /* throws */ : _contents(std::make_shared<Contents>())
 {
     this->ParseData(data);
 }
 
-// Heavily inspired by libimobiledevice/ideviceprovision.c
-// https://github.com/libimobiledevice/libimobiledevice/blob/ddba0b5efbcab483e80be10130c5c797f9ac8d08/tools/ideviceprovision.c#L98
-void ProvisioningProfile::ParseData(std::vector<unsigned char> &encodedData)
+void ProvisioningProfile::ParseData(std::vector<unsigned char> &data)
 {
-    // Helper blocks
-    auto itemSize = [](unsigned char *pointer) -> size_t
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(data.data(), data.size(), digest);
+    
+    std::string key((const char *)digest, sizeof(digest));
+    
     {
-        size_t size = -1;
+        std::lock_guard<std::mutex> lock(cacheMutex);
         
-        char bsize = *(pointer + 1);
-        if (bsize & 0x80)
+        auto iterator = cachedProfiles.find(key);
+        if (iterator != cachedProfiles.end())
         {
-            switch (bsize & 0xF)
-            {
-                case 2:
-                {
-                    uint16_t value = *(uint16_t *)(pointer + 2);
-                    size = ntohs(value);
-                    break;
-                }
-                    
-                case 3:
-                {
-                    uint32_t value = *(uint32_t *)(pointer + 2);
-                    size = ntohl(value) >> 8;
-                    break;
-                }
-                    
-                case 4:
-                {
-                    uint32_t value = *(uint32_t *)(pointer + 2);
-                    size = ntohl(value);
-                    break;
-                }
-                    
-                default:
-                    break;
-            }
-        }
-        else
-        {
-            size = (size_t)bsize;
+            iterator->second.second = ++cacheUseCount;
+            profileCacheStatistics.hits++;
+            
+            // Shares the cached profile's data and entitlements.
+            *this = iterator->second.first;
+            return;
         }
         
-        return size;
-    };
+        profileCacheStatistics.misses++;
+    }
+    
+    this->ParseUncachedData(data);
+    
+    std::lock_guard<std::mutex> lock(cacheMutex);
     
-    auto advanceToNextItem = [](unsigned char *pointer) -> unsigned char *
+    if (cachedProfiles.size() >= PARSED_PROFILE_CACHE_CAPACITY && cachedProfiles.count(key) == 0)
     {
-        unsigned char *nextItem = pointer;
-        
-        char bsize = *(pointer + 1);
-        if (bsize & 0x80)
+        auto leastRecentlyUsed = cachedProfiles.begin();
+        for (auto iterator = cachedProfiles.begin(); iterator != cachedProfiles.end(); iterator++)
         {
-            nextItem += 2 + (bsize & 0xF);
-        }
-        else
-        {
-            nextItem += 3;
+            if (iterator->second.second < leastRecentlyUsed->second.second)
+            {
+                leastRecentlyUsed = iterator;
+            }
         }
         
-        return nextItem;
-    };
+        cachedProfiles.erase(leastRecentlyUsed);
+    }
     
-    auto skipNextItem = [&itemSize](unsigned char *pointer) -> unsigned char *
-    {
-        size_t size = itemSize(pointer);
-        
-        unsigned char *nextItem = pointer + 2 + size;
-        return nextItem;
-    };
+    cachedProfiles[key] = std::make_pair(*this, ++cacheUseCount);
+}
+
+// The profile is a CMS SignedData envelope (RFC 5652) whose encapsulated content is the profile's plist:
+//
+//   ContentInfo ::= SEQUENCE { contentType OID (signedData), content [0] EXPLICIT SignedData }
+//   SignedData ::= SEQUENCE { version INTEGER, digestAlgorithms SET, encapContentInfo SEQUENCE, ... }
+//   EncapsulatedContentInfo ::= SEQUENCE { eContentType OID (data), eContent [0] EXPLICIT OCTET STRING }
+void ProvisioningProfile::ParseUncachedData(std::vector<unsigned char> &encodedData)
+{
+    const unsigned char *bytes = encodedData.data();
     
-    /* Start parsing */
-    unsigned char *pointer = (unsigned char *)encodedData.data();
-    if (!pointer || *pointer != ASN1_SEQUENCE)
+    ASN1Element contentInfo;
+    if (!ReadElement(bytes, bytes + encodedData.size(), contentInfo) || contentInfo.tag != ASN1_SEQUENCE)
     {
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    pointer = advanceToNextItem(pointer);
-    if (!pointer || *pointer != ASN1_OBJECT_IDENTIFIER)
+    ASN1Reader contentInfoReader(contentInfo);
+    if (!IsObjectIdentifier(contentInfoReader.Next(ASN1_OBJECT_IDENTIFIER), SignedDataObjectIdentifier, sizeof(SignedDataObjectIdentifier)))
     {
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    pointer = skipNextItem(pointer);
-    if (!pointer || *pointer != ASN1_CONTAINER)
-    {
-        throw SignError(SignErrorCode::InvalidProvisioningProfile);
-    }
+    ASN1Reader contentReader(contentInfoReader.Next(ASN1_CONTAINER));
+    ASN1Reader signedDataReader(contentReader.Next(ASN1_SEQUENCE));
+    signedDataReader.Next(ASN1_INTEGER);
+    signedDataReader.Next(ASN1_SET);
     
-    pointer = advanceToNextItem(pointer);
-    if (!pointer || *pointer != ASN1_SEQUENCE)
+    ASN1Reader encapsulatedContentInfoReader(signedDataReader.Next(ASN1_SEQUENCE));
+    if (!IsObjectIdentifier(encapsulatedContentInfoReader.Next(ASN1_OBJECT_IDENTIFIER), DataObjectIdentifier, sizeof(DataObjectIdentifier)))
     {
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    pointer = advanceToNextItem(pointer);
+    auto eContent = encapsulatedContentInfoReader.Next(ASN1_CONTAINER);
     
-    // Skip 2 items.
-    for (int i = 0; i < 2; i++)
-    {
-        pointer = skipNextItem(pointer);
-    }
-    
-    if (!pointer || *pointer != ASN1_SEQUENCE)
+    ASN1Element octetString;
+    if (!ReadElement(eContent.contents, eContent.contents + eContent.length, octetString))
     {
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    pointer = advanceToNextItem(pointer);
-    if (!pointer || *pointer != ASN1_OBJECT_IDENTIFIER)
+    const char *plistData = nullptr;
+    size_t length = 0;
+    
+    // BER encoders may split the content into a constructed string of chunks.
+    std::string chunks;
+    
+    if (octetString.tag == ASN1_OCTET_STRING)
     {
-        throw SignError(SignErrorCode::InvalidProvisioningProfile);
+        plistData = (const char *)octetString.contents;
+        length = octetString.length;
     }
-    
-    pointer = skipNextItem(pointer);
-    if (!pointer || *pointer != ASN1_CONTAINER)
+    else if (octetString.tag == ASN1_CONSTRUCTED_OCTET_STRING)
     {
-        throw SignError(SignErrorCode::InvalidProvisioningProfile);
+        ASN1Reader chunksReader(octetString);
+        while (!chunksReader.isAtEnd())
+        {
+            auto chunk = chunksReader.Next(ASN1_OCTET_STRING);
+            chunks.append((const char *)chunk.contents, chunk.length);
+        }
+        
+        plistData = chunks.data();
+        length = chunks.size();
     }
-    
-    pointer = advanceToNextItem(pointer);
-    if (!pointer || *pointer != ASN1_OCTET_STRING)
+    else
     {
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    size_t length = itemSize(pointer);
-    pointer = advanceToNextItem(pointer);
-    
     plist_t parsedPlist = nullptr;
-    plist_from_memory((const char *)pointer, (unsigned int)length, &parsedPlist);
+    plist_from_memory(plistData, (unsigned int)length, &parsedPlist);
     
     if (parsedPlist == nullptr)
     {
@@ -249,12 +407,14 @@ void ProvisioningProfile::ParseData(std::vector<unsigned char> &encodedData)
     
     if (nameNode == nullptr || uuidNode == nullptr || teamIdentifiersNode == nullptr || creationDateNode == nullptr || expirationDateNode == nullptr || entitlementsNode == nullptr)
     {
+        plist_free(parsedPlist);
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
     auto teamIdentifierNode = plist_array_get_item(teamIdentifiersNode, 0);
     if (teamIdentifierNode == nullptr)
     {
+        plist_free(parsedPlist);
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
 
@@ -271,15 +431,6 @@ void ProvisioningProfile::ParseData(std::vector<unsigned char> &encodedData)
 		_isFreeProvisioningProfile = 0;
 	}
     
-    char *name = nullptr;
-    plist_get_string_val(nameNode, &name);
-    
-    char *uuid = nullptr;
-    plist_get_string_val(uuidNode, &uuid);
-    
-    char *teamIdentifier = nullptr;
-    plist_get_string_val(teamIdentifierNode, &teamIdentifier);
-    
     int32_t create_sec = 0;
     int32_t create_usec = 0;
     plist_get_date_val(creationDateNode, &create_sec, &create_usec);
@@ -291,25 +442,34 @@ void ProvisioningProfile::ParseData(std::vector<unsigned char> &encodedData)
     plist_t bundleIdentifierNode = plist_dict_get_item(entitlementsNode, "application-identifier");
     if (bundleIdentifierNode == nullptr)
     {
+        plist_free(parsedPlist);
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
-    char *rawApplicationIdentifier = nullptr;
-    plist_get_string_val(bundleIdentifierNode, &rawApplicationIdentifier);
+    auto stringValue = [](plist_t node) -> std::string {
+        char *value = nullptr;
+        plist_get_string_val(node, &value);
+        
+        std::string string = (value != nullptr) ? value : "";
+        free(value);
+        
+        return string;
+    };
     
-    std::string applicationIdentifier(rawApplicationIdentifier);
+    std::string applicationIdentifier = stringValue(bundleIdentifierNode);
     
     size_t location = applicationIdentifier.find(".");
     if (location == std::string::npos)
     {
+        plist_free(parsedPlist);
         throw SignError(SignErrorCode::InvalidProvisioningProfile);
     }
     
     std::string bundleIdentifier(applicationIdentifier.begin() + location + 1, applicationIdentifier.end());
     
-    _name = name;
-    _uuid = uuid;
-    _teamIdentifier = teamIdentifier;
+    _name = stringValue(nameNode);
+    _uuid = stringValue(uuidNode);
+    _teamIdentifier = stringValue(teamIdentifierNode);
     _bundleIdentifier = bundleIdentifier;
 
 	_creationDateSeconds = create_sec + SECONDS_FROM_1970_TO_APPLE_REFERENCE_DATE;
@@ -318,9 +478,11 @@ void ProvisioningProfile::ParseData(std::vector<unsigned char> &encodedData)
 	_expirationDateSeconds = expiration_sec + SECONDS_FROM_1970_TO_APPLE_REFERENCE_DATE;
 	_expirationDateMicroseconds = expiration_usec;
 
-    _entitlements = plist_copy(entitlementsNode);
+    _contents = std::make_shared<Contents>();
+    _contents->entitlements = plist_copy(entitlementsNode);
+    _contents->data = encodedData;
     
-    _data = encodedData;
+    plist_free(parsedPlist);
 }
 
 #pragma mark - Getters -
@@ -352,7 +514,7 @@ std::string ProvisioningProfile::teamIdentifier() const
 
 std::vector<unsigned char> ProvisioningProfile::data() const
 {
-    return _data;
+    return _contents->data;
 }
 
 timeval ProvisioningProfile::creationDate() const
@@ -369,10 +531,40 @@ timeval ProvisioningProfile::expirationDate() const
 
 plist_t ProvisioningProfile::entitlements() const
 {
-	return _entitlements;
+	return _contents->entitlements;
+}
+
+std::string ProvisioningProfile::entitlementsXML() const
+{
+	auto contents = _contents;
+
+	std::call_once(contents->entitlementsXMLFlag, [contents]() {
+		if (contents->entitlements == nullptr)
+		{
+			return;
+		}
+
+		char *xml = nullptr;
+		uint32_t length = 0;
+		plist_to_xml(contents->entitlements, &xml, &length);
+
+		contents->entitlementsXML = std::string(xml, length);
+		free(xml);
+	});
+
+	return contents->entitlementsXML;
 }
 
 bool ProvisioningProfile::isFreeProvisioningProfile() const
 {
 	return _isFreeProvisioningProfile;
-}
\ No newline at end of file
+}
+
+ProvisioningProfileCacheStatistics ProvisioningProfile::cacheStatistics()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+
+	auto statistics = profileCacheStatistics;
+	statistics.entries = cachedProfiles.size();
+	return statistics;
+}
@@ -12,6 +12,8 @@
 /* The classes below are exported */
 #pragma GCC visibility push(default)
 
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -20,6 +22,15 @@
 
 struct timeval;
 
+struct ProvisioningProfileCacheStatistics
+{
+    // Profiles whose data was already parsed, e.g. the ones read from a device on every install.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    size_t entries = 0;
+};
+
 class ProvisioningProfile
 {
 public:
@@ -40,12 +51,18 @@ public:
 	timeval creationDate() const;
 	timeval expirationDate() const;
     
+    // Owned by the profile, and shared by every profile parsed from the same data.
     plist_t entitlements() const;
+    
+    // Entitlements as XML, serialized once per profile data.
+    std::string entitlementsXML() const;
 
 	bool isFreeProvisioningProfile() const;
     
     std::vector<unsigned char> data() const;
     
+    static ProvisioningProfileCacheStatistics cacheStatistics();
+    
     friend std::ostream& operator<<(std::ostream& os, const ProvisioningProfile& profile);
     
 private:
@@ -62,12 +79,23 @@ private:
 	long _expirationDateSeconds;
 	long _expirationDateMicroseconds;
     
-    plist_t _entitlements;
 	bool _isFreeProvisioningProfile;
     
-    std::vector<unsigned char> _data;
+    struct Contents
+    {
+        ~Contents();
+        
+        std::vector<unsigned char> data;
+        plist_t entitlements = nullptr;
+        
+        std::once_flag entitlementsXMLFlag;
+        std::string entitlementsXML;
+    };
+    
+    std::shared_ptr<Contents> _contents;
     
     void ParseData(std::vector<unsigned char>& data);
+    void ParseUncachedData(std::vector<unsigned char>& data);
 };
 
 #pragma GCC visibility pop
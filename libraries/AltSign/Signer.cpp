@@ -11,6 +11,7 @@
 #include "Error.hpp"
 #include "Archiver.hpp"
 #include "Application.hpp"
+#include "Tracer.hpp"
 
 #include "ldid/ldid.hpp"
 
@@ -201,6 +202,8 @@ void Signer::SignApp(std::string path, std::vector<std::shared_ptr<ProvisioningP
 {   
     fs::path appPath = fs::path(path);
 
+    TraceSpan span("sign", "Sign app");
+
 	auto pathExtension = appPath.extension().string();
 	std::transform(pathExtension.begin(), pathExtension.end(), pathExtension.begin(), [](unsigned char c) {
 		return std::tolower(c);
@@ -255,29 +258,34 @@ void Signer::SignApp(std::string path, std::vector<std::shared_ptr<ProvisioningP
 			fout.write((char*)& profile->data()[0], profile->data().size() * sizeof(char));
 			fout.close();
             
-            plist_t entitlements = profile->entitlements();
-            
-            char *entitlementsString = nullptr;
-            uint32_t entitlementsSize = 0;
-            plist_to_xml(entitlements, &entitlementsString, &entitlementsSize);
-            
-            entitlementsByFilepath[app.path()] = entitlementsString;
+            // Serialized once per profile, not on every signing run.
+            entitlementsByFilepath[app.path()] = profile->entitlementsXML();
         };
         
         odslog("Signing app " << appBundlePath.string() << " using ldid...");
 
         Application app(appBundlePath.string());
-        prepareApp(app);
+        span.set("app", app.bundleIdentifier());
+
+        {
+            TraceSpan embedSpan("sign", "Embed profiles");
+            embedSpan.set("extensions", app.appExtensions().size());
+
+            prepareApp(app);
 
-		for (auto appExtension : app.appExtensions())
-		{
-			prepareApp(*appExtension);
-		}
+            for (auto appExtension : app.appExtensions())
+            {
+                prepareApp(*appExtension);
+            }
+        }
         
         // Sign application
         ldid::DiskFolder appBundle(app.path());
         std::string key = CertificatesContent(this->certificate());
         
+        TraceSpan ldidSpan("sign", "ldid sign");
+        ldidSpan.set("app", app.bundleIdentifier());
+
         ldid::Sign("", appBundle, key, "",
                    ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
             std::string filepath;
@@ -295,13 +303,15 @@ void Signer::SignApp(std::string path, std::vector<std::shared_ptr<ProvisioningP
             return entitlements;
         }),
                    ldid::fun([&](const std::string &string) {
-			odslog("Signing: " << string);
+			odstrace("Signing: " << string);
 //            progress.completedUnitCount += 1;
         }),
                    ldid::fun([&](const double signingProgress) {
 			//odslog("Signing Progress: " << signingProgress);
         }));
         
+        ldidSpan.End();
+        
         // Zip app back up.
         if (ipaPath.has_value())
         {
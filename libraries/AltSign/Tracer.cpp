@@ -0,0 +1,478 @@
+//
+//  Tracer.cpp
+//  AltSign
+//
+
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "altsign_common.h"
+
+namespace fs = std::filesystem;
+
+// Spans outside any trace are kept this long (by count) for exporting traces that overlap them.
+#define RECENT_EVENTS_CAPACITY 16384
+
+namespace
+{
+    long CurrentThreadID()
+    {
+        thread_local long threadID = (long)syscall(SYS_gettid);
+        return threadID;
+    }
+
+    std::string JSONString(const std::string& string)
+    {
+        std::string output = "\"";
+
+        for (unsigned char c : string)
+        {
+            switch (c)
+            {
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\n': output += "\\n"; break;
+            case '\r': output += "\\r"; break;
+            case '\t': output += "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    output += escaped;
+                }
+                else
+                {
+                    output += (char)c;
+                }
+                break;
+            }
+        }
+
+        output += "\"";
+        return output;
+    }
+
+    long long Microseconds(std::chrono::steady_clock::time_point date)
+    {
+        return (long long)std::chrono::duration_cast<std::chrono::microseconds>(date.time_since_epoch()).count();
+    }
+
+    double Milliseconds(std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    void AppendArguments(std::stringstream& ss, const std::vector<std::pair<std::string, std::string>>& arguments)
+    {
+        ss << "{";
+
+        for (size_t i = 0; i < arguments.size(); i++)
+        {
+            ss << (i > 0 ? "," : "") << JSONString(arguments[i].first) << ":" << arguments[i].second;
+        }
+
+        ss << "}";
+    }
+}
+
+#pragma mark - TraceHistogram -
+
+void TraceHistogram::Add(double milliseconds)
+{
+    count++;
+    totalMilliseconds += milliseconds;
+    maximumMilliseconds = std::max(maximumMilliseconds, milliseconds);
+
+    size_t bucket = 0;
+    while (bucket < BucketCount - 1 && milliseconds >= std::ldexp(1.0, (int)bucket))
+    {
+        bucket++;
+    }
+
+    buckets[bucket]++;
+}
+
+double TraceHistogram::Percentile(double percentile) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    auto rank = (uint64_t)std::ceil(percentile / 100.0 * count);
+    uint64_t total = 0;
+
+    for (size_t bucket = 0; bucket < BucketCount - 1; bucket++)
+    {
+        total += buckets[bucket];
+        if (total >= rank)
+        {
+            return std::min(std::ldexp(1.0, (int)bucket), maximumMilliseconds);
+        }
+    }
+
+    return maximumMilliseconds;
+}
+
+#pragma mark - Trace -
+
+Trace::Trace(std::string name) : _name(name), _startDate(std::chrono::steady_clock::now())
+{
+}
+
+std::string Trace::name() const
+{
+    return _name;
+}
+
+std::chrono::steady_clock::time_point Trace::startDate() const
+{
+    return _startDate;
+}
+
+std::optional<std::chrono::steady_clock::time_point> Trace::endDate() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _endDate;
+}
+
+void Trace::SetArgument(std::string key, std::string value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _arguments.push_back(std::make_pair(key, JSONString(value)));
+}
+
+void Trace::SetArgument(std::string key, uint64_t value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _arguments.push_back(std::make_pair(key, std::to_string(value)));
+}
+
+#pragma mark - Tracer -
+
+Tracer* Tracer::_instance = nullptr;
+std::atomic<bool> Tracer::_isEnabled(false);
+
+Tracer* Tracer::instance()
+{
+    if (_instance == 0)
+    {
+        _instance = new Tracer();
+    }
+
+    return _instance;
+}
+
+Tracer::Tracer()
+{
+}
+
+Tracer::~Tracer()
+{
+}
+
+void Tracer::setEnabled(bool isEnabled)
+{
+    _isEnabled.store(isEnabled, std::memory_order_relaxed);
+}
+
+std::string Tracer::exportDirectoryPath()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _exportDirectoryPath;
+}
+
+void Tracer::setExportDirectoryPath(std::string exportDirectoryPath)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _exportDirectoryPath = exportDirectoryPath;
+}
+
+std::shared_ptr<Trace> Tracer::StartTrace(std::string name)
+{
+    if (!Tracer::isEnabled())
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<Trace>(name);
+}
+
+std::optional<std::string> Tracer::FinishTrace(std::shared_ptr<Trace> trace)
+{
+    if (trace == nullptr)
+    {
+        return std::nullopt;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(trace->_mutex);
+        trace->_endDate = std::chrono::steady_clock::now();
+    }
+
+    auto directoryPath = this->exportDirectoryPath();
+    if (directoryPath.empty())
+    {
+        return std::nullopt;
+    }
+
+    auto now = std::chrono::system_clock::now();
+    auto time = std::chrono::system_clock::to_time_t(now);
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+
+    struct tm components;
+    localtime_r(&time, &components);
+
+    std::stringstream filename;
+    filename << trace->name() << "-" << std::put_time(&components, "%Y%m%d-%H%M%S") << "-" << std::setw(3) << std::setfill('0') << milliseconds << ".json";
+
+    auto path = fs::path(directoryPath).append(filename.str());
+
+    try
+    {
+        fs::create_directories(directoryPath);
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        file << this->ChromeTraceJSON(trace);
+        file.close();
+
+        if (file.fail())
+        {
+            throw std::runtime_error("Couldn't write file.");
+        }
+    }
+    catch (std::exception& e)
+    {
+        odslog("Failed to write trace " << path << ". " << e.what());
+        return std::nullopt;
+    }
+
+    odslog("Wrote trace to " << path.string());
+    return path.string();
+}
+
+void Tracer::Record(TraceEvent event, std::shared_ptr<Trace> trace)
+{
+    auto key = event.category + ": " + event.name;
+    auto duration = Milliseconds(event.endDate - event.startDate);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _histograms[key].Add(duration);
+
+        if (trace == nullptr)
+        {
+            _recentEvents.push_back(std::move(event));
+
+            if (_recentEvents.size() > RECENT_EVENTS_CAPACITY)
+            {
+                _recentEvents.pop_front();
+            }
+
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(trace->_mutex);
+    trace->_events.push_back(std::move(event));
+}
+
+std::string Tracer::ChromeTraceJSON(std::shared_ptr<Trace> trace)
+{
+    std::vector<TraceEvent> traceEvents;
+    std::vector<std::pair<std::string, std::string>> arguments;
+    std::chrono::steady_clock::time_point endDate;
+
+    {
+        std::lock_guard<std::mutex> lock(trace->_mutex);
+        traceEvents = trace->_events;
+        arguments = trace->_arguments;
+        endDate = trace->_endDate.value_or(std::chrono::steady_clock::now());
+    }
+
+    std::vector<TraceEvent> overlappingEvents;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (auto& event : _recentEvents)
+        {
+            if (event.endDate >= trace->startDate() && event.startDate <= endDate)
+            {
+                overlappingEvents.push_back(event);
+            }
+        }
+    }
+
+    auto processID = (long)getpid();
+
+    std::stringstream ss;
+    ss << "{\"traceEvents\":[";
+    ss << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << processID << ",\"args\":{\"name\":" << JSONString("AltServer " + trace->name()) << "}}";
+
+    // The trace's own spans (an install's stages) overlap without nesting, so they go on async tracks of their own.
+    for (size_t i = 0; i < traceEvents.size(); i++)
+    {
+        auto& event = traceEvents[i];
+
+        ss << ",{\"name\":" << JSONString(event.name) << ",\"cat\":" << JSONString(event.category) << ",\"ph\":\"b\",\"id\":" << i
+            << ",\"ts\":" << Microseconds(event.startDate) << ",\"pid\":" << processID << ",\"tid\":" << event.threadID << ",\"args\":";
+        AppendArguments(ss, event.arguments);
+        ss << "}";
+
+        ss << ",{\"name\":" << JSONString(event.name) << ",\"cat\":" << JSONString(event.category) << ",\"ph\":\"e\",\"id\":" << i
+            << ",\"ts\":" << Microseconds(event.endDate) << ",\"pid\":" << processID << ",\"tid\":" << event.threadID << "}";
+    }
+
+    for (auto& event : overlappingEvents)
+    {
+        ss << ",{\"name\":" << JSONString(event.name) << ",\"cat\":" << JSONString(event.category) << ",\"ph\":\"X\""
+            << ",\"ts\":" << Microseconds(event.startDate) << ",\"dur\":" << Microseconds(event.endDate) - Microseconds(event.startDate)
+            << ",\"pid\":" << processID << ",\"tid\":" << event.threadID << ",\"args\":";
+        AppendArguments(ss, event.arguments);
+        ss << "}";
+    }
+
+    ss << "],\"displayTimeUnit\":\"ms\",\"otherData\":";
+    AppendArguments(ss, arguments);
+    ss << "}";
+
+    return ss.str();
+}
+
+std::map<std::string, TraceHistogram> Tracer::histograms()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _histograms;
+}
+
+void Tracer::LogHistograms()
+{
+    auto histograms = this->histograms();
+
+    if (histograms.empty())
+    {
+        odslog((Tracer::isEnabled() ? "No spans have been traced yet." : "Tracing is disabled, set ALTSERVER_TRACE=1 to collect stage histograms."));
+        return;
+    }
+
+    std::stringstream ss;
+    ss << "Stage durations (ms):";
+
+    for (auto& pair : histograms)
+    {
+        auto& histogram = pair.second;
+
+        ss << std::endl << "  " << pair.first << ": " << histogram.count << " spans, mean " << std::fixed << std::setprecision(1) << histogram.totalMilliseconds / histogram.count
+            << ", p50 <= " << histogram.Percentile(50) << ", p95 <= " << histogram.Percentile(95) << ", max " << histogram.maximumMilliseconds << std::defaultfloat << "; buckets";
+
+        for (size_t bucket = 0; bucket < TraceHistogram::BucketCount; bucket++)
+        {
+            if (histogram.buckets[bucket] == 0)
+            {
+                continue;
+            }
+
+            if (bucket == TraceHistogram::BucketCount - 1)
+            {
+                ss << " >=" << (uint64_t)std::ldexp(1.0, (int)bucket - 1) << ":" << histogram.buckets[bucket];
+            }
+            else
+            {
+                ss << " <" << (uint64_t)std::ldexp(1.0, (int)bucket) << ":" << histogram.buckets[bucket];
+            }
+        }
+    }
+
+    odslog(ss.str());
+}
+
+#pragma mark - TraceSpan -
+
+TraceSpan::TraceSpan(const char* category, const char* name, std::shared_ptr<Trace> trace) : _isActive(false)
+{
+    if (Tracer::isEnabled())
+    {
+        this->Start(category, name, trace);
+    }
+}
+
+TraceSpan::TraceSpan(const char* category, const std::string& name, std::shared_ptr<Trace> trace) : _isActive(false)
+{
+    if (Tracer::isEnabled())
+    {
+        this->Start(category, name, trace);
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    this->End();
+}
+
+void TraceSpan::Start(const char* category, const std::string& name, std::shared_ptr<Trace> trace)
+{
+    _isActive = true;
+    _trace = trace;
+
+    _event.category = category;
+    _event.name = name;
+    _event.threadID = CurrentThreadID();
+    _event.startDate = std::chrono::steady_clock::now();
+}
+
+void TraceSpan::set(const char* key, const std::string& value)
+{
+    if (_isActive)
+    {
+        this->SetJSONArgument(key, JSONString(value));
+    }
+}
+
+void TraceSpan::set(const char* key, const char* value)
+{
+    if (_isActive)
+    {
+        this->SetJSONArgument(key, JSONString(value));
+    }
+}
+
+void TraceSpan::SetJSONArgument(const char* key, std::string value)
+{
+    for (auto& argument : _event.arguments)
+    {
+        if (argument.first == key)
+        {
+            argument.second = value;
+            return;
+        }
+    }
+
+    _event.arguments.push_back(std::make_pair(key, value));
+}
+
+void TraceSpan::End()
+{
+    if (!_isActive)
+    {
+        return;
+    }
+
+    _isActive = false;
+    _event.endDate = std::chrono::steady_clock::now();
+
+    Tracer::instance()->Record(std::move(_event), std::move(_trace));
+}
@@ -0,0 +1,179 @@
+//
+//  Tracer.hpp
+//  AltSign
+//
+//  Spans for the stages of an install: Apple API requests, signing, device
+//  transfers and so on. Finished spans feed per-stage duration histograms and
+//  can be exported for one job as Chrome trace JSON (chrome://tracing,
+//  Perfetto). Everything is skipped while tracing is disabled.
+//
+
+#ifndef Tracer_hpp
+#define Tracer_hpp
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+struct TraceEvent
+{
+    std::string category;
+    std::string name;
+
+    std::chrono::steady_clock::time_point startDate;
+    std::chrono::steady_clock::time_point endDate;
+    long threadID = 0;
+
+    // Values are JSON: quoted strings or numbers.
+    std::vector<std::pair<std::string, std::string>> arguments;
+};
+
+// Durations in power-of-two millisecond buckets: bucket 0 counts spans under 1 ms,
+// bucket i spans of [2^(i-1), 2^i) ms, and the last bucket everything longer.
+struct TraceHistogram
+{
+    static const size_t BucketCount = 24;
+
+    uint64_t count = 0;
+    double totalMilliseconds = 0;
+    double maximumMilliseconds = 0;
+    std::array<uint64_t, BucketCount> buckets = {};
+
+    void Add(double milliseconds);
+
+    // Upper bound of the bucket holding the given percentile (0-100).
+    double Percentile(double percentile) const;
+};
+
+// One job, e.g. an install. Spans recorded against it are exported together with every other
+// span that overlaps it, which covers work the job started on other threads.
+class Trace
+{
+public:
+    Trace(std::string name);
+
+    std::string name() const;
+
+    std::chrono::steady_clock::time_point startDate() const;
+    std::optional<std::chrono::steady_clock::time_point> endDate() const;
+
+    // Shown with the trace's metadata, e.g. the device and app of an install.
+    void SetArgument(std::string key, std::string value);
+    void SetArgument(std::string key, uint64_t value);
+
+private:
+    friend class Tracer;
+
+    std::string _name;
+    std::chrono::steady_clock::time_point _startDate;
+    std::optional<std::chrono::steady_clock::time_point> _endDate;
+
+    mutable std::mutex _mutex;
+    std::vector<TraceEvent> _events;
+    std::vector<std::pair<std::string, std::string>> _arguments;
+};
+
+class Tracer
+{
+public:
+    static Tracer* instance();
+
+    // Checked by every span before it does anything else.
+    static bool isEnabled()
+    {
+        return _isEnabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool isEnabled);
+
+    // Finished traces are written here as <name>-<date>.json; empty writes none.
+    std::string exportDirectoryPath();
+    void setExportDirectoryPath(std::string exportDirectoryPath);
+
+    // nullptr while tracing is disabled.
+    std::shared_ptr<Trace> StartTrace(std::string name);
+
+    // Ends trace and exports it, returning the path it was written to. Does nothing for nullptr.
+    std::optional<std::string> FinishTrace(std::shared_ptr<Trace> trace);
+
+    void Record(TraceEvent event, std::shared_ptr<Trace> trace = nullptr);
+
+    std::string ChromeTraceJSON(std::shared_ptr<Trace> trace);
+
+    // Keyed by "category: name".
+    std::map<std::string, TraceHistogram> histograms();
+
+    // Logs count, mean, p50, p95 and maximum of every stage; AltServer calls it on SIGUSR1.
+    void LogHistograms();
+
+private:
+    Tracer();
+    ~Tracer();
+
+    static Tracer* _instance;
+    static std::atomic<bool> _isEnabled;
+
+    std::mutex _mutex;
+    std::string _exportDirectoryPath;
+
+    // Spans not recorded against a trace, kept for exporting the traces they overlap.
+    std::deque<TraceEvent> _recentEvents;
+
+    std::map<std::string, TraceHistogram> _histograms;
+};
+
+// Measures from construction until End() or destruction. Inactive spans, created while tracing
+// is disabled, ignore everything; check isActive() before computing expensive arguments.
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name, std::shared_ptr<Trace> trace = nullptr);
+    TraceSpan(const char* category, const std::string& name, std::shared_ptr<Trace> trace = nullptr);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool isActive() const
+    {
+        return _isActive;
+    }
+
+    void set(const char* key, const std::string& value);
+    void set(const char* key, const char* value);
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type set(const char* key, T value)
+    {
+        if (_isActive)
+        {
+            this->SetJSONArgument(key, std::to_string(value));
+        }
+    }
+
+    void End();
+
+private:
+    bool _isActive;
+    TraceEvent _event;
+    std::shared_ptr<Trace> _trace;
+
+    void Start(const char* category, const std::string& name, std::shared_ptr<Trace> trace);
+    void SetJSONArgument(const char* key, std::string value);
+};
+
+#pragma GCC visibility pop
+
+#endif /* Tracer_hpp */
@@ -2,6 +2,9 @@
 #include <arpa/inet.h>
 
 typedef struct timeval TIMEVAL;
+
+#include "Logger.hpp"
+
 #ifndef odslog
-#define odslog(msg) { std::cout << msg << std::endl; }
+#define odslog(msg) odslog_level(LogLevel::Info, msg)
 #endif
\ No newline at end of file
@@ -0,0 +1,412 @@
+//
+//  APIBench.cpp
+//  AltSign
+//
+//  Runs the Apple side of AltServer installs through AppleAPI against
+//  tools/AppleStandIn (or any server speaking the same protocols): sign in,
+//  then per install fetch the team, register the device, check the
+//  certificate, add or find the App ID, enable app groups, assign the group
+//  and download a profile. Installs run --concurrency at a time, so the
+//  scheduler, coalescer and caches see the same pattern as several devices
+//  installing at once. Per-step latencies and the scheduler, coalescer and
+//  cache statistics are printed as a single JSON object.
+//
+
+#include "BenchSupport.hpp"
+
+#include "AppleAPI.hpp"
+#include "AnisetteData.h"
+#include "Logger.hpp"
+
+#include <iostream>
+#include <mutex>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include <plist/plist.h>
+
+struct Configuration
+{
+    // AppleStandIn serves developer services on 127.0.0.1 and sign-in on localhost, so each keeps its own rate limit.
+    std::string developerServicesURL = "http://127.0.0.1:6972/services";
+    std::string gsaURL = "http://localhost:6972";
+
+    std::string appleID = "bench@altsign.dev";
+    std::string password = "altserver";
+
+    int installs = 20;
+    int concurrency = 4;
+    int devices = 4;
+    int apps = 2;
+
+    // Seconds; negative keeps AppleAPI's defaults.
+    int cacheLifetime = -1;
+};
+
+// Latency of each step of an install, in the order AltServer runs them.
+struct Steps
+{
+    std::mutex mutex;
+
+    bench::Samples team;
+    bench::Samples device;
+    bench::Samples certificate;
+    bench::Samples appID;
+    bench::Samples features;
+    bench::Samples appGroups;
+    bench::Samples profile;
+    bench::Samples install;
+
+    uint64_t succeeded = 0;
+    uint64_t failed = 0;
+    std::map<std::string, uint64_t> errors;
+};
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times one step; the sample is only kept if the step succeeds.
+template <typename T, typename Function>
+static pplx::task<T> TimeStep(Steps& steps, bench::Samples Steps::*samples, Function&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    return function().then([&steps, samples, start](T value) {
+        auto milliseconds = MillisecondsSince(start);
+
+        std::lock_guard<std::mutex> lock(steps.mutex);
+        (steps.*samples).add(milliseconds);
+
+        return value;
+    });
+}
+
+// Anisette values aren't checked by the stand-in.
+static std::shared_ptr<AnisetteData> MakeAnisetteData()
+{
+    struct timeval date;
+    gettimeofday(&date, NULL);
+
+    return std::make_shared<AnisetteData>("AAAAABQAAAAQbWFjaGluZS1pZGVudGlmaWVy", "AAAAABQAAAAQb25lLXRpbWUtcGFzc3dvcmQ=", "APIBENCH", 17106176,
+        make_uuid(), "C02XXXXXXXXX", "<MacBookPro15,1> <Mac OS X;10.15.2;19C57> <com.apple.AuthKit/1 (com.apple.dt.Xcode/3594.4.19)>", date, "en_US", "PST");
+}
+
+static pplx::task<void> RunInstall(int index, const Configuration& configuration, std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session,
+    std::shared_ptr<Certificate> certificate, Steps& steps)
+{
+    auto api = AppleAPI::getInstance();
+
+    // Same UDIDs as DeviceStandIn's devices.
+    char udid[32];
+    snprintf(udid, sizeof(udid), "00008101-%016X", index % configuration.devices + 1);
+
+    auto device = std::make_shared<Device>("APIBench " + std::to_string(index % configuration.devices + 1), udid, Device::Type::iPhone);
+
+    auto app = index % configuration.apps;
+    auto appName = "APIBench " + std::to_string(app);
+    auto bundleIdentifier = "com.altsign.apibench" + std::to_string(app);
+
+    auto start = std::chrono::steady_clock::now();
+
+    return TimeStep<std::shared_ptr<Team>>(steps, &Steps::team, [=]() {
+        return api->FetchTeams(account, session).then([](std::vector<std::shared_ptr<Team>> teams) {
+            if (teams.empty())
+            {
+                throw APIError(APIErrorCode::InvalidResponse);
+            }
+
+            return teams[0];
+        });
+    })
+    .then([=, &steps](std::shared_ptr<Team> team) {
+        return TimeStep<std::shared_ptr<Device>>(steps, &Steps::device, [=]() {
+            return api->FetchDevices(team, device->type(), session).then([=](std::vector<std::shared_ptr<Device>> devices) {
+                for (auto& registeredDevice : devices)
+                {
+                    if (registeredDevice->identifier() == device->identifier())
+                    {
+                        return pplx::task_from_result(registeredDevice);
+                    }
+                }
+
+                return api->RegisterDevice(device->name(), device->identifier(), device->type(), team, session);
+            });
+        })
+        .then([=, &steps](std::shared_ptr<Device>) {
+            return TimeStep<bool>(steps, &Steps::certificate, [=]() {
+                return api->FetchCertificates(team, session).then([=](std::vector<std::shared_ptr<Certificate>> certificates) {
+                    for (auto& fetchedCertificate : certificates)
+                    {
+                        if (fetchedCertificate->serialNumber() == certificate->serialNumber())
+                        {
+                            return true;
+                        }
+                    }
+
+                    throw APIError(APIErrorCode::CertificateDoesNotExist);
+                });
+            });
+        })
+        .then([=, &steps](bool) {
+            return TimeStep<std::shared_ptr<AppID>>(steps, &Steps::appID, [=]() {
+                return api->FetchAppIDs(team, session).then([=](std::vector<std::shared_ptr<AppID>> appIDs) {
+                    for (auto& appID : appIDs)
+                    {
+                        if (appID->bundleIdentifier() == bundleIdentifier)
+                        {
+                            return pplx::task_from_result(appID);
+                        }
+                    }
+
+                    return api->AddAppID(appName, bundleIdentifier, team, session);
+                });
+            });
+        })
+        .then([=, &steps](std::shared_ptr<AppID> appID) {
+            return TimeStep<std::shared_ptr<AppID>>(steps, &Steps::features, [=]() {
+                auto features = appID->features();
+
+                auto enabled = plist_new_bool(true);
+                features[AppIDFeatureAppGroups] = enabled;
+
+                auto updatedAppID = std::make_shared<AppID>(*appID);
+                updatedAppID->setFeatures(features);
+                plist_free(enabled);
+
+                return api->UpdateAppID(updatedAppID, team, session);
+            });
+        })
+        .then([=, &steps](std::shared_ptr<AppID> appID) {
+            return TimeStep<std::shared_ptr<AppID>>(steps, &Steps::appGroups, [=]() {
+                auto groupIdentifier = "group." + bundleIdentifier + "." + team->identifier();
+
+                return api->FetchAppGroups(team, session).then([=](std::vector<std::shared_ptr<AppGroup>> groups) {
+                    for (auto& group : groups)
+                    {
+                        if (group->groupIdentifier() == groupIdentifier)
+                        {
+                            return pplx::task_from_result(group);
+                        }
+                    }
+
+                    return api->AddAppGroup(appName + " Group", groupIdentifier, team, session);
+                })
+                .then([=](std::shared_ptr<AppGroup> group) {
+                    return api->AssignAppIDToGroups(appID, { group }, team, session);
+                })
+                .then([appID](bool) {
+                    return appID;
+                });
+            });
+        })
+        .then([=, &steps](std::shared_ptr<AppID> appID) {
+            return TimeStep<std::shared_ptr<ProvisioningProfile>>(steps, &Steps::profile, [=]() {
+                return api->FetchProvisioningProfile(appID, device->type(), team, session);
+            });
+        });
+    })
+    .then([start, &steps](pplx::task<std::shared_ptr<ProvisioningProfile>> task) {
+        auto milliseconds = MillisecondsSince(start);
+
+        std::lock_guard<std::mutex> lock(steps.mutex);
+
+        try
+        {
+            task.get();
+
+            steps.install.add(milliseconds);
+            steps.succeeded++;
+        }
+        catch (std::exception& exception)
+        {
+            steps.failed++;
+            steps.errors[exception.what()]++;
+        }
+    });
+}
+
+static bench::JSONObject CacheStatistics(AppleAPIResource resource)
+{
+    auto statistics = AppleAPI::getInstance()->cacheStatistics(resource);
+
+    bench::JSONObject result;
+    result.set("hits", statistics.hits)
+        .set("misses", statistics.misses)
+        .set("updates", statistics.updates)
+        .set("invalidations", statistics.invalidations);
+    return result;
+}
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--developer-services-url URL] [--gsa-url URL] [--apple-id ID] [--password PASSWORD] [--installs N] [--concurrency N] [--devices N] [--apps N] [--cache-ttl SECONDS]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"developer-services-url", required_argument, 0, 'D'},
+        {"gsa-url",                required_argument, 0, 'G'},
+        {"apple-id",               required_argument, 0, 'a'},
+        {"password",               required_argument, 0, 'p'},
+        {"installs",               required_argument, 0, 'n'},
+        {"concurrency",            required_argument, 0, 'c'},
+        {"devices",                required_argument, 0, 'd'},
+        {"apps",                   required_argument, 0, 'A'},
+        {"cache-ttl",              required_argument, 0, 't'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'D': configuration.developerServicesURL = optarg; break;
+        case 'G': configuration.gsaURL = optarg; break;
+        case 'a': configuration.appleID = optarg; break;
+        case 'p': configuration.password = optarg; break;
+        case 'n': configuration.installs = std::max(1, atoi(optarg)); break;
+        case 'c': configuration.concurrency = std::max(1, atoi(optarg)); break;
+        case 'd': configuration.devices = std::max(1, atoi(optarg)); break;
+        case 'A': configuration.apps = std::max(1, atoi(optarg)); break;
+        case 't': configuration.cacheLifetime = std::max(0, atoi(optarg)); break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Keep the JSON on stdout clean of AltSign's request logging.
+    Logger::instance()->setLevel(LogLevel::Off);
+
+    auto api = AppleAPI::getInstance();
+    api->setDeveloperServicesURL(configuration.developerServicesURL);
+    api->setGSAURL(configuration.gsaURL);
+
+    if (configuration.cacheLifetime >= 0)
+    {
+        for (auto resource : { AppleAPIResource::Teams, AppleAPIResource::Devices, AppleAPIResource::Certificates, AppleAPIResource::AppIDs, AppleAPIResource::AppGroups })
+        {
+            api->setCacheLifetime(resource, std::chrono::seconds(configuration.cacheLifetime));
+        }
+    }
+
+    std::shared_ptr<Account> account;
+    std::shared_ptr<AppleAPISession> session;
+    std::shared_ptr<Certificate> certificate;
+
+    double signInTime = 0;
+    double certificateTime = 0;
+
+    try
+    {
+        signInTime = bench::time([&]() {
+            auto result = api->Authenticate(configuration.appleID, configuration.password, MakeAnisetteData(), std::nullopt).get();
+            account = result.first;
+            session = result.second;
+        });
+
+        // Once per run, as AltServer keeps its certificate between installs.
+        certificateTime = bench::time([&]() {
+            auto team = api->FetchTeams(account, session).get().at(0);
+            certificate = api->AddCertificate("AltStore", team, session).get();
+        });
+    }
+    catch (std::exception& exception)
+    {
+        std::cerr << "Failed to set up: " << exception.what() << std::endl;
+        return 1;
+    }
+
+    Steps steps;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int first = 0; first < configuration.installs; first += configuration.concurrency)
+    {
+        std::vector<pplx::task<void>> tasks;
+        for (int index = first; index < std::min(configuration.installs, first + configuration.concurrency); index++)
+        {
+            tasks.push_back(RunInstall(index, configuration, account, session, certificate, steps));
+        }
+
+        pplx::when_all(tasks.begin(), tasks.end()).wait();
+    }
+
+    auto duration = MillisecondsSince(start);
+
+    auto schedulerStatistics = api->scheduler().statistics();
+    auto coalescerStatistics = api->coalescerStatistics();
+
+    bench::JSONObject config;
+    config.set("installs", (uint64_t)configuration.installs)
+        .set("concurrency", (uint64_t)configuration.concurrency)
+        .set("devices", (uint64_t)configuration.devices)
+        .set("apps", (uint64_t)configuration.apps)
+        .set("cache_ttl", configuration.cacheLifetime >= 0 ? std::to_string(configuration.cacheLifetime) : std::string("default"));
+
+    bench::JSONObject setup;
+    setup.set("sign_in_ms", signInTime)
+        .set("add_certificate_ms", certificateTime);
+
+    bench::JSONObject stepsResult;
+    stepsResult.set("team", steps.team)
+        .set("device", steps.device)
+        .set("certificate", steps.certificate)
+        .set("app_id", steps.appID)
+        .set("features", steps.features)
+        .set("app_groups", steps.appGroups)
+        .set("profile", steps.profile);
+
+    bench::JSONObject errors;
+    for (auto& pair : steps.errors)
+    {
+        errors.set(pair.first, pair.second);
+    }
+
+    bench::JSONObject schedulerResult;
+    schedulerResult.set("sent", schedulerStatistics.sentRequests)
+        .set("retried", schedulerStatistics.retriedRequests)
+        .set("throttled", schedulerStatistics.throttledResponses)
+        .set("max_queue_depth", (uint64_t)schedulerStatistics.maximumQueueDepth)
+        .set("average_wait_ms", (double)schedulerStatistics.averageWaitTime().count())
+        .set("max_wait_ms", (double)schedulerStatistics.maximumWaitTime.count());
+
+    bench::JSONObject coalescerResult;
+    coalescerResult.set("calls", coalescerStatistics.calls)
+        .set("coalesced", coalescerStatistics.coalescedCalls)
+        .set("serialized", coalescerStatistics.serializedCalls);
+
+    bench::JSONObject cacheResult;
+    cacheResult.set("teams", CacheStatistics(AppleAPIResource::Teams))
+        .set("devices", CacheStatistics(AppleAPIResource::Devices))
+        .set("certificates", CacheStatistics(AppleAPIResource::Certificates))
+        .set("app_ids", CacheStatistics(AppleAPIResource::AppIDs))
+        .set("app_groups", CacheStatistics(AppleAPIResource::AppGroups));
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("api"))
+        .set("config", config)
+        .set("setup", setup)
+        .set("total_ms", duration)
+        .set("succeeded", steps.succeeded)
+        .set("failed", steps.failed)
+        .set("errors", errors)
+        .set("install", steps.install)
+        .set("steps", stepsResult)
+        .set("scheduler", schedulerResult)
+        .set("coalescer", coalescerResult)
+        .set("cache", cacheResult);
+
+    std::cout << result.str() << std::endl;
+
+    return steps.failed == 0 ? 0 : 1;
+}
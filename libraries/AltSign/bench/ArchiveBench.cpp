@@ -0,0 +1,260 @@
+//
+//  ArchiveBench.cpp
+//  AltSign
+//
+//  Offline archive benchmark. For each compression backend compiled into
+//  minizip, packs a synthetic IPA, then times UnzipAppBundle and the
+//  ZipAppBundle re-pack at each requested thread count. Results are printed
+//  as a single JSON object.
+//
+
+#include "BenchSupport.hpp"
+
+#include "Archiver.hpp"
+#include "Logger.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <getopt.h>
+
+extern "C" {
+#include "zip.h"
+#include "backend.h"
+}
+
+namespace fs = std::filesystem;
+
+struct Configuration
+{
+    int entries = 20000;
+    int megabytes = 1024;
+    int directories = 64;
+    int mediaPercent = 50;
+    std::vector<int> threads;
+    int iterations = 3;
+    std::string workingDirectory = fs::temp_directory_path().append("AltSignArchiveBench").string();
+};
+
+// Writes an IPA straight from memory. mediaPercent of the entries are random bytes standing in for
+// already-compressed media, alternately named .png and .dat (so only content reveals them); the rest
+// are repetitive text.
+static uint64_t MakeIPA(const fs::path& ipaPath, const Configuration& configuration)
+{
+    size_t fileSize = std::max<size_t>(1, ((size_t)configuration.megabytes << 20) / configuration.entries);
+    uint64_t totalBytes = 0;
+
+    std::mt19937 random(1);
+    std::string text;
+    while (text.size() < fileSize)
+    {
+        text += "<key>CFBundleIdentifier</key><string>com.altsign.bench</string>\n";
+    }
+    text.resize(fileSize);
+
+    zipFile zipFile = zipOpen(ipaPath.string().c_str(), APPEND_STATUS_CREATE);
+
+    auto add = [&](const std::string& filename, const std::string& data, uLong mode) {
+        zip_fileinfo fileInfo = {};
+        fileInfo.external_fa = mode << 16;
+
+        zipOpenNewFileInZip(zipFile, filename.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, data.empty() ? 0 : Z_DEFLATED, Z_DEFAULT_COMPRESSION);
+        zipWriteInFileInZip(zipFile, data.data(), (unsigned int)data.size());
+        zipCloseFileInZip(zipFile);
+    };
+
+    add("Payload/", "", 040755);
+    add("Payload/Bench.app/", "", 040755);
+
+    // Entries are separate deflate streams, so reusing one random block costs nothing in realism
+    // and keeps data generation out of the timing.
+    std::string data(fileSize, '\0');
+    for (size_t j = 0; j + 4 <= fileSize; j += 4)
+    {
+        uint32_t value = random();
+        memcpy(&data[j], &value, sizeof(value));
+    }
+
+    for (int i = 0; i < configuration.entries; i++)
+    {
+        bool isMedia = (i % 100) < configuration.mediaPercent;
+        std::string extension = isMedia ? (i % 2 == 0 ? ".png" : ".dat") : ".strings";
+
+        auto filename = "Payload/Bench.app/Assets/" + std::to_string(i % configuration.directories) + "/file" + std::to_string(i) + extension;
+        add(filename, isMedia ? data : text, 0100644);
+
+        totalBytes += fileSize;
+    }
+
+    zipClose(zipFile, NULL);
+
+    return totalBytes;
+}
+
+static std::vector<int> ParseList(const char* value)
+{
+    std::vector<int> values;
+
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        values.push_back(std::max(1, atoi(item.c_str())));
+    }
+
+    return values;
+}
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--entries N] [--mb N] [--dirs N] [--media-percent N] [--threads 1,4,...] [--iterations N] [--workdir PATH]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"entries",     required_argument, 0, 'n'},
+        {"mb",          required_argument, 0, 'm'},
+        {"dirs",        required_argument, 0, 'd'},
+        {"media-percent", required_argument, 0, 'p'},
+        {"threads",     required_argument, 0, 't'},
+        {"iterations",  required_argument, 0, 'i'},
+        {"workdir",     required_argument, 0, 'w'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'n': configuration.entries = std::max(1, atoi(optarg)); break;
+        case 'm': configuration.megabytes = std::max(1, atoi(optarg)); break;
+        case 'd': configuration.directories = std::max(1, atoi(optarg)); break;
+        case 'p': configuration.mediaPercent = std::min(100, std::max(0, atoi(optarg))); break;
+        case 't': configuration.threads = ParseList(optarg); break;
+        case 'i': configuration.iterations = std::max(1, atoi(optarg)); break;
+        case 'w': configuration.workingDirectory = optarg; break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (configuration.threads.empty())
+    {
+        configuration.threads = { 1, std::max(1, (int)std::thread::hardware_concurrency()) };
+    }
+
+    // Keep the JSON on stdout clean of AltSign's progress logging.
+    Logger::instance()->setLevel(LogLevel::Off);
+
+    fs::path workingDirectory(configuration.workingDirectory);
+    fs::remove_all(workingDirectory);
+    fs::create_directories(workingDirectory);
+
+    auto ipaPath = fs::path(workingDirectory).append("Bench.ipa");
+    uint64_t bundleBytes = 0;
+    uint64_t ipaBytes = 0;
+
+    auto megabytesPerSecond = [&](const bench::Samples& samples) {
+        return (double)bundleBytes / (1 << 20) / (samples.min() / 1000);
+    };
+
+    bench::JSONObject backends;
+    for (int backend : { Z_BACKEND_ZLIB, Z_BACKEND_LIBDEFLATE })
+    {
+        if (!zbackendSet(backend))
+        {
+            continue;
+        }
+
+        bench::Samples pack;
+        for (int i = 0; i < configuration.iterations; i++)
+        {
+            pack.add(bench::time([&]() {
+                bundleBytes = MakeIPA(ipaPath, configuration);
+            }));
+        }
+
+        ipaBytes = fs::file_size(ipaPath);
+
+        auto outputDirectory = fs::path(workingDirectory).append("Unzip");
+        std::string appPath;
+
+        bench::JSONObject unzip;
+        for (int threadCount : configuration.threads)
+        {
+            bench::Samples samples;
+            for (int i = 0; i < configuration.iterations; i++)
+            {
+                fs::remove_all(outputDirectory);
+                fs::create_directories(outputDirectory);
+
+                samples.add(bench::time([&]() {
+                    appPath = UnzipAppBundle(ipaPath.string(), outputDirectory.string(), threadCount);
+                }));
+            }
+
+            bench::JSONObject entry;
+            entry.set("min_ms", samples.min())
+                .set("median_ms", samples.median())
+                .set("mb_per_s", megabytesPerSecond(samples));
+            unzip.set(std::to_string(threadCount), entry);
+        }
+
+        bench::JSONObject repack;
+        for (int threadCount : configuration.threads)
+        {
+            bench::Samples samples;
+            std::string repackedPath;
+            for (int i = 0; i < configuration.iterations; i++)
+            {
+                samples.add(bench::time([&]() {
+                    repackedPath = ZipAppBundle(appPath, threadCount);
+                }));
+            }
+
+            bench::JSONObject entry;
+            entry.set("min_ms", samples.min())
+                .set("median_ms", samples.median())
+                .set("mb_per_s", megabytesPerSecond(samples))
+                .set("ipa_bytes", (uint64_t)fs::file_size(repackedPath));
+            repack.set(std::to_string(threadCount), entry);
+        }
+
+        bench::JSONObject deflate;
+        deflate.set("min_ms", pack.min())
+            .set("median_ms", pack.median())
+            .set("mb_per_s", megabytesPerSecond(pack));
+
+        bench::JSONObject result;
+        result.set("ipa_bytes", ipaBytes).set("pack", deflate).set("unzip_by_threads", unzip).set("repack_by_threads", repack);
+        backends.set(zbackendName(backend), result);
+    }
+
+    fs::remove_all(workingDirectory);
+
+    bench::JSONObject config;
+    config.set("entries", (uint64_t)configuration.entries)
+        .set("mb", (uint64_t)configuration.megabytes)
+        .set("dirs", (uint64_t)configuration.directories)
+        .set("media_percent", (uint64_t)configuration.mediaPercent)
+        .set("iterations", (uint64_t)configuration.iterations)
+        .set("hardware_threads", (uint64_t)std::thread::hardware_concurrency());
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("archive"))
+        .set("config", config)
+        .set("bundle_bytes", bundleBytes)
+        .set("backends", backends);
+
+    std::cout << result.str() << std::endl;
+
+    return 0;
+}
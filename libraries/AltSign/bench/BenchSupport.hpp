@@ -0,0 +1,376 @@
+//
+//  BenchSupport.hpp
+//  AltSign
+//
+//  Shared helpers for the offline AltSign benchmarks: timing, synthetic
+//  Mach-O images and provisioning profiles, and a throwaway self-signed
+//  signing identity.
+//
+
+#ifndef BenchSupport_hpp
+#define BenchSupport_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <openssl/cms.h>
+#include <openssl/evp.h>
+#include <openssl/pkcs12.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <plist/plist.h>
+
+// Provided by HostGlue.cpp, as AltServer provides them to AltSign.
+std::string make_uuid();
+std::vector<unsigned char> readFile(const char* filename);
+
+namespace bench
+{
+
+class Samples
+{
+public:
+    void add(double milliseconds)
+    {
+        _values.push_back(milliseconds);
+    }
+
+    double min() const
+    {
+        return _values.empty() ? 0 : *std::min_element(_values.begin(), _values.end());
+    }
+
+    double median() const
+    {
+        if (_values.empty())
+        {
+            return 0;
+        }
+
+        auto values = _values;
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+private:
+    std::vector<double> _values;
+};
+
+template <typename Function>
+double time(Function&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Minimal JSON object writer; keys are emitted in insertion order.
+class JSONObject
+{
+public:
+    JSONObject& set(const std::string& key, const std::string& value)
+    {
+        return raw(key, "\"" + value + "\"");
+    }
+
+    JSONObject& set(const std::string& key, double value)
+    {
+        std::ostringstream ss;
+        ss.precision(3);
+        ss << std::fixed << value;
+        return raw(key, ss.str());
+    }
+
+    JSONObject& set(const std::string& key, uint64_t value)
+    {
+        return raw(key, std::to_string(value));
+    }
+
+    JSONObject& set(const std::string& key, const JSONObject& value)
+    {
+        return raw(key, value.str());
+    }
+
+    JSONObject& set(const std::string& key, const Samples& samples)
+    {
+        JSONObject object;
+        object.set("min_ms", samples.min());
+        object.set("median_ms", samples.median());
+        return set(key, object);
+    }
+
+    std::string str() const
+    {
+        return "{" + _body + "}";
+    }
+
+private:
+    std::string _body;
+
+    JSONObject& raw(const std::string& key, const std::string& value)
+    {
+        if (!_body.empty())
+        {
+            _body += ", ";
+        }
+
+        _body += "\"" + key + "\": " + value;
+        return *this;
+    }
+};
+
+enum class MachOType : uint32_t
+{
+    Execute = 0x2,
+    Dylib = 0x6,
+};
+
+struct Architecture
+{
+    uint32_t cpuType;
+    uint32_t cpuSubtype;
+};
+
+static const Architecture ARM64 = { 0x0100000c, 0x0 };
+static const Architecture ARM64e = { 0x0100000c, 0x2 };
+static const Architecture ARMv7 = { 0x0000000c, 0x9 };
+
+// Thin 64-bit image: header, __TEXT, __LINKEDIT and an LC_SYMTAB whose string table ends at EOF,
+// which is the minimum ldid needs to lay out and sign a slice.
+inline std::string MakeMachO(size_t size, MachOType type, Architecture architecture, uint32_t seed)
+{
+    size = std::max<size_t>(size, 0x8000);
+    std::string data(size, '\0');
+
+    std::mt19937 random(seed);
+    for (size_t i = 0x4000; i + 4 <= size; i += 4)
+    {
+        uint32_t value = random();
+        memcpy(&data[i], &value, sizeof(value));
+    }
+
+    struct
+    {
+        uint32_t magic, cputype, cpusubtype, filetype, ncmds, sizeofcmds, flags, reserved;
+    } header = { 0xfeedfacf, architecture.cpuType, architecture.cpuSubtype, (uint32_t)type, 3, 72 * 2 + 24, 0, 0 };
+
+    struct Segment
+    {
+        uint32_t cmd, cmdsize;
+        char segname[16];
+        uint64_t vmaddr, vmsize, fileoff, filesize;
+        uint32_t maxprot, initprot, nsects, flags;
+    };
+
+    Segment text = {};
+    text.cmd = 0x19;
+    text.cmdsize = sizeof(Segment);
+    strcpy(text.segname, "__TEXT");
+    text.vmsize = 0x4000;
+    text.filesize = 0x4000;
+
+    Segment linkedit = {};
+    linkedit.cmd = 0x19;
+    linkedit.cmdsize = sizeof(Segment);
+    strcpy(linkedit.segname, "__LINKEDIT");
+    linkedit.vmaddr = 0x4000;
+    linkedit.fileoff = 0x4000;
+    linkedit.filesize = size - 0x4000;
+    linkedit.vmsize = linkedit.filesize;
+
+    struct
+    {
+        uint32_t cmd, cmdsize, symoff, nsyms, stroff, strsize;
+    } symtab = { 0x2, 24, 0x4000, 0, 0x4000, (uint32_t)(size - 0x4000) };
+
+    size_t offset = 0;
+    memcpy(&data[offset], &header, sizeof(header));
+    offset += sizeof(header);
+    memcpy(&data[offset], &text, sizeof(text));
+    offset += sizeof(text);
+    memcpy(&data[offset], &linkedit, sizeof(linkedit));
+    offset += sizeof(linkedit);
+    memcpy(&data[offset], &symtab, sizeof(symtab));
+
+    return data;
+}
+
+// Universal image with one slice per architecture, each aligned to 16 KB.
+inline std::string MakeFatMachO(size_t sliceSize, MachOType type, const std::vector<Architecture>& architectures, uint32_t seed)
+{
+    if (architectures.size() == 1)
+    {
+        return MakeMachO(sliceSize, type, architectures[0], seed);
+    }
+
+    auto bigEndian = [](std::string& data, size_t offset, uint32_t value) {
+        value = __builtin_bswap32(value);
+        memcpy(&data[offset], &value, sizeof(value));
+    };
+
+    std::string data(0x4000, '\0');
+    bigEndian(data, 0, 0xcafebabe);
+    bigEndian(data, 4, (uint32_t)architectures.size());
+
+    for (size_t i = 0; i < architectures.size(); i++)
+    {
+        auto slice = MakeMachO(sliceSize, type, architectures[i], seed + (uint32_t)i);
+
+        size_t entry = 8 + i * 20;
+        bigEndian(data, entry + 0, architectures[i].cpuType);
+        bigEndian(data, entry + 4, architectures[i].cpuSubtype);
+        bigEndian(data, entry + 8, (uint32_t)data.size());
+        bigEndian(data, entry + 12, (uint32_t)slice.size());
+        bigEndian(data, entry + 16, 14);
+
+        data += slice;
+        data.resize((data.size() + 0x3fff) & ~size_t(0x3fff));
+    }
+
+    return data;
+}
+
+inline void WriteFile(const std::string& path, const std::string& data)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+}
+
+inline std::vector<unsigned char> ToBytes(BIO* bio)
+{
+    char* bytes = nullptr;
+    long size = BIO_get_mem_data(bio, &bytes);
+    return std::vector<unsigned char>(bytes, bytes + size);
+}
+
+// Self-signed RSA identity whose subject carries the team identifier as OU, like Apple's.
+class Identity
+{
+public:
+    Identity(const std::string& teamIdentifier) : _key(nullptr), _certificate(nullptr)
+    {
+        auto context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+        EVP_PKEY_keygen_init(context);
+        EVP_PKEY_CTX_set_rsa_keygen_bits(context, 2048);
+        EVP_PKEY_keygen(context, &_key);
+        EVP_PKEY_CTX_free(context);
+
+        _certificate = X509_new();
+        X509_set_version(_certificate, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(_certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(_certificate), 0);
+        X509_gmtime_adj(X509_getm_notAfter(_certificate), 60 * 60 * 24);
+        X509_set_pubkey(_certificate, _key);
+
+        auto name = X509_get_subject_name(_certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"AltSign Benchmark", -1, -1, 0);
+        X509_NAME_add_entry_by_txt(name, "OU", MBSTRING_ASC, (const unsigned char*)teamIdentifier.c_str(), -1, -1, 0);
+        X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char*)"AltSign", -1, -1, 0);
+        X509_set_issuer_name(_certificate, name);
+        X509_sign(_certificate, _key, EVP_sha256());
+    }
+
+    ~Identity()
+    {
+        X509_free(_certificate);
+        EVP_PKEY_free(_key);
+    }
+
+    EVP_PKEY* key() const
+    {
+        return _key;
+    }
+
+    X509* certificate() const
+    {
+        return _certificate;
+    }
+
+    // Unencrypted .p12 in the form ldid::Sign expects for its key argument.
+    std::vector<unsigned char> p12Data() const
+    {
+        char password[] = "";
+        auto p12 = PKCS12_create(password, password, _key, _certificate, NULL, 0, 0, 0, 0, 0);
+
+        BIO* buffer = BIO_new(BIO_s_mem());
+        i2d_PKCS12_bio(buffer, p12);
+        auto data = ToBytes(buffer);
+
+        BIO_free(buffer);
+        PKCS12_free(p12);
+
+        return data;
+    }
+
+private:
+    EVP_PKEY* _key;
+    X509* _certificate;
+};
+
+// A .mobileprovision for bundleIdentifier: the profile plist in a CMS envelope signed by identity.
+// extraEntitlements adds that many keychain groups, to make profiles the size of ones with many capabilities.
+inline std::vector<unsigned char> MakeProfileData(const Identity& identity, const std::string& teamIdentifier, const std::string& bundleIdentifier,
+    const std::string& uuid, int extraEntitlements = 0)
+{
+    // Apple's reference date is 2001-01-01.
+    int32_t now = (int32_t)(::time(NULL) - 978307200);
+
+    plist_t entitlements = plist_new_dict();
+    plist_dict_set_item(entitlements, "application-identifier", plist_new_string((teamIdentifier + "." + bundleIdentifier).c_str()));
+    plist_dict_set_item(entitlements, "com.apple.developer.team-identifier", plist_new_string(teamIdentifier.c_str()));
+    plist_dict_set_item(entitlements, "get-task-allow", plist_new_bool(1));
+
+    plist_t keychainGroups = plist_new_array();
+    plist_array_append_item(keychainGroups, plist_new_string((teamIdentifier + ".*").c_str()));
+    for (int i = 0; i < extraEntitlements; i++)
+    {
+        plist_array_append_item(keychainGroups, plist_new_string((teamIdentifier + "." + bundleIdentifier + ".group" + std::to_string(i)).c_str()));
+    }
+    plist_dict_set_item(entitlements, "keychain-access-groups", keychainGroups);
+
+    plist_t teamIdentifiers = plist_new_array();
+    plist_array_append_item(teamIdentifiers, plist_new_string(teamIdentifier.c_str()));
+
+    plist_t plist = plist_new_dict();
+    plist_dict_set_item(plist, "Name", plist_new_string(("Bench " + bundleIdentifier).c_str()));
+    plist_dict_set_item(plist, "UUID", plist_new_string(uuid.c_str()));
+    plist_dict_set_item(plist, "TeamIdentifier", teamIdentifiers);
+    plist_dict_set_item(plist, "CreationDate", plist_new_date(now, 0));
+    plist_dict_set_item(plist, "ExpirationDate", plist_new_date(now + 7 * 24 * 60 * 60, 0));
+    plist_dict_set_item(plist, "Entitlements", entitlements);
+
+    char* xml = nullptr;
+    uint32_t length = 0;
+    plist_to_xml(plist, &xml, &length);
+
+    // Embed the plist in a CMS envelope like a real .mobileprovision.
+    BIO* content = BIO_new_mem_buf(xml, (int)length);
+    CMS_ContentInfo* cms = CMS_sign(identity.certificate(), identity.key(), NULL, content, CMS_BINARY | CMS_NOSMIMECAP);
+
+    BIO* output = BIO_new(BIO_s_mem());
+    i2d_CMS_bio(output, cms);
+    auto data = ToBytes(output);
+
+    BIO_free(output);
+    CMS_ContentInfo_free(cms);
+    BIO_free(content);
+    free(xml);
+    plist_free(plist);
+
+    return data;
+}
+
+}
+
+#endif /* BenchSupport_hpp */
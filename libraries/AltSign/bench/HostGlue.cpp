@@ -0,0 +1,40 @@
+//
+//  HostGlue.cpp
+//  AltSign
+//
+//  Functions AltSign declares extern and AltServer normally provides, linked
+//  into every benchmark in their place.
+//
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <uuid/uuid.h>
+
+std::string make_uuid()
+{
+    uuid_t b;
+    char out[UUID_STR_LEN] = { 0 };
+    uuid_generate(b);
+    uuid_unparse_lower(b, out);
+    return out;
+}
+
+std::vector<unsigned char> readFile(const char* filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+std::string replace_all(const std::string& str, const std::string& find, const std::string& replace)
+{
+    std::string result = str;
+    for (size_t position = result.find(find); position != std::string::npos; position = result.find(find, position + replace.size()))
+    {
+        result.replace(position, find.size(), replace);
+    }
+
+    return result;
+}
@@ -0,0 +1,279 @@
+//
+//  LogBench.cpp
+//  AltSign
+//
+//  Times the offline part of an install with per-file logging off, through
+//  the asynchronous logger, and written synchronously line by line (as
+//  odslog did before it was buffered). Each run receives a synthetic .ipa in
+//  4 KB chunks, unzips it, signs it and copies every file to a stand-in
+//  device directory, logging at trace level wherever AltServer does.
+//  Results are printed as a single JSON object.
+//
+
+#include "BenchSupport.hpp"
+
+#include "Archiver.hpp"
+#include "Certificate.hpp"
+#include "Logger.hpp"
+#include "ProvisioningProfile.hpp"
+#include "Signer.hpp"
+#include "Team.hpp"
+
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <getopt.h>
+
+#include <plist/plist.h>
+
+namespace fs = std::filesystem;
+
+struct Configuration
+{
+    int files = 2000;
+    int fileKB = 16;
+    int machOMB = 4;
+    int iterations = 3;
+    std::string logPath = "/dev/null";
+    std::string workingDirectory = fs::temp_directory_path().append("AltSignLogBench").string();
+};
+
+struct Mode
+{
+    const char* name;
+    LogLevel level;
+    bool isAsynchronous;
+};
+
+static const char* TeamIdentifier = "BENCHTEAM1";
+static const char* BundleIdentifier = "com.altsign.bench";
+
+// Same chunk size as WirelessConnection::ReceiveData.
+#define RECEIVE_CHUNK_SIZE 4096
+
+static std::string InfoPlist()
+{
+    plist_t plist = plist_new_dict();
+    plist_dict_set_item(plist, "CFBundleExecutable", plist_new_string("Bench"));
+    plist_dict_set_item(plist, "CFBundleIdentifier", plist_new_string(BundleIdentifier));
+    plist_dict_set_item(plist, "CFBundleName", plist_new_string("Bench"));
+    plist_dict_set_item(plist, "CFBundleShortVersionString", plist_new_string("1.0"));
+
+    char* xml = nullptr;
+    uint32_t length = 0;
+    plist_to_xml(plist, &xml, &length);
+
+    std::string data(xml, length);
+    free(xml);
+    plist_free(plist);
+
+    return data;
+}
+
+static void MakeBundle(const fs::path& appPath, const Configuration& configuration)
+{
+    fs::create_directories(appPath);
+
+    bench::WriteFile(fs::path(appPath).append("Info.plist").string(), InfoPlist());
+    bench::WriteFile(fs::path(appPath).append("Bench").string(), bench::MakeMachO((size_t)configuration.machOMB << 20, bench::MachOType::Execute, bench::ARM64, 1));
+
+    std::mt19937 random(3);
+    std::string asset((size_t)configuration.fileKB << 10, '\0');
+
+    for (int i = 0; i < configuration.files; i++)
+    {
+        std::string directory = "Assets/" + std::to_string(i % 32);
+        fs::create_directories(fs::path(appPath).append(directory));
+
+        for (auto& byte : asset)
+        {
+            byte = (char)random();
+        }
+
+        bench::WriteFile(fs::path(appPath).append(directory).append("asset" + std::to_string(i) + ".bin").string(), asset);
+    }
+}
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--files N] [--file-kb N] [--macho-mb N] [--iterations N] [--log-file PATH] [--workdir PATH]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"files",       required_argument, 0, 'f'},
+        {"file-kb",     required_argument, 0, 'k'},
+        {"macho-mb",    required_argument, 0, 'm'},
+        {"iterations",  required_argument, 0, 'i'},
+        {"log-file",    required_argument, 0, 'l'},
+        {"workdir",     required_argument, 0, 'w'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'f': configuration.files = std::max(0, atoi(optarg)); break;
+        case 'k': configuration.fileKB = std::max(1, atoi(optarg)); break;
+        case 'm': configuration.machOMB = std::max(1, atoi(optarg)); break;
+        case 'i': configuration.iterations = std::max(1, atoi(optarg)); break;
+        case 'l': configuration.logPath = optarg; break;
+        case 'w': configuration.workingDirectory = optarg; break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The JSON goes to stdout, so the log needs a destination of its own.
+    int logFileDescriptor = open(configuration.logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (logFileDescriptor < 0)
+    {
+        std::cerr << "Failed to open " << configuration.logPath << std::endl;
+        return 1;
+    }
+
+    auto logger = Logger::instance();
+    logger->setLevel(LogLevel::Off);
+    logger->setFileDescriptor(logFileDescriptor);
+
+    fs::path workingDirectory(configuration.workingDirectory);
+    fs::remove_all(workingDirectory);
+    fs::create_directories(workingDirectory);
+
+    bench::Identity identity(TeamIdentifier);
+    auto p12Data = identity.p12Data();
+    auto certificate = std::make_shared<Certificate>(p12Data, "");
+    auto team = std::make_shared<Team>();
+
+    auto profileData = bench::MakeProfileData(identity, TeamIdentifier, BundleIdentifier, make_uuid());
+    std::vector<std::shared_ptr<ProvisioningProfile>> profiles = { std::make_shared<ProvisioningProfile>(profileData) };
+
+    auto templatePath = fs::path(workingDirectory).append("Template").append("Bench.app");
+    MakeBundle(templatePath, configuration);
+
+    // Written next to the template, so it goes with the working directory.
+    auto ipaPath = ZipAppBundle(templatePath.string());
+    auto ipaData = readFile(ipaPath.c_str());
+
+    std::vector<Mode> modes = {
+        { "off", LogLevel::Info, true },
+        { "trace_async", LogLevel::Trace, true },
+        { "trace_sync", LogLevel::Trace, false },
+    };
+
+    bench::JSONObject results;
+
+    for (auto& mode : modes)
+    {
+        bench::Samples receive, unzip, sign, write, total;
+
+        logger->setLevel(mode.level);
+        logger->setAsynchronous(mode.isAsynchronous);
+
+        auto initialStatistics = logger->statistics();
+
+        for (int iteration = 0; iteration < configuration.iterations; iteration++)
+        {
+            auto installPath = fs::path(workingDirectory).append(std::string(mode.name) + "-" + std::to_string(iteration));
+            auto devicePath = fs::path(installPath).append("Device");
+            fs::create_directories(devicePath);
+
+            std::string appPath;
+
+            total.add(bench::time([&] {
+                receive.add(bench::time([&] {
+                    std::vector<unsigned char> data;
+                    data.reserve(ipaData.size());
+
+                    for (size_t offset = 0; offset < ipaData.size(); offset += RECEIVE_CHUNK_SIZE)
+                    {
+                        auto end = std::min(offset + RECEIVE_CHUNK_SIZE, ipaData.size());
+                        data.insert(data.end(), ipaData.begin() + offset, ipaData.begin() + end);
+
+                        odstrace("Received bytes: " << data.size() << "(of " << ipaData.size() << ")");
+                    }
+
+                    bench::WriteFile(fs::path(installPath).append("App.ipa").string(), std::string(data.begin(), data.end()));
+                }));
+
+                unzip.add(bench::time([&] {
+                    appPath = UnzipAppBundle(fs::path(installPath).append("App.ipa").string(), installPath.string());
+                }));
+
+                sign.add(bench::time([&] {
+                    Signer signer(team, certificate);
+                    signer.SignApp(appPath, profiles);
+                }));
+
+                write.add(bench::time([&] {
+                    for (auto& entry : fs::recursive_directory_iterator(appPath))
+                    {
+                        auto destinationPath = fs::path(devicePath).append(fs::relative(entry.path(), appPath).string());
+
+                        if (entry.is_directory())
+                        {
+                            fs::create_directories(destinationPath);
+                            continue;
+                        }
+
+                        odstrace("Writing File: " << entry.path().c_str() << " to: " << destinationPath.c_str());
+                        fs::copy_file(entry.path(), destinationPath, fs::copy_options::overwrite_existing);
+                    }
+                }));
+
+                // Count writing whatever is still buffered against this run.
+                logger->Flush();
+            }));
+
+            fs::remove_all(installPath);
+        }
+
+        auto statistics = logger->statistics();
+
+        bench::JSONObject phases;
+        phases.set("receive", receive)
+            .set("unzip", unzip)
+            .set("sign", sign)
+            .set("write", write)
+            .set("install", total);
+
+        bench::JSONObject log;
+        log.set("records", (statistics.records - initialStatistics.records) / configuration.iterations)
+            .set("writes", (statistics.writes - initialStatistics.writes) / configuration.iterations)
+            .set("dropped", (statistics.droppedRecords - initialStatistics.droppedRecords) / configuration.iterations);
+
+        bench::JSONObject result;
+        result.set("phases", phases).set("log_per_install", log);
+        results.set(mode.name, result);
+    }
+
+    logger->setLevel(LogLevel::Off);
+
+    fs::remove_all(workingDirectory);
+
+    bench::JSONObject config;
+    config.set("files", (uint64_t)configuration.files)
+        .set("file_kb", (uint64_t)configuration.fileKB)
+        .set("macho_mb", (uint64_t)configuration.machOMB)
+        .set("iterations", (uint64_t)configuration.iterations)
+        .set("log_file", configuration.logPath);
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("log"))
+        .set("config", config)
+        .set("ipa_bytes", (uint64_t)ipaData.size())
+        .set("modes", results);
+
+    std::cout << result.str() << std::endl;
+
+    return 0;
+}
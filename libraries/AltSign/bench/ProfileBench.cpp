@@ -0,0 +1,148 @@
+//
+//  ProfileBench.cpp
+//  AltSign
+//
+//  Parses a batch of synthetic provisioning profiles, the way DeviceManager
+//  reads every profile on a device during an install. Each iteration parses
+//  fresh profiles (cache misses), then parses the most recent ones again
+//  (cache hits), and serializes every profile's entitlements twice. Results
+//  are printed as a single JSON object.
+//
+
+#include "BenchSupport.hpp"
+
+#include "ProvisioningProfile.hpp"
+
+#include <iostream>
+#include <getopt.h>
+
+struct Configuration
+{
+    int profiles = 500;
+    int reparsedProfiles = 100;
+    int extraEntitlements = 16;
+    int iterations = 3;
+};
+
+static const char* TeamIdentifier = "BENCHTEAM1";
+
+void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--profiles N] [--reparse N] [--entitlements N] [--iterations N]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"profiles",     required_argument, 0, 'p'},
+        {"reparse",      required_argument, 0, 'r'},
+        {"entitlements", required_argument, 0, 'e'},
+        {"iterations",   required_argument, 0, 'i'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'p': configuration.profiles = std::max(1, atoi(optarg)); break;
+        case 'r': configuration.reparsedProfiles = std::max(0, atoi(optarg)); break;
+        case 'e': configuration.extraEntitlements = std::max(0, atoi(optarg)); break;
+        case 'i': configuration.iterations = std::max(1, atoi(optarg)); break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Only the most recently parsed profiles are guaranteed to still be cached.
+    configuration.reparsedProfiles = std::min(configuration.reparsedProfiles, configuration.profiles);
+
+    bench::Identity identity(TeamIdentifier);
+
+    bench::Samples parse, cachedParse, firstEntitlementsXML, cachedEntitlementsXML;
+    uint64_t profileBytes = 0;
+
+    auto initialStatistics = ProvisioningProfile::cacheStatistics();
+
+    for (int iteration = 0; iteration < configuration.iterations; iteration++)
+    {
+        // Fresh UUIDs every iteration, so the first pass never hits the cache.
+        std::vector<std::vector<unsigned char>> profilesData;
+        for (int i = 0; i < configuration.profiles; i++)
+        {
+            auto bundleIdentifier = "com.altsign.bench.app" + std::to_string(i);
+            profilesData.push_back(bench::MakeProfileData(identity, TeamIdentifier, bundleIdentifier, make_uuid(), configuration.extraEntitlements));
+            profileBytes += profilesData.back().size();
+        }
+
+        std::vector<std::shared_ptr<ProvisioningProfile>> profiles;
+        profiles.reserve(profilesData.size());
+
+        parse.add(bench::time([&] {
+            for (auto& data : profilesData)
+            {
+                profiles.push_back(std::make_shared<ProvisioningProfile>(data));
+            }
+        }));
+
+        cachedParse.add(bench::time([&] {
+            for (size_t i = profilesData.size() - configuration.reparsedProfiles; i < profilesData.size(); i++)
+            {
+                ProvisioningProfile profile(profilesData[i]);
+            }
+        }));
+
+        size_t length = 0;
+
+        firstEntitlementsXML.add(bench::time([&] {
+            for (auto& profile : profiles)
+            {
+                length += profile->entitlementsXML().size();
+            }
+        }));
+
+        cachedEntitlementsXML.add(bench::time([&] {
+            for (auto& profile : profiles)
+            {
+                length += profile->entitlementsXML().size();
+            }
+        }));
+    }
+
+    auto statistics = ProvisioningProfile::cacheStatistics();
+
+    bench::JSONObject config;
+    config.set("profiles", (uint64_t)configuration.profiles)
+        .set("reparse", (uint64_t)configuration.reparsedProfiles)
+        .set("entitlements", (uint64_t)configuration.extraEntitlements)
+        .set("iterations", (uint64_t)configuration.iterations);
+
+    bench::JSONObject phases;
+    phases.set("parse", parse)
+        .set("cached_parse", cachedParse)
+        .set("entitlements_xml", firstEntitlementsXML)
+        .set("cached_entitlements_xml", cachedEntitlementsXML);
+
+    bench::JSONObject cache;
+    cache.set("hits", statistics.hits - initialStatistics.hits)
+        .set("misses", statistics.misses - initialStatistics.misses)
+        .set("entries", (uint64_t)statistics.entries);
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("profile"))
+        .set("config", config)
+        .set("average_profile_bytes", (uint64_t)(profileBytes / ((uint64_t)configuration.profiles * configuration.iterations)))
+        .set("phases", phases)
+        .set("cache", cache);
+
+    std::cout << result.str() << std::endl;
+
+    return 0;
+}
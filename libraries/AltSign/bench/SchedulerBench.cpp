@@ -0,0 +1,286 @@
+//
+//  SchedulerBench.cpp
+//  AltSign
+//
+//  Drives AppleAPIScheduler against a local mock server that throttles like
+//  Apple: it answers 429 once its own request rate is exceeded, 503 for a
+//  share of requests, and delays every response. Bursts from several accounts
+//  (some of them background) are scheduled at once; the result, including the
+//  scheduler's queue and wait metrics, is printed as a single JSON object.
+//
+
+#include "BenchSupport.hpp"
+
+#include "AppleAPIScheduler.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <getopt.h>
+
+#include <cpprest/http_listener.h>
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::client;
+using namespace web::http::experimental::listener;
+
+struct Configuration
+{
+    int port = 6970;
+    int requests = 200;
+    int accounts = 4;
+    int backgroundPercent = 25;
+
+    // Mock server behavior.
+    int serverRequestsPerSecond = 20;
+    int unavailablePercent = 5;
+    int latency = 50;
+
+    // Scheduler limits; 0 keeps the scheduler's defaults.
+    int concurrency = 0;
+    int requestsPerSecond = 0;
+};
+
+class MockServer
+{
+public:
+    MockServer(const Configuration& configuration) : _configuration(configuration), _random(1),
+        _listener("http://127.0.0.1:" + std::to_string(configuration.port)), _windowStart(std::chrono::steady_clock::now())
+    {
+        _listener.support(methods::POST, [this](http_request request) {
+            this->Handle(request);
+        });
+
+        _listener.open().wait();
+    }
+
+    ~MockServer()
+    {
+        _listener.close().wait();
+    }
+
+    uint64_t throttledResponses() const { return _throttledResponses; }
+    uint64_t unavailableResponses() const { return _unavailableResponses; }
+
+private:
+    Configuration _configuration;
+
+    std::mutex _mutex;
+    std::mt19937 _random;
+
+    http_listener _listener;
+
+    std::chrono::steady_clock::time_point _windowStart;
+    int _windowRequests = 0;
+
+    std::atomic<uint64_t> _throttledResponses{0};
+    std::atomic<uint64_t> _unavailableResponses{0};
+
+    void Handle(http_request request)
+    {
+        status_code statusCode = status_codes::OK;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            // Fixed one-second windows, like a simple server-side limiter.
+            auto now = std::chrono::steady_clock::now();
+            if (now - _windowStart >= std::chrono::seconds(1))
+            {
+                _windowStart = now;
+                _windowRequests = 0;
+            }
+
+            if (++_windowRequests > _configuration.serverRequestsPerSecond)
+            {
+                statusCode = 429;
+                _throttledResponses++;
+            }
+            else if ((int)(_random() % 100) < _configuration.unavailablePercent)
+            {
+                statusCode = status_codes::ServiceUnavailable;
+                _unavailableResponses++;
+            }
+        }
+
+        auto latency = _configuration.latency;
+        pplx::create_task([request, statusCode, latency]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+
+            http_response response(statusCode);
+            if (statusCode == 429)
+            {
+                response.headers().add(header_names::retry_after, "1");
+            }
+
+            return request.reply(response);
+        }).then([](pplx::task<void> task) {
+            try
+            {
+                task.get();
+            }
+            catch (std::exception& exception)
+            {
+                std::cerr << "Failed to reply: " << exception.what() << std::endl;
+            }
+        });
+    }
+};
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--port N] [--requests N] [--accounts N] [--background-percent N] [--server-rps N] [--unavailable-percent N] [--latency-ms N] [--concurrency N] [--rps N]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"port",                required_argument, 0, 'P'},
+        {"requests",            required_argument, 0, 'n'},
+        {"accounts",            required_argument, 0, 'a'},
+        {"background-percent",  required_argument, 0, 'b'},
+        {"server-rps",          required_argument, 0, 's'},
+        {"unavailable-percent", required_argument, 0, 'u'},
+        {"latency-ms",          required_argument, 0, 'l'},
+        {"concurrency",         required_argument, 0, 'c'},
+        {"rps",                 required_argument, 0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'P': configuration.port = atoi(optarg); break;
+        case 'n': configuration.requests = std::max(1, atoi(optarg)); break;
+        case 'a': configuration.accounts = std::max(1, atoi(optarg)); break;
+        case 'b': configuration.backgroundPercent = std::min(100, std::max(0, atoi(optarg))); break;
+        case 's': configuration.serverRequestsPerSecond = std::max(1, atoi(optarg)); break;
+        case 'u': configuration.unavailablePercent = std::min(100, std::max(0, atoi(optarg))); break;
+        case 'l': configuration.latency = std::max(0, atoi(optarg)); break;
+        case 'c': configuration.concurrency = std::max(0, atoi(optarg)); break;
+        case 'r': configuration.requestsPerSecond = std::max(0, atoi(optarg)); break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Keep the JSON on stdout clean of AltSign's retry logging.
+    Logger::instance()->setLevel(LogLevel::Off);
+
+    MockServer server(configuration);
+
+    AppleAPIScheduler scheduler;
+    if (configuration.concurrency > 0)
+    {
+        scheduler.setMaximumConcurrentRequests(configuration.concurrency);
+    }
+
+    if (configuration.requestsPerSecond > 0)
+    {
+        scheduler.setDefaultEndpointRateLimit({ (double)configuration.requestsPerSecond, (double)configuration.requestsPerSecond });
+    }
+
+    http_client client("http://127.0.0.1:" + std::to_string(configuration.port));
+
+    std::mutex resultsMutex;
+    bench::Samples interactiveLatencies;
+    bench::Samples backgroundLatencies;
+    uint64_t succeeded = 0;
+    uint64_t failed = 0;
+
+    std::vector<pplx::task<void>> tasks;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < configuration.requests; i++)
+    {
+        auto account = "account" + std::to_string(i % configuration.accounts);
+        // Background requests are spread through the burst, so they are often queued ahead of interactive ones.
+        auto priority = (i % 100) < configuration.backgroundPercent ? AppleAPIRequestPriority::Background : AppleAPIRequestPriority::Interactive;
+
+        auto requestStart = std::chrono::steady_clock::now();
+        auto task = scheduler.Schedule(client, account, priority, []() {
+            http_request request(methods::POST);
+            request.set_request_uri("/services/QH65B2/listDevices.action");
+            request.set_body(std::string("<plist/>"));
+            return request;
+        })
+        .then([&, priority, requestStart](pplx::task<http_response> task) {
+            auto latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requestStart).count();
+
+            std::lock_guard<std::mutex> lock(resultsMutex);
+
+            try
+            {
+                auto response = task.get();
+                if (response.status_code() == status_codes::OK)
+                {
+                    succeeded++;
+                }
+                else
+                {
+                    failed++;
+                }
+            }
+            catch (...)
+            {
+                failed++;
+            }
+
+            (priority == AppleAPIRequestPriority::Interactive ? interactiveLatencies : backgroundLatencies).add(latency);
+        });
+
+        tasks.push_back(task);
+    }
+
+    pplx::when_all(tasks.begin(), tasks.end()).wait();
+
+    auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    auto statistics = scheduler.statistics();
+
+    bench::JSONObject config;
+    config.set("requests", (uint64_t)configuration.requests)
+        .set("accounts", (uint64_t)configuration.accounts)
+        .set("background_percent", (uint64_t)configuration.backgroundPercent)
+        .set("server_rps", (uint64_t)configuration.serverRequestsPerSecond)
+        .set("unavailable_percent", (uint64_t)configuration.unavailablePercent)
+        .set("latency_ms", (uint64_t)configuration.latency)
+        .set("concurrency", (uint64_t)scheduler.maximumConcurrentRequests());
+
+    bench::JSONObject serverResult;
+    serverResult.set("throttled", server.throttledResponses())
+        .set("unavailable", server.unavailableResponses());
+
+    bench::JSONObject schedulerResult;
+    schedulerResult.set("sent", statistics.sentRequests)
+        .set("retried", statistics.retriedRequests)
+        .set("throttled", statistics.throttledResponses)
+        .set("max_queue_depth", (uint64_t)statistics.maximumQueueDepth)
+        .set("average_wait_ms", (double)statistics.averageWaitTime().count())
+        .set("max_wait_ms", (double)statistics.maximumWaitTime.count());
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("scheduler"))
+        .set("config", config)
+        .set("total_ms", duration)
+        .set("succeeded", succeeded)
+        .set("failed", failed)
+        .set("interactive_latency", interactiveLatencies)
+        .set("background_latency", backgroundLatencies)
+        .set("server", serverResult)
+        .set("scheduler", schedulerResult);
+
+    std::cout << result.str() << std::endl;
+
+    return 0;
+}
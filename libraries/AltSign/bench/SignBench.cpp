@@ -0,0 +1,390 @@
+//
+//  SignBench.cpp
+//  AltSign
+//
+//  Offline signing benchmark. Generates synthetic app bundles signed with a
+//  throwaway self-signed identity and times each phase of ldid::Sign and
+//  Signer::SignApp. Results are printed as a single JSON object. Exits with 1
+//  if signing the slices of the main executable concurrently gives different
+//  bytes than signing them one at a time.
+//
+
+#include "BenchSupport.hpp"
+
+#include "Application.hpp"
+#include "Certificate.hpp"
+#include "Logger.hpp"
+#include "ProvisioningProfile.hpp"
+#include "Signer.hpp"
+#include "Team.hpp"
+
+#include "ldid/ldid.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <getopt.h>
+
+#include <openssl/sha.h>
+
+#include <plist/plist.h>
+
+namespace fs = std::filesystem;
+
+struct Configuration
+{
+    int files = 200;
+    int assetKB = 64;
+    int frameworks = 2;
+    int appExtensions = 1;
+    int machOMB = 16;
+    int dylibKB = 1024;
+    int slices = 1;
+    int iterations = 3;
+    std::string workingDirectory = fs::temp_directory_path().append("AltSignBench").string();
+};
+
+static const char* TeamIdentifier = "BENCHTEAM1";
+static const char* BundleIdentifier = "com.altsign.bench";
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    std::streamsize xsputn(const char_type* data, std::streamsize size) override
+    {
+        return size;
+    }
+
+    int_type overflow(int_type next) override
+    {
+        return traits_type::not_eof(next);
+    }
+};
+
+std::string InfoPlist(const std::string& executable, const std::string& bundleIdentifier)
+{
+    plist_t plist = plist_new_dict();
+    plist_dict_set_item(plist, "CFBundleExecutable", plist_new_string(executable.c_str()));
+    plist_dict_set_item(plist, "CFBundleIdentifier", plist_new_string(bundleIdentifier.c_str()));
+    plist_dict_set_item(plist, "CFBundleName", plist_new_string(executable.c_str()));
+    plist_dict_set_item(plist, "CFBundleShortVersionString", plist_new_string("1.0"));
+
+    char* xml = nullptr;
+    uint32_t length = 0;
+    plist_to_xml(plist, &xml, &length);
+
+    std::string data(xml, length);
+    free(xml);
+    plist_free(plist);
+
+    return data;
+}
+
+std::shared_ptr<ProvisioningProfile> MakeProfile(const bench::Identity& identity, const std::string& bundleIdentifier)
+{
+    auto data = bench::MakeProfileData(identity, TeamIdentifier, bundleIdentifier, make_uuid());
+    return std::make_shared<ProvisioningProfile>(data);
+}
+
+// Writes the synthetic bundle and returns the relative paths of every Mach-O in it.
+std::vector<std::string> MakeBundle(const fs::path& appPath, const Configuration& configuration)
+{
+    std::vector<std::string> binaries;
+
+    fs::create_directories(appPath);
+
+    std::vector<bench::Architecture> architectures = { bench::ARM64, bench::ARM64e, bench::ARMv7 };
+    architectures.resize(std::max(1, std::min(configuration.slices, (int)architectures.size())));
+
+    bench::WriteFile(fs::path(appPath).append("Info.plist").string(), InfoPlist("Bench", BundleIdentifier));
+    bench::WriteFile(fs::path(appPath).append("Bench").string(), bench::MakeFatMachO((size_t)configuration.machOMB << 20, bench::MachOType::Execute, architectures, 1));
+    binaries.push_back("Bench");
+
+    std::mt19937 random(2);
+    std::string asset((size_t)configuration.assetKB << 10, '\0');
+
+    for (int i = 0; i < configuration.files; i++)
+    {
+        // Spread assets across a few directories, including localized ones.
+        std::string directory = (i % 4 == 0) ? "en.lproj" : "Assets/" + std::to_string(i % 16);
+        fs::create_directories(fs::path(appPath).append(directory));
+
+        for (auto& byte : asset)
+        {
+            byte = (char)random();
+        }
+
+        bench::WriteFile(fs::path(appPath).append(directory).append("asset" + std::to_string(i) + ".bin").string(), asset);
+    }
+
+    for (int i = 0; i < configuration.frameworks; i++)
+    {
+        std::string name = "Framework" + std::to_string(i);
+        auto frameworkPath = fs::path(appPath).append("Frameworks").append(name + ".framework");
+        fs::create_directories(frameworkPath);
+
+        bench::WriteFile(fs::path(frameworkPath).append("Info.plist").string(), InfoPlist(name, std::string(BundleIdentifier) + "." + name));
+        bench::WriteFile(fs::path(frameworkPath).append(name).string(), bench::MakeMachO((size_t)configuration.dylibKB << 10, bench::MachOType::Dylib, bench::ARM64, 100 + i));
+        binaries.push_back("Frameworks/" + name + ".framework/" + name);
+    }
+
+    for (int i = 0; i < configuration.appExtensions; i++)
+    {
+        std::string name = "Extension" + std::to_string(i);
+        auto extensionPath = fs::path(appPath).append("PlugIns").append(name + ".appex");
+        fs::create_directories(extensionPath);
+
+        bench::WriteFile(fs::path(extensionPath).append("Info.plist").string(), InfoPlist(name, std::string(BundleIdentifier) + "." + name));
+        bench::WriteFile(fs::path(extensionPath).append(name).string(), bench::MakeMachO((size_t)configuration.dylibKB << 10, bench::MachOType::Execute, bench::ARM64, 200 + i));
+        binaries.push_back("PlugIns/" + name + ".appex/" + name);
+    }
+
+    return binaries;
+}
+
+std::string ReadPadded(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Same trailing padding ldid applies before signing an image.
+    data.append(0x10 - (data.size() & 0xf), '\0');
+    return data;
+}
+
+void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--files N] [--asset-kb N] [--frameworks N] [--appex N] [--macho-mb N] [--dylib-kb N] [--slices 1-3] [--iterations N] [--workdir PATH]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    Configuration configuration;
+
+    static struct option long_options[] =
+    {
+        {"files",       required_argument, 0, 'f'},
+        {"asset-kb",    required_argument, 0, 'a'},
+        {"frameworks",  required_argument, 0, 'F'},
+        {"appex",       required_argument, 0, 'e'},
+        {"macho-mb",    required_argument, 0, 'm'},
+        {"dylib-kb",    required_argument, 0, 'd'},
+        {"slices",      required_argument, 0, 's'},
+        {"iterations",  required_argument, 0, 'i'},
+        {"workdir",     required_argument, 0, 'w'},
+        {0, 0, 0, 0}
+    };
+
+    while (1)
+    {
+        int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) break;
+
+        switch (c)
+        {
+        case 'f': configuration.files = atoi(optarg); break;
+        case 'a': configuration.assetKB = atoi(optarg); break;
+        case 'F': configuration.frameworks = atoi(optarg); break;
+        case 'e': configuration.appExtensions = atoi(optarg); break;
+        case 'm': configuration.machOMB = atoi(optarg); break;
+        case 'd': configuration.dylibKB = atoi(optarg); break;
+        case 's': configuration.slices = atoi(optarg); break;
+        case 'i': configuration.iterations = std::max(1, atoi(optarg)); break;
+        case 'w': configuration.workingDirectory = optarg; break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Keep the JSON on stdout clean of AltSign's progress logging.
+    Logger::instance()->setLevel(LogLevel::Off);
+
+    fs::path workingDirectory(configuration.workingDirectory);
+    fs::remove_all(workingDirectory);
+    fs::create_directories(workingDirectory);
+
+    bench::Identity identity(TeamIdentifier);
+    auto p12Data = identity.p12Data();
+    std::string key(p12Data.begin(), p12Data.end());
+
+    auto certificate = std::make_shared<Certificate>(p12Data, "");
+    auto team = std::make_shared<Team>();
+
+    auto templatePath = fs::path(workingDirectory).append("Template").append("Bench.app");
+    auto binaries = MakeBundle(templatePath, configuration);
+
+    std::vector<std::shared_ptr<ProvisioningProfile>> profiles;
+    std::map<std::string, std::string> entitlementsByRoot;
+
+    profiles.push_back(MakeProfile(identity, BundleIdentifier));
+    entitlementsByRoot[""] = profiles.back()->entitlementsXML();
+
+    for (int i = 0; i < configuration.appExtensions; i++)
+    {
+        std::string name = "Extension" + std::to_string(i);
+        profiles.push_back(MakeProfile(identity, std::string(BundleIdentifier) + "." + name));
+        entitlementsByRoot["PlugIns/" + name + ".appex/"] = profiles.back()->entitlementsXML();
+    }
+
+    uint64_t bundleBytes = 0;
+    uint64_t bundleFiles = 0;
+    for (auto& entry : fs::recursive_directory_iterator(templatePath))
+    {
+        if (entry.is_regular_file())
+        {
+            bundleBytes += entry.file_size();
+            bundleFiles += 1;
+        }
+    }
+
+    std::set<std::string> machOs(binaries.begin(), binaries.end());
+
+    bench::Samples walk, resources, pages, cms, serialSlices, concurrentSlices, sign, commit, signApp;
+
+    for (int iteration = 0; iteration < configuration.iterations; iteration++)
+    {
+        // Bundle walk: directory traversal only.
+        std::vector<std::string> paths;
+        walk.add(bench::time([&] {
+            ldid::DiskFolder folder(templatePath.string());
+            folder.Find("", ldid::fun([&](const std::string& name) {
+                paths.push_back(name);
+            }), ldid::fun([&](const std::string& name, const ldid::Functor<std::string()>& read) {
+            }));
+        }));
+
+        // Resource hashing: SHA-1 + SHA-256 of every non Mach-O file, as CodeResources needs.
+        resources.add(bench::time([&] {
+            ldid::DiskFolder folder(templatePath.string());
+            for (auto& name : paths)
+            {
+                if (machOs.count(name) != 0)
+                {
+                    continue;
+                }
+
+                folder.Open(name, ldid::fun([&](std::streambuf& data, size_t length, const void* flag) {
+                    SHA_CTX sha1;
+                    SHA256_CTX sha256;
+                    SHA1_Init(&sha1);
+                    SHA256_Init(&sha256);
+
+                    char buffer[4096 * 4];
+                    for (std::streamsize size; (size = data.sgetn(buffer, sizeof(buffer))) > 0;)
+                    {
+                        SHA1_Update(&sha1, buffer, size);
+                        SHA256_Update(&sha256, buffer, size);
+                    }
+
+                    unsigned char digest[SHA256_DIGEST_LENGTH];
+                    SHA1_Final(digest, &sha1);
+                    SHA256_Final(digest, &sha256);
+                }));
+            }
+        }));
+
+        // Page hashing and CMS: sign every Mach-O into a null sink, without and then with a key.
+        std::vector<std::string> images;
+        for (auto& binary : binaries)
+        {
+            images.push_back(ReadPadded(fs::path(templatePath).append(binary).string()));
+        }
+
+        auto signImages = [&](const std::string& key) {
+            for (auto& image : images)
+            {
+                NullBuffer output;
+                ldid::Slots slots;
+                ldid::Sign(image.data(), image.size(), output, BundleIdentifier, "", "", key, slots, ldid::fun([](double) {}));
+            }
+        };
+
+        double pageTime = bench::time([&] { signImages(""); });
+        double keyedTime = bench::time([&] { signImages(key); });
+        pages.add(pageTime);
+        cms.add(std::max(0.0, keyedTime - pageTime));
+
+        // Slice signing: the fat main executable without a key, one slice at a time and then concurrently.
+        // Both must produce the same bytes.
+        auto signSlices = [&](bool concurrent, std::stringbuf& output) {
+            ldid::SetConcurrentSlices(concurrent);
+
+            ldid::Slots slots;
+            ldid::Sign(images[0].data(), images[0].size(), output, BundleIdentifier, "", "", "", slots, ldid::fun([](double) {}));
+        };
+
+        std::stringbuf serialOutput, concurrentOutput;
+        serialSlices.add(bench::time([&] { signSlices(false, serialOutput); }));
+        concurrentSlices.add(bench::time([&] { signSlices(true, concurrentOutput); }));
+
+        if (serialOutput.str() != concurrentOutput.str())
+        {
+            std::cerr << "Signing slices concurrently changed the signed image (" << serialOutput.str().size() << " vs " << concurrentOutput.str().size() << " bytes)." << std::endl;
+
+            fs::remove_all(workingDirectory);
+            return 1;
+        }
+
+        // Full ldid::Sign over a fresh copy, with the commit (rename of every rewritten file) timed on its own.
+        auto ldidPath = fs::path(workingDirectory).append("ldid-" + std::to_string(iteration)).append("Bench.app");
+        fs::create_directories(ldidPath);
+        fs::copy(templatePath, ldidPath, fs::copy_options::recursive);
+
+        auto folder = std::make_unique<ldid::DiskFolder>(ldidPath.string());
+        sign.add(bench::time([&] {
+            ldid::Sign("", *folder, key, "",
+                ldid::fun([&](const std::string& root, const std::string& entitlements) -> std::string {
+                    auto pair = entitlementsByRoot.find(root);
+                    return (pair != entitlementsByRoot.end()) ? pair->second : entitlements;
+                }),
+                ldid::fun([](const std::string&) {}),
+                ldid::fun([](double) {}));
+        }));
+        commit.add(bench::time([&] { folder.reset(); }));
+
+        // End to end, including provisioning profile embedding and entitlement serialization.
+        auto signerPath = fs::path(workingDirectory).append("signer-" + std::to_string(iteration)).append("Bench.app");
+        fs::create_directories(signerPath);
+        fs::copy(templatePath, signerPath, fs::copy_options::recursive);
+
+        Signer signer(team, certificate);
+        signApp.add(bench::time([&] { signer.SignApp(signerPath.string(), profiles); }));
+
+        fs::remove_all(ldidPath.parent_path());
+        fs::remove_all(signerPath.parent_path());
+    }
+
+    fs::remove_all(workingDirectory);
+
+    bench::JSONObject config;
+    config.set("files", (uint64_t)configuration.files)
+        .set("asset_kb", (uint64_t)configuration.assetKB)
+        .set("frameworks", (uint64_t)configuration.frameworks)
+        .set("appex", (uint64_t)configuration.appExtensions)
+        .set("macho_mb", (uint64_t)configuration.machOMB)
+        .set("dylib_kb", (uint64_t)configuration.dylibKB)
+        .set("slices", (uint64_t)configuration.slices)
+        .set("iterations", (uint64_t)configuration.iterations);
+
+    bench::JSONObject bundle;
+    bundle.set("files", bundleFiles).set("bytes", bundleBytes).set("macho_count", (uint64_t)binaries.size());
+
+    bench::JSONObject phases;
+    phases.set("bundle_walk", walk)
+        .set("resource_hashing", resources)
+        .set("page_hashing", pages)
+        .set("cms_signing", cms)
+        .set("slice_signing_serial", serialSlices)
+        .set("slice_signing_concurrent", concurrentSlices)
+        .set("ldid_sign", sign)
+        .set("commit", commit)
+        .set("sign_app", signApp);
+
+    bench::JSONObject result;
+    result.set("benchmark", std::string("sign")).set("config", config).set("bundle", bundle).set("phases", phases);
+
+    std::cout << result.str() << std::endl;
+
+    return 0;
+}
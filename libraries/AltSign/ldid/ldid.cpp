@@ -36,12 +36,15 @@
 #define BOOST_STACKTRACE_GNU_SOURCE_NOT_REQUIRED
 #include <boost/stacktrace.hpp>
 
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
@@ -125,6 +128,7 @@ namespace fs = std::filesystem;
 #endif
 
 #include "ldid.hpp"
+#include "Tracer.hpp"
 
 #define _assert___(line) \
     #line
@@ -1225,19 +1229,22 @@ private:
 	File file_;
 	void* data_;
 	size_t size_;
+	size_t mapped_;
 
 	void clear() {
 		if (data_ == NULL)
 			return;
-		_syscall(munmap(data_, size_));
+		_syscall(munmap(data_, mapped_));
 		data_ = NULL;
 		size_ = 0;
+		mapped_ = 0;
 	}
 
 public:
 	Map() :
 		data_(NULL),
-		size_(0)
+		size_(0),
+		mapped_(0)
 	{
 	}
 
@@ -1253,6 +1260,12 @@ public:
 		open(path, edit);
 	}
 
+	Map(const std::string& path, size_t pad) :
+		Map()
+	{
+		open(path, pad);
+	}
+
 	~Map() {
 		clear();
 	}
@@ -1277,7 +1290,28 @@ public:
 		size_ = stat.st_size;
 		// std::cerr << "mmap file: " << path << " size: " << size_ << std::endl;
 
-		data_ = _syscall(mmap(NULL, size_, pflag, mflag, file, 0));
+		mapped_ = size_;
+		data_ = _syscall(mmap(NULL, mapped_, pflag, mflag, file, 0));
+	}
+
+	// read-only mapping followed by at least pad bytes of zeros, so callers
+	// can read slightly past the end of the file without copying it first
+	void open(const std::string& path, size_t pad) {
+		clear();
+
+		file_.open(path.c_str(), O_RDONLY);
+		int file(file_.file());
+
+		struct stat stat;
+		_syscall(fstat(file, &stat));
+		size_ = stat.st_size;
+
+		// the anonymous reservation supplies the zeros past the last file page
+		mapped_ = Align(size_ + pad, sysconf(_SC_PAGESIZE));
+		data_ = _syscall(mmap(NULL, mapped_, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (size_ != 0)
+			_syscall(mmap(data_, size_, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0));
+		madvise(data_, mapped_, MADV_SEQUENTIAL);
 	}
 
 	void open(const std::string& path, bool edit) {
@@ -1302,6 +1336,54 @@ public:
 		return std::string(static_cast<char*>(data_), size_);
 	}
 };
+
+class MapBuffer :
+	public std::streambuf
+{
+private:
+	Map map_;
+
+public:
+	MapBuffer(const std::string& path) :
+		map_(path, size_t(0x10))
+	{
+		auto data(static_cast<char*>(map_.data()));
+		setg(data, data, data + map_.size());
+	}
+
+	const char* data() const {
+		return eback();
+	}
+
+	size_t size() const {
+		return map_.size();
+	}
+
+protected:
+	virtual pos_type seekoff(off_type offset, std::ios::seekdir way, std::ios::openmode which) {
+		if ((which & std::ios::in) == 0)
+			return pos_type(off_type(-1));
+
+		off_type base;
+		if (way == std::ios::beg)
+			base = 0;
+		else if (way == std::ios::cur)
+			base = gptr() - eback();
+		else
+			base = egptr() - eback();
+
+		base += offset;
+		if (base < 0 || base > egptr() - eback())
+			return pos_type(off_type(-1));
+
+		setg(eback(), eback() + base, egptr());
+		return pos_type(base);
+	}
+
+	virtual pos_type seekpos(pos_type position, std::ios::openmode which) {
+		return seekoff(off_type(position), std::ios::beg, which);
+	}
+};
 #endif
 
 namespace ldid {
@@ -1334,6 +1416,13 @@ namespace ldid {
 		return entitlements;
 	}
 
+	// Cleared to sign a fat image's slices one after another, as with LDID_NOTHREADS.
+	static std::atomic<bool> concurrentSlices_(true);
+
+	void SetConcurrentSlices(bool concurrent) {
+		concurrentSlices_ = concurrent;
+	}
+
 	static void Allocate(const void* idata, size_t isize, std::streambuf& output, const Functor<size_t(const MachHeader&, size_t)>& allocate, const Functor<size_t(const MachHeader&, std::streambuf& output, size_t, size_t, const std::string&, const char*, const Functor<void(double)>&)>& save, const Functor<void(double)>& percent) {
 		FatHeader source(const_cast<void*>(idata), isize);
 
@@ -1427,11 +1516,22 @@ namespace ldid {
 			}
 		}
 
-		_foreach(allocation, allocations) {
-			auto& mach_header(allocation.mach_header_);
+		// slices only depend on their own source bytes, so their headers are laid
+		// out first and their signatures computed independently of the output
+		struct Slice {
+			std::string header_;
+			std::string overlap_;
+			size_t execSegLimit_;
+			std::stringbuf signature_;
+			size_t saved_;
+		};
 
-			pad(output, allocation.offset_ - position);
-			position = allocation.offset_;
+		std::vector<Slice> slices(allocations.size());
+
+		for (size_t i(0); i != allocations.size(); ++i) {
+			auto& allocation(allocations[i]);
+			auto& mach_header(allocation.mach_header_);
+			auto& slice(slices[i]);
 
 			std::vector<std::string> commands;
 			size_t execSegLimit = 0;
@@ -1485,8 +1585,6 @@ namespace ldid {
 				commands.push_back(std::string(reinterpret_cast<const char*>(&signature), sizeof(signature)));
 			}
 
-			size_t begin(position);
-
 			uint32_t after(0);
 			_foreach(command, commands)
 				after += command.size();
@@ -1496,46 +1594,73 @@ namespace ldid {
 			struct mach_header header(*mach_header);
 			header.ncmds = mach_header.Swap(uint32_t(commands.size()));
 			header.sizeofcmds = mach_header.Swap(after);
-			put(output, &header, sizeof(header));
 			put(altern, &header, sizeof(header));
-			position += sizeof(header);
 
 			if (mach_header.Bits64()) {
 				auto pad(mach_header.Swap(uint32_t(0)));
-				put(output, &pad, sizeof(pad));
 				put(altern, &pad, sizeof(pad));
-				position += sizeof(pad);
 			}
 
-			_foreach(command, commands) {
-				put(output, command.data(), command.size());
+			_foreach(command, commands)
 				put(altern, command.data(), command.size());
-				position += command.size();
-			}
 
 			uint32_t before(mach_header.Swap(mach_header->sizeofcmds));
-			if (before > after) {
-				pad(output, before - after);
+			if (before > after)
 				pad(altern, before - after);
-				position += before - after;
-			}
 
 			auto top(reinterpret_cast<char*>(mach_header.GetBase()));
 
-			std::string overlap(altern.str());
-			overlap.append(top + overlap.size(), Align(overlap.size(), 0x1000) - overlap.size());
+			slice.header_ = altern.str();
+			slice.overlap_ = slice.header_;
+			slice.overlap_.append(top + slice.overlap_.size(), Align(slice.overlap_.size(), 0x1000) - slice.overlap_.size());
+			slice.execSegLimit_ = execSegLimit;
+		}
+
+		auto sign([&](size_t i, const Functor<void(double)>& percent) {
+			auto& allocation(allocations[i]);
+			auto& slice(slices[i]);
+			auto top(reinterpret_cast<char*>(allocation.mach_header_.GetBase()));
+			slice.saved_ = save(allocation.mach_header_, slice.signature_, allocation.limit_, slice.execSegLimit_, slice.overlap_, top, percent);
+		});
+
+#ifndef LDID_NOTHREADS
+		if (allocations.size() > 1 && concurrentSlices_) {
+			std::vector<std::future<void>> signing;
+			for (size_t i(0); i != allocations.size(); ++i)
+				signing.push_back(std::async(std::launch::async, [&, i]() {
+					sign(i, fun(dummy));
+				}));
+			for (auto& future : signing)
+				future.get();
+		}
+		else
+#endif
+			for (size_t i(0); i != allocations.size(); ++i)
+				sign(i, percent);
+
+		for (size_t i(0); i != allocations.size(); ++i) {
+			auto& allocation(allocations[i]);
+			auto& mach_header(allocation.mach_header_);
+			auto& slice(slices[i]);
 
-			put(output, top + (position - begin), allocation.size_ - (position - begin), percent);
-			position = begin + allocation.size_;
+			pad(output, allocation.offset_ - position);
+			position = allocation.offset_;
+
+			put(output, slice.header_.data(), slice.header_.size());
+
+			auto top(reinterpret_cast<char*>(mach_header.GetBase()));
+			put(output, top + slice.header_.size(), allocation.size_ - slice.header_.size(), percent);
+			position += allocation.size_;
 
 			pad(output, allocation.limit_ - allocation.size_);
 			position += allocation.limit_ - allocation.size_;
 
-			size_t saved(save(mach_header, output, allocation.limit_, execSegLimit, overlap, top, percent));
-			if (allocation.alloc_ > saved)
-				pad(output, allocation.alloc_ - saved);
+			auto signature(slice.signature_.str());
+			put(output, signature.data(), signature.size());
+			if (allocation.alloc_ > slice.saved_)
+				pad(output, allocation.alloc_ - slice.saved_);
 			else
-				_assert(allocation.alloc_ == saved);
+				_assert(allocation.alloc_ == slice.saved_);
 			position += allocation.alloc_;
 		}
 	}
@@ -1856,7 +1981,9 @@ static void Commit(const std::string& path, const std::string& temp) {
 namespace ldid {
 
 	Hash Sign(const void* idata, size_t isize, std::streambuf& output, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, const Functor<void(double)>& percent) {
-		Hash hash;
+		// slices may be signed concurrently; the result is the last slice's hash
+		std::map<const void*, Hash> hashes;
+		std::mutex lock;
 
 		std::string team;
 
@@ -1937,6 +2064,7 @@ namespace ldid {
 			return alloc;
 			}), fun([&](const MachHeader& mach_header, std::streambuf& output, size_t limit, size_t execSegLimit, const std::string& overlap, const char* top, const Functor<void(double)>& percent) -> size_t {
 				Blobs blobs;
+				Hash hash;
 				uint64_t execSegFlags = 0;
 
 				if (true) {
@@ -2061,6 +2189,10 @@ namespace ldid {
 					}
 					}));
 
+				TraceSpan hashSpan("sign", "Hash pages");
+				hashSpan.set("bytes", limit);
+				hashSpan.set("pages", (limit + PageSize_ - 1) / PageSize_);
+
 				unsigned total(0);
 				for (Algorithm* pointer : GetAlgorithms()) {
 					Algorithm& algorithm(*pointer);
@@ -2145,15 +2277,21 @@ namespace ldid {
 					++total;
 				}
 
+				hashSpan.set("algorithms", total);
+				hashSpan.End();
+
 #ifndef LDID_NOSMIME
 				if (!key.empty()) {
 					std::stringbuf data;
 					const std::string& sign(blobs[CSSLOT_CODEDIRECTORY]);
 
+					TraceSpan signatureSpan("sign", "CMS signature");
+
 					Stuff stuff(key);
 					Buffer bio(sign);
 
 					Signature signature(stuff, sign);
+					signatureSpan.End();
 					Buffer result(signature);
 					std::string value(result);
 					put(data, value.data(), value.size());
@@ -2163,10 +2301,16 @@ namespace ldid {
 				}
 #endif
 
+				if (true) {
+					std::lock_guard<std::mutex> guard(lock);
+					hashes[mach_header.GetBase()] = hash;
+				}
+
 				return put(output, CSMAGIC_EMBEDDED_SIGNATURE, blobs);
 				}), percent);
 
-		return hash;
+		FatHeader fat_header(const_cast<void*>(idata), isize);
+		return hashes.at(fat_header.GetMachHeaders().back().GetBase());
 	}
 
 #ifndef LDID_NOTOOLS
@@ -2278,16 +2422,11 @@ namespace ldid {
 	}
 
 	void DiskFolder::Open(const std::string& path, const Functor<void(std::streambuf&, size_t, const void*)>& code) const {
-		std::filebuf data;
 		// std::cerr << Path(path).c_str() << std::endl;
-		auto result(data.open(Path(path).c_str(), std::ios::binary | std::ios::in));
-		// std::cout << boost::stacktrace::stacktrace() << std::endl;
-		_assert_(result == &data, "DiskFolder::Open(%s)", path.c_str());
-
-		auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
-		data.pubseekpos(0, std::ios::in);
-		// std::cout << "datalen: " << length << std::endl;
-		code(data, length, NULL);
+		_assert_(access(Path(path).c_str(), R_OK) == 0, "DiskFolder::Open(%s)", path.c_str());
+		MapBuffer data(Path(path));
+		// std::cout << "datalen: " << data.size() << std::endl;
+		code(data, data.size(), NULL);
 	}
 
 	void DiskFolder::Find(const std::string& path, const Functor<void(const std::string&)>& code, const Functor<void(const std::string&, const Functor<std::string()>&)>& link) const {
@@ -2513,17 +2652,34 @@ namespace ldid {
 	};
 
 #ifndef LDID_NOPLIST
-	static Hash Sign(const uint8_t* prefix, size_t size, std::streambuf& buffer, Hash& hash, std::streambuf& save, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, size_t length, const Functor<void(double)>& percent) {
+	static void Image(const uint8_t* prefix, size_t size, std::streambuf& buffer, size_t length, const Functor<void(double)>& percent, const Functor<void(const char*, size_t)>& code) {
+		// XXX: this is a stupid hack
+		size_t padded(length + 0x10 - (length & 0xf));
+
+		// files from a DiskFolder are already mapped with zeros past the end
+		if (auto mapped = dynamic_cast<MapBuffer*>(&buffer)) {
+			_assert(mapped->size() == length);
+			_assert(size == 0 || memcmp(mapped->data(), prefix, size) == 0);
+			percent(1);
+			return code(mapped->data(), padded);
+		}
+
 		// XXX: this is a miserable fail
 		std::stringbuf temp;
 		put(temp, prefix, size);
 		copy(buffer, temp, length - size, percent);
-		// XXX: this is a stupid hack
-		pad(temp, 0x10 - (length & 0xf));
+		pad(temp, padded - length);
 		auto data(temp.str());
+		code(data.data(), data.size());
+	}
 
-		HashProxy proxy(hash, save);
-		return Sign(data.data(), data.size(), proxy, identifier, entitlements, requirement, key, slots, percent);
+	static Hash Sign(const uint8_t* prefix, size_t size, std::streambuf& buffer, Hash& hash, std::streambuf& save, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, size_t length, const Functor<void(double)>& percent) {
+		Hash result;
+		Image(prefix, size, buffer, length, percent, fun([&](const char* data, size_t size) {
+			HashProxy proxy(hash, save);
+			result = Sign(data, size, proxy, identifier, entitlements, requirement, key, slots, percent);
+			}));
+		return result;
 	}
 
 	Bundle Sign(const std::string& root, Folder& folder, const std::string& key, std::map<std::string, Hash>& remote, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
@@ -2555,13 +2711,9 @@ namespace ldid {
 
 		std::string entitlements;
 		folder.Open(executable, fun([&](std::streambuf& buffer, size_t length, const void* flag) {
-			// XXX: this is a miserable fail
-			std::stringbuf temp;
-			copy(buffer, temp, length, percent);
-			// XXX: this is a stupid hack
-			pad(temp, 0x10 - (length & 0xf));
-			auto data(temp.str());
-			entitlements = alter(root, Analyze(data.data(), data.size()));
+			Image(NULL, 0, buffer, length, percent, fun([&](const char* data, size_t size) {
+				entitlements = alter(root, Analyze(data, size));
+				}));
 			}));
 
 		static const std::string directory("_CodeSignature/");
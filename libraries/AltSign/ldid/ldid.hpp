@@ -154,6 +154,9 @@ typedef std::map<uint32_t, Hash> Slots;
 
 Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, const Functor<void (double)> &percent);
 
+// The slices of a fat image are signed concurrently unless this is set to false; the output is the same either way.
+void SetConcurrentSlices(bool concurrent);
+
 std::string Entitlements(std::string path);
 }
 
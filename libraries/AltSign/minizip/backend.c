@@ -0,0 +1,188 @@
+/* backend.c -- selects the inflate/deflate implementation used by zip.c and unzip.c
+
+   Not part of the original minizip 1.01e distribution. See backend.h.
+*/
+
+#include <stdlib.h>
+#include "backend.h"
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifndef local
+#  define local static
+#endif
+
+struct zbackend_state_s
+{
+#ifdef USE_LIBDEFLATE
+    struct libdeflate_decompressor* decompressor;
+    struct libdeflate_compressor* compressor;
+    int compressor_level;
+#else
+    int unused;
+#endif
+};
+
+#ifdef USE_LIBDEFLATE
+static int zbackend_current = Z_BACKEND_LIBDEFLATE;
+#else
+static int zbackend_current = Z_BACKEND_ZLIB;
+#endif
+
+extern int ZEXPORT zbackendAvailable (backend)
+    int backend;
+{
+    if (backend == Z_BACKEND_ZLIB)
+        return 1;
+#ifdef USE_LIBDEFLATE
+    if (backend == Z_BACKEND_LIBDEFLATE)
+        return 1;
+#endif
+    return 0;
+}
+
+extern int ZEXPORT zbackendSet (backend)
+    int backend;
+{
+    if (!zbackendAvailable(backend))
+        return 0;
+    zbackend_current = backend;
+    return 1;
+}
+
+extern int ZEXPORT zbackendGet ()
+{
+    return zbackend_current;
+}
+
+extern const char* ZEXPORT zbackendName (backend)
+    int backend;
+{
+    switch (backend)
+    {
+        case Z_BACKEND_ZLIB: return "zlib";
+        case Z_BACKEND_LIBDEFLATE: return "libdeflate";
+        default: return "unknown";
+    }
+}
+
+extern int zbackend_whole_buffer ()
+{
+    return zbackend_current != Z_BACKEND_ZLIB;
+}
+
+local zbackend_state zbackend_get_state(state)
+    zbackend_state* state;
+{
+    if (*state == NULL)
+        *state = (zbackend_state)calloc(1, sizeof(struct zbackend_state_s));
+    return *state;
+}
+
+/* Returns Z_OK once exactly out_size bytes were produced, Z_DATA_ERROR otherwise. */
+extern int zbackend_inflate (state, in, in_size, out, out_size)
+    zbackend_state* state;
+    const void* in;
+    uLong in_size;
+    void* out;
+    uLong out_size;
+{
+#ifdef USE_LIBDEFLATE
+    size_t actual = 0;
+    zbackend_state s = zbackend_get_state(state);
+    if (s == NULL)
+        return Z_MEM_ERROR;
+
+    if (s->decompressor == NULL)
+        s->decompressor = libdeflate_alloc_decompressor();
+    if (s->decompressor == NULL)
+        return Z_MEM_ERROR;
+
+    if (libdeflate_deflate_decompress(s->decompressor, in, in_size, out, out_size, &actual) != LIBDEFLATE_SUCCESS ||
+        actual != out_size)
+        return Z_DATA_ERROR;
+
+    return Z_OK;
+#else
+    return Z_STREAM_ERROR;
+#endif
+}
+
+#ifdef USE_LIBDEFLATE
+local struct libdeflate_compressor* zbackend_get_compressor(state, level)
+    zbackend_state* state;
+    int level;
+{
+    zbackend_state s = zbackend_get_state(state);
+    if (s == NULL)
+        return NULL;
+
+    /* zlib's default level is 6; libdeflate accepts 0-12. */
+    if (level == Z_DEFAULT_COMPRESSION)
+        level = 6;
+
+    if (s->compressor != NULL && s->compressor_level != level)
+    {
+        libdeflate_free_compressor(s->compressor);
+        s->compressor = NULL;
+    }
+
+    if (s->compressor == NULL)
+    {
+        s->compressor = libdeflate_alloc_compressor(level);
+        s->compressor_level = level;
+    }
+
+    return s->compressor;
+}
+#endif
+
+extern uLong zbackend_deflate_bound (state, level, in_size)
+    zbackend_state* state;
+    int level;
+    uLong in_size;
+{
+#ifdef USE_LIBDEFLATE
+    struct libdeflate_compressor* compressor = zbackend_get_compressor(state, level);
+    if (compressor == NULL)
+        return 0;
+    return (uLong)libdeflate_deflate_compress_bound(compressor, in_size);
+#else
+    return 0;
+#endif
+}
+
+/* Returns the compressed size, or 0 on failure. */
+extern uLong zbackend_deflate (state, level, in, in_size, out, out_avail)
+    zbackend_state* state;
+    int level;
+    const void* in;
+    uLong in_size;
+    void* out;
+    uLong out_avail;
+{
+#ifdef USE_LIBDEFLATE
+    struct libdeflate_compressor* compressor = zbackend_get_compressor(state, level);
+    if (compressor == NULL)
+        return 0;
+    return (uLong)libdeflate_deflate_compress(compressor, in, in_size, out, out_avail);
+#else
+    return 0;
+#endif
+}
+
+extern void zbackend_free (state)
+    zbackend_state state;
+{
+    if (state == NULL)
+        return;
+#ifdef USE_LIBDEFLATE
+    if (state->decompressor != NULL)
+        libdeflate_free_decompressor(state->decompressor);
+    if (state->compressor != NULL)
+        libdeflate_free_compressor(state->compressor);
+#endif
+    free(state);
+}
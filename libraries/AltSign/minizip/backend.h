@@ -0,0 +1,62 @@
+/* backend.h -- selects the inflate/deflate implementation used by zip.c and unzip.c
+
+   Not part of the original minizip 1.01e distribution.
+
+   By default everything goes through zlib's streaming inflate()/deflate().
+   When built with -DUSE_LIBDEFLATE (and linked with -ldeflate), entries whose
+   whole content is available at once can instead be (de)compressed in a single
+   call through libdeflate, which is considerably faster than zlib for both
+   directions and produces standard raw deflate streams:
+
+     - unzReadCurrentFile inflates the whole entry directly into the caller's
+       buffer when that buffer can hold the entry's uncompressed size, as
+       known from the central directory.
+     - zipWriteInFileInZip collects the entry's data (up to
+       Z_BACKEND_WHOLE_LIMIT bytes) and zipCloseFileInZipRaw deflates it in
+       one call. Larger entries fall back to zlib streaming.
+
+   Encrypted and raw entries always use zlib.
+
+   The backend is process-wide; change it only while no zip or unzip handle
+   is in use.
+*/
+
+#ifndef _ZLIBBACKEND_H
+#define _ZLIBBACKEND_H
+
+#include "zlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define Z_BACKEND_ZLIB          (0)
+#define Z_BACKEND_LIBDEFLATE    (1)
+
+#define Z_BACKEND_WHOLE_LIMIT   (64UL * 1024 * 1024)
+
+/* Selects the backend; returns 0 if it was not compiled in. */
+extern int ZEXPORT zbackendSet OF((int backend));
+extern int ZEXPORT zbackendGet OF((void));
+extern int ZEXPORT zbackendAvailable OF((int backend));
+extern const char* ZEXPORT zbackendName OF((int backend));
+
+/* Internal helpers for zip.c / unzip.c. state is per zip/unzip handle and
+   released with zbackend_free. */
+typedef struct zbackend_state_s* zbackend_state;
+
+extern int zbackend_whole_buffer OF((void));
+extern int zbackend_inflate OF((zbackend_state* state,
+                                const void* in, uLong in_size,
+                                void* out, uLong out_size));
+extern uLong zbackend_deflate_bound OF((zbackend_state* state, int level, uLong in_size));
+extern uLong zbackend_deflate OF((zbackend_state* state, int level,
+                                  const void* in, uLong in_size,
+                                  void* out, uLong out_avail));
+extern void zbackend_free OF((zbackend_state state));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ZLIBBACKEND_H */
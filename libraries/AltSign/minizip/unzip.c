@@ -40,6 +40,7 @@ woven in by Terry Thorsen 1/2003.
 #include <string.h>
 #include "zlib.h"
 #include "unzip.h"
+#include "backend.h"
 
 #ifdef STDC
 #  include <stddef.h>
@@ -149,6 +150,9 @@ typedef struct
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
 #    endif
+    zbackend_state backend;     /* whole-entry inflate state, see backend.h */
+    Bytef* whole_buffer;        /* compressed data of the current entry */
+    uLong whole_buffer_size;
 } unz_s;
 
 
@@ -488,6 +492,9 @@ extern unzFile ZEXPORT unzOpen2 (path, pzlib_filefunc_def)
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
     us.encrypted = 0;
+    us.backend = NULL;
+    us.whole_buffer = NULL;
+    us.whole_buffer_size = 0;
 
 
     s=(unz_s*)ALLOC(sizeof(unz_s));
@@ -520,6 +527,8 @@ extern int ZEXPORT unzClose (file)
         unzCloseCurrentFile(file);
 
     ZCLOSE(s->z_filefunc, s->filestream);
+    zbackend_free(s->backend);
+    TRYFREE(s->whole_buffer);
     TRYFREE(s);
     return UNZ_OK;
 }
@@ -1221,6 +1230,57 @@ extern int ZEXPORT unzOpenCurrentFile2 (file,method,level,raw)
   return <0 with error code if there is an error
     (UNZ_ERRNO for IO error, or zLib error for uncompress error)
 */
+/*
+  Inflate the whole current entry into buf in one call through the selected
+  backend. Only used before anything has been read from the entry, when buf
+  can hold all of it.
+*/
+local int unzlocal_ReadWholeCurrentFile OF((unz_s* s, voidp buf));
+
+local int unzlocal_ReadWholeCurrentFile (s, buf)
+    unz_s* s;
+    voidp buf;
+{
+    file_in_zip_read_info_s* pfile_in_zip_read_info = s->pfile_in_zip_read;
+    uLong uCompressed = pfile_in_zip_read_info->rest_read_compressed;
+    uLong uUncompressed = pfile_in_zip_read_info->rest_read_uncompressed;
+
+    if (uUncompressed == 0)
+        return UNZ_EOF;
+
+    if (s->whole_buffer_size < uCompressed)
+    {
+        TRYFREE(s->whole_buffer);
+        s->whole_buffer = (Bytef*)ALLOC(uCompressed);
+        s->whole_buffer_size = (s->whole_buffer != NULL) ? uCompressed : 0;
+        if (s->whole_buffer == NULL)
+            return UNZ_INTERNALERROR;
+    }
+
+    if (ZSEEK(pfile_in_zip_read_info->z_filefunc,
+              pfile_in_zip_read_info->filestream,
+              pfile_in_zip_read_info->pos_in_zipfile +
+                 pfile_in_zip_read_info->byte_before_the_zipfile,
+              ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return UNZ_ERRNO;
+    if (ZREAD(pfile_in_zip_read_info->z_filefunc,
+              pfile_in_zip_read_info->filestream,
+              s->whole_buffer,
+              uCompressed)!=uCompressed)
+        return UNZ_ERRNO;
+
+    if (zbackend_inflate(&s->backend, s->whole_buffer, uCompressed, buf, uUncompressed) != Z_OK)
+        return Z_DATA_ERROR;
+
+    pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32, buf, (uInt)uUncompressed);
+    pfile_in_zip_read_info->pos_in_zipfile += uCompressed;
+    pfile_in_zip_read_info->rest_read_compressed = 0;
+    pfile_in_zip_read_info->rest_read_uncompressed = 0;
+    pfile_in_zip_read_info->stream.total_out += uUncompressed;
+
+    return (int)uUncompressed;
+}
+
 extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
     unzFile file;
     voidp buf;
@@ -1244,6 +1304,14 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
     if (len==0)
         return 0;
 
+    if (zbackend_whole_buffer() &&
+        (pfile_in_zip_read_info->compression_method==Z_DEFLATED) &&
+        (!pfile_in_zip_read_info->raw) && (!s->encrypted) &&
+        (pfile_in_zip_read_info->stream.total_out==0) &&
+        (pfile_in_zip_read_info->stream.avail_in==0) &&
+        (len>=pfile_in_zip_read_info->rest_read_uncompressed))
+        return unzlocal_ReadWholeCurrentFile(s, buf);
+
     pfile_in_zip_read_info->stream.next_out = (Bytef*)buf;
 
     pfile_in_zip_read_info->stream.avail_out = (uInt)len;
@@ -16,6 +16,7 @@
 #include <time.h>
 #include "zlib.h"
 #include "zip.h"
+#include "backend.h"
 
 #ifdef STDC
 #  include <stddef.h>
@@ -133,6 +134,13 @@ typedef struct
     const unsigned long* pcrc_32_tab;
     int crypt_header_size;
 #endif
+    int  level;                 /* compression level of file currently wr. */
+    int  whole;                 /* 1 while data is collected for a single
+                                   backend deflate call, see backend.h */
+    uLong whole_size;           /* bytes collected in whole_data */
+    int  windowBits;            /* deflateInit2 parameters, kept so whole */
+    int  memLevel;              /* mode can init the stream only if it */
+    int  strategy;              /* falls back to zlib */
 } curfile_info;
 
 typedef struct
@@ -149,6 +157,11 @@ typedef struct
 #ifndef NO_ADDFILEINEXISTINGZIP
     char *globalcomment;
 #endif
+    zbackend_state backend;     /* whole-entry deflate state */
+    Bytef* whole_data;          /* uncompressed data of the current file */
+    uLong whole_data_alloc;
+    Bytef* whole_out;           /* its compressed form */
+    uLong whole_out_alloc;
 } zip_internal;
 
 
@@ -525,6 +538,11 @@ extern zipFile ZEXPORT zipOpen2 (pathname, append, globalcomment, pzlib_filefunc
     ziinit.in_opened_file_inzip = 0;
     ziinit.ci.stream_initialised = 0;
     ziinit.number_entry = 0;
+    ziinit.backend = NULL;
+    ziinit.whole_data = NULL;
+    ziinit.whole_data_alloc = 0;
+    ziinit.whole_out = NULL;
+    ziinit.whole_out_alloc = 0;
     ziinit.add_position_when_writting_offset = 0;
     init_linkedlist(&(ziinit.central_dir));
 
@@ -687,6 +705,31 @@ extern zipFile ZEXPORT zipOpen (pathname, append)
     return zipOpen2(pathname,append,NULL,NULL);
 }
 
+/* Sets up the zlib stream of the current file with the parameters it was opened with. */
+local int zipInitStream OF((zip_internal* zi));
+
+local int zipInitStream(zi)
+    zip_internal* zi;
+{
+    int windowBits = zi->ci.windowBits;
+    int err;
+
+    zi->ci.stream.zalloc = (alloc_func)0;
+    zi->ci.stream.zfree = (free_func)0;
+    zi->ci.stream.opaque = (voidpf)0;
+
+    if (windowBits>0)
+        windowBits = -windowBits;
+
+    err = deflateInit2(&zi->ci.stream, zi->ci.level,
+           Z_DEFLATED, windowBits, zi->ci.memLevel, zi->ci.strategy);
+
+    if (err==Z_OK)
+        zi->ci.stream_initialised = 1;
+
+    return err;
+}
+
 extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
                                          extrafield_local, size_extrafield_local,
                                          extrafield_global, size_extrafield_global,
@@ -858,21 +901,18 @@ extern int ZEXPORT zipOpenNewFileInZip3 (file, filename, zipfi,
     zi->ci.stream.total_in = 0;
     zi->ci.stream.total_out = 0;
 
-    if ((err==ZIP_OK) && (zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
-    {
-        zi->ci.stream.zalloc = (alloc_func)0;
-        zi->ci.stream.zfree = (free_func)0;
-        zi->ci.stream.opaque = (voidpf)0;
-
-        if (windowBits>0)
-            windowBits = -windowBits;
+    zi->ci.level = level;
+    zi->ci.whole = zbackend_whole_buffer() &&
+                   (zi->ci.method == Z_DEFLATED) && (!zi->ci.raw) && (password == NULL);
+    zi->ci.whole_size = 0;
 
-        err = deflateInit2(&zi->ci.stream, level,
-               Z_DEFLATED, windowBits, memLevel, strategy);
+    zi->ci.windowBits = windowBits;
+    zi->ci.memLevel = memLevel;
+    zi->ci.strategy = strategy;
 
-        if (err==Z_OK)
-            zi->ci.stream_initialised = 1;
-    }
+    /* Whole mode never feeds the stream, so it's only set up if that falls back. */
+    if ((err==ZIP_OK) && (zi->ci.method == Z_DEFLATED) && (!zi->ci.raw) && (!zi->ci.whole))
+        err = zipInitStream(zi);
 #    ifndef NOCRYPT
     zi->ci.crypt_header_size = 0;
     if ((err==Z_OK) && (password != NULL))
@@ -963,24 +1003,17 @@ local int zipFlushWriteBuffer(zi)
     return err;
 }
 
-extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
-    zipFile file;
+local int zipWriteToStream OF((zip_internal* zi, const void* buf, unsigned len));
+
+local int zipWriteToStream(zi, buf, len)
+    zip_internal* zi;
     const void* buf;
     unsigned len;
 {
-    zip_internal* zi;
     int err=ZIP_OK;
 
-    if (file == NULL)
-        return ZIP_PARAMERROR;
-    zi = (zip_internal*)file;
-
-    if (zi->in_opened_file_inzip == 0)
-        return ZIP_PARAMERROR;
-
     zi->ci.stream.next_in = (void*)buf;
     zi->ci.stream.avail_in = len;
-    zi->ci.crc32 = crc32(zi->ci.crc32,buf,len);
 
     while ((err==ZIP_OK) && (zi->ci.stream.avail_in>0))
     {
@@ -1028,6 +1061,104 @@ extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
     return err;
 }
 
+local int zipGrowBuffer OF((Bytef** buffer, uLong* alloc, uLong size));
+
+local int zipGrowBuffer(buffer, alloc, size)
+    Bytef** buffer;
+    uLong* alloc;
+    uLong size;
+{
+    Bytef* grown;
+    uLong new_alloc;
+
+    if (size <= *alloc)
+        return ZIP_OK;
+
+    new_alloc = (*alloc < Z_BUFSIZE) ? Z_BUFSIZE : *alloc;
+    while (new_alloc < size)
+        new_alloc *= 2;
+
+    grown = (Bytef*)realloc(*buffer, new_alloc);
+    if (grown == NULL)
+        return ZIP_INTERNALERROR;
+
+    *buffer = grown;
+    *alloc = new_alloc;
+    return ZIP_OK;
+}
+
+/* Deflates the collected data of the current file in one backend call. */
+local int zipWriteWholeData OF((zip_internal* zi));
+
+local int zipWriteWholeData(zi)
+    zip_internal* zi;
+{
+    uLong bound, compressed_size;
+
+    bound = zbackend_deflate_bound(&zi->backend, zi->ci.level, zi->ci.whole_size);
+    if (bound == 0)
+        return ZIP_INTERNALERROR;
+
+    if (zipGrowBuffer(&zi->whole_out, &zi->whole_out_alloc, bound) != ZIP_OK)
+        return ZIP_INTERNALERROR;
+
+    compressed_size = zbackend_deflate(&zi->backend, zi->ci.level,
+                                       zi->whole_data, zi->ci.whole_size,
+                                       zi->whole_out, bound);
+    if (compressed_size == 0)
+        return ZIP_INTERNALERROR;
+
+    if (ZWRITE(zi->z_filefunc,zi->filestream,zi->whole_out,compressed_size) != compressed_size)
+        return ZIP_ERRNO;
+
+    zi->ci.stream.total_in = zi->ci.whole_size;
+    zi->ci.stream.total_out = compressed_size;
+    return ZIP_OK;
+}
+
+extern int ZEXPORT zipWriteInFileInZip (file, buf, len)
+    zipFile file;
+    const void* buf;
+    unsigned len;
+{
+    zip_internal* zi;
+    int err=ZIP_OK;
+
+    if (file == NULL)
+        return ZIP_PARAMERROR;
+    zi = (zip_internal*)file;
+
+    if (zi->in_opened_file_inzip == 0)
+        return ZIP_PARAMERROR;
+
+    zi->ci.crc32 = crc32(zi->ci.crc32,buf,len);
+
+    if (zi->ci.whole)
+    {
+        if (zi->ci.whole_size + len <= Z_BACKEND_WHOLE_LIMIT)
+        {
+            if (zipGrowBuffer(&zi->whole_data, &zi->whole_data_alloc, zi->ci.whole_size + len) != ZIP_OK)
+                return ZIP_INTERNALERROR;
+
+            memcpy(zi->whole_data + zi->ci.whole_size, buf, len);
+            zi->ci.whole_size += len;
+            return ZIP_OK;
+        }
+
+        /* Too large for a single call: stream everything through zlib instead. */
+        zi->ci.whole = 0;
+        err = zipInitStream(zi);
+        if (err != ZIP_OK)
+            return err;
+
+        err = zipWriteToStream(zi, zi->whole_data, (unsigned)zi->ci.whole_size);
+        if (err != ZIP_OK)
+            return err;
+    }
+
+    return zipWriteToStream(zi, buf, len);
+}
+
 extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
     zipFile file;
     uLong uncompressed_size;
@@ -1045,7 +1176,9 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
         return ZIP_PARAMERROR;
     zi->ci.stream.avail_in = 0;
 
-    if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
+    if (zi->ci.whole)
+        err = zipWriteWholeData(zi);
+    else if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
         while (err==ZIP_OK)
     {
         uLong uTotalOutBefore;
@@ -1068,7 +1201,7 @@ extern int ZEXPORT zipCloseFileInZipRaw (file, uncompressed_size, crc32)
         if (zipFlushWriteBuffer(zi)==ZIP_ERRNO)
             err = ZIP_ERRNO;
 
-    if ((zi->ci.method == Z_DEFLATED) && (!zi->ci.raw))
+    if (zi->ci.stream_initialised)
     {
         err=deflateEnd(&zi->ci.stream);
         zi->ci.stream_initialised = 0;
@@ -1213,6 +1346,9 @@ extern int ZEXPORT zipClose (file, global_comment)
 #ifndef NO_ADDFILEINEXISTINGZIP
     TRYFREE(zi->globalcomment);
 #endif
+    zbackend_free(zi->backend);
+    TRYFREE(zi->whole_data);
+    TRYFREE(zi->whole_out);
     TRYFREE(zi);
 
     return err;
@@ -8,6 +8,8 @@
 #include "AltServerApp.h"
 
 #include "AppleAPI.hpp"
+#include "CertificateKeyPool.hpp"
+#include "Digest.hpp"
 #include "ConnectionManager.hpp"
 #include "InstallError.hpp"
 #include "Signer.hpp"
@@ -16,24 +18,36 @@
 #include "ServerError.hpp"
 
 #include "AnisetteDataManager.h"
+#include "SessionManager.h"
+#include "CertificateStore.h"
+#include "SignedAppCache.h"
+#include "AppDownloadCache.h"
+#include "InstallTimeline.h"
+#include "WorkspaceManager.h"
+#include "Tracer.hpp"
 
 #include <cpprest/http_client.h>
 #include <cpprest/filestream.h>
 
 #include <optional>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <regex>
 
 #include <plist/plist.h>
 
+#include <openssl/rand.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
 using namespace utility;                    // Common utilities like string conversions
 using namespace web;                        // Common features like URIs.
 using namespace web::http;                  // Common HTTP functionality
 using namespace web::http::client;          // HTTP client features
 using namespace concurrency::streams;       // Asynchronous streams
 
-extern std::string temporary_directory();
-extern std::string make_uuid();
 extern std::vector<unsigned char> readFile(const char* filename);
 
 
@@ -50,8 +64,262 @@ AltServerApp* AltServerApp::instance()
 	return _instance;
 }
 
+static const std::vector<std::pair<AppleAPIResource, const char*>> APIResources = {
+	{ AppleAPIResource::Teams, "teams" },
+	{ AppleAPIResource::Devices, "devices" },
+	{ AppleAPIResource::Certificates, "certificates" },
+	{ AppleAPIResource::AppIDs, "app IDs" },
+	{ AppleAPIResource::AppGroups, "app groups" },
+};
+
+static void LogAPICacheStatistics()
+{
+	std::stringstream ss;
+	for (auto& resource : APIResources)
+	{
+		auto statistics = AppleAPI::getInstance()->cacheStatistics(resource.first);
+		ss << " " << resource.second << " " << statistics.hits << "/" << (statistics.hits + statistics.misses);
+	}
+
+	odslog("Developer services cache hits:" << ss.str());
+}
+
+static void LogAPISchedulerStatistics()
+{
+	auto statistics = AppleAPI::getInstance()->scheduler().statistics();
+
+	odslog("Apple API requests: " << statistics.sentRequests << " sent, " << statistics.retriedRequests << " retried, " << statistics.throttledResponses << " throttled; "
+		<< statistics.queueDepth << " queued (max " << statistics.maximumQueueDepth << "), average wait " << statistics.averageWaitTime().count() << " ms (max " << statistics.maximumWaitTime.count() << " ms)");
+
+	auto coalescerStatistics = AppleAPI::getInstance()->coalescerStatistics();
+	odslog("Apple API calls: " << coalescerStatistics.calls << " made, " << coalescerStatistics.coalescedCalls << " duplicates shared an in-flight call, "
+		<< coalescerStatistics.serializedCalls << " waited for another change to the same resource");
+}
+
+static void LogCertificateKeyPoolStatistics()
+{
+	auto statistics = CertificateKeyPool::instance()->statistics();
+
+	odslog("Certificate keys: " << statistics.pooledKeys << " from pool (" << statistics.savedGenerationTime.count() << " ms of generation kept off installs), "
+		<< statistics.generatedOnDemandKeys << " generated on demand (" << statistics.onDemandGenerationTime.count() << " ms), " << statistics.availableKeys << " ready");
+}
+
+static void LogCertificateStoreStatistics()
+{
+	auto statistics = CertificateStore::instance()->statistics();
+
+	odslog("Certificate store: " << statistics.certificateHits << "/" << (statistics.certificateHits + statistics.certificateMisses) << " certificates and "
+		<< statistics.p12Hits << "/" << (statistics.p12Hits + statistics.p12Misses) << " encrypted .p12s reused, saving " << statistics.savedTime.count() << " ms in total");
+}
+
+static void LogApplicationStatistics()
+{
+	auto statistics = Application::statistics();
+
+	odslog("App bundles: " << statistics.infoPlistParses << " Info.plists parsed, " << statistics.extensionScans << " extension scans, "
+		<< statistics.provisioningProfileReads << " embedded profiles read, " << statistics.entitlementQueries << " entitlement queries");
+}
+
+static void LogProvisioningProfileCacheStatistics()
+{
+	auto statistics = ProvisioningProfile::cacheStatistics();
+
+	odslog("Provisioning profiles: " << statistics.hits << "/" << (statistics.hits + statistics.misses) << " parses reused a cached profile, " << statistics.entries << " cached");
+}
+
+static void LogWorkspaceStatistics()
+{
+	auto statistics = WorkspaceManager::instance()->statistics();
+
+	odslog("Workspaces: " << statistics.allocations << " allocated, " << statistics.waitedAllocations << " waited for space (" << statistics.waitTime.count() << " ms in total); "
+		<< statistics.removedDirectories << " directories removed, " << statistics.failedRemovals << " failed; " << statistics.reservedBytes << " bytes reserved (max " << statistics.maximumReservedBytes << ")");
+}
+
+static void LogLoggerStatistics()
+{
+	auto statistics = Logger::instance()->statistics();
+
+	odslog("Log: " << statistics.records << " records, " << statistics.droppedRecords << " dropped and " << statistics.waitedRecords << " waited for a full buffer; "
+		<< statistics.bytesWritten << " bytes in " << statistics.writes << " writes");
+}
+
+static void LogSignedAppCacheStatistics()
+{
+	auto statistics = SignedAppCache::instance()->statistics();
+
+	odslog("Signed app cache: " << statistics.hits << "/" << (statistics.hits + statistics.misses) << " hits, " << statistics.bytesSaved << " bytes not signed again; "
+		<< statistics.entries << " apps (" << statistics.size << " bytes) cached");
+}
+
+// ALTSERVER_KEY_POOL_PASSPHRASE encrypts pooled certificate keys on disk. Without it a random passphrase
+// is generated once and kept, readable only by its owner, outside the Keys directory.
+static std::string CertificateKeyPoolPassphrase(fs::path appDataDirectoryPath)
+{
+	const char* passphrase = getenv("ALTSERVER_KEY_POOL_PASSPHRASE");
+	if (passphrase != NULL && strlen(passphrase) > 0)
+	{
+		return passphrase;
+	}
+
+	auto passphrasePath = appDataDirectoryPath.append("KeyPool.secret");
+	if (fs::exists(passphrasePath))
+	{
+		std::ifstream file(passphrasePath);
+
+		std::string storedPassphrase;
+		std::getline(file, storedPassphrase);
+
+		if (!storedPassphrase.empty())
+		{
+			return storedPassphrase;
+		}
+	}
+
+	unsigned char bytes[32];
+	if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+	{
+		throw std::runtime_error("Failed to generate a certificate key pool passphrase.");
+	}
+
+	auto generatedPassphrase = HexString(bytes, sizeof(bytes));
+
+	// Created owner-only, so the passphrase is never readable by others, not even briefly.
+	int fd = open(passphrasePath.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+	{
+		throw std::runtime_error("Failed to create " + passphrasePath.string() + ": " + strerror(errno));
+	}
+
+	// An existing (empty) file keeps its permissions through O_CREAT.
+	fchmod(fd, S_IRUSR | S_IWUSR);
+
+	auto contents = generatedPassphrase + "\n";
+	bool succeeded = (write(fd, contents.data(), contents.size()) == (ssize_t)contents.size());
+	close(fd);
+
+	if (!succeeded)
+	{
+		throw std::runtime_error("Failed to write " + passphrasePath.string() + ".");
+	}
+
+	return generatedPassphrase;
+}
+
 AltServerApp::AltServerApp() : _appGroupSemaphore(1)
 {
+	// ALTSERVER_LOG_LEVEL is one of trace, debug, info (default), warning, error or off. Trace adds a line per file and per received chunk.
+	const char* logLevel = getenv("ALTSERVER_LOG_LEVEL");
+	if (logLevel != NULL && strlen(logLevel) > 0)
+	{
+		auto level = Logger::LevelFromName(logLevel);
+		if (level.has_value())
+		{
+			Logger::instance()->setLevel(*level);
+		}
+		else
+		{
+			odslog("Unknown log level " << logLevel << ", using info.");
+		}
+	}
+
+	// ALTSERVER_LOG_FORMAT=json writes one JSON object per line instead of plain text.
+	const char* logFormat = getenv("ALTSERVER_LOG_FORMAT");
+	if (logFormat != NULL && strcmp(logFormat, "json") == 0)
+	{
+		Logger::instance()->setFormat(LogFormat::JSON);
+	}
+
+	// ALTSERVER_LOG_SYNCHRONOUS=1 writes every line before continuing, so nothing is lost if AltServer crashes.
+	const char* logSynchronous = getenv("ALTSERVER_LOG_SYNCHRONOUS");
+	if (logSynchronous != NULL && atoi(logSynchronous) != 0)
+	{
+		Logger::instance()->setAsynchronous(false);
+	}
+
+	// ALTSERVER_TRACE=1 records spans for each stage of an install; SIGUSR1 logs their duration histograms.
+	const char* trace = getenv("ALTSERVER_TRACE");
+	if (trace != NULL && atoi(trace) != 0)
+	{
+		Tracer::instance()->setEnabled(true);
+	}
+
+	// ALTSERVER_TRACE_DIR also writes each install's spans there as Chrome trace JSON, which implies ALTSERVER_TRACE=1.
+	const char* traceDirectory = getenv("ALTSERVER_TRACE_DIR");
+	if (traceDirectory != NULL && strlen(traceDirectory) > 0)
+	{
+		Tracer::instance()->setEnabled(true);
+		Tracer::instance()->setExportDirectoryPath(traceDirectory);
+	}
+
+	// ALTSERVER_API_CACHE_TTL overrides how many seconds developer services lists are reused; 0 disables caching.
+	const char* cacheLifetime = getenv("ALTSERVER_API_CACHE_TTL");
+	if (cacheLifetime != NULL)
+	{
+		auto lifetime = std::chrono::seconds(std::max(0, atoi(cacheLifetime)));
+		for (auto& resource : APIResources)
+		{
+			AppleAPI::getInstance()->setCacheLifetime(resource.first, lifetime);
+		}
+	}
+
+	// ALTSERVER_DEVELOPER_SERVICES_URL sends developer services requests elsewhere, e.g. to tools/AppleStandIn.
+	const char* developerServicesURL = getenv("ALTSERVER_DEVELOPER_SERVICES_URL");
+	if (developerServicesURL != NULL && strlen(developerServicesURL) > 0)
+	{
+		AppleAPI::getInstance()->setDeveloperServicesURL(developerServicesURL);
+	}
+
+	// ALTSERVER_GSA_URL does the same for sign-in requests, which normally go to gsa.apple.com.
+	const char* gsaURL = getenv("ALTSERVER_GSA_URL");
+	if (gsaURL != NULL && strlen(gsaURL) > 0)
+	{
+		AppleAPI::getInstance()->setGSAURL(gsaURL);
+	}
+
+	// ALTSERVER_PORT fixes the port AltStore connects to, so clients can reach it without mDNS; by default the system picks one.
+	const char* port = getenv("ALTSERVER_PORT");
+	if (port != NULL && strlen(port) > 0)
+	{
+		ConnectionManager::instance()->setPort(std::max(0, atoi(port)));
+	}
+
+	// ALTSERVER_SIGNED_APP_CACHE_SIZE sets how many megabytes of signed apps are kept for reinstalls; 0 disables the cache.
+	const char* signedAppCacheSize = getenv("ALTSERVER_SIGNED_APP_CACHE_SIZE");
+	if (signedAppCacheSize != NULL)
+	{
+		SignedAppCache::instance()->setQuota((uint64_t)std::max(0, atoi(signedAppCacheSize)) * 1024 * 1024);
+	}
+
+	// ALTSERVER_WORKSPACE_DIR moves temporary files of installs elsewhere, e.g. to a tmpfs such as /dev/shm.
+	const char* workspaceDirectory = getenv("ALTSERVER_WORKSPACE_DIR");
+	if (workspaceDirectory != NULL && strlen(workspaceDirectory) > 0)
+	{
+		WorkspaceManager::instance()->setRootPath(workspaceDirectory);
+	}
+
+	// ALTSERVER_WORKSPACE_QUOTA sets how many megabytes installs may reserve for temporary files before new ones wait; 0 disables the quota.
+	const char* workspaceQuota = getenv("ALTSERVER_WORKSPACE_QUOTA");
+	if (workspaceQuota != NULL)
+	{
+		WorkspaceManager::instance()->setQuota((uint64_t)std::max(0, atoi(workspaceQuota)) * 1024 * 1024);
+	}
+
+	// ALTSERVER_KEY_POOL_SIZE sets how many certificate keys are kept ready; 0 generates them when needed.
+	const char* keyPoolSize = getenv("ALTSERVER_KEY_POOL_SIZE");
+	if (keyPoolSize != NULL)
+	{
+		CertificateKeyPool::instance()->setCapacity(std::max(0, atoi(keyPoolSize)));
+	}
+
+	try
+	{
+		CertificateKeyPool::instance()->setStorage(this->keysDirectoryPath().string(), CertificateKeyPoolPassphrase(this->appDataDirectoryPath()));
+	}
+	catch (std::exception& e)
+	{
+		// Keys are still pooled in memory.
+		odslog("Failed to set up certificate key storage: " << e.what());
+	}
 }
 
 AltServerApp::~AltServerApp()
@@ -62,6 +330,15 @@ void AltServerApp::Start(HWND windowHandle, HINSTANCE instanceHandle)
 {
 	ConnectionManager::instance()->Start();
 	DeviceManager::instance()->Start();
+
+	// Warm the anisette cache so the first AltStore request doesn't wait on the network.
+	AnisetteDataManager::instance()->PrefetchAnisetteData();
+
+	// Likewise for the key of the next certificate AltServer has to request.
+	CertificateKeyPool::instance()->Refill();
+
+	// Temporary files of installs that were interrupted by quitting.
+	WorkspaceManager::instance()->RemoveLeftoverWorkspaces();
 }
 
 void AltServerApp::Stop()
@@ -87,6 +364,9 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApplication(std::o
 				// This appears to happen when iCloud is running simultaneously, and just happens to provision device at same time as AltServer.
 				AnisetteDataManager::instance()->ResetProvisioning();
 
+				// The saved session is bound to the old anisette identity.
+				SessionManager::instance()->RemoveSession(appleID);
+
 				this->ShowNotification("Registering PC with Apple...", "This may take a few seconds.");
 
 				// Provisioning device can fail if attempted too soon after previous attempt.
@@ -112,6 +392,16 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApplication(std::o
 
 			this->ShowNotification("Installation Succeeded", ss.str());
 
+			LogAPICacheStatistics();
+			LogAPISchedulerStatistics();
+			LogCertificateKeyPoolStatistics();
+			LogCertificateStoreStatistics();
+			LogSignedAppCacheStatistics();
+			LogWorkspaceStatistics();
+			LogApplicationStatistics();
+			LogProvisioningProfileCacheStatistics();
+			LogLoggerStatistics();
+
 			return application;
 		}
 		catch (InstallError& error)
@@ -158,22 +448,49 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApplication(std::o
 
 pplx::task<std::shared_ptr<Application>> AltServerApp::_InstallApplication(std::optional<std::string> filepath, std::shared_ptr<Device> installDevice, std::string appleID, std::string password)
 {
-    fs::path destinationDirectoryPath(temporary_directory());
-    destinationDirectoryPath.append(make_uuid());
+	// Holds the unzipped app until every stage has settled.
+	auto workspace = std::make_shared<std::shared_ptr<Workspace>>();
     
 	auto account = std::make_shared<Account>();
-	auto app = std::make_shared<Application>();
 	auto team = std::make_shared<Team>();
-	auto device = std::make_shared<Device>();
-	auto appID = std::make_shared<AppID>();
-	auto certificate = std::make_shared<Certificate>();
-	auto profile = std::make_shared<ProvisioningProfile>();
 
 	auto session = std::make_shared<AppleAPISession>();
+	auto reusedSession = std::make_shared<bool>(false);
 
-	return pplx::create_task([=]() {
-		auto anisetteData = AnisetteDataManager::instance()->FetchAnisetteData();
-		return this->Authenticate(appleID, password, anisetteData);
+	auto timeline = std::make_shared<InstallTimeline>();
+	if (auto trace = timeline->trace())
+	{
+		trace->SetArgument("device", installDevice->name());
+		trace->SetArgument("udid", installDevice->identifier());
+	}
+
+	// Identifies the .ipa's contents for the signed app cache.
+	auto appHash = std::make_shared<std::optional<std::string>>();
+
+	// Stages only wait for the stages whose results they use:
+	//
+	//   Authenticate -> Fetch team -+-> Register device ---+-> Prepare profiles -+-> Install app
+	//                               +-> Fetch certificate -|---------------------+
+	//   Download app -> Unzip app -------------------------+
+
+	auto teamTask = TimeStage(timeline, "Authenticate", [=]() {
+		return pplx::create_task([=]() {
+			auto anisetteData = AnisetteDataManager::instance()->FetchAnisetteData();
+
+			if (anisetteData != NULL)
+			{
+				auto cachedSession = SessionManager::instance()->CachedSession(appleID, password, anisetteData);
+				if (cachedSession.has_value())
+				{
+					odslog("Reusing session for " << appleID << "...");
+
+					*reusedSession = true;
+					return pplx::task_from_result(*cachedSession);
+				}
+			}
+
+			return this->Authenticate(appleID, password, anisetteData);
+		});
 	})
     .then([=](std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>> pair)
           {
@@ -182,100 +499,187 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::_InstallApplication(std::
 
 			  odslog("Fetching team...");
 
-              return this->FetchTeam(account, session);
+              // Fetching teams is the first authenticated request, so it also tells us whether a reused session is still valid.
+              // Cached teams wouldn't, and a rejected session would only fail later stages that can't sign in again.
+              return TimeStage(timeline, "Fetch team", [=]() {
+                  return this->FetchTeam(account, session, !*reusedSession);
+              })
+              .then([=](pplx::task<std::shared_ptr<Team>> task) -> pplx::task<std::shared_ptr<Team>> {
+                  try
+                  {
+                      return pplx::task_from_result(task.get());
+                  }
+                  catch (LocalizedError& error)
+                  {
+                      if (!*reusedSession || !SessionManager::IsSessionRejectedError(error))
+                      {
+                          throw;
+                      }
+
+                      odslog("Saved session for " << appleID << " was rejected, signing in again...");
+                      SessionManager::instance()->RemoveSession(appleID);
+
+                      return TimeStage(timeline, "Reauthenticate", [=]() {
+                          auto anisetteData = AnisetteDataManager::instance()->FetchAnisetteData();
+                          return this->Authenticate(appleID, password, anisetteData)
+                          .then([=](std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>> pair) {
+                              *account = *(pair.first);
+                              *session = *(pair.second);
+
+                              return this->FetchTeam(account, session);
+                          });
+                      });
+                  }
+              });
           })
     .then([=](std::shared_ptr<Team> tempTeam)
           {
+              *team = *tempTeam;
+              return team;
+          });
+
+	// Registering the device and fetching the certificate touch different resources, so they run side by side.
+	auto deviceTask = teamTask.then([=](std::shared_ptr<Team> team)
+		{
 			odslog("Registering device...");
+			return TimeStage(timeline, "Register device", [=]() {
+				return this->RegisterDevice(installDevice, team, session);
+			});
+		});
 
-              *team = *tempTeam;
-              return this->RegisterDevice(installDevice, team, session);
-          })
-    .then([=](std::shared_ptr<Device> tempDevice)
-          {
+	auto certificateTask = teamTask.then([=](std::shared_ptr<Team> team)
+		{
 			odslog("Fetching certificate...");
+			return TimeStage(timeline, "Fetch certificate", [=]() {
+				return this->FetchCertificate(team, session);
+			});
+		});
 
-              *device = *tempDevice;
-              return this->FetchCertificate(team, session);
-          })
-    .then([=](std::shared_ptr<Certificate> tempCertificate)
-          {
-              *certificate = *tempCertificate;
+	// Getting the app doesn't need Apple at all, so it starts right away.
+	pplx::task<fs::path> downloadTask;
+	if (filepath.has_value())
+	{
+		odslog("Importing app...");
+		downloadTask = pplx::task_from_result(fs::path(*filepath));
+	}
+	else
+	{
+		odslog("Downloading app...");
 
-			  if (filepath.has_value())
-			  {
-				  odslog("Importing app...");
+		// Show alert before downloading AltStore.
+		this->ShowInstallationNotification("AltStore", installDevice->name());
+		downloadTask = TimeStage(timeline, "Download app", [=]() {
+			return this->DownloadApp();
+		});
+	}
 
-				  return pplx::create_task([filepath] {
-					  return fs::path(*filepath);
-					});
-			  }
-			  else
-			  {
-				  odslog("Downloading app...");
-
-				  // Show alert before downloading AltStore.
-				  this->ShowInstallationNotification("AltStore", device->name());
-				  return this->DownloadApp();
-			  }
-          })
-    .then([=](fs::path downloadedAppPath)
-          {
+	auto appTask = downloadTask.then([=](fs::path downloadedAppPath)
+		{
 			odslog("Downloaded app!");
 
-              fs::create_directory(destinationDirectoryPath);
-              
-              auto appBundlePath = UnzipAppBundle(downloadedAppPath.string(), destinationDirectoryPath.string());
-			  auto app = std::make_shared<Application>(appBundlePath);
-
-			  if (filepath.has_value())
-			  {
-				  // Show alert after "downloading" local .ipa.
-				  this->ShowInstallationNotification(app->name(), device->name());
-			  }
-			  else
-			  {
-				  // Remove downloaded app.
-
-				  try
-				  {
-					  fs::remove(downloadedAppPath);
-				  }
-				  catch (std::exception& e)
-				  {
-					  odslog("Failed to remove downloaded .ipa." << e.what());
-				  }
-			  }              
-              
-              return app;
-          })
-    .then([=](std::shared_ptr<Application> tempApp)
-          {
-			  odslog("Preparing provisioning profiles!");
-              *app = *tempApp;
-			  return this->PrepareAllProvisioningProfiles(app, device, team, session);
-          })
-    .then([=](std::map<std::string, std::shared_ptr<ProvisioningProfile>> profiles)
-          {
-			  odslog("Installing apps!");
-              return this->InstallApp(app, device, team, certificate, profiles);
-          })
-    .then([=](pplx::task<std::shared_ptr<Application>> task)
+			return TimeStage(timeline, "Unzip app", [=]() {
+				// Waits here if other installs' temporary files already fill the workspace quota.
+				return WorkspaceManager::instance()->Allocate(WorkspaceManager::UnzippedAppSize(fs::file_size(downloadedAppPath)))
+				.then([=](std::shared_ptr<Workspace> allocatedWorkspace) {
+					*workspace = allocatedWorkspace;
+
+					auto hashTask = pplx::create_task([=]() -> std::optional<std::string> {
+						try
+						{
+							return SignedAppCache::HashFile(downloadedAppPath.string());
+						}
+						catch (std::exception& e)
+						{
+							odslog("Failed to hash .ipa, it won't be cached once signed. " << e.what());
+							return std::nullopt;
+						}
+					});
+
+					auto appBundlePath = UnzipAppBundle(downloadedAppPath.string(), allocatedWorkspace->path());
+					auto app = std::make_shared<Application>(appBundlePath);
+
+					if (auto trace = timeline->trace())
+					{
+						trace->SetArgument("app", app->bundleIdentifier());
+						trace->SetArgument("ipa_bytes", (uint64_t)fs::file_size(downloadedAppPath));
+					}
+
+					// Finish hashing before later stages read appHash.
+					*appHash = hashTask.get();
+
+					if (filepath.has_value())
+					{
+						// Show alert after "downloading" local .ipa.
+						this->ShowInstallationNotification(app->name(), installDevice->name());
+					}
+
+					// Downloaded apps stay in AppDownloadCache for the next install.
+
+					return app;
+				});
+			});
+		});
+
+	std::vector<pplx::task<void>> profileDependencies = { appTask.then([](std::shared_ptr<Application>) {}), deviceTask.then([](std::shared_ptr<Device>) {}) };
+	auto profilesTask = pplx::when_all(profileDependencies.begin(), profileDependencies.end())
+		.then([=]()
+		{
+			odslog("Preparing provisioning profiles!");
+
+			auto app = appTask.get();
+			auto device = deviceTask.get();
+
+			return TimeStage(timeline, "Prepare profiles", [=]() {
+				return this->PrepareAllProvisioningProfiles(app, device, team, session);
+			});
+		});
+
+	std::vector<pplx::task<void>> installDependencies = { profilesTask.then([](std::map<std::string, std::shared_ptr<ProvisioningProfile>>) {}), certificateTask.then([](std::shared_ptr<Certificate>) {}) };
+	auto installTask = pplx::when_all(installDependencies.begin(), installDependencies.end())
+		.then([=]()
+		{
+			odslog("Installing apps!");
+
+			auto app = appTask.get();
+			auto device = deviceTask.get();
+			auto certificate = certificateTask.get();
+			auto profiles = profilesTask.get();
+
+			return TimeStage(timeline, "Install app", [=]() {
+				return this->InstallApp(app, device, team, certificate, profiles, *appHash);
+			});
+		});
+
+	// Wait for every branch to settle, even after one fails, so nothing is still writing to the
+	// workspace when we release it and no failed task goes unobserved.
+	std::vector<pplx::task<void>> stages = {
+		teamTask.then([](pplx::task<std::shared_ptr<Team>> task) { try { task.get(); } catch (...) {} }),
+		deviceTask.then([](pplx::task<std::shared_ptr<Device>> task) { try { task.get(); } catch (...) {} }),
+		certificateTask.then([](pplx::task<std::shared_ptr<Certificate>> task) { try { task.get(); } catch (...) {} }),
+		appTask.then([](pplx::task<std::shared_ptr<Application>> task) { try { task.get(); } catch (...) {} }),
+		profilesTask.then([](pplx::task<std::map<std::string, std::shared_ptr<ProvisioningProfile>>> task) { try { task.get(); } catch (...) {} }),
+		installTask.then([](pplx::task<std::shared_ptr<Application>> task) { try { task.get(); } catch (...) {} }),
+	};
+
+	return pplx::when_all(stages.begin(), stages.end())
+    .then([=]()
           {
-			if (fs::exists(destinationDirectoryPath))
-			{
-				std::string comm = "rm -rf '";
-				comm += destinationDirectoryPath.string();
-				comm += "'";
-				odslog("Removing tmp dir: " << comm);
-				system(comm.c_str());
-				
-				// if (fs::exists(destinationDirectoryPath)) fs::remove_all(destinationDirectoryPath);
-			}     
+			timeline->Log();
+			Tracer::instance()->FinishTrace(timeline->trace());
+
+			// Removed in the background, so the result isn't held up by deleting the unzipped app.
+			workspace->reset();
 
 			try
 			{
-				auto application = task.get();
+				// Report the failure of the earliest stage, as the sequential workflow did; later stages fail with the same error.
+				teamTask.get();
+				deviceTask.get();
+				certificateTask.get();
+				appTask.get();
+				profilesTask.get();
+
+				auto application = installTask.get();
 				return application;
 			}
 			catch (LocalizedError& error)
@@ -301,43 +705,43 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::_InstallApplication(std::
 
 pplx::task<fs::path> AltServerApp::DownloadApp()
 {
-    fs::path temporaryPath(temporary_directory());
-    temporaryPath.append(make_uuid());
-    
-    auto outputFile = std::make_shared<ostream>();
-    
-    // Open stream to output file.
-    auto task = fstream::open_ostream((temporaryPath.string()))
-    .then([=](ostream file)
-          {
-              *outputFile = file;
-              
-              uri_builder builder("https://cdn.altstore.io/file/altstore/altstore.ipa");
-              
-              http_client client(builder.to_uri());
-              return client.request(methods::GET);
-          })
-    .then([=](http_response response)
-          {
-              printf("Received download response status code:%u\n", response.status_code());
-              
-              // Write response body into the file.
-              return response.body().read_to_end(outputFile->streambuf());
-          })
-    .then([=](size_t)
-          {
-              outputFile->close();
-              return temporaryPath;
-          });
-    
-    return task;
+	// ALTSERVER_ALTSTORE_URL downloads AltStore from elsewhere, e.g. a local mirror.
+	std::string url = "https://cdn.altstore.io/file/altstore/altstore.ipa";
+
+	const char* altstoreURL = getenv("ALTSERVER_ALTSTORE_URL");
+	if (altstoreURL != NULL && strlen(altstoreURL) > 0)
+	{
+		url = altstoreURL;
+	}
+
+	// ALTSERVER_ALTSTORE_SHA256 pins the expected checksum; without it the download is only checked against itself when reused.
+	std::optional<std::string> expectedSHA256 = std::nullopt;
+
+	const char* sha256 = getenv("ALTSERVER_ALTSTORE_SHA256");
+	if (sha256 != NULL && strlen(sha256) > 0)
+	{
+		std::string hash(sha256);
+		std::transform(hash.begin(), hash.end(), hash.begin(), ::tolower);
+		expectedSHA256 = hash;
+	}
+
+	return AppDownloadCache::instance()->Download(url, expectedSHA256)
+	.then([](std::string path) {
+		auto statistics = AppDownloadCache::instance()->statistics();
+		odslog("AltStore downloads: " << statistics.completeDownloads << " complete, " << statistics.resumedDownloads << " resumed, " << statistics.notModifiedResponses << " not modified, "
+			<< statistics.sharedDownloads << " shared; " << statistics.bytesDownloaded << " bytes downloaded, " << statistics.bytesReused << " reused");
+
+		return fs::path(path);
+	});
 }
 
 pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>> AltServerApp::Authenticate(std::string appleID, std::string password, std::shared_ptr<AnisetteData> anisetteData)
 {
 	auto verificationHandler = [=](void)->pplx::task<std::optional<std::string>> {
 		return pplx::create_task([=]() -> std::optional<std::string> {
-			std::cout << "Enter two factor code" << std::endl;
+			// Through the logger, so lines logged before it can't appear after it.
+			Logger::instance()->Prompt("Enter two factor code\n");
+
 			std::string _verificationCode = "";
 			std::cin >> _verificationCode;
 			auto verificationCode = std::make_optional<std::string>(_verificationCode);
@@ -354,12 +758,16 @@ pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>
 		}
 
 		return AppleAPI::getInstance()->Authenticate(appleID, password, anisetteData, verificationHandler);
+	})
+	.then([=](std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>> pair) {
+		SessionManager::instance()->SaveSession(appleID, password, pair.first, pair.second);
+		return pair;
 	});
 }
 
-pplx::task<std::shared_ptr<Team>> AltServerApp::FetchTeam(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session)
+pplx::task<std::shared_ptr<Team>> AltServerApp::FetchTeam(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache)
 {
-    auto task = AppleAPI::getInstance()->FetchTeams(account, session)
+    auto task = AppleAPI::getInstance()->FetchTeams(account, session, usesCache)
     .then([](std::vector<std::shared_ptr<Team>> teams) {
 
 		for (auto& team : teams)
@@ -423,19 +831,31 @@ pplx::task<std::shared_ptr<Certificate>> AltServerApp::FetchCertificate(std::sha
 					}
 				}
 
-				if (fs::exists(cachedCertificatePath) && certificate->machineIdentifier().has_value())
+				if (certificate->machineIdentifier().has_value())
 				{
 					try
 					{
-						auto data = readFile(cachedCertificatePath.string().c_str());
-						auto cachedCertificate = std::make_shared<Certificate>(data, *certificate->machineIdentifier());
-
-						// Manually set machineIdentifier so we can encrypt + embed certificate if needed.
-						cachedCertificate->setMachineIdentifier(*certificate->machineIdentifier());
-
-						return pplx::create_task([cachedCertificate] {
+						auto machineIdentifier = *certificate->machineIdentifier();
+						auto cachedCertificate = CertificateStore::instance()->LoadCertificate(team->identifier(), certificate->serialNumber(), [cachedCertificatePath, machineIdentifier]() -> std::shared_ptr<Certificate> {
+							if (!fs::exists(cachedCertificatePath))
+							{
+								return nullptr;
+							}
+
+							auto data = readFile(cachedCertificatePath.string().c_str());
+							auto cachedCertificate = std::make_shared<Certificate>(data, machineIdentifier);
+
+							// Manually set machineIdentifier so we can encrypt + embed certificate if needed.
+							cachedCertificate->setMachineIdentifier(machineIdentifier);
 							return cachedCertificate;
 						});
+
+						if (cachedCertificate != nullptr)
+						{
+							return pplx::create_task([cachedCertificate] {
+								return cachedCertificate;
+							});
+						}
 					}
 					catch(std::exception &e)
 					{
@@ -456,8 +876,9 @@ pplx::task<std::shared_ptr<Certificate>> AltServerApp::FetchCertificate(std::sha
               if (certificates.size() != 0)
               {
                   auto certificate = (preferredCertificate != nullptr) ? preferredCertificate : certificates[0];
-                  return AppleAPI::getInstance()->RevokeCertificate(certificate, team, session).then([this, team, session](bool success)
+                  return AppleAPI::getInstance()->RevokeCertificate(certificate, team, session).then([this, team, session, certificate](bool success)
                                                                                             {
+                                                                                                CertificateStore::instance()->RemoveCertificate(team->identifier(), certificate->serialNumber());
                                                                                                 return this->FetchCertificate(team, session);
                                                                                             });
               }
@@ -475,7 +896,7 @@ pplx::task<std::shared_ptr<Certificate>> AltServerApp::FetchCertificate(std::sha
                             }
                                                                                              
                             return AppleAPI::getInstance()->FetchCertificates(team, session)
-                            .then([privateKey, addedCertificate, cachedCertificatePath](std::vector<std::shared_ptr<Certificate>> certificates)
+                            .then([team, privateKey, addedCertificate, cachedCertificatePath](std::vector<std::shared_ptr<Certificate>> certificates)
                                 {
                                     std::shared_ptr<Certificate> certificate = nullptr;
                                                                                                        
@@ -501,7 +922,8 @@ pplx::task<std::shared_ptr<Certificate>> AltServerApp::FetchCertificate(std::sha
 										{
 											auto machineIdentifier = certificate->machineIdentifier();
 
-											auto encryptedData = certificate->encryptedP12Data(*machineIdentifier);
+											// Also stores the encrypted .p12 for AltStore's install to embed.
+											auto encryptedData = CertificateStore::instance()->EncryptedP12Data(team->identifier(), certificate, *machineIdentifier);
 											if (encryptedData.has_value())
 											{
 												std::ofstream fout(cachedCertificatePath.string(), std::ios::out | std::ios::binary);
@@ -823,23 +1245,26 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
                             std::shared_ptr<Device> device,
                             std::shared_ptr<Team> team,
                             std::shared_ptr<Certificate> certificate,
-                            std::map<std::string, std::shared_ptr<ProvisioningProfile>> profilesByBundleID)
+                            std::map<std::string, std::shared_ptr<ProvisioningProfile>> profilesByBundleID,
+                            std::optional<std::string> appHash)
 {
 	auto prepareInfoPlist = [profilesByBundleID](std::shared_ptr<Application> app, plist_t additionalValues){
+		TraceSpan span("sign", "Prepare Info.plist");
+		span.set("app", app->bundleIdentifier());
+
 		auto profile = profilesByBundleID.at(app->bundleIdentifier());
 
 		fs::path infoPlistPath(app->path());
 		infoPlistPath.append("Info.plist");
 
-		auto data = readFile(infoPlistPath.string().c_str());
-
-		plist_t plist = nullptr;
-		plist_from_memory((const char*)data.data(), (int)data.size(), &plist);
-		if (plist == nullptr)
+		// Application already parsed Info.plist, and it hasn't been changed since.
+		if (app->infoPlist() == nullptr)
 		{
 			throw InstallError(InstallErrorCode::MissingInfoPlist);
 		}
 
+		plist_t plist = plist_copy(app->infoPlist());
+
 		plist_dict_set_item(plist, "CFBundleIdentifier", plist_new_string(profile->bundleIdentifier().c_str()));
 		plist_dict_set_item(plist, "ALTBundleIdentifier", plist_new_string(app->bundleIdentifier().c_str()));
 
@@ -862,17 +1287,13 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 		std::ofstream fout(infoPlistPath.string(), std::ios::out | std::ios::binary);
 		fout.write(plistXML, length);
 		fout.close();
+
+		free(plistXML);
+		plist_free(plist);
 	};
 
     return pplx::task<std::shared_ptr<Application>>([=]() {
-        fs::path infoPlistPath(app->path());
-        infoPlistPath.append("Info.plist");
-        
-		odslog("Signing: Reading InfoPlist...");
-        auto data = readFile(infoPlistPath.string().c_str());
-        
-        plist_t plist = nullptr;
-        plist_from_memory((const char *)data.data(), (int)data.size(), &plist);
+        plist_t plist = app->infoPlist();
         if (plist == nullptr)
         {
             throw InstallError(InstallErrorCode::MissingInfoPlist);
@@ -913,7 +1334,7 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 			auto machineIdentifier = certificate->machineIdentifier();
 			if (machineIdentifier.has_value())
 			{
-				auto encryptedData = certificate->encryptedP12Data(*machineIdentifier);
+				auto encryptedData = CertificateStore::instance()->EncryptedP12Data(team->identifier(), certificate, *machineIdentifier);
 				if (encryptedData.has_value())
 				{
 					plist_dict_set_item(additionalValues, "ALTCertificateID", plist_new_string(certificate->serialNumber().c_str()));
@@ -929,16 +1350,6 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 			}
 		}        
 
-		odslog("Signing: Preparing InfoPlist...");
-		prepareInfoPlist(app, additionalValues);
-
-		for (auto appExtension : app->appExtensions())
-		{
-			odslog("Signing: Preparing InfoPlist for extensions...");
-			prepareInfoPlist(appExtension, NULL);
-		}
-
-		odslog("Signing: Preparing provisioning profiles...");
 		std::vector<std::shared_ptr<ProvisioningProfile>> profiles;
 		std::set<std::string> profileIdentifiers;
 		for (auto pair : profilesByBundleID)
@@ -946,10 +1357,52 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 			profiles.push_back(pair.second);
 			profileIdentifiers.insert(pair.second->bundleIdentifier());
 		}
-        
-		odslog("Signing: Signing app...");
-        Signer signer(team, certificate);
-        signer.SignApp(app->path(), profiles);
+
+		// The signed bundle only depends on the .ipa, the certificate, the profiles, and the values we add to Info.plist,
+		// so installing the same app to another device covered by the same profiles can reuse it.
+		std::optional<std::string> cacheKey = std::nullopt;
+		if (appHash.has_value())
+		{
+			std::vector<std::string> components = { *appHash, certificate->serialNumber(), certificate->machineIdentifier().value_or("") };
+			for (auto& profile : profiles)
+			{
+				// Ordered by bundle ID, since profilesByBundleID is a map.
+				components.push_back(profile->uuid());
+			}
+
+			char* additionalValuesXML = nullptr;
+			uint32_t length = 0;
+			plist_to_xml(additionalValues, &additionalValuesXML, &length);
+			components.push_back(std::string(additionalValuesXML, length));
+			free(additionalValuesXML);
+
+			cacheKey = SignedAppCache::Key(components);
+		}
+
+		// Keeps the cached bundle from being evicted until the install is done with it, however it ends.
+		auto cachedApp = cacheKey.has_value() ? SignedAppCache::instance()->LookUp(*cacheKey) : nullptr;
+		auto appPath = (cachedApp != nullptr) ? cachedApp->path() : app->path();
+
+		if (cachedApp != nullptr)
+		{
+			odslog("Signing: Reusing signed app " << cachedApp->path() << "...");
+			plist_free(additionalValues);
+		}
+		else
+		{
+			odslog("Signing: Preparing InfoPlist...");
+			prepareInfoPlist(app, additionalValues);
+
+			for (auto appExtension : app->appExtensions())
+			{
+				odslog("Signing: Preparing InfoPlist for extensions...");
+				prepareInfoPlist(appExtension, NULL);
+			}
+
+			odslog("Signing: Signing app...");
+			Signer signer(team, certificate);
+			signer.SignApp(app->path(), profiles);
+		}
 
 		std::optional<std::set<std::string>> activeProfiles = std::nullopt;
 		if (team->type() == Team::Type::Free && app->isAltStoreApp())
@@ -958,10 +1411,25 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 		}
         
 		odslog("Signing: Installing app...");
-		return DeviceManager::instance()->InstallApp(app->path(), device->identifier(), activeProfiles, [](double progress) {
-			odslog("Installation Progress: " << progress);
+		return DeviceManager::instance()->InstallApp(appPath, device->identifier(), activeProfiles, [](double progress) {
+			odstrace("Installation Progress: " << progress);
 		})
-		.then([app] {
+		.then([app, cacheKey, cachedApp](pplx::task<void> task) {
+			task.get();
+
+			if (cacheKey.has_value() && cachedApp == nullptr)
+			{
+				// Only cache bundles the device accepted.
+				try
+				{
+					SignedAppCache::instance()->Store(*cacheKey, app->path());
+				}
+				catch (std::exception& e)
+				{
+					odslog("Failed to cache signed app. " << e.what());
+				}
+			}
+
 			return app;
 		});
     });
@@ -969,13 +1437,13 @@ pplx::task<std::shared_ptr<Application>> AltServerApp::InstallApp(std::shared_pt
 
 void AltServerApp::ShowNotification(std::string title, std::string message)
 {
-	std::cout << "Notify: " << title << std::endl << "    " << message << std::endl;
+	odslog("Notify: " << title << "\n    " << message);
 }
 
 void AltServerApp::ShowAlert(std::string title, std::string message)
 {
-	std::cout << "Alert: " << title << std::endl << "    " << message << std::endl;
-	std::cout << "Press any key to continue..." << std::endl;
+	Logger::instance()->Prompt("Alert: " + title + "\n    " + message + "\nPress any key to continue...\n");
+
 	char a;
 	std::cin >> a;
 }
@@ -1018,6 +1486,58 @@ fs::path AltServerApp::appDataDirectoryPath() const
 	return altserverDirectoryPath;
 }
 
+fs::path AltServerApp::sessionsDirectoryPath() const
+{
+	auto appDataPath = this->appDataDirectoryPath();
+	auto sessionsDirectoryPath = appDataPath.append("Sessions");
+
+	if (!fs::exists(sessionsDirectoryPath))
+	{
+		fs::create_directory(sessionsDirectoryPath);
+	}
+
+	return sessionsDirectoryPath;
+}
+
+fs::path AltServerApp::downloadsDirectoryPath() const
+{
+	auto appDataPath = this->appDataDirectoryPath();
+	auto downloadsDirectoryPath = appDataPath.append("Downloads");
+
+	if (!fs::exists(downloadsDirectoryPath))
+	{
+		fs::create_directory(downloadsDirectoryPath);
+	}
+
+	return downloadsDirectoryPath;
+}
+
+fs::path AltServerApp::signedAppsDirectoryPath() const
+{
+	auto appDataPath = this->appDataDirectoryPath();
+	auto signedAppsDirectoryPath = appDataPath.append("SignedApps");
+
+	if (!fs::exists(signedAppsDirectoryPath))
+	{
+		fs::create_directory(signedAppsDirectoryPath);
+	}
+
+	return signedAppsDirectoryPath;
+}
+
+fs::path AltServerApp::keysDirectoryPath() const
+{
+	auto appDataPath = this->appDataDirectoryPath();
+	auto keysDirectoryPath = appDataPath.append("Keys");
+
+	if (!fs::exists(keysDirectoryPath))
+	{
+		fs::create_directory(keysDirectoryPath);
+	}
+
+	return keysDirectoryPath;
+}
+
 fs::path AltServerApp::certificatesDirectoryPath() const
 {
 	auto appDataPath = this->appDataDirectoryPath();
@@ -67,6 +67,10 @@ public:
 	std::string appleFolderPath() const;
 	std::string internetServicesFolderPath() const;
 	std::string applicationSupportFolderPath() const;
+
+	fs::path sessionsDirectoryPath() const;
+	fs::path signedAppsDirectoryPath() const;
+	fs::path downloadsDirectoryPath() const;
 private:
 	AltServerApp();
 	~AltServerApp();
@@ -95,13 +99,14 @@ private:
 
 	fs::path appDataDirectoryPath() const;
 	fs::path certificatesDirectoryPath() const;
+	fs::path keysDirectoryPath() const;
 
     pplx::task<fs::path> DownloadApp();
 
 	void ShowInstallationNotification(std::string appName, std::string deviceName);
     
 	pplx::task<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>>  Authenticate(std::string appleID, std::string password, std::shared_ptr<AnisetteData> anisetteData);
-    pplx::task<std::shared_ptr<Team>> FetchTeam(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session);
+    pplx::task<std::shared_ptr<Team>> FetchTeam(std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session, bool usesCache = true);
     pplx::task<std::shared_ptr<Certificate>> FetchCertificate(std::shared_ptr<Team> team, std::shared_ptr<AppleAPISession> session);
 	pplx::task<std::map<std::string, std::shared_ptr<ProvisioningProfile>>> PrepareAllProvisioningProfiles(
 		std::shared_ptr<Application> application,
@@ -124,5 +129,6 @@ private:
 		std::shared_ptr<Device> device,
 		std::shared_ptr<Team> team,
 		std::shared_ptr<Certificate> certificate,
-		std::map<std::string, std::shared_ptr<ProvisioningProfile>> profiles);
+		std::map<std::string, std::shared_ptr<ProvisioningProfile>> profiles,
+		std::optional<std::string> appHash);
 };
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <fstream>
 #include <iterator>
@@ -13,12 +15,14 @@
 #include <iomanip>
 #include <codecvt>
 #include <random>
+#include <thread>
 
 #define _T(x) x
 
 // AltSign
 #include "DeviceManager.hpp"
 #include "Error.hpp"
+#include "Tracer.hpp"
 
 #include "AltServerApp.h"
 
@@ -27,47 +31,6 @@
 #include <pplx/pplxtasks.h>
 #include <pplx/threadpool.h>
 
-#include <uuid/uuid.h>
-std::string make_uuid() {
-    uuid_t b;
-	char out[UUID_STR_LEN] = {0};
-	uuid_generate(b);
-  	uuid_unparse_lower(b, out);
-	return out;
-}
-
-std::string temporary_directory()
-{
-	return fs::temp_directory_path().string();
-}
-
-std::vector<unsigned char> readFile(const char* filename)
-{
-	// open the file:
-	std::ifstream file(filename, std::ios::binary);
-
-	// Stop eating new lines in binary mode!!!
-	file.unsetf(std::ios::skipws);
-
-	// get its size:
-	std::streampos fileSize;
-
-	file.seekg(0, std::ios::end);
-	fileSize = file.tellg();
-	file.seekg(0, std::ios::beg);
-
-	// reserve capacity
-	std::vector<unsigned char> vec;
-	vec.reserve(fileSize);
-
-	// read the data:
-	vec.insert(vec.begin(),
-		std::istream_iterator<unsigned char>(file),
-		std::istream_iterator<unsigned char>());
-
-	return vec;
-}
-
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 
@@ -103,6 +66,24 @@ int setupHeartbeatTimer() {
 	return 1;
 }
 
+// Logs the stage duration histograms on every SIGUSR1. Must be called before any other thread starts,
+// so they all inherit the blocked signal and only the waiting thread receives it.
+void setupHistogramSignal() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	std::thread([signals]() {
+		while (1) {
+			int signal = 0;
+			if (sigwait(&signals, &signal) == 0) {
+				Tracer::instance()->LogHistograms();
+			}
+		}
+	}).detach();
+}
+
 #define BOOST_STACKTRACE_GNU_SOURCE_NOT_REQUIRED
 #include <boost/stacktrace.hpp>
 
@@ -173,6 +154,8 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
+	setupHistogramSignal();
+
 	setvbuf(stdin, NULL, _IONBF, 0); 
     setvbuf(stdout, NULL, _IONBF, 0); 
     setvbuf(stderr, NULL, _IONBF, 0); 
@@ -8,8 +8,12 @@
 #include <ctime>
 #include <cstdlib>
 
+#include <pplx/threadpool.h>
+
 #include "AnisetteData.h"
+#include "AnisetteProvider.h"
 #include "AltServerApp.h"
+#include "Tracer.hpp"
 
 AnisetteDataManager* AnisetteDataManager::_instance = nullptr;
 
@@ -23,8 +27,55 @@ AnisetteDataManager* AnisetteDataManager::instance()
 	return _instance;
 }
 
-AnisetteDataManager::AnisetteDataManager() : loadedDependencies(false)
+// Apple accepts a one-time password for a while after it was generated, so a recent
+// response can be handed out again instead of asking the server for every request.
+#define DEFAULT_ANISETTE_DATA_LIFETIME 60
+
+#define DEFAULT_ANISETTE_SERVER "https://armconverter.com/anisette/irGb3Quww8zrhgqnzmrx"
+
+AnisetteDataManager::AnisetteDataManager() : loadedDependencies(false), _anisetteDataGeneration(0), _anisetteDataAccessed(false),
+	_anisetteDataLifetime(DEFAULT_ANISETTE_DATA_LIFETIME)
 {
+	// ALTSERVER_ANISETTE_TTL=0 disables caching; concurrent callers still share one fetch.
+	const char* lifetime = getenv("ALTSERVER_ANISETTE_TTL");
+	if (lifetime != NULL)
+	{
+		_anisetteDataLifetime = std::chrono::seconds(std::max(0, atoi(lifetime)));
+	}
+
+	// ALTSERVER_ANISETTE_SERVERS lists anisette servers in order of preference, separated by commas,
+	// e.g. a local AnisetteStandIn or anisette server first and a public one as fallback.
+	std::vector<std::string> urls;
+
+	const char* servers = getenv("ALTSERVER_ANISETTE_SERVERS");
+	if (servers != NULL)
+	{
+		std::stringstream ss(servers);
+		std::string url;
+		while (std::getline(ss, url, ','))
+		{
+			url.erase(0, url.find_first_not_of(" \t"));
+			url.erase(url.find_last_not_of(" \t") + 1);
+
+			if (!url.empty())
+			{
+				urls.push_back(url);
+			}
+		}
+	}
+
+	if (urls.empty())
+	{
+		urls.push_back(DEFAULT_ANISETTE_SERVER);
+	}
+
+	std::vector<std::shared_ptr<AnisetteProvider>> providers;
+	for (auto& url : urls)
+	{
+		providers.push_back(std::make_shared<RemoteAnisetteProvider>(url));
+	}
+
+	_anisetteProvider = std::make_shared<FailoverAnisetteProvider>(providers);
 }
 
 AnisetteDataManager::~AnisetteDataManager()
@@ -47,91 +98,176 @@ using namespace web;                        // Common features like URIs.
 using namespace web::http;                  // Common HTTP functionality
 using namespace web::http::client;          // HTTP client features
 
+std::chrono::seconds AnisetteDataManager::anisetteDataLifetime() const
+{
+	return _anisetteDataLifetime;
+}
+
+std::shared_ptr<AnisetteProvider> AnisetteDataManager::provider()
+{
+	std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+	return _anisetteProvider;
+}
+
+void AnisetteDataManager::setProvider(std::shared_ptr<AnisetteProvider> provider)
+{
+	{
+		std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+		_anisetteProvider = provider;
+	}
+
+	this->InvalidateAnisetteData();
+}
+
 std::shared_ptr<AnisetteData> AnisetteDataManager::FetchAnisetteData()
 {
-	std::string wideURI = ("/anisette/irGb3Quww8zrhgqnzmrx");
-	
-	auto encodedURI = web::uri::encode_uri(wideURI);
-	uri_builder builder(encodedURI);
-
-	http_request request(methods::GET);
-	request.set_request_uri(builder.to_string());
-	
-	std::map<utility::string_t, utility::string_t> headers = {
-		{"User-Agent", "Xcode"},
-	};
+	TraceSpan span("anisette", "Fetch anisette");
+
+	pplx::task<std::shared_ptr<AnisetteData>> task;
 
-	for (auto& pair : headers)
 	{
-		if (request.headers().has(pair.first))
+		std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+		_anisetteDataAccessed = true;
+
+		if (_anisetteData != nullptr && std::chrono::steady_clock::now() - _anisetteDataFetchDate < _anisetteDataLifetime)
 		{
-			request.headers().remove(pair.first);
+			span.set("source", "cache");
+			return _anisetteData;
 		}
 
-		request.headers().add(pair.first, pair.second);
+		span.set("source", _anisetteDataTask.has_value() ? "prefetch" : "server");
+		task = _anisetteDataTask.has_value() ? *_anisetteDataTask : this->StartFetchingAnisetteData();
 	}
 
-	std::shared_ptr<AnisetteData> anisetteData = NULL;
+	return task.get();
+}
 
-	auto client = web::http::client::http_client(U("https://armconverter.com"));
-	auto task = client.request(request)
-		.then([=](http_response response)
-			{
-				return response.content_ready();
-			})
-		.then([=](http_response response)
+void AnisetteDataManager::PrefetchAnisetteData()
+{
+	std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+	_anisetteDataAccessed = true;
+
+	if (!_anisetteDataTask.has_value())
+	{
+		this->StartFetchingAnisetteData();
+	}
+}
+
+void AnisetteDataManager::InvalidateAnisetteData()
+{
+	std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+
+	// Results of fetches already in flight are dropped when they complete.
+	_anisetteDataGeneration++;
+	_anisetteData = nullptr;
+	_anisetteDataTask.reset();
+
+	if (_anisetteDataRefreshTimer != nullptr)
+	{
+		_anisetteDataRefreshTimer->cancel();
+		_anisetteDataRefreshTimer = nullptr;
+	}
+}
+
+pplx::task<std::shared_ptr<AnisetteData>> AnisetteDataManager::StartFetchingAnisetteData()
+{
+	auto generation = _anisetteDataGeneration;
+
+	pplx::task<std::shared_ptr<AnisetteData>> request;
+	try
+	{
+		request = _anisetteProvider->FetchAnisetteData();
+	}
+	catch (...)
+	{
+		request = pplx::task_from_exception<std::shared_ptr<AnisetteData>>(std::current_exception());
+	}
+
+	auto task = request
+		.then([this, generation](pplx::task<std::shared_ptr<AnisetteData>> task) {
+			std::shared_ptr<AnisetteData> anisetteData;
+
+			try
 			{
-				odslog("Received response status code: " << response.status_code());
-				return response.extract_json();
-			})
-		.then([&anisetteData](pplx::task<json::value> previousTask)
+				anisetteData = task.get();
+			}
+			catch (...)
 			{
-				odslog("parse anisette data ret");
-				json::value jsonVal = previousTask.get();
-				odslog("Got anisetteData json: " << jsonVal);
-				std::vector<std::string> keys = {
-					"X-Apple-I-MD-M",
-					"X-Apple-I-MD",
-					"X-Apple-I-MD-LU",
-					"X-Apple-I-MD-RINFO",
-					"X-Mme-Device-Id",
-					"X-Apple-I-SRL-NO",
-					"X-MMe-Client-Info",
-					"X-Apple-I-Client-Time",
-					"X-Apple-Locale",
-					"X-Apple-I-TimeZone"
-				};
-				for (auto &key : keys) {
-					odslog(key << ": " << jsonVal.at(key).as_string().c_str());
+				std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+				if (generation == _anisetteDataGeneration)
+				{
+					_anisetteDataTask.reset();
 				}
 
-				struct tm tm = { 0 };
-				strptime(jsonVal.at("X-Apple-I-Client-Time").as_string().c_str(), "%FT%T%z", &tm);
-				time_t ts = mktime(&tm);
-				struct timeval tv = {0};
-				tv.tv_sec = ts;
-
-				odslog("Building anisetteData obj...");
-				anisetteData = std::make_shared<AnisetteData>(
-					jsonVal.at("X-Apple-I-MD-M").as_string(),
-					jsonVal.at("X-Apple-I-MD").as_string(),
-					jsonVal.at("X-Apple-I-MD-LU").as_string(),
-					std::atoi(jsonVal.at("X-Apple-I-MD-RINFO").as_string().c_str()),
-					jsonVal.at("X-Mme-Device-Id").as_string(),
-					jsonVal.at("X-Apple-I-SRL-NO").as_string(),
-					jsonVal.at("X-MMe-Client-Info").as_string(),
-					tv,
-					jsonVal.at("X-Apple-Locale").as_string(),
-					jsonVal.at("X-Apple-I-TimeZone").as_string());
-
-				//IterateJSONValue();
-			});
-	
-	task.wait();
-
-	odslog(*anisetteData);
-
-	return anisetteData;
+				throw;
+			}
+
+			std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+			if (generation == _anisetteDataGeneration)
+			{
+				_anisetteData = anisetteData;
+				_anisetteDataFetchDate = std::chrono::steady_clock::now();
+				_anisetteDataTask.reset();
+
+				this->ScheduleAnisetteDataRefresh();
+			}
+
+			return anisetteData;
+		});
+
+	// Background fetches may have no waiter, and pplx aborts on unobserved exceptions.
+	task.then([](pplx::task<std::shared_ptr<AnisetteData>> task) {
+		try
+		{
+			task.get();
+		}
+		catch (std::exception& exception)
+		{
+			odslog("Failed to fetch anisette data: " << exception.what());
+		}
+	});
+
+	_anisetteDataTask = task;
+	return task;
+}
+
+void AnisetteDataManager::ScheduleAnisetteDataRefresh()
+{
+	if (_anisetteDataLifetime.count() == 0)
+	{
+		return;
+	}
+
+	// Refresh once two thirds of the lifetime have passed, so callers never wait on an expired value.
+	// Refreshing stops while nobody asks for anisette data.
+	auto& ioService = crossplat::threadpool::shared_instance().service();
+
+	auto timer = std::make_shared<boost::asio::steady_timer>(ioService, _anisetteDataLifetime * 2 / 3);
+	auto generation = _anisetteDataGeneration;
+
+	_anisetteDataRefreshTimer = timer;
+	_anisetteDataAccessed = false;
+
+	timer->async_wait([this, timer, generation](const boost::system::error_code& error) {
+		if (error)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(_anisetteDataMutex);
+		if (generation != _anisetteDataGeneration || _anisetteDataRefreshTimer != timer)
+		{
+			return;
+		}
+
+		_anisetteDataRefreshTimer = nullptr;
+
+		if (_anisetteDataAccessed && !_anisetteDataTask.has_value())
+		{
+			odslog("Refreshing anisette data in the background...");
+			this->StartFetchingAnisetteData();
+		}
+	});
 }
 
 bool AnisetteDataManager::ReprovisionDevice(std::function<void(void)> provisionCallback)
@@ -245,6 +381,8 @@ bool AnisetteDataManager::ReprovisionDevice(std::function<void(void)> provisionC
 
 bool AnisetteDataManager::ResetProvisioning()
 {
+	this->InvalidateAnisetteData();
+
 	std::string adiDirectoryPath = "C:\\ProgramData\\Apple Computer\\iTunes\\adi";
 
 	// Remove existing AltServer .pb files so we can create new ones next time we provision this device.
@@ -2,10 +2,17 @@
 
 #include <memory>
 #include <functional>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+#include <pplx/pplxtasks.h>
+#include <boost/asio/steady_timer.hpp>
 
 #include "Error.hpp"
 
 class AnisetteData;
+class AnisetteProvider;
 
 enum class AnisetteErrorCode
 {
@@ -65,7 +72,20 @@ class AnisetteDataManager
 public:
 	static AnisetteDataManager* instance();
 
+	// Returns cached anisette data while it is younger than anisetteDataLifetime(),
+	// otherwise waits for a fetch shared with any other caller.
 	std::shared_ptr<AnisetteData> FetchAnisetteData();
+
+	// Starts a fetch in the background so the next FetchAnisetteData() is a memory read.
+	void PrefetchAnisetteData();
+	void InvalidateAnisetteData();
+
+	std::chrono::seconds anisetteDataLifetime() const;
+
+	// Defaults to the servers in ALTSERVER_ANISETTE_SERVERS, with failover between them.
+	std::shared_ptr<AnisetteProvider> provider();
+	void setProvider(std::shared_ptr<AnisetteProvider> provider);
+
 	bool LoadDependencies();
 
 	bool ResetProvisioning();
@@ -79,6 +99,20 @@ private:
 	bool ReprovisionDevice(std::function<void(void)> provisionCallback);
 	bool LoadiCloudDependencies();
 
+	// Both require _anisetteDataMutex to be held.
+	pplx::task<std::shared_ptr<AnisetteData>> StartFetchingAnisetteData();
+	void ScheduleAnisetteDataRefresh();
+
 	bool loadedDependencies;
+
+	std::mutex _anisetteDataMutex;
+	std::shared_ptr<AnisetteProvider> _anisetteProvider;
+	std::shared_ptr<AnisetteData> _anisetteData;
+	std::chrono::steady_clock::time_point _anisetteDataFetchDate;
+	std::optional<pplx::task<std::shared_ptr<AnisetteData>>> _anisetteDataTask;
+	std::shared_ptr<boost::asio::steady_timer> _anisetteDataRefreshTimer;
+	unsigned int _anisetteDataGeneration;
+	bool _anisetteDataAccessed;
+	std::chrono::seconds _anisetteDataLifetime;
 };
 
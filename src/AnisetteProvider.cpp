@@ -0,0 +1,369 @@
+#include "AnisetteProvider.h"
+
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+
+#include <cpprest/http_client.h>
+#include <pplx/threadpool.h>
+#include <boost/asio/steady_timer.hpp>
+
+#include "AnisetteData.h"
+#include "ServerError.hpp"
+#include "common.h"
+
+using namespace web;                        // Common features like URIs.
+using namespace web::http;                  // Common HTTP functionality
+using namespace web::http::client;          // HTTP client features
+
+#define ANISETTE_REQUEST_TIMEOUT 15
+
+static std::string DescribeException(std::exception_ptr exception)
+{
+	try
+	{
+		std::rethrow_exception(exception);
+	}
+	catch (std::exception& e)
+	{
+		return e.what();
+	}
+	catch (...)
+	{
+		return "Unknown error";
+	}
+}
+
+#pragma mark - RemoteAnisetteProvider -
+
+RemoteAnisetteProvider::RemoteAnisetteProvider(std::string url) : _url(url)
+{
+}
+
+std::string RemoteAnisetteProvider::name() const
+{
+	return _url;
+}
+
+pplx::task<std::shared_ptr<AnisetteData>> RemoteAnisetteProvider::FetchAnisetteData()
+{
+	http_client_config config;
+	config.set_timeout(std::chrono::seconds(ANISETTE_REQUEST_TIMEOUT));
+
+	auto client = http_client(_url, config);
+
+	http_request request(methods::GET);
+	request.headers().add("User-Agent", "Xcode");
+
+	return client.request(request)
+		.then([client](http_response response)
+			{
+				odslog("Received response status code: " << response.status_code());
+
+				if (response.status_code() != status_codes::OK)
+				{
+					throw ServerError(ServerErrorCode::InvalidAnisetteData);
+				}
+
+				return response.extract_json();
+			})
+		.then([](json::value json)
+			{
+				return RemoteAnisetteProvider::ParseAnisetteData(json);
+			});
+}
+
+std::shared_ptr<AnisetteData> RemoteAnisetteProvider::ParseAnisetteData(const json::value& json)
+{
+	odslog("Got anisetteData json: " << json);
+
+	if (!json.is_object() || !json.has_field("X-Apple-I-MD-M") || !json.has_field("X-Apple-I-MD") ||
+		!json.has_field("X-Mme-Device-Id") || !json.has_field("X-MMe-Client-Info"))
+	{
+		throw ServerError(ServerErrorCode::InvalidAnisetteData);
+	}
+
+	// Servers differ in which of the remaining fields they send, so fall back to the values Apple's own clients use.
+	auto field = [&json](const char* key, std::string defaultValue) -> std::string {
+		if (!json.has_field(key))
+		{
+			return defaultValue;
+		}
+
+		auto& value = json.at(key);
+		return value.is_string() ? value.as_string() : value.serialize();
+	};
+
+	struct timeval date = { 0 };
+	auto clientTime = field("X-Apple-I-Client-Time", "");
+	if (clientTime.empty())
+	{
+		date.tv_sec = time(NULL);
+	}
+	else
+	{
+		struct tm tm = { 0 };
+		strptime(clientTime.c_str(), "%FT%T%z", &tm);
+		date.tv_sec = mktime(&tm);
+	}
+
+	odslog("Building anisetteData obj...");
+	auto anisetteData = std::make_shared<AnisetteData>(
+		field("X-Apple-I-MD-M", ""),
+		field("X-Apple-I-MD", ""),
+		field("X-Apple-I-MD-LU", ""),
+		std::atoi(field("X-Apple-I-MD-RINFO", "17106176").c_str()),
+		field("X-Mme-Device-Id", ""),
+		field("X-Apple-I-SRL-NO", "0"),
+		field("X-MMe-Client-Info", ""),
+		date,
+		field("X-Apple-Locale", "en_US"),
+		field("X-Apple-I-TimeZone", "UTC"));
+
+	odslog(*anisetteData);
+
+	return anisetteData;
+}
+
+#pragma mark - FailoverAnisetteProvider -
+
+struct FailoverAnisetteProvider::Attempt
+{
+	std::mutex mutex;
+
+	std::vector<size_t> backends;
+	size_t nextBackend = 0;
+	int pendingRequests = 0;
+	bool finished = false;
+
+	std::shared_ptr<boost::asio::steady_timer> hedgeTimer;
+	pplx::task_completion_event<std::shared_ptr<AnisetteData>> completionEvent;
+};
+
+FailoverAnisetteProvider::FailoverAnisetteProvider(std::vector<std::shared_ptr<AnisetteProvider>> providers) : _providers(providers)
+{
+	for (auto& provider : providers)
+	{
+		Backend backend;
+		backend.provider = provider;
+		_backends.push_back(backend);
+	}
+}
+
+std::string FailoverAnisetteProvider::name() const
+{
+	std::string name;
+	for (auto& provider : _providers)
+	{
+		name += (name.empty() ? "" : ", ") + provider->name();
+	}
+
+	return name;
+}
+
+const std::vector<std::shared_ptr<AnisetteProvider>>& FailoverAnisetteProvider::providers() const
+{
+	return _providers;
+}
+
+pplx::task<std::shared_ptr<AnisetteData>> FailoverAnisetteProvider::FetchAnisetteData()
+{
+	auto attempt = std::make_shared<Attempt>();
+	attempt->backends = this->AvailableBackends();
+
+	if (attempt->backends.empty())
+	{
+		return pplx::task_from_exception<std::shared_ptr<AnisetteData>>(ServerError(ServerErrorCode::InvalidAnisetteData));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(attempt->mutex);
+		this->StartNextRequest(attempt);
+	}
+
+	return pplx::create_task(attempt->completionEvent);
+}
+
+std::vector<size_t> FailoverAnisetteProvider::AvailableBackends()
+{
+	std::lock_guard<std::mutex> lock(_backendsMutex);
+
+	auto now = std::chrono::steady_clock::now();
+
+	std::vector<size_t> closedBackends;
+	std::vector<size_t> openBackends;
+
+	for (size_t i = 0; i < _backends.size(); i++)
+	{
+		// Once the open period is over the provider gets one more try; another failure reopens its circuit.
+		if (_backends[i].circuitOpenUntil <= now)
+		{
+			closedBackends.push_back(i);
+		}
+		else
+		{
+			openBackends.push_back(i);
+		}
+	}
+
+	if (closedBackends.empty() && !openBackends.empty())
+	{
+		// Failing fast would only turn a flaky provider into a guaranteed failure.
+		odslog("All anisette providers are failing, trying them anyway.");
+		return openBackends;
+	}
+
+	return closedBackends;
+}
+
+std::chrono::milliseconds FailoverAnisetteProvider::HedgeDelay(size_t backend)
+{
+	std::lock_guard<std::mutex> lock(_backendsMutex);
+
+	auto& latencies = _backends[backend].latencies;
+	if (latencies.size() < MinimumLatencySampleCount)
+	{
+		return DefaultHedgeDelay;
+	}
+
+	std::vector<std::chrono::milliseconds> sortedLatencies(latencies.begin(), latencies.end());
+	std::sort(sortedLatencies.begin(), sortedLatencies.end());
+
+	auto p95 = sortedLatencies[(sortedLatencies.size() - 1) * 95 / 100];
+	return std::min(std::max(p95, MinimumHedgeDelay), MaximumHedgeDelay);
+}
+
+// Requires attempt->mutex to be held.
+void FailoverAnisetteProvider::StartNextRequest(std::shared_ptr<Attempt> attempt)
+{
+	if (attempt->hedgeTimer != nullptr)
+	{
+		attempt->hedgeTimer->cancel();
+		attempt->hedgeTimer = nullptr;
+	}
+
+	auto backend = attempt->backends[attempt->nextBackend++];
+	auto provider = _backends[backend].provider;
+
+	odslog("Requesting anisette data from " << provider->name() << "...");
+
+	pplx::task<std::shared_ptr<AnisetteData>> task;
+	try
+	{
+		task = provider->FetchAnisetteData();
+	}
+	catch (...)
+	{
+		task = pplx::task_from_exception<std::shared_ptr<AnisetteData>>(std::current_exception());
+	}
+
+	attempt->pendingRequests++;
+
+	auto startDate = std::chrono::steady_clock::now();
+	task.then([this, attempt, backend, startDate](pplx::task<std::shared_ptr<AnisetteData>> task) {
+		this->FinishRequest(attempt, backend, startDate, task);
+	});
+
+	if (attempt->nextBackend >= attempt->backends.size())
+	{
+		return;
+	}
+
+	auto& ioService = crossplat::threadpool::shared_instance().service();
+
+	auto timer = std::make_shared<boost::asio::steady_timer>(ioService, this->HedgeDelay(backend));
+	attempt->hedgeTimer = timer;
+
+	timer->async_wait([this, attempt, timer](const boost::system::error_code& error) {
+		if (error)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(attempt->mutex);
+		if (attempt->finished || attempt->hedgeTimer != timer)
+		{
+			return;
+		}
+
+		odslog("Anisette request is slower than usual, also asking the next provider.");
+		this->StartNextRequest(attempt);
+	});
+}
+
+void FailoverAnisetteProvider::FinishRequest(std::shared_ptr<Attempt> attempt, size_t backend, std::chrono::steady_clock::time_point startDate,
+	pplx::task<std::shared_ptr<AnisetteData>> task)
+{
+	auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startDate);
+
+	std::shared_ptr<AnisetteData> anisetteData;
+	std::exception_ptr error;
+
+	try
+	{
+		anisetteData = task.get();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	{
+		// Requests that lose a hedge race still count, so a provider's statistics don't depend on its rivals.
+		std::lock_guard<std::mutex> lock(_backendsMutex);
+
+		auto& state = _backends[backend];
+		if (error == nullptr)
+		{
+			state.latencies.push_back(latency);
+			if (state.latencies.size() > LatencySampleCount)
+			{
+				state.latencies.pop_front();
+			}
+
+			state.consecutiveFailures = 0;
+		}
+		else
+		{
+			odslog("Anisette provider " << state.provider->name() << " failed: " << DescribeException(error));
+
+			state.consecutiveFailures++;
+			if (state.consecutiveFailures >= CircuitFailureThreshold)
+			{
+				odslog("Skipping anisette provider " << state.provider->name() << " for " << CircuitOpenDuration.count() << " seconds.");
+				state.circuitOpenUntil = std::chrono::steady_clock::now() + CircuitOpenDuration;
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(attempt->mutex);
+	attempt->pendingRequests--;
+
+	if (attempt->finished)
+	{
+		return;
+	}
+
+	if (error == nullptr)
+	{
+		attempt->finished = true;
+
+		if (attempt->hedgeTimer != nullptr)
+		{
+			attempt->hedgeTimer->cancel();
+			attempt->hedgeTimer = nullptr;
+		}
+
+		attempt->completionEvent.set(anisetteData);
+	}
+	else if (attempt->nextBackend < attempt->backends.size())
+	{
+		// No point waiting for the hedge delay once the current provider has given up.
+		this->StartNextRequest(attempt);
+	}
+	else if (attempt->pendingRequests == 0)
+	{
+		attempt->finished = true;
+		attempt->completionEvent.set_exception(error);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+#include <pplx/pplxtasks.h>
+#include <cpprest/json.h>
+
+class AnisetteData;
+
+class AnisetteProvider
+{
+public:
+	virtual ~AnisetteProvider() {}
+
+	virtual std::string name() const = 0;
+	virtual pplx::task<std::shared_ptr<AnisetteData>> FetchAnisetteData() = 0;
+};
+
+// Anisette server answering a GET with a JSON object of X-Apple-I-MD* values, the schema shared by
+// armconverter.com, self-hosted anisette servers and AnisetteStandIn.
+class RemoteAnisetteProvider : public AnisetteProvider
+{
+public:
+	RemoteAnisetteProvider(std::string url);
+
+	virtual std::string name() const;
+	virtual pplx::task<std::shared_ptr<AnisetteData>> FetchAnisetteData();
+
+	static std::shared_ptr<AnisetteData> ParseAnisetteData(const web::json::value& json);
+
+private:
+	std::string _url;
+};
+
+// Asks providers in priority order. A request that is still running after the provider's p95 latency
+// is hedged with the next provider, and the first answer wins. Providers that keep failing are skipped
+// until their circuit closes again.
+class FailoverAnisetteProvider : public AnisetteProvider
+{
+public:
+	FailoverAnisetteProvider(std::vector<std::shared_ptr<AnisetteProvider>> providers);
+
+	virtual std::string name() const;
+	virtual pplx::task<std::shared_ptr<AnisetteData>> FetchAnisetteData();
+
+	const std::vector<std::shared_ptr<AnisetteProvider>>& providers() const;
+
+	// Hedging waits for the provider's p95 latency over its recent successful requests, bounded so
+	// one slow outlier cannot stall failover and one fast burst cannot cause a hedge per request.
+	static constexpr size_t LatencySampleCount = 32;
+	static constexpr size_t MinimumLatencySampleCount = 5;
+	static constexpr std::chrono::milliseconds DefaultHedgeDelay = std::chrono::milliseconds(2000);
+	static constexpr std::chrono::milliseconds MinimumHedgeDelay = std::chrono::milliseconds(250);
+	static constexpr std::chrono::milliseconds MaximumHedgeDelay = std::chrono::milliseconds(10000);
+
+	// Providers that fail this many times in a row are skipped for CircuitOpenDuration.
+	static constexpr int CircuitFailureThreshold = 3;
+	static constexpr std::chrono::seconds CircuitOpenDuration = std::chrono::seconds(30);
+
+private:
+	struct Backend
+	{
+		std::shared_ptr<AnisetteProvider> provider;
+
+		std::deque<std::chrono::milliseconds> latencies;
+		int consecutiveFailures = 0;
+		std::chrono::steady_clock::time_point circuitOpenUntil;
+	};
+
+	struct Attempt;
+
+	std::vector<std::shared_ptr<AnisetteProvider>> _providers;
+
+	std::mutex _backendsMutex;
+	std::vector<Backend> _backends;
+
+	std::vector<size_t> AvailableBackends();
+	std::chrono::milliseconds HedgeDelay(size_t backend);
+
+	void StartNextRequest(std::shared_ptr<Attempt> attempt);
+	void FinishRequest(std::shared_ptr<Attempt> attempt, size_t backend, std::chrono::steady_clock::time_point startDate,
+		pplx::task<std::shared_ptr<AnisetteData>> task);
+};
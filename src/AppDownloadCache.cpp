@@ -0,0 +1,375 @@
+#include "AppDownloadCache.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <cpprest/http_client.h>
+#include <cpprest/filestream.h>
+
+#include <plist/plist.h>
+
+#include "AltServerApp.h"
+#include "Digest.hpp"
+#include "InstallError.hpp"
+#include "SignedAppCache.h"
+
+#include "common.h"
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::client;
+
+// Extensions of the files kept for each URL.
+#define DOWNLOAD_EXTENSION ".ipa"
+#define PARTIAL_DOWNLOAD_EXTENSION ".ipa.partial"
+#define METADATA_EXTENSION ".plist"
+
+extern std::vector<unsigned char> readFile(const char* filename);
+
+AppDownloadCache* AppDownloadCache::_instance = nullptr;
+
+AppDownloadCache* AppDownloadCache::instance()
+{
+	if (_instance == 0)
+	{
+		_instance = new AppDownloadCache();
+	}
+
+	return _instance;
+}
+
+AppDownloadCache::AppDownloadCache()
+{
+}
+
+AppDownloadCache::~AppDownloadCache()
+{
+}
+
+pplx::task<std::string> AppDownloadCache::Download(std::string url, std::optional<std::string> expectedSHA256)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto iterator = _downloads.find(url);
+	if (iterator != _downloads.end())
+	{
+		_statistics.sharedDownloads++;
+		return iterator->second;
+	}
+
+	auto task = pplx::create_task([=]() {
+		return this->_Download(url, expectedSHA256);
+	});
+
+	_downloads[url] = task;
+
+	task.then([this, url](pplx::task<std::string> task) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_downloads.erase(url);
+
+		try
+		{
+			task.get();
+		}
+		catch (...)
+		{
+			// Reported to callers.
+		}
+	});
+
+	return task;
+}
+
+std::string AppDownloadCache::_Download(std::string url, std::optional<std::string> expectedSHA256)
+{
+	auto path = this->downloadPath(url);
+	auto filePath = path + DOWNLOAD_EXTENSION;
+	auto partialFilePath = path + PARTIAL_DOWNLOAD_EXTENSION;
+	auto metadataPath = path + METADATA_EXTENSION;
+
+	auto metadata = this->LoadMetadata(metadataPath);
+
+	bool hasCopy = metadata.has_value() && !metadata->sha256.empty() && fs::exists(filePath) &&
+		(!expectedSHA256.has_value() || *expectedSHA256 == metadata->sha256) && this->VerifyCopy(filePath, metadata->sha256);
+
+	// A partial download can only be resumed if we can tell the server which version it belongs to.
+	bool canResume = !hasCopy && metadata.has_value() && (!metadata->etag.empty() || !metadata->lastModified.empty()) && fs::exists(partialFilePath);
+
+	// Second attempt only if the server won't resume the partial download.
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		uint64_t offset = canResume ? fs::file_size(partialFilePath) : 0;
+
+		http_request request(methods::GET);
+
+		if (hasCopy)
+		{
+			if (!metadata->etag.empty())
+			{
+				request.headers().add(header_names::if_none_match, metadata->etag);
+			}
+
+			if (!metadata->lastModified.empty())
+			{
+				request.headers().add(header_names::if_modified_since, metadata->lastModified);
+			}
+		}
+		else if (offset > 0)
+		{
+			request.headers().add(header_names::range, "bytes=" + std::to_string(offset) + "-");
+
+			// Sends the whole file instead if it changed since the partial download started.
+			request.headers().add(header_names::if_range, !metadata->etag.empty() ? metadata->etag : metadata->lastModified);
+		}
+
+		http_response response;
+
+		try
+		{
+			http_client client(url);
+			response = client.request(request).get();
+		}
+		catch (std::exception& e)
+		{
+			if (hasCopy)
+			{
+				odslog("Failed to check for a newer download of " << url << ", using stored copy. " << e.what());
+				return filePath;
+			}
+
+			odslog("Failed to download " << url << ". " << e.what());
+			throw InstallError(InstallErrorCode::DownloadFailed);
+		}
+
+		odslog("Received download response status code: " << response.status_code());
+
+		if (response.status_code() == status_codes::NotModified && hasCopy)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_statistics.notModifiedResponses++;
+			_statistics.bytesReused += fs::file_size(filePath);
+
+			return filePath;
+		}
+
+		if (response.status_code() == 416)
+		{
+			// Range Not Satisfiable: the partial download is no use, so start over.
+			fs::remove(partialFilePath);
+			canResume = false;
+			continue;
+		}
+
+		bool isResuming = false;
+
+		if (response.status_code() == status_codes::PartialContent && offset > 0)
+		{
+			// Only append if the server continues exactly where we stopped.
+			uint64_t start = 0;
+			auto contentRange = response.headers().has(header_names::content_range) ? response.headers()[header_names::content_range] : "";
+			if (sscanf(contentRange.c_str(), "bytes %llu-", (unsigned long long*)&start) != 1 || start != offset)
+			{
+				fs::remove(partialFilePath);
+				canResume = false;
+				continue;
+			}
+
+			isResuming = true;
+		}
+		else if (response.status_code() != status_codes::OK)
+		{
+			if (hasCopy)
+			{
+				odslog("Server answered " << response.status_code() << " for " << url << ", using stored copy.");
+				return filePath;
+			}
+
+			throw InstallError(InstallErrorCode::DownloadFailed);
+		}
+
+		// Save the validators first, so an interrupted download can be resumed by the next install.
+		Metadata downloadMetadata;
+		downloadMetadata.etag = response.headers().has(header_names::etag) ? response.headers()[header_names::etag] : "";
+		downloadMetadata.lastModified = response.headers().has(header_names::last_modified) ? response.headers()[header_names::last_modified] : "";
+		this->SaveMetadata(metadataPath, downloadMetadata);
+
+		auto mode = isResuming ? (std::ios::out | std::ios::binary | std::ios::app) : (std::ios::out | std::ios::binary | std::ios::trunc);
+		auto file = concurrency::streams::fstream::open_ostream(partialFilePath, mode).get();
+
+		size_t receivedLength = 0;
+
+		try
+		{
+			receivedLength = response.body().read_to_end(file.streambuf()).get();
+			file.close().get();
+		}
+		catch (std::exception& e)
+		{
+			try
+			{
+				file.close().wait();
+			}
+			catch (...)
+			{
+			}
+
+			odslog("Download of " << url << " was interrupted, it will resume next time. " << e.what());
+			throw InstallError(InstallErrorCode::DownloadFailed);
+		}
+
+		{
+			// Counted even if the download turns out incomplete or corrupted, since it was transferred all the same.
+			std::lock_guard<std::mutex> lock(_mutex);
+			_statistics.bytesDownloaded += receivedLength;
+		}
+
+		auto expectedLength = response.headers().content_length();
+		if (expectedLength > 0 && receivedLength < expectedLength)
+		{
+			odslog("Download of " << url << " ended early, it will resume next time.");
+			throw InstallError(InstallErrorCode::DownloadFailed);
+		}
+
+		auto sha256 = SignedAppCache::HashFile(partialFilePath);
+		if (expectedSHA256.has_value() && sha256 != *expectedSHA256)
+		{
+			odslog("Downloaded " << url << " has SHA-256 " << sha256 << ", expected " << *expectedSHA256 << ".");
+
+			fs::remove(partialFilePath);
+			fs::remove(metadataPath);
+
+			throw InstallError(InstallErrorCode::DownloadCorrupted);
+		}
+
+		// Replacing the stored copy doesn't affect installs still reading the previous one.
+		fs::rename(partialFilePath, filePath);
+
+		downloadMetadata.sha256 = sha256;
+		this->SaveMetadata(metadataPath, downloadMetadata);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_verifiedCopies.insert(std::make_pair(filePath, sha256));
+
+		if (isResuming)
+		{
+			_statistics.resumedDownloads++;
+			_statistics.bytesReused += offset;
+		}
+		else
+		{
+			_statistics.completeDownloads++;
+		}
+
+		return filePath;
+	}
+
+	throw InstallError(InstallErrorCode::DownloadFailed);
+}
+
+bool AppDownloadCache::VerifyCopy(std::string path, std::string sha256)
+{
+	auto copy = std::make_pair(path, sha256);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_verifiedCopies.count(copy) > 0)
+		{
+			return true;
+		}
+	}
+
+	if (SignedAppCache::HashFile(path) != sha256)
+	{
+		odslog("Stored copy " << path << " is damaged, downloading it again.");
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_verifiedCopies.insert(copy);
+
+	return true;
+}
+
+#pragma mark - Metadata -
+
+std::optional<AppDownloadCache::Metadata> AppDownloadCache::LoadMetadata(std::string path)
+{
+	if (!fs::exists(path))
+	{
+		return std::nullopt;
+	}
+
+	auto data = readFile(path.c_str());
+
+	plist_t plist = nullptr;
+	plist_from_memory((const char*)data.data(), (int)data.size(), &plist);
+	if (plist == nullptr)
+	{
+		return std::nullopt;
+	}
+
+	auto stringValue = [plist](const char* key) -> std::string {
+		auto node = plist_dict_get_item(plist, key);
+		if (node == nullptr)
+		{
+			return "";
+		}
+
+		char* value = nullptr;
+		plist_get_string_val(node, &value);
+
+		std::string string = (value != nullptr) ? value : "";
+		free(value);
+
+		return string;
+	};
+
+	Metadata metadata;
+	metadata.etag = stringValue("ETag");
+	metadata.lastModified = stringValue("LastModified");
+	metadata.sha256 = stringValue("SHA256");
+
+	plist_free(plist);
+
+	return metadata;
+}
+
+void AppDownloadCache::SaveMetadata(std::string path, const Metadata& metadata)
+{
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "ETag", plist_new_string(metadata.etag.c_str()));
+	plist_dict_set_item(plist, "LastModified", plist_new_string(metadata.lastModified.c_str()));
+	plist_dict_set_item(plist, "SHA256", plist_new_string(metadata.sha256.c_str()));
+
+	char* plistXML = nullptr;
+	uint32_t length = 0;
+	plist_to_xml(plist, &plistXML, &length);
+	plist_free(plist);
+
+	auto temporaryPath = path + ".tmp";
+
+	{
+		std::ofstream fout(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		fout.write(plistXML, length);
+	}
+
+	free(plistXML);
+
+	fs::rename(temporaryPath, path);
+}
+
+std::string AppDownloadCache::downloadPath(std::string url) const
+{
+	// Name files by a digest of the URL, which may contain characters that aren't valid in file names.
+	auto path = AltServerApp::instance()->downloadsDirectoryPath();
+	path.append(SHA256HexString(url));
+	return path.string();
+}
+
+#pragma mark - Getters -
+
+AppDownloadCacheStatistics AppDownloadCache::statistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+
+#include <pplx/pplxtasks.h>
+
+struct AppDownloadCacheStatistics
+{
+	// Requests answered 304, so the stored copy was used as is.
+	uint64_t notModifiedResponses = 0;
+
+	uint64_t completeDownloads = 0;
+	uint64_t resumedDownloads = 0;
+
+	// Callers that waited for a download another install had already started.
+	uint64_t sharedDownloads = 0;
+
+	uint64_t bytesDownloaded = 0;
+
+	// Bytes that didn't have to be transferred again: stored copies that were still current, and the parts of resumed downloads received earlier.
+	uint64_t bytesReused = 0;
+};
+
+// Keeps downloaded apps (i.e. AltStore) on disk between installs. Stored copies are revalidated with the server's
+// ETag or Last-Modified date, interrupted downloads resume where they stopped, and every copy is checked against its
+// SHA-256 before use. Concurrent requests for the same URL share one download.
+class AppDownloadCache
+{
+public:
+	static AppDownloadCache* instance();
+
+	// Returns the path of an up-to-date copy of url. Callers must not modify or remove it.
+	// If expectedSHA256 is set, copies with another SHA-256 are rejected.
+	pplx::task<std::string> Download(std::string url, std::optional<std::string> expectedSHA256);
+
+	AppDownloadCacheStatistics statistics();
+
+private:
+	AppDownloadCache();
+	~AppDownloadCache();
+
+	static AppDownloadCache* _instance;
+
+	struct Metadata
+	{
+		std::string etag;
+		std::string lastModified;
+
+		// Empty until the download completes.
+		std::string sha256;
+	};
+
+	std::mutex _mutex;
+	std::map<std::string, pplx::task<std::string>> _downloads;
+
+	// Copies whose SHA-256 was already checked since launch, as path and hash.
+	std::set<std::pair<std::string, std::string>> _verifiedCopies;
+
+	AppDownloadCacheStatistics _statistics;
+
+	std::string _Download(std::string url, std::optional<std::string> expectedSHA256);
+
+	bool VerifyCopy(std::string path, std::string sha256);
+
+	std::optional<Metadata> LoadMetadata(std::string path);
+	void SaveMetadata(std::string path, const Metadata& metadata);
+
+	std::string downloadPath(std::string url) const;
+};
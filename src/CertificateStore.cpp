@@ -0,0 +1,128 @@
+#include "CertificateStore.h"
+
+#include <iostream>
+
+#include "Certificate.hpp"
+
+#include "common.h"
+
+CertificateStore* CertificateStore::_instance = nullptr;
+
+CertificateStore* CertificateStore::instance()
+{
+	if (_instance == 0)
+	{
+		_instance = new CertificateStore();
+	}
+
+	return _instance;
+}
+
+CertificateStore::CertificateStore()
+{
+}
+
+CertificateStore::~CertificateStore()
+{
+}
+
+std::shared_ptr<Certificate> CertificateStore::LoadCertificate(std::string teamIdentifier, std::string serialNumber, std::function<std::shared_ptr<Certificate>(void)> load)
+{
+	auto key = std::make_pair(teamIdentifier, serialNumber);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto iterator = _entries.find(key);
+		if (iterator != _entries.end() && iterator->second.certificate != nullptr)
+		{
+			_statistics.certificateHits++;
+			_statistics.savedTime += iterator->second.loadTime;
+
+			odslog("Reused stored certificate " << serialNumber << ", saving " << iterator->second.loadTime.count() << " ms.");
+
+			// Installs change the certificates they're given (e.g. their machine identifier), so each gets its own.
+			return std::make_shared<Certificate>(*iterator->second.certificate);
+		}
+
+		_statistics.certificateMisses++;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	auto certificate = load();
+	if (certificate == nullptr)
+	{
+		return nullptr;
+	}
+
+	auto loadTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto& entry = _entries[key];
+	entry.certificate = std::make_shared<Certificate>(*certificate);
+	entry.loadTime = loadTime;
+
+	return certificate;
+}
+
+std::optional<std::vector<unsigned char>> CertificateStore::EncryptedP12Data(std::string teamIdentifier, std::shared_ptr<Certificate> certificate, std::string machineIdentifier)
+{
+	auto key = std::make_pair(teamIdentifier, certificate->serialNumber());
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto iterator = _entries.find(key);
+		if (iterator != _entries.end())
+		{
+			auto p12Iterator = iterator->second.encryptedP12s.find(machineIdentifier);
+			if (p12Iterator != iterator->second.encryptedP12s.end())
+			{
+				_statistics.p12Hits++;
+				_statistics.savedTime += p12Iterator->second.encryptionTime;
+
+				odslog("Reused encrypted certificate " << certificate->serialNumber() << ", saving " << p12Iterator->second.encryptionTime.count() << " ms.");
+
+				return p12Iterator->second.data;
+			}
+		}
+
+		_statistics.p12Misses++;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	auto encryptedData = certificate->encryptedP12Data(machineIdentifier);
+	if (!encryptedData.has_value())
+	{
+		return std::nullopt;
+	}
+
+	auto encryptionTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto& entry = _entries[key];
+	if (entry.certificate == nullptr)
+	{
+		entry.certificate = std::make_shared<Certificate>(*certificate);
+	}
+
+	entry.encryptedP12s[machineIdentifier] = { *encryptedData, encryptionTime };
+
+	return encryptedData;
+}
+
+void CertificateStore::RemoveCertificate(std::string teamIdentifier, std::string serialNumber)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_entries.erase(std::make_pair(teamIdentifier, serialNumber));
+}
+
+CertificateStoreStatistics CertificateStore::statistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+class Certificate;
+
+struct CertificateStoreStatistics
+{
+	uint64_t certificateHits = 0;
+	uint64_t certificateMisses = 0;
+
+	uint64_t p12Hits = 0;
+	uint64_t p12Misses = 0;
+
+	// Time hits would have spent reading and decrypting the cached .p12, or encrypting a new one.
+	std::chrono::milliseconds savedTime = std::chrono::milliseconds(0);
+};
+
+// Keeps signing certificates in memory, keyed by team and serial number, along with the encrypted .p12
+// embedded in AltStore for each machine identifier, so neither is decoded or re-encrypted on every install.
+class CertificateStore
+{
+public:
+	static CertificateStore* instance();
+
+	// Returns a copy of the certificate stored for serialNumber, or calls load (e.g. to decrypt the .p12 cached on disk) and stores its result.
+	std::shared_ptr<Certificate> LoadCertificate(std::string teamIdentifier, std::string serialNumber, std::function<std::shared_ptr<Certificate>(void)> load);
+
+	// Returns certificate's .p12 encrypted with machineIdentifier, encrypting it only the first time.
+	std::optional<std::vector<unsigned char>> EncryptedP12Data(std::string teamIdentifier, std::shared_ptr<Certificate> certificate, std::string machineIdentifier);
+
+	// Forgets a revoked certificate.
+	void RemoveCertificate(std::string teamIdentifier, std::string serialNumber);
+
+	CertificateStoreStatistics statistics();
+
+private:
+	CertificateStore();
+	~CertificateStore();
+
+	static CertificateStore* _instance;
+
+	struct Entry
+	{
+		std::shared_ptr<Certificate> certificate;
+		std::chrono::milliseconds loadTime = std::chrono::milliseconds(0);
+
+		struct EncryptedP12
+		{
+			std::vector<unsigned char> data;
+			std::chrono::milliseconds encryptionTime;
+		};
+
+		// Keyed by machine identifier.
+		std::map<std::string, EncryptedP12> encryptedP12s;
+	};
+
+	std::mutex _mutex;
+	std::map<std::pair<std::string, std::string>, Entry> _entries;
+
+	CertificateStoreStatistics _statistics;
+};
@@ -8,11 +8,10 @@
 #include "DeviceManager.hpp"
 #include "AnisetteDataManager.h"
 #include "AnisetteData.h"
+#include "Tracer.hpp"
 
 #include "ServerError.hpp"
 
-extern std::string make_uuid();
-extern std::string temporary_directory();
 
 using namespace web;
 
@@ -82,7 +81,16 @@ pplx::task<void> ClientConnection::ProcessPrepareAppRequest(web::json::value req
 	utility::string_t* filepath = new utility::string_t;
 	std::string udid = (request["udid"].as_string());
 
-	return this->ReceiveApp(request).then([this, filepath](std::string path) {
+	// Room for the .ipa and for DeviceManager to unzip it next to it.
+	auto appSize = (uint64_t)request["contentSize"].as_integer();
+	auto workspace = std::make_shared<std::shared_ptr<Workspace>>();
+
+	return WorkspaceManager::instance()->Allocate(appSize + WorkspaceManager::UnzippedAppSize(appSize))
+	.then([this, request, workspace](std::shared_ptr<Workspace> allocatedWorkspace) {
+		*workspace = allocatedWorkspace;
+		return this->ReceiveApp(request, allocatedWorkspace);
+	})
+	.then([this, filepath](std::string path) {
 		*filepath = (path);
 		return this->ReceiveRequest();
 	})
@@ -103,19 +111,10 @@ pplx::task<void> ClientConnection::ProcessPrepareAppRequest(web::json::value req
 
 		return this->InstallApp((*filepath), udid, activeProfiles);
 	})
-	.then([this, filepath, udid](pplx::task<void> task) {
+	.then([this, filepath, workspace](pplx::task<void> task) {
 
-		if (filepath->size() > 0)
-		{
-			try
-			{
-				fs::remove(fs::path(*filepath));
-			}
-			catch (std::exception& e)
-			{
-				odslog("Failed to remove received .ipa." << e.what());
-			}
-		}
+		// Removes the received .ipa in the background.
+		workspace->reset();
 
 		delete filepath;		
 
@@ -154,16 +153,23 @@ pplx::task<void> ClientConnection::ProcessAnisetteDataRequest(web::json::value r
 	});
 }
 
-pplx::task<std::string> ClientConnection::ReceiveApp(web::json::value request)
+pplx::task<std::string> ClientConnection::ReceiveApp(web::json::value request, std::shared_ptr<Workspace> workspace)
 {
 	auto appSize = request["contentSize"].as_integer();
-	std::cout << "Receiving app (" << appSize << " bytes)..." << std::endl;
+	odslog("Receiving app (" << appSize << " bytes)...");
 
-	return this->ReceiveData(appSize).then([this](std::vector<unsigned char> data) {
-		fs::path filepath = fs::path(temporary_directory()).append(make_uuid() + ".ipa");
+	// Ends once the .ipa is written, or when the task is dropped if receiving fails.
+	auto span = std::make_shared<TraceSpan>("connection", "Receive app");
+	span->set("bytes", appSize);
+
+	return this->ReceiveData(appSize).then([this, workspace, span](std::vector<unsigned char> data) {
+		fs::path filepath = fs::path(workspace->path()).append("App.ipa");
 
 		std::ofstream file(filepath.string(), std::ios::out | std::ios::binary);
 		copy(data.cbegin(), data.cend(), std::ostreambuf_iterator<char>(file));
+		file.close();
+
+		span->End();
 
 		return filepath.string();
 	});
@@ -195,17 +201,17 @@ pplx::task<void> ClientConnection::InstallApp(std::string filepath, std::string
 		}
 		catch (Error& error)
 		{
-			std::cout << error << std::endl;
+			odslog(error);
 
 			throw error;
 		}
 		catch (std::exception& e)
 		{
-			std::cout << "Exception: " << e.what() << std::endl;
+			odslog("Exception: " << e.what());
 
 			throw e;
 		}
-		std::cout << "Installed app!" << std::endl;
+		odslog("Installed app!");
 	});
 }
 
@@ -382,7 +388,7 @@ pplx::task<void> ClientConnection::SendResponse(web::json::value json)
 
 	std::memcpy(responseSizeData.data(), &size, sizeof(size));
 
-	std::cout << "Represented Value: " << *((int32_t*)responseSizeData.data()) << std::endl;
+	odsdebug("Represented Value: " << *((int32_t*)responseSizeData.data()));
 
 	auto task = this->SendData(responseSizeData)
 	.then([this, responseData]() mutable {
@@ -410,12 +416,12 @@ pplx::task<web::json::value> ClientConnection::ReceiveRequest()
 {
 	int size = sizeof(uint32_t);
 
-	std::cout << "Receiving request size..." << std::endl;
+	odsdebug("Receiving request size...");
 
 	auto task = this->ReceiveData(size)
 	.then([this](std::vector<unsigned char> data) {
 		int expectedBytes = *((int32_t*)data.data());
-		std::cout << "Receiving " << expectedBytes << " bytes..." << std::endl;
+		odsdebug("Receiving " << expectedBytes << " bytes...");
 
 		return this->ReceiveData(expectedBytes);
 	})
@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "Device.hpp"
+#include "WorkspaceManager.h"
 
 #include <pplx/pplxtasks.h>
 #include <cpprest/json.h>
@@ -35,7 +36,7 @@ public:
 	virtual pplx::task<std::vector<unsigned char>> ReceiveData(int size) = 0;
 
 private:
-	pplx::task<std::string> ReceiveApp(web::json::value request);
+	pplx::task<std::string> ReceiveApp(web::json::value request, std::shared_ptr<Workspace> workspace);
 	pplx::task<void> InstallApp(std::string filepath, std::string udid, std::optional<std::set<std::string>> activeProfiles);
 
 	web::json::value ErrorResponse(std::exception& exception);
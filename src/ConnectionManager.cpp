@@ -39,7 +39,7 @@
 #ifdef HAVE_MDNS
 void DNSSD_API ConnectionManagerBonjourRegistrationFinished(DNSServiceRef service, DNSServiceFlags flags, DNSServiceErrorType errorCode, const char *name, const char *regtype, const char *domain, void *context)
 {
-	std::cout << "Registered service: " << name << " (Error: " << errorCode << ")" << std::endl;
+	odslog("Registered service: " << name << " (Error: " << errorCode << ")");
 }
 #endif
 
@@ -65,7 +65,7 @@ ConnectionManager* ConnectionManager::instance()
     return _instance;
 }
 
-ConnectionManager::ConnectionManager()
+ConnectionManager::ConnectionManager() : _mDNSResponderSocket(-1), _port(0)
 {
 	DeviceManager::instance()->setConnectedDeviceCallback(ConnectionManagerConnectedDevice);
 	DeviceManager::instance()->setDisconnectedDeviceCallback(ConnectionManagerDisconnectedDevice);
@@ -83,6 +83,8 @@ void ConnectionManager::Start()
 void ConnectionManager::Disconnect(std::shared_ptr<ClientConnection> connection)
 {
 	connection->Disconnect();
+
+	std::lock_guard<std::mutex> lock(_connectionsMutex);
 	_connections.erase(connection);
 }
 
@@ -109,14 +111,14 @@ void ConnectionManager::StartAdvertising(int socketPort)
 	DNSServiceErrorType registrationResult = DNSServiceRegister(&service, 0, 0, NULL, "_altserver._tcp", NULL, NULL, port, txtData.size(), txtData.data(), ConnectionManagerBonjourRegistrationFinished, NULL);
 	if (registrationResult != kDNSServiceErr_NoError)
 	{
-		std::cout << "Bonjour Registration Error: " << registrationResult << std::endl;
+		odslog("Bonjour Registration Error: " << registrationResult);
 		return;
 	}
 
 	int dnssd_socket = DNSServiceRefSockFD(service);
 	if (dnssd_socket == -1)
 	{
-		std::cout << "Failed to retrieve mDNSResponder socket." << std::endl;
+		odslog("Failed to retrieve mDNSResponder socket.");
 	}
 
 	this->_mDNSResponderSocket = dnssd_socket;
@@ -128,7 +130,7 @@ void ConnectionManager::Listen()
     int socket4 = socket(AF_INET, SOCK_STREAM, 0);
     if (socket4 == 0)
     {
-        std::cout << "Failed to create socket." << std::endl;
+        odslog("Failed to create socket.");
         return;
     }
     
@@ -136,18 +138,19 @@ void ConnectionManager::Listen()
     memset(&address4, 0, sizeof(address4));
     //address4.sin_len = sizeof(address4);
     address4.sin_family = AF_INET;
-    address4.sin_port = 0; // Choose for us.
+    address4.sin_port = htons(this->port()); // 0 lets the system choose.
     address4.sin_addr.s_addr = INADDR_ANY;
     
     if (bind(socket4, (struct sockaddr *)&address4, sizeof(address4)) < 0)
     {
-        std::cout << "Failed to bind socket." << std::endl;
+        odslog("Failed to bind socket.");
         return;
     }
     
-    if (listen(socket4, 0) != 0)
+    // Room for many AltStore clients connecting at once; a backlog of 0 drops connections under load.
+    if (listen(socket4, SOMAXCONN) != 0)
     {
-        std::cout << "Failed to prepare listening socket." << std::endl;
+        odslog("Failed to prepare listening socket.");
     }
     
     struct sockaddr_in sin;
@@ -155,10 +158,12 @@ void ConnectionManager::Listen()
     
     if (getsockname(socket4, (struct sockaddr *)&sin, &len) == -1)
     {
-        std::cout << "Failed to get socket name." << std::endl;
+        odslog("Failed to get socket name.");
     }
     
     int port4 = ntohs(sin.sin_port);
+    odslog("Listening for AltStore on port " << port4);
+
     this->StartAdvertising(port4);
     
     fd_set input_set;
@@ -204,7 +209,7 @@ void ConnectionManager::Listen()
         else if (ready_for_reading == -1)
         {
              /* Handle the error */
-            std::cout << "Uh-oh" << std::endl;
+            odslog("Uh-oh");
         }
         else
         {
@@ -302,7 +307,10 @@ void ConnectionManager::HandleNotification(std::string notification, std::shared
 
 void ConnectionManager::HandleRequest(std::shared_ptr<ClientConnection> clientConnection)
 {
-	this->_connections.insert(clientConnection);
+	{
+		std::lock_guard<std::mutex> lock(_connectionsMutex);
+		this->_connections.insert(clientConnection);
+	}
 
 	clientConnection->ProcessAppRequest().then([=](pplx::task<void> task) {
 		try
@@ -331,9 +339,20 @@ int ConnectionManager::mDNSResponderSocket() const
 
 std::set<std::shared_ptr<ClientConnection>> ConnectionManager::connections() const
 {
+    std::lock_guard<std::mutex> lock(_connectionsMutex);
     return _connections;
 }
 
+int ConnectionManager::port() const
+{
+    return _port;
+}
+
+void ConnectionManager::setPort(int port)
+{
+    _port = port;
+}
+
 std::map<std::string, std::shared_ptr<NotificationConnection>> ConnectionManager::notificationConnections() const
 {
 	return _notificationConnections;
@@ -13,6 +13,7 @@
 #include <set>
 #include <thread>
 #include <map>
+#include <mutex>
 
 #include "ClientConnection.h"
 #include "NotificationConnection.h"
@@ -25,6 +26,10 @@ public:
 	void Start();
 	void Disconnect(std::shared_ptr<ClientConnection> connection);
 
+	// TCP port AltStore connects to; 0 (the default) lets the system choose. Set before Start().
+	int port() const;
+	void setPort(int port);
+
 private:
 	ConnectionManager();
 	~ConnectionManager();
@@ -34,6 +39,10 @@ private:
 	std::thread _listeningThread;
 
 	int _mDNSResponderSocket;
+	int _port;
+
+	// Connections are added on the listening thread and removed when their request finishes, on another.
+	mutable std::mutex _connectionsMutex;
 	std::set<std::shared_ptr<ClientConnection>> _connections;
 	std::map<std::string, std::shared_ptr<NotificationConnection>> _notificationConnections;
 
@@ -28,6 +28,8 @@
 #include "ServerError.hpp"
 #include "ProvisioningProfile.hpp"
 #include "Application.hpp"
+#include "WorkspaceManager.h"
+#include "Tracer.hpp"
 
 
 #define DEVICE_LISTENING_SOCKET 28151
@@ -39,7 +41,6 @@ void DeviceDidChangeConnectionStatus(const idevice_event_t* event, void* user_da
 namespace fs = std::filesystem;
 
 extern std::string make_uuid();
-extern std::string temporary_directory();
 extern std::vector<unsigned char> readFile(const char* filename);
 
 idevice_error_t idevice_new_all(idevice_t *idevice, const char *udid) {
@@ -113,10 +114,8 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 		misagent_client_t mis = NULL;
 		lockdownd_service_descriptor_t service = NULL;
 
-		fs::path temporaryDirectory(temporary_directory());
-		temporaryDirectory.append(make_uuid());
-
-		fs::create_directory(temporaryDirectory);
+		// Only used to unzip .ipas.
+		auto temporaryDirectory = std::make_shared<fs::path>();
 
 		auto installedProfiles = std::make_shared<std::vector<std::shared_ptr<ProvisioningProfile>>>();
 		auto cachedProfiles = std::make_shared<std::map<std::string, std::shared_ptr<ProvisioningProfile>>>();
@@ -135,11 +134,18 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				free(uuidString);
 
 				this->_mutex.unlock();
-				// if (fs::exists(temporaryDirectory)) fs::remove_all(temporaryDirectory);
+
+				if (!temporaryDirectory->empty())
+				{
+					WorkspaceManager::instance()->Remove(temporaryDirectory->string());
+				}
 			};
 
 			try
 			{
+				TraceSpan span("device", "Restore profiles");
+				span.set("profiles", cachedProfiles->size());
+
 				if (activeProfiles.has_value())
 				{
 					// Remove installed provisioning profiles if they're not active.
@@ -200,8 +206,13 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			}
 			else if (extension == ".ipa")
 			{
-				std::cout << "Unzipping .ipa..." << std::endl;
-				appBundlePath = UnzipAppBundle(filepath.string(), temporaryDirectory.string());
+				odslog("Unzipping .ipa...");
+
+				// Next to the .ipa, like Signer does, so it counts toward the caller's workspace.
+				*temporaryDirectory = fs::path(filepath).parent_path().append(make_uuid());
+				fs::create_directory(*temporaryDirectory);
+
+				appBundlePath = UnzipAppBundle(filepath.string(), temporaryDirectory->string());
 			}
 			else
 			{
@@ -227,6 +238,9 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				}
 			}
 
+			TraceSpan connectSpan("device", "Connect device");
+			connectSpan.set("udid", deviceUDID);
+
 			odslog("InstallApp: Finding Device...")
 			/* Find Device */
 			if (idevice_new_all(&device, deviceUDID.c_str()) != IDEVICE_E_SUCCESS)
@@ -289,6 +303,8 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				throw ServerError(ServerErrorCode::ConnectionFailed);
 			}
 
+			connectSpan.End();
+
 			odslog("InstallApp: Preparing to write files to device...")
 			fs::path stagingPath("PublicStaging");
 
@@ -315,22 +331,34 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				free(files);
 			}
 
-			std::cout << "Writing to device..." << std::endl;
+			odslog("Writing to device...");
 
 			plist_t options = instproxy_client_options_new();
 			instproxy_client_options_add(options, "PackageType", "Developer", NULL);
 
 			fs::path destinationPath = stagingPath.append(appBundlePath.filename().string());
 
+			TraceSpan uploadSpan("device", "Upload app");
+			uploadSpan.set("app", application->bundleIdentifier());
+
 			int numberOfFiles = 0;
+			uint64_t numberOfBytes = 0;
 			for (auto& item : fs::recursive_directory_iterator(appBundlePath))
 			{
 				if (item.is_regular_file())
 				{
 					numberOfFiles++;
+
+					if (uploadSpan.isActive())
+					{
+						numberOfBytes += item.file_size();
+					}
 				}				
 			}
 
+			uploadSpan.set("files", numberOfFiles);
+			uploadSpan.set("bytes", numberOfBytes);
+
 			int writtenFiles = 0;
 
 			try
@@ -383,7 +411,8 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				}
 			}
 
-			std::cout << "Finished writing to device." << std::endl;
+			uploadSpan.End();
+			odslog("Finished writing to device.");
 
 
 			if (service)
@@ -399,7 +428,11 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				// Free developer account was used to sign this app, so we need to remove all
 				// provisioning profiles in order to remain under sideloaded app limit.
 
+				TraceSpan span("device", "Remove profiles");
+
 				auto removedProfiles = this->RemoveAllFreeProvisioningProfilesExcludingBundleIdentifiers({}, mis);
+				span.set("profiles", removedProfiles.size());
+
 				for (auto& pair : removedProfiles)
 				{
 					if (activeProfiles.has_value())
@@ -476,6 +509,9 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			auto narrowDestinationPath = destinationPath.string();
 			std::replace(narrowDestinationPath.begin(), narrowDestinationPath.end(), '\\', '/');
 
+			TraceSpan installSpan("device", "instproxy install");
+			installSpan.set("app", application->bundleIdentifier());
+
 			instproxy_install(ipc, narrowDestinationPath.c_str(), options, DeviceManagerUpdateStatus, uuidString);
 			instproxy_client_options_free(options);
 
@@ -484,6 +520,7 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			cv.wait(lock, [&didFinishInstalling] { return didFinishInstalling; });
 
 			lock.unlock();
+			installSpan.End();
 
 			if (serverError.has_value())
 			{
@@ -544,7 +581,7 @@ void DeviceManager::WriteFile(afc_client_t client, std::string filepath, std::st
 	std::replace(destinationPath.begin(), destinationPath.end(), '\\', '/');
 	destinationPath = replace_all(destinationPath, "__colon__", ":");
 
-	odslog("Writing File: " << filepath.c_str() << " to: " << destinationPath.c_str());
+	odstrace("Writing File: " << filepath.c_str() << " to: " << destinationPath.c_str());
     
     auto data = readFile(filepath.c_str());
     
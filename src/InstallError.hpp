@@ -18,6 +18,8 @@ enum class InstallErrorCode
     MissingPrivateKey,
     MissingCertificate,
     MissingInfoPlist,
+    DownloadFailed,
+    DownloadCorrupted,
 };
 
 class InstallError: public Error
@@ -50,6 +52,12 @@ public:
 
 		case InstallErrorCode::MissingInfoPlist:
 			return "The app's Info.plist could not be found.";
+
+		case InstallErrorCode::DownloadFailed:
+			return "The app could not be downloaded.";
+
+		case InstallErrorCode::DownloadCorrupted:
+			return "The downloaded app does not match its expected checksum.";
 		}
     }
 };
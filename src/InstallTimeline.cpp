@@ -0,0 +1,89 @@
+#include "InstallTimeline.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "common.h"
+
+InstallTimeline::InstallTimeline() : _startDate(std::chrono::steady_clock::now()), _trace(Tracer::instance()->StartTrace("install"))
+{
+}
+
+void InstallTimeline::BeginStage(std::string name)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	Stage stage;
+	stage.name = name;
+	stage.startDate = std::chrono::steady_clock::now();
+	_stages.push_back(stage);
+}
+
+void InstallTimeline::EndStage(std::string name)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto& stage : _stages)
+	{
+		if (stage.name == name && !stage.finished)
+		{
+			stage.endDate = std::chrono::steady_clock::now();
+			stage.finished = true;
+
+			if (_trace != nullptr)
+			{
+				TraceEvent event;
+				event.category = "install";
+				event.name = name;
+				event.startDate = stage.startDate;
+				event.endDate = stage.endDate;
+				Tracer::instance()->Record(event, _trace);
+			}
+
+			break;
+		}
+	}
+}
+
+void InstallTimeline::Log() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto milliseconds = [](std::chrono::steady_clock::duration duration) {
+		return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+	};
+
+	auto endDate = _startDate;
+	std::chrono::steady_clock::duration serialDuration(0);
+
+	std::stringstream ss;
+	ss << "Install timeline (ms since start):";
+
+	for (auto& stage : _stages)
+	{
+		ss << std::endl << "  " << std::left << std::setw(20) << stage.name << std::right << std::setw(8) << milliseconds(stage.startDate - _startDate) << " - ";
+
+		if (stage.finished)
+		{
+			ss << std::setw(8) << milliseconds(stage.endDate - _startDate) << " (" << milliseconds(stage.endDate - stage.startDate) << " ms)";
+
+			endDate = std::max(endDate, stage.endDate);
+			serialDuration += stage.endDate - stage.startDate;
+		}
+		else
+		{
+			ss << std::setw(8) << "-";
+		}
+	}
+
+	ss << std::endl << "Critical path took " << milliseconds(endDate - _startDate) << " ms; stages took " << milliseconds(serialDuration) << " ms in total.";
+
+	odslog(ss.str());
+}
+
+std::shared_ptr<Trace> InstallTimeline::trace() const
+{
+	return _trace;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+#include "Tracer.hpp"
+
+// Records when each stage of an install started and finished, so the log shows which stages
+// overlapped and how long the critical path was compared to running them one after another.
+// While tracing is enabled the stages also become spans of the install's trace.
+class InstallTimeline
+{
+public:
+	InstallTimeline();
+
+	void BeginStage(std::string name);
+	void EndStage(std::string name);
+
+	void Log() const;
+
+	// nullptr while tracing is disabled.
+	std::shared_ptr<Trace> trace() const;
+
+private:
+	struct Stage
+	{
+		std::string name;
+		std::chrono::steady_clock::time_point startDate;
+		std::chrono::steady_clock::time_point endDate;
+		bool finished = false;
+	};
+
+	std::chrono::steady_clock::time_point _startDate;
+	std::shared_ptr<Trace> _trace;
+
+	mutable std::mutex _mutex;
+	std::vector<Stage> _stages;
+};
+
+// Runs body as the named stage of timeline. The stage ends when the returned task does, whether or not it succeeds.
+template <typename Body>
+auto TimeStage(std::shared_ptr<InstallTimeline> timeline, std::string name, Body body) -> decltype(body())
+{
+	using StageTask = decltype(body());
+
+	timeline->BeginStage(name);
+
+	return body().then([timeline, name](StageTask task) {
+		timeline->EndStage(name);
+		return task.get();
+	});
+}
@@ -0,0 +1,379 @@
+#include "SessionManager.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <plist/plist.h>
+
+#include "Account.hpp"
+#include "AppleAPISession.h"
+#include "AnisetteData.h"
+#include "AltServerApp.h"
+#include "Digest.hpp"
+
+// Session file layout: magic, PBKDF2 salt, AES-256-GCM IV and tag, then the encrypted binary plist.
+#define SESSION_FILE_MAGIC "ALTSESS1"
+#define SESSION_SALT_LENGTH 16
+#define SESSION_IV_LENGTH 12
+#define SESSION_TAG_LENGTH 16
+#define SESSION_KEY_LENGTH 32
+#define SESSION_KEY_ITERATIONS 20000
+
+// Treat tokens as expired a little early so one doesn't run out halfway through an install.
+#define SESSION_EXPIRATION_MARGIN 300
+
+SessionManager* SessionManager::_instance = nullptr;
+
+SessionManager* SessionManager::instance()
+{
+	if (_instance == 0)
+	{
+		_instance = new SessionManager();
+	}
+
+	return _instance;
+}
+
+SessionManager::SessionManager()
+{
+}
+
+SessionManager::~SessionManager()
+{
+}
+
+static std::string NormalizedAppleID(std::string appleID)
+{
+	std::transform(appleID.begin(), appleID.end(), appleID.begin(), ::tolower);
+	return appleID;
+}
+
+static std::vector<unsigned char> PasswordDigest(const std::vector<unsigned char>& salt, const std::string& password)
+{
+	std::vector<unsigned char> data(salt);
+	data.insert(data.end(), password.begin(), password.end());
+
+	std::vector<unsigned char> digest(SHA256_DIGEST_LENGTH);
+	SHA256(data.data(), data.size(), digest.data());
+
+	OPENSSL_cleanse(data.data(), data.size());
+	return digest;
+}
+
+static std::vector<unsigned char> DeriveKey(const std::vector<unsigned char>& salt, const std::string& password)
+{
+	std::vector<unsigned char> key(SESSION_KEY_LENGTH);
+	if (PKCS5_PBKDF2_HMAC(password.c_str(), (int)password.size(), salt.data(), (int)salt.size(), SESSION_KEY_ITERATIONS, EVP_sha256(), (int)key.size(), key.data()) != 1)
+	{
+		throw std::runtime_error("Failed to derive session key.");
+	}
+
+	return key;
+}
+
+static std::string StringValue(plist_t dictionary, const char* key)
+{
+	auto node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_STRING)
+	{
+		throw std::runtime_error(std::string("Session is missing ") + key + ".");
+	}
+
+	char* value = nullptr;
+	plist_get_string_val(node, &value);
+
+	std::string string(value);
+	free(value);
+
+	return string;
+}
+
+std::optional<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>> SessionManager::CachedSession(std::string appleID, std::string password, std::shared_ptr<AnisetteData> anisetteData)
+{
+	appleID = NormalizedAppleID(appleID);
+
+	std::lock_guard<std::mutex> lock(_sessionsMutex);
+
+	std::optional<Session> session;
+
+	auto iterator = _sessions.find(appleID);
+	if (iterator != _sessions.end())
+	{
+		if (PasswordDigest(iterator->second.salt, password) != iterator->second.passwordDigest)
+		{
+			return std::nullopt;
+		}
+
+		session = iterator->second;
+	}
+	else
+	{
+		session = this->LoadSession(appleID, password);
+		if (!session.has_value())
+		{
+			return std::nullopt;
+		}
+
+		_sessions[appleID] = *session;
+	}
+
+	if (session->expirationDate.has_value() && *session->expirationDate - SESSION_EXPIRATION_MARGIN <= time(NULL))
+	{
+		odslog("Session for " << appleID << " expired, signing in again...");
+
+		_sessions.erase(appleID);
+
+		boost::system::error_code error;
+		fs::remove(this->sessionPath(appleID), error);
+
+		return std::nullopt;
+	}
+
+	if (session->deviceIdentifier != anisetteData->deviceUniqueIdentifier() || session->localUserID != anisetteData->localUserID())
+	{
+		odslog("Session for " << appleID << " belongs to another anisette identity, signing in again...");
+		return std::nullopt;
+	}
+
+	auto account = std::make_shared<Account>(session->accountAppleID, session->accountIdentifier, session->firstName, session->lastName);
+	auto apiSession = std::make_shared<AppleAPISession>(session->dsid, session->authToken, session->expirationDate, anisetteData);
+
+	return std::make_pair(account, apiSession);
+}
+
+void SessionManager::SaveSession(std::string appleID, std::string password, std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> apiSession)
+{
+	appleID = NormalizedAppleID(appleID);
+
+	Session session;
+	session.salt.resize(SESSION_SALT_LENGTH);
+	RAND_bytes(session.salt.data(), (int)session.salt.size());
+	session.passwordDigest = PasswordDigest(session.salt, password);
+
+	session.accountAppleID = account->appleID();
+	session.accountIdentifier = account->identifier();
+	session.firstName = account->firstName();
+	session.lastName = account->lastName();
+
+	session.dsid = apiSession->dsid();
+	session.authToken = apiSession->authToken();
+	session.expirationDate = apiSession->expirationDate();
+
+	session.deviceIdentifier = apiSession->anisetteData()->deviceUniqueIdentifier();
+	session.localUserID = apiSession->anisetteData()->localUserID();
+
+	std::lock_guard<std::mutex> lock(_sessionsMutex);
+	_sessions[appleID] = session;
+
+	try
+	{
+		this->WriteSession(appleID, password, session);
+	}
+	catch (std::exception& exception)
+	{
+		odslog("Failed to save session for " << appleID << ": " << exception.what());
+	}
+}
+
+void SessionManager::RemoveSession(std::string appleID)
+{
+	appleID = NormalizedAppleID(appleID);
+
+	std::lock_guard<std::mutex> lock(_sessionsMutex);
+	_sessions.erase(appleID);
+
+	try
+	{
+		fs::remove(this->sessionPath(appleID));
+	}
+	catch (std::exception& exception)
+	{
+		odslog("Failed to remove session for " << appleID << ": " << exception.what());
+	}
+}
+
+bool SessionManager::IsSessionRejectedError(const LocalizedError& error)
+{
+	// "Your session has expired. Please log in."
+	return error.code() == 1100;
+}
+
+std::optional<SessionManager::Session> SessionManager::LoadSession(std::string appleID, std::string password)
+{
+	auto path = this->sessionPath(appleID);
+	if (!fs::exists(path))
+	{
+		return std::nullopt;
+	}
+
+	plist_t plist = nullptr;
+
+	try
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		size_t headerLength = strlen(SESSION_FILE_MAGIC) + SESSION_SALT_LENGTH + SESSION_IV_LENGTH + SESSION_TAG_LENGTH;
+		if (data.size() <= headerLength || memcmp(data.data(), SESSION_FILE_MAGIC, strlen(SESSION_FILE_MAGIC)) != 0)
+		{
+			throw std::runtime_error("Unrecognized session file.");
+		}
+
+		auto salt = data.begin() + strlen(SESSION_FILE_MAGIC);
+		auto iv = salt + SESSION_SALT_LENGTH;
+		auto tag = iv + SESSION_IV_LENGTH;
+		auto ciphertext = tag + SESSION_TAG_LENGTH;
+
+		Session session;
+		session.salt = std::vector<unsigned char>(salt, iv);
+		session.passwordDigest = PasswordDigest(session.salt, password);
+
+		auto key = DeriveKey(session.salt, password);
+
+		std::vector<unsigned char> plaintext(data.end() - ciphertext);
+		int length = 0;
+
+		auto context = EVP_CIPHER_CTX_new();
+		bool decrypted = EVP_DecryptInit_ex(context, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+			EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_IVLEN, SESSION_IV_LENGTH, NULL) == 1 &&
+			EVP_DecryptInit_ex(context, NULL, NULL, key.data(), &*iv) == 1 &&
+			EVP_DecryptUpdate(context, plaintext.data(), &length, &*ciphertext, (int)plaintext.size()) == 1 &&
+			EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, SESSION_TAG_LENGTH, &*tag) == 1 &&
+			EVP_DecryptFinal_ex(context, plaintext.data() + length, &length) == 1;
+		EVP_CIPHER_CTX_free(context);
+
+		OPENSSL_cleanse(key.data(), key.size());
+
+		if (!decrypted)
+		{
+			// Most likely the password changed since the session was saved.
+			odslog("Could not decrypt saved session for " << appleID << ".");
+			return std::nullopt;
+		}
+
+		plist_from_bin((const char*)plaintext.data(), (uint32_t)plaintext.size(), &plist);
+		OPENSSL_cleanse(plaintext.data(), plaintext.size());
+
+		if (plist == nullptr)
+		{
+			throw std::runtime_error("Invalid session file.");
+		}
+
+		session.accountAppleID = StringValue(plist, "accountAppleID");
+		session.accountIdentifier = StringValue(plist, "accountIdentifier");
+		session.firstName = StringValue(plist, "firstName");
+		session.lastName = StringValue(plist, "lastName");
+		session.dsid = StringValue(plist, "dsid");
+		session.authToken = StringValue(plist, "authToken");
+		session.deviceIdentifier = StringValue(plist, "deviceIdentifier");
+		session.localUserID = StringValue(plist, "localUserID");
+
+		auto expirationDateNode = plist_dict_get_item(plist, "expirationDate");
+		if (expirationDateNode != nullptr)
+		{
+			uint64_t expirationDate = 0;
+			plist_get_uint_val(expirationDateNode, &expirationDate);
+			session.expirationDate = (time_t)expirationDate;
+		}
+
+		plist_free(plist);
+
+		odslog("Loaded saved session for " << appleID << ".");
+
+		return session;
+	}
+	catch (std::exception& exception)
+	{
+		if (plist != nullptr)
+		{
+			plist_free(plist);
+		}
+
+		odslog("Failed to load session for " << appleID << ": " << exception.what());
+		return std::nullopt;
+	}
+}
+
+void SessionManager::WriteSession(std::string appleID, std::string password, const Session& session)
+{
+	auto plist = plist_new_dict();
+	plist_dict_set_item(plist, "accountAppleID", plist_new_string(session.accountAppleID.c_str()));
+	plist_dict_set_item(plist, "accountIdentifier", plist_new_string(session.accountIdentifier.c_str()));
+	plist_dict_set_item(plist, "firstName", plist_new_string(session.firstName.c_str()));
+	plist_dict_set_item(plist, "lastName", plist_new_string(session.lastName.c_str()));
+	plist_dict_set_item(plist, "dsid", plist_new_string(session.dsid.c_str()));
+	plist_dict_set_item(plist, "authToken", plist_new_string(session.authToken.c_str()));
+	plist_dict_set_item(plist, "deviceIdentifier", plist_new_string(session.deviceIdentifier.c_str()));
+	plist_dict_set_item(plist, "localUserID", plist_new_string(session.localUserID.c_str()));
+
+	if (session.expirationDate.has_value())
+	{
+		plist_dict_set_item(plist, "expirationDate", plist_new_uint((uint64_t)*session.expirationDate));
+	}
+
+	char* plistData = nullptr;
+	uint32_t plistLength = 0;
+	plist_to_bin(plist, &plistData, &plistLength);
+	plist_free(plist);
+
+	std::vector<unsigned char> plaintext(plistData, plistData + plistLength);
+	OPENSSL_cleanse(plistData, plistLength);
+	free(plistData);
+
+	std::vector<unsigned char> iv(SESSION_IV_LENGTH);
+	RAND_bytes(iv.data(), (int)iv.size());
+
+	auto key = DeriveKey(session.salt, password);
+
+	std::vector<unsigned char> ciphertext(plaintext.size());
+	std::vector<unsigned char> tag(SESSION_TAG_LENGTH);
+	int length = 0;
+
+	auto context = EVP_CIPHER_CTX_new();
+	bool encrypted = EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+		EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_IVLEN, SESSION_IV_LENGTH, NULL) == 1 &&
+		EVP_EncryptInit_ex(context, NULL, NULL, key.data(), iv.data()) == 1 &&
+		EVP_EncryptUpdate(context, ciphertext.data(), &length, plaintext.data(), (int)plaintext.size()) == 1 &&
+		EVP_EncryptFinal_ex(context, ciphertext.data() + length, &length) == 1 &&
+		EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, SESSION_TAG_LENGTH, tag.data()) == 1;
+	EVP_CIPHER_CTX_free(context);
+
+	OPENSSL_cleanse(key.data(), key.size());
+	OPENSSL_cleanse(plaintext.data(), plaintext.size());
+
+	if (!encrypted)
+	{
+		throw std::runtime_error("Failed to encrypt session.");
+	}
+
+	auto path = this->sessionPath(appleID);
+	auto temporaryPath = path + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write(SESSION_FILE_MAGIC, strlen(SESSION_FILE_MAGIC));
+		file.write((const char*)session.salt.data(), session.salt.size());
+		file.write((const char*)iv.data(), iv.size());
+		file.write((const char*)tag.data(), tag.size());
+		file.write((const char*)ciphertext.data(), ciphertext.size());
+
+		if (!file)
+		{
+			throw std::runtime_error("Failed to write " + temporaryPath + ".");
+		}
+	}
+
+	fs::rename(temporaryPath, path);
+}
+
+std::string SessionManager::sessionPath(std::string appleID) const
+{
+	// Name files by a digest so the Apple ID itself isn't on disk in the clear.
+	auto path = AltServerApp::instance()->sessionsDirectoryPath();
+	path.append(SHA256HexString(appleID) + ".session");
+	return path.string();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include "Error.hpp"
+
+class Account;
+class AppleAPISession;
+class AnisetteData;
+
+// Remembers signed-in Apple ID sessions in memory and, encrypted with a key derived from
+// the account's password, on disk, so installs can skip the SRP handshake.
+class SessionManager
+{
+public:
+	static SessionManager* instance();
+
+	// Returns the account and a session bound to anisetteData if appleID signed in before with the
+	// same password and anisette identity, and Apple's token hasn't expired.
+	std::optional<std::pair<std::shared_ptr<Account>, std::shared_ptr<AppleAPISession>>> CachedSession(std::string appleID, std::string password, std::shared_ptr<AnisetteData> anisetteData);
+
+	void SaveSession(std::string appleID, std::string password, std::shared_ptr<Account> account, std::shared_ptr<AppleAPISession> session);
+	void RemoveSession(std::string appleID);
+
+	// Whether Apple rejected a request because its session is no longer valid.
+	static bool IsSessionRejectedError(const LocalizedError& error);
+
+private:
+	SessionManager();
+	~SessionManager();
+
+	static SessionManager* _instance;
+
+	struct Session
+	{
+		std::vector<unsigned char> salt;
+		std::vector<unsigned char> passwordDigest;
+
+		std::string accountAppleID;
+		std::string accountIdentifier;
+		std::string firstName;
+		std::string lastName;
+
+		std::string dsid;
+		std::string authToken;
+		std::optional<time_t> expirationDate;
+
+		// Apple binds auth tokens to the anisette identity they were issued to.
+		std::string deviceIdentifier;
+		std::string localUserID;
+	};
+
+	std::mutex _sessionsMutex;
+	std::map<std::string, Session> _sessions;
+
+	std::optional<Session> LoadSession(std::string appleID, std::string password);
+	void WriteSession(std::string appleID, std::string password, const Session& session);
+
+	std::string sessionPath(std::string appleID) const;
+};
@@ -0,0 +1,433 @@
+#include "SignedAppCache.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <openssl/evp.h>
+
+#include "AltServerApp.h"
+#include "Digest.hpp"
+
+#include "common.h"
+
+// 1 GB.
+#define DEFAULT_QUOTA (1024ull * 1024 * 1024)
+
+#define LAST_USE_DATE_FILENAME "LastUsed"
+#define TEMPORARY_ENTRY_SUFFIX ".tmp"
+
+extern std::string make_uuid();
+
+CachedSignedApp::CachedSignedApp(std::string key, std::string path) : _key(key), _path(path)
+{
+}
+
+CachedSignedApp::~CachedSignedApp()
+{
+	SignedAppCache::instance()->Release(_key);
+}
+
+std::string CachedSignedApp::path() const
+{
+	return _path;
+}
+
+SignedAppCache* SignedAppCache::_instance = nullptr;
+
+SignedAppCache* SignedAppCache::instance()
+{
+	if (_instance == 0)
+	{
+		_instance = new SignedAppCache();
+	}
+
+	return _instance;
+}
+
+SignedAppCache::SignedAppCache() : _loadedEntries(false), _quota(DEFAULT_QUOTA), _size(0)
+{
+}
+
+SignedAppCache::~SignedAppCache()
+{
+}
+
+static uint64_t DirectorySize(const fs::path& path)
+{
+	uint64_t size = 0;
+
+	for (auto& item : fs::recursive_directory_iterator(path))
+	{
+		if (fs::is_regular_file(item.path()) && !fs::is_symlink(item.path()))
+		{
+			size += fs::file_size(item.path());
+		}
+	}
+
+	return size;
+}
+
+static void CopyDirectory(const fs::path& sourcePath, const fs::path& destinationPath)
+{
+	fs::create_directories(destinationPath);
+
+	for (auto& item : fs::recursive_directory_iterator(sourcePath))
+	{
+		auto relativePath = item.path().lexically_relative(sourcePath);
+
+		fs::path itemDestinationPath(destinationPath);
+		itemDestinationPath.append(relativePath.string());
+
+		if (fs::is_symlink(item.path()))
+		{
+			fs::copy_symlink(item.path(), itemDestinationPath);
+		}
+		else if (fs::is_directory(item.path()))
+		{
+			fs::create_directories(itemDestinationPath);
+		}
+		else
+		{
+			fs::copy_file(item.path(), itemDestinationPath);
+		}
+	}
+}
+
+#pragma mark - Keys -
+
+std::string SignedAppCache::HashFile(std::string path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open " + path + ".");
+	}
+
+	auto context = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+
+	std::vector<char> buffer(1024 * 1024);
+	while (file)
+	{
+		file.read(buffer.data(), buffer.size());
+		EVP_DigestUpdate(context, buffer.data(), file.gcount());
+	}
+
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestLength = 0;
+	EVP_DigestFinal_ex(context, digest, &digestLength);
+	EVP_MD_CTX_free(context);
+
+	return HexString(digest, digestLength);
+}
+
+std::string SignedAppCache::Key(const std::vector<std::string>& components)
+{
+	auto context = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+
+	for (auto& component : components)
+	{
+		// Length-prefixed, so ("ab", "c") and ("a", "bc") don't collide.
+		uint64_t length = component.size();
+		EVP_DigestUpdate(context, &length, sizeof(length));
+		EVP_DigestUpdate(context, component.data(), component.size());
+	}
+
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestLength = 0;
+	EVP_DigestFinal_ex(context, digest, &digestLength);
+	EVP_MD_CTX_free(context);
+
+	return HexString(digest, digestLength);
+}
+
+#pragma mark - Entries -
+
+std::shared_ptr<CachedSignedApp> SignedAppCache::LookUp(std::string key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_quota == 0)
+	{
+		return nullptr;
+	}
+
+	this->LoadEntries();
+
+	auto iterator = _entries.find(key);
+	if (iterator != _entries.end() && !fs::exists(iterator->second.appPath))
+	{
+		// Removed behind our back.
+		_size -= iterator->second.size;
+		_entries.erase(iterator);
+		iterator = _entries.end();
+	}
+
+	if (iterator == _entries.end())
+	{
+		_statistics.misses++;
+		return nullptr;
+	}
+
+	auto& entry = iterator->second;
+	entry.useCount++;
+
+	_statistics.hits++;
+	_statistics.bytesSaved += entry.size;
+
+	this->MarkUsed(key, entry);
+
+	return std::shared_ptr<CachedSignedApp>(new CachedSignedApp(key, entry.appPath));
+}
+
+void SignedAppCache::Release(std::string key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto iterator = _entries.find(key);
+	if (iterator != _entries.end() && iterator->second.useCount > 0)
+	{
+		iterator->second.useCount--;
+	}
+}
+
+void SignedAppCache::Store(std::string key, std::string appPath)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_quota == 0)
+		{
+			return;
+		}
+
+		this->LoadEntries();
+
+		if (_entries.count(key) > 0)
+		{
+			return;
+		}
+	}
+
+	auto size = DirectorySize(appPath);
+	if (size > this->quota())
+	{
+		odslog("Not caching signed app " << appPath << ", it is larger than the cache.");
+		return;
+	}
+
+	// Copy to a temporary entry first so a half-written bundle is never found.
+	auto path = this->entryPath(key);
+	auto temporaryPath = path + "." + make_uuid() + TEMPORARY_ENTRY_SUFFIX;
+
+	fs::path temporaryAppPath(temporaryPath);
+	temporaryAppPath.append(fs::path(appPath).filename().string());
+
+	CopyDirectory(appPath, temporaryAppPath);
+
+	std::vector<std::string> evictedPaths;
+	bool isDuplicate = false;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_entries.count(key) > 0 || fs::exists(path))
+		{
+			// Another install stored the same bundle meanwhile.
+			isDuplicate = true;
+		}
+		else
+		{
+			fs::rename(temporaryPath, path);
+
+			fs::path entryAppPath(path);
+			entryAppPath.append(fs::path(appPath).filename().string());
+
+			Entry entry;
+			entry.appPath = entryAppPath.string();
+			entry.size = size;
+
+			this->MarkUsed(key, entry);
+
+			_entries[key] = entry;
+			_size += size;
+
+			evictedPaths = this->EvictEntries();
+		}
+	}
+
+	if (isDuplicate)
+	{
+		fs::remove_all(temporaryPath);
+	}
+
+	for (auto& evictedPath : evictedPaths)
+	{
+		odslog("Removing least recently used signed app " << evictedPath);
+
+		try
+		{
+			fs::remove_all(evictedPath);
+		}
+		catch (std::exception& e)
+		{
+			odslog("Failed to remove " << evictedPath << ". " << e.what());
+		}
+	}
+}
+
+void SignedAppCache::LoadEntries()
+{
+	if (_loadedEntries)
+	{
+		return;
+	}
+
+	_loadedEntries = true;
+
+	auto directoryPath = AltServerApp::instance()->signedAppsDirectoryPath();
+
+	for (auto& item : fs::directory_iterator(directoryPath))
+	{
+		if (!fs::is_directory(item.path()))
+		{
+			continue;
+		}
+
+		try
+		{
+			auto key = item.path().filename().string();
+			if (key.find('.') != std::string::npos)
+			{
+				// Left over from a copy that didn't finish.
+				fs::remove_all(item.path());
+				continue;
+			}
+
+			Entry entry;
+
+			for (auto& child : fs::directory_iterator(item.path()))
+			{
+				if (fs::is_directory(child.path()) && child.path().extension().string() == ".app")
+				{
+					entry.appPath = child.path().string();
+					break;
+				}
+			}
+
+			if (entry.appPath.empty())
+			{
+				fs::remove_all(item.path());
+				continue;
+			}
+
+			entry.size = DirectorySize(entry.appPath);
+
+			fs::path lastUseDatePath(item.path());
+			lastUseDatePath.append(LAST_USE_DATE_FILENAME);
+
+			std::ifstream file(lastUseDatePath.string());
+			file >> entry.lastUseDate;
+
+			_entries[key] = entry;
+			_size += entry.size;
+		}
+		catch (std::exception& e)
+		{
+			odslog("Failed to load signed app " << item.path() << ". " << e.what());
+		}
+	}
+
+	// The quota may have shrunk since the last launch.
+	for (auto& evictedPath : this->EvictEntries())
+	{
+		try
+		{
+			fs::remove_all(evictedPath);
+		}
+		catch (std::exception& e)
+		{
+			odslog("Failed to remove " << evictedPath << ". " << e.what());
+		}
+	}
+}
+
+std::vector<std::string> SignedAppCache::EvictEntries()
+{
+	std::vector<std::string> evictedPaths;
+
+	while (_size > _quota)
+	{
+		auto leastRecentlyUsed = _entries.end();
+
+		for (auto iterator = _entries.begin(); iterator != _entries.end(); iterator++)
+		{
+			// Bundles still being installed stay.
+			if (iterator->second.useCount > 0)
+			{
+				continue;
+			}
+
+			if (leastRecentlyUsed == _entries.end() || iterator->second.lastUseDate < leastRecentlyUsed->second.lastUseDate)
+			{
+				leastRecentlyUsed = iterator;
+			}
+		}
+
+		if (leastRecentlyUsed == _entries.end())
+		{
+			break;
+		}
+
+		evictedPaths.push_back(this->entryPath(leastRecentlyUsed->first));
+
+		_size -= leastRecentlyUsed->second.size;
+		_entries.erase(leastRecentlyUsed);
+	}
+
+	return evictedPaths;
+}
+
+void SignedAppCache::MarkUsed(std::string key, Entry& entry)
+{
+	entry.lastUseDate = time(nullptr);
+
+	// Kept on disk so the least recently used bundles are still known after a restart.
+	fs::path lastUseDatePath(this->entryPath(key));
+	lastUseDatePath.append(LAST_USE_DATE_FILENAME);
+
+	std::ofstream file(lastUseDatePath.string(), std::ios::out | std::ios::trunc);
+	file << entry.lastUseDate;
+}
+
+std::string SignedAppCache::entryPath(std::string key) const
+{
+	auto path = AltServerApp::instance()->signedAppsDirectoryPath();
+	path.append(key);
+	return path.string();
+}
+
+#pragma mark - Getters -
+
+uint64_t SignedAppCache::quota()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _quota;
+}
+
+void SignedAppCache::setQuota(uint64_t quota)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_quota = quota;
+}
+
+SignedAppCacheStatistics SignedAppCache::statistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto statistics = _statistics;
+	statistics.entries = _entries.size();
+	statistics.size = _size;
+	return statistics;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct SignedAppCacheStatistics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	// Size of the signed bundles hits installed without preparing and signing them again.
+	uint64_t bytesSaved = 0;
+
+	size_t entries = 0;
+	uint64_t size = 0;
+};
+
+// A signed bundle in SignedAppCache. It isn't removed from the cache until the last reference is released.
+class CachedSignedApp
+{
+public:
+	~CachedSignedApp();
+
+	std::string path() const;
+
+private:
+	friend class SignedAppCache;
+
+	CachedSignedApp(std::string key, std::string path);
+
+	std::string _key;
+	std::string _path;
+};
+
+// Keeps signed app bundles on disk, keyed by a digest of everything that goes into signing them, so installing
+// the same .ipa with the same certificate and profiles again (e.g. to another device) can skip straight to the upload.
+// Least recently used bundles are removed once the cache outgrows its quota.
+class SignedAppCache
+{
+public:
+	static SignedAppCache* instance();
+
+	// SHA-256 of the file at path, as hex.
+	static std::string HashFile(std::string path);
+
+	// Combines everything a signed bundle depends on into one cache key.
+	static std::string Key(const std::vector<std::string>& components);
+
+	// Returns the signed .app stored for key, or nullptr.
+	std::shared_ptr<CachedSignedApp> LookUp(std::string key);
+
+	// Copies the signed .app at appPath into the cache.
+	void Store(std::string key, std::string appPath);
+
+	// In bytes; 0 disables the cache.
+	uint64_t quota();
+	void setQuota(uint64_t quota);
+
+	SignedAppCacheStatistics statistics();
+
+private:
+	friend class CachedSignedApp;
+
+	SignedAppCache();
+	~SignedAppCache();
+
+	static SignedAppCache* _instance;
+
+	struct Entry
+	{
+		std::string appPath;
+		uint64_t size = 0;
+		time_t lastUseDate = 0;
+		int useCount = 0;
+	};
+
+	std::mutex _mutex;
+	std::map<std::string, Entry> _entries;
+	bool _loadedEntries;
+
+	uint64_t _quota;
+	uint64_t _size;
+
+	SignedAppCacheStatistics _statistics;
+
+	// Require _mutex to be held.
+	void LoadEntries();
+	std::vector<std::string> EvictEntries();
+
+	void Release(std::string key);
+
+	void MarkUsed(std::string key, Entry& entry);
+	std::string entryPath(std::string key) const;
+};
@@ -61,7 +61,7 @@ pplx::task<void> WirelessConnection::SendData(std::vector<unsigned char>& data)
 			ssize_t sentBytes = send(this->socket(), (const char*)data.data(), (size_t)(data.size() - totalSentBytes), 0);
 			totalSentBytes += sentBytes;
 
-			std::cout << "Sent Bytes Count: " << sentBytes << " (" << totalSentBytes << ")" << std::endl;
+			odstrace("Sent Bytes Count: " << sentBytes << " (" << totalSentBytes << ")");
 
 			if (totalSentBytes >= sentBytes)
 			{
@@ -69,7 +69,7 @@ pplx::task<void> WirelessConnection::SendData(std::vector<unsigned char>& data)
 			}
 		}
 
-		std::cout << "Sent Data: " << totalSentBytes << " Bytes" << std::endl;
+		odsdebug("Sent Data: " << totalSentBytes << " Bytes");
 		});
 }
 
@@ -91,7 +91,7 @@ pplx::task<std::vector<unsigned char>> WirelessConnection::ReceiveData(int size)
 			tv.tv_usec = 0; /* no microseconds. */
 
 			int socket = this->socket();
-			std::cout << "Checking socket: " << socket << std::endl;
+			odstrace("Checking socket: " << socket);
 
 			/* Selection */
 			FD_ZERO(&input_set);   /* Empty the FD Set */
@@ -108,17 +108,23 @@ pplx::task<std::vector<unsigned char>> WirelessConnection::ReceiveData(int size)
 			}
 			else if (result == -1)
 			{
-				std::cout << "Error!" << std::endl;
+				odslog("Error!");
 			}
 			else
 			{
 				ssize_t readBytes = recv(this->socket(), buffer, min((ssize_t)4096, (ssize_t)(size - data.size())), 0);
+				if (readBytes <= 0)
+				{
+					// The client went away; without this the loop spins on a socket that stays readable.
+					throw ServerError(ServerErrorCode::LostConnection);
+				}
+
 				for (int i = 0; i < readBytes; i++)
 				{
 					data.push_back(buffer[i]);
 				}
 
-				odslog("Received bytes: " << data.size() << "(of " << size << ")");
+				odstrace("Received bytes: " << data.size() << "(of " << size << ")");
 
 				if (data.size() >= size)
 				{
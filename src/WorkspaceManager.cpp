@@ -0,0 +1,408 @@
+#include "WorkspaceManager.h"
+
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+namespace fs = std::filesystem;
+
+// 4 GB.
+#define DEFAULT_QUOTA (4096ull * 1024 * 1024)
+
+// Unzipped apps are rarely more than twice the size of their .ipa; signing rewrites them in place.
+#define UNZIPPED_APP_SIZE_FACTOR 3
+
+#define WORKSPACES_DIRECTORY_NAME "AltServerWorkspaces"
+
+// Held by the instance whose workspaces are in the directory of the same name.
+#define INSTANCE_LOCK_EXTENSION ".lock"
+
+extern std::string make_uuid();
+extern std::string temporary_directory();
+
+#pragma mark - Workspace -
+
+Workspace::Workspace(std::string path, uint64_t reservedBytes) : _path(path), _reservedBytes(reservedBytes)
+{
+}
+
+Workspace::~Workspace()
+{
+	WorkspaceManager::instance()->RemoveWorkspace(_path, _reservedBytes);
+}
+
+std::string Workspace::path() const
+{
+	return _path;
+}
+
+uint64_t Workspace::reservedBytes() const
+{
+	return _reservedBytes;
+}
+
+#pragma mark - WorkspaceManager -
+
+WorkspaceManager* WorkspaceManager::_instance = nullptr;
+
+WorkspaceManager* WorkspaceManager::instance()
+{
+	if (_instance == 0)
+	{
+		_instance = new WorkspaceManager();
+	}
+
+	return _instance;
+}
+
+WorkspaceManager::WorkspaceManager() : _rootPath(temporary_directory()), _instanceIdentifier(make_uuid()), _quota(DEFAULT_QUOTA), _reservedBytes(0), _workspaceCount(0)
+{
+	_reaperThread = std::thread([this]() {
+		this->Reap();
+	});
+}
+
+WorkspaceManager::~WorkspaceManager()
+{
+	_reaperThread.detach();
+}
+
+uint64_t WorkspaceManager::UnzippedAppSize(uint64_t ipaSize)
+{
+	return ipaSize * UNZIPPED_APP_SIZE_FACTOR;
+}
+
+#pragma mark - Allocation -
+
+pplx::task<std::shared_ptr<Workspace>> WorkspaceManager::Allocate(uint64_t reservedBytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_statistics.allocations++;
+
+		// Earlier allocations go first, so a large one isn't starved by a stream of small ones.
+		if (!_pendingAllocations.empty() || !this->CanReserve(reservedBytes))
+		{
+			odslog("Waiting for " << reservedBytes << " bytes of workspace (" << _reservedBytes << " of " << _quota << " reserved)...");
+
+			PendingAllocation allocation;
+			allocation.reservedBytes = reservedBytes;
+			allocation.requestDate = std::chrono::steady_clock::now();
+			_pendingAllocations.push_back(allocation);
+
+			_statistics.waitedAllocations++;
+
+			return pplx::create_task(allocation.completionEvent);
+		}
+
+		_reservedBytes += reservedBytes;
+		_workspaceCount++;
+
+		_statistics.maximumReservedBytes = std::max(_statistics.maximumReservedBytes, _reservedBytes);
+	}
+
+	return pplx::create_task([=]() {
+		return this->MakeWorkspace(reservedBytes);
+	});
+}
+
+bool WorkspaceManager::CanReserve(uint64_t reservedBytes) const
+{
+	if (_quota == 0 || _workspaceCount == 0)
+	{
+		return true;
+	}
+
+	return _reservedBytes + reservedBytes <= _quota;
+}
+
+std::vector<WorkspaceManager::PendingAllocation> WorkspaceManager::DequeueAllocations()
+{
+	std::vector<PendingAllocation> allocations;
+
+	auto now = std::chrono::steady_clock::now();
+
+	while (!_pendingAllocations.empty() && this->CanReserve(_pendingAllocations.front().reservedBytes))
+	{
+		auto allocation = _pendingAllocations.front();
+		_pendingAllocations.pop_front();
+
+		_reservedBytes += allocation.reservedBytes;
+		_workspaceCount++;
+
+		_statistics.maximumReservedBytes = std::max(_statistics.maximumReservedBytes, _reservedBytes);
+		_statistics.waitTime += std::chrono::duration_cast<std::chrono::milliseconds>(now - allocation.requestDate);
+
+		allocations.push_back(allocation);
+	}
+
+	return allocations;
+}
+
+void WorkspaceManager::CompleteAllocations(std::vector<PendingAllocation> allocations)
+{
+	for (auto& allocation : allocations)
+	{
+		try
+		{
+			allocation.completionEvent.set(this->MakeWorkspace(allocation.reservedBytes));
+		}
+		catch (...)
+		{
+			allocation.completionEvent.set_exception(std::current_exception());
+		}
+	}
+}
+
+std::shared_ptr<Workspace> WorkspaceManager::MakeWorkspace(uint64_t reservedBytes)
+{
+	fs::path path;
+
+	try
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			path = this->instanceDirectoryPath();
+		}
+
+		path.append(make_uuid());
+		fs::create_directories(path);
+	}
+	catch (std::exception& e)
+	{
+		odslog("Failed to create workspace " << path << ". " << e.what());
+
+		// Still goes through the reaper, which returns the reservation.
+		this->RemoveWorkspace(path.string(), reservedBytes);
+		throw;
+	}
+
+	return std::shared_ptr<Workspace>(new Workspace(path.string(), reservedBytes));
+}
+
+#pragma mark - Removal -
+
+void WorkspaceManager::Remove(std::string path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_removals.push_back({ path, false, 0 });
+	_removalCondition.notify_one();
+}
+
+void WorkspaceManager::RemoveWorkspace(std::string path, uint64_t releasedBytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_removals.push_back({ path, true, releasedBytes });
+	_removalCondition.notify_one();
+}
+
+void WorkspaceManager::RemoveLeftoverWorkspaces()
+{
+	fs::path directoryPath;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		directoryPath = this->workspacesDirectoryPath();
+	}
+
+	std::error_code error;
+	if (!fs::exists(directoryPath, error))
+	{
+		return;
+	}
+
+	for (auto& item : fs::directory_iterator(directoryPath, error))
+	{
+		auto identifier = item.path().stem().string();
+		if (identifier == _instanceIdentifier)
+		{
+			continue;
+		}
+
+		if (item.path().extension() == INSTANCE_LOCK_EXTENSION)
+		{
+			// Locked while its instance is running; flock() locks are released when a process exits, however it exits.
+			int fd = open(item.path().c_str(), O_RDWR);
+			if (fd < 0)
+			{
+				continue;
+			}
+
+			bool isRunning = (flock(fd, LOCK_EX | LOCK_NB) != 0);
+			close(fd);
+
+			if (isRunning)
+			{
+				continue;
+			}
+
+			auto instancePath = directoryPath;
+			instancePath.append(identifier);
+
+			odslog("Removing leftover workspaces " << instancePath);
+			this->Remove(instancePath.string());
+			this->Remove(item.path().string());
+		}
+		else if (item.is_directory(error) && !fs::exists(fs::path(item.path()).concat(INSTANCE_LOCK_EXTENSION), error))
+		{
+			// Only removed along with its lock file, unless it has none (e.g. it was created before instances had their own directory).
+			odslog("Removing leftover workspace " << item.path());
+			this->Remove(item.path().string());
+		}
+	}
+}
+
+void WorkspaceManager::Reap()
+{
+	while (true)
+	{
+		Removal removal;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_removalCondition.wait(lock, [this]() { return !_removals.empty(); });
+
+			removal = _removals.front();
+			_removals.pop_front();
+		}
+
+		std::error_code error;
+		fs::remove_all(removal.path, error);
+
+		if (error)
+		{
+			odslog("Failed to remove " << removal.path << ". " << error.message());
+		}
+
+		std::vector<PendingAllocation> allocations;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (error)
+			{
+				_statistics.failedRemovals++;
+			}
+			else
+			{
+				_statistics.removedDirectories++;
+			}
+
+			if (removal.isWorkspace)
+			{
+				// Returned even if removal failed, so one bad directory can't block every install.
+				_reservedBytes -= std::min(_reservedBytes, removal.releasedBytes);
+				_workspaceCount--;
+
+				allocations = this->DequeueAllocations();
+			}
+		}
+
+		this->CompleteAllocations(allocations);
+	}
+}
+
+#pragma mark - Getters -
+
+std::string WorkspaceManager::workspacesDirectoryPath() const
+{
+	fs::path path(_rootPath);
+	path.append(WORKSPACES_DIRECTORY_NAME);
+	return path.string();
+}
+
+std::string WorkspaceManager::instanceDirectoryPath()
+{
+	fs::path path(this->workspacesDirectoryPath());
+
+	if (_lockedRootPath != _rootPath)
+	{
+		fs::create_directories(path);
+
+		auto lockPath = path;
+		lockPath.append(_instanceIdentifier + INSTANCE_LOCK_EXTENSION);
+
+		// Held until the process exits. A previous root's lock is kept too, since its workspaces may still be in use.
+		while (true)
+		{
+			int fd = open(lockPath.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+			if (fd < 0)
+			{
+				throw std::system_error(errno, std::generic_category(), "Failed to create " + lockPath.string());
+			}
+
+			if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+			{
+				int error = errno;
+				close(fd);
+
+				throw std::system_error(error, std::generic_category(), "Failed to lock " + lockPath.string());
+			}
+
+			// Another instance may have locked the new file first, taken it for a leftover and removed it.
+			struct stat lockedFile, currentFile;
+			if (fstat(fd, &lockedFile) == 0 && stat(lockPath.c_str(), &currentFile) == 0 && lockedFile.st_ino == currentFile.st_ino)
+			{
+				break;
+			}
+
+			close(fd);
+		}
+
+		_lockedRootPath = _rootPath;
+	}
+
+	path.append(_instanceIdentifier);
+	return path.string();
+}
+
+std::string WorkspaceManager::rootPath()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _rootPath;
+}
+
+void WorkspaceManager::setRootPath(std::string rootPath)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_rootPath = rootPath;
+}
+
+uint64_t WorkspaceManager::quota()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _quota;
+}
+
+void WorkspaceManager::setQuota(uint64_t quota)
+{
+	std::vector<PendingAllocation> allocations;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quota = quota;
+
+		// A larger quota may fit allocations that were waiting.
+		allocations = this->DequeueAllocations();
+	}
+
+	this->CompleteAllocations(allocations);
+}
+
+WorkspaceStatistics WorkspaceManager::statistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto statistics = _statistics;
+	statistics.reservedBytes = _reservedBytes;
+	return statistics;
+}
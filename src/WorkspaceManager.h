@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+struct WorkspaceStatistics
+{
+	uint64_t allocations = 0;
+
+	// Allocations that had to wait for other workspaces to be removed, and how long they waited in total.
+	uint64_t waitedAllocations = 0;
+	std::chrono::milliseconds waitTime = std::chrono::milliseconds(0);
+
+	uint64_t removedDirectories = 0;
+	uint64_t failedRemovals = 0;
+
+	// Currently reserved, and the most that was ever reserved at once.
+	uint64_t reservedBytes = 0;
+	uint64_t maximumReservedBytes = 0;
+};
+
+// A directory for one job's temporary files. Removing it is left to WorkspaceManager's reaper
+// once the last reference (including tasks that returned it) is released, so callers never wait for the deletion.
+class Workspace
+{
+public:
+	~Workspace();
+
+	std::string path() const;
+	uint64_t reservedBytes() const;
+
+private:
+	friend class WorkspaceManager;
+
+	Workspace(std::string path, uint64_t reservedBytes);
+
+	std::string _path;
+	uint64_t _reservedBytes;
+};
+
+// Hands out per-job directories under one root (e.g. on a tmpfs), and removes them on a background thread.
+// Each workspace reserves an estimate of the bytes it will hold; once the reservations reach the quota,
+// further allocations wait until enough workspaces have been removed.
+class WorkspaceManager
+{
+public:
+	static WorkspaceManager* instance();
+
+	// Bytes to reserve for unzipping (and signing) an .ipa of the given size.
+	static uint64_t UnzippedAppSize(uint64_t ipaSize);
+
+	// Creates an empty workspace once reservedBytes fit in the quota. Allocations are granted in order,
+	// and one that is larger than the quota is granted once no other workspace exists.
+	pplx::task<std::shared_ptr<Workspace>> Allocate(uint64_t reservedBytes);
+
+	// Removes path on the reaper thread.
+	void Remove(std::string path);
+
+	// Queues workspaces left behind by instances that are no longer running for removal.
+	void RemoveLeftoverWorkspaces();
+
+	// Workspaces are created in a directory of their own inside rootPath, grouped by instance.
+	// Each instance holds a lock on its group while it runs, so instances sharing rootPath leave each other's workspaces alone.
+	std::string rootPath();
+	void setRootPath(std::string rootPath);
+
+	// In bytes; 0 disables the quota.
+	uint64_t quota();
+	void setQuota(uint64_t quota);
+
+	WorkspaceStatistics statistics();
+
+private:
+	friend class Workspace;
+
+	WorkspaceManager();
+	~WorkspaceManager();
+
+	static WorkspaceManager* _instance;
+
+	struct PendingAllocation
+	{
+		uint64_t reservedBytes;
+		std::chrono::steady_clock::time_point requestDate;
+		pplx::task_completion_event<std::shared_ptr<Workspace>> completionEvent;
+	};
+
+	struct Removal
+	{
+		std::string path;
+
+		// Workspaces return their reservation to the quota once removed.
+		bool isWorkspace;
+		uint64_t releasedBytes;
+	};
+
+	std::mutex _mutex;
+	std::string _rootPath;
+
+	std::string _instanceIdentifier;
+	std::optional<std::string> _lockedRootPath;
+	uint64_t _quota;
+	uint64_t _reservedBytes;
+	size_t _workspaceCount;
+
+	std::deque<PendingAllocation> _pendingAllocations;
+
+	std::deque<Removal> _removals;
+	std::condition_variable _removalCondition;
+	std::thread _reaperThread;
+
+	WorkspaceStatistics _statistics;
+
+	void Reap();
+	void RemoveWorkspace(std::string path, uint64_t releasedBytes);
+
+	// Require _mutex to be held.
+	bool CanReserve(uint64_t reservedBytes) const;
+	std::vector<PendingAllocation> DequeueAllocations();
+	std::string workspacesDirectoryPath() const;
+	std::string instanceDirectoryPath();
+
+	// Reservations were already made by DequeueAllocations().
+	void CompleteAllocations(std::vector<PendingAllocation> allocations);
+	std::shared_ptr<Workspace> MakeWorkspace(uint64_t reservedBytes);
+};
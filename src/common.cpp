@@ -0,0 +1,52 @@
+// Functions AltSign and AltServer's sources declare extern. Kept out of AltServerMain.cpp so the checks in tools/,
+// which link everything else, get them too.
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <uuid/uuid.h>
+
+namespace fs = std::filesystem;
+
+std::string make_uuid() {
+    uuid_t b;
+	char out[UUID_STR_LEN] = {0};
+	uuid_generate(b);
+  	uuid_unparse_lower(b, out);
+	return out;
+}
+
+std::string temporary_directory()
+{
+	return fs::temp_directory_path().string();
+}
+
+std::vector<unsigned char> readFile(const char* filename)
+{
+	// open the file:
+	std::ifstream file(filename, std::ios::binary);
+
+	// Stop eating new lines in binary mode!!!
+	file.unsetf(std::ios::skipws);
+
+	// get its size:
+	std::streampos fileSize;
+
+	file.seekg(0, std::ios::end);
+	fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	// reserve capacity
+	std::vector<unsigned char> vec;
+	vec.reserve(fileSize);
+
+	// read the data:
+	vec.insert(vec.begin(),
+		std::istream_iterator<unsigned char>(file),
+		std::istream_iterator<unsigned char>());
+
+	return vec;
+}
@@ -20,8 +20,12 @@ typedef int HINSTANCE;
 typedef struct timeval TIMEVAL;
 typedef int BOOL;
 
+#ifdef __cplusplus
+#include "Logger.hpp"
+
 #ifndef odslog
-#define odslog(msg) { std::cout << msg << std::endl; }
+#define odslog(msg) odslog_level(LogLevel::Info, msg)
+#endif
 #endif
 
 
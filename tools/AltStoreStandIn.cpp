@@ -0,0 +1,1182 @@
+//
+//  AltStoreStandIn.cpp
+//  AltServer
+//
+//  Load generator standing in for many AltStore clients at once. Each of
+//  --clients connections in flight sends one request, as AltStore does, over
+//  the length-prefixed JSON protocol ConnectionManager speaks: PrepareAppRequest
+//  followed by a synthetic .ipa and BeginInstallationRequest,
+//  AnisetteDataRequest, InstallProvisioningProfilesRequest or RemoveAppRequest,
+//  mixed by --mix weights. Apps are stored zips of --ipa-kb with an Info.plist
+//  and an embedded profile; profiles are CMS-signed by a throwaway identity,
+//  which AltServer accepts as it doesn't check who signed them.
+//
+//  --upload-mbps caps each connection's upload and --rate starts requests at a
+//  fixed rate instead of as soon as a connection is free; latencies then count
+//  from when a request was due, so a server falling behind shows up in them.
+//  Latency percentiles, throughput and errors per request type are printed at
+//  the end, or when interrupted, and --json PATH also writes them as JSON.
+//
+//  Start AltServer with ALTSERVER_PORT=6973 (and DeviceStandIn and AnisetteStandIn
+//  for its devices and anisette servers), then run ./AltStoreStandIn --port 6973
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cpprest/json.h>
+
+#include <openssl/cms.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include <plist/plist.h>
+#include <zlib.h>
+
+using namespace web;
+
+#define TEAM_IDENTIFIER "ALTSTORE01"
+
+#define UPLOAD_CHUNK_SIZE (64 * 1024)
+
+// Larger frames are treated as a broken connection.
+#define MAXIMUM_FRAME_SIZE (16 * 1024 * 1024)
+
+#define PROFILE_LIFETIME (7 * 24 * 60 * 60)
+
+// Apple's reference date is 2001-01-01.
+#define APPLE_REFERENCE_DATE 978307200
+
+enum class RequestType
+{
+	PrepareApp,
+	AnisetteData,
+	InstallProfiles,
+	RemoveApp,
+};
+
+static const std::vector<std::pair<RequestType, std::string>> RequestTypeNames = {
+	{ RequestType::PrepareApp, "prepare" },
+	{ RequestType::AnisetteData, "anisette" },
+	{ RequestType::InstallProfiles, "profiles" },
+	{ RequestType::RemoveApp, "remove" },
+};
+
+struct Configuration
+{
+	std::string host = "127.0.0.1";
+	int port = 6973;
+
+	int clients = 8;
+	int requests = 100;
+	int duration = 0;
+	double rate = 0;
+
+	// Same UDIDs as DeviceStandIn's devices by default.
+	std::vector<std::string> udids;
+	int deviceCount = 1;
+
+	int apps = 4;
+	int ipaKB = 4096;
+	double uploadBandwidth = 0;
+
+	int timeout = 300;
+
+	// Relative weight of each request type.
+	std::map<RequestType, int> mix = {
+		{ RequestType::PrepareApp, 40 },
+		{ RequestType::AnisetteData, 30 },
+		{ RequestType::InstallProfiles, 20 },
+		{ RequestType::RemoveApp, 10 },
+	};
+
+	std::string jsonPath;
+};
+
+struct SyntheticApp
+{
+	std::string bundleIdentifier;
+	std::string profile;
+	std::string ipa;
+};
+
+// Thrown for any failed request; message is what errors are grouped by.
+class RequestError : public std::runtime_error
+{
+public:
+	RequestError(const std::string& message) : std::runtime_error(message)
+	{
+	}
+};
+
+static std::mutex _logMutex;
+
+static void Log(const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(_logMutex);
+	std::cout << message << std::endl;
+}
+
+static std::string RequestTypeName(RequestType type)
+{
+	for (auto& pair : RequestTypeNames)
+	{
+		if (pair.first == type)
+		{
+			return pair.second;
+		}
+	}
+
+	return "unknown";
+}
+
+#pragma mark - Synthetic Apps -
+
+static std::string XMLString(plist_t plist)
+{
+	char* xml = nullptr;
+	uint32_t length = 0;
+	plist_to_xml(plist, &xml, &length);
+
+	std::string string(xml, length);
+	free(xml);
+
+	return string;
+}
+
+static std::string RandomUUID(std::mt19937& random)
+{
+	const char* digits = "0123456789ABCDEF";
+
+	std::string uuid;
+	for (int i = 0; i < 32; i++)
+	{
+		if (i == 8 || i == 12 || i == 16 || i == 20)
+		{
+			uuid += '-';
+		}
+
+		uuid += digits[random() % 16];
+	}
+
+	return uuid;
+}
+
+// Signs profiles; AltServer reads them without checking the signer.
+class Identity
+{
+public:
+	Identity() : _key(nullptr), _certificate(X509_new())
+	{
+		auto context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+		EVP_PKEY_keygen_init(context);
+		EVP_PKEY_CTX_set_rsa_keygen_bits(context, 2048);
+		EVP_PKEY_keygen(context, &_key);
+		EVP_PKEY_CTX_free(context);
+
+		X509_set_version(_certificate, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(_certificate), 1);
+		X509_gmtime_adj(X509_getm_notBefore(_certificate), 0);
+		X509_gmtime_adj(X509_getm_notAfter(_certificate), PROFILE_LIFETIME);
+		X509_set_pubkey(_certificate, _key);
+
+		auto name = X509_get_subject_name(_certificate);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"AltStoreStandIn", -1, -1, 0);
+		X509_NAME_add_entry_by_txt(name, "OU", MBSTRING_ASC, (const unsigned char*)TEAM_IDENTIFIER, -1, -1, 0);
+		X509_set_issuer_name(_certificate, name);
+		X509_sign(_certificate, _key, EVP_sha256());
+	}
+
+	~Identity()
+	{
+		X509_free(_certificate);
+		EVP_PKEY_free(_key);
+	}
+
+	Identity(const Identity&) = delete;
+	Identity& operator=(const Identity&) = delete;
+
+	std::string Sign(const std::string& content) const
+	{
+		BIO* input = BIO_new_mem_buf(content.data(), (int)content.size());
+		CMS_ContentInfo* cms = CMS_sign(_certificate, _key, NULL, input, CMS_BINARY | CMS_NOSMIMECAP);
+
+		BIO* output = BIO_new(BIO_s_mem());
+		i2d_CMS_bio(output, cms);
+
+		char* bytes = nullptr;
+		long length = BIO_get_mem_data(output, &bytes);
+		std::string data(bytes, length);
+
+		BIO_free(output);
+		CMS_ContentInfo_free(cms);
+		BIO_free(input);
+
+		return data;
+	}
+
+private:
+	EVP_PKEY* _key;
+	X509* _certificate;
+};
+
+static std::string MakeProfile(const Identity& identity, const std::string& bundleIdentifier, const std::vector<std::string>& udids, std::mt19937& random)
+{
+	int32_t now = (int32_t)(time(NULL) - APPLE_REFERENCE_DATE);
+
+	plist_t entitlements = plist_new_dict();
+	plist_dict_set_item(entitlements, "application-identifier", plist_new_string((TEAM_IDENTIFIER "." + bundleIdentifier).c_str()));
+	plist_dict_set_item(entitlements, "com.apple.developer.team-identifier", plist_new_string(TEAM_IDENTIFIER));
+	plist_dict_set_item(entitlements, "get-task-allow", plist_new_bool(1));
+
+	plist_t devices = plist_new_array();
+	for (auto& udid : udids)
+	{
+		plist_array_append_item(devices, plist_new_string(udid.c_str()));
+	}
+
+	plist_t teamIdentifiers = plist_new_array();
+	plist_array_append_item(teamIdentifiers, plist_new_string(TEAM_IDENTIFIER));
+
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "AppIDName", plist_new_string(bundleIdentifier.c_str()));
+	plist_dict_set_item(plist, "CreationDate", plist_new_date(now, 0));
+	plist_dict_set_item(plist, "Entitlements", entitlements);
+	plist_dict_set_item(plist, "ExpirationDate", plist_new_date(now + PROFILE_LIFETIME, 0));
+	plist_dict_set_item(plist, "LocalProvision", plist_new_bool(1));
+	plist_dict_set_item(plist, "Name", plist_new_string(("iOS Team Provisioning Profile: " + bundleIdentifier).c_str()));
+	plist_dict_set_item(plist, "ProvisionedDevices", devices);
+	plist_dict_set_item(plist, "TeamIdentifier", teamIdentifiers);
+	plist_dict_set_item(plist, "TeamName", plist_new_string("AltStoreStandIn"));
+	plist_dict_set_item(plist, "UUID", plist_new_string(RandomUUID(random).c_str()));
+	plist_dict_set_item(plist, "Version", plist_new_uint(1));
+
+	auto xml = XMLString(plist);
+	plist_free(plist);
+
+	return identity.Sign(xml);
+}
+
+static void AppendUInt16(std::string& data, uint16_t value)
+{
+	data += (char)(value & 0xFF);
+	data += (char)(value >> 8);
+}
+
+static void AppendUInt32(std::string& data, uint32_t value)
+{
+	AppendUInt16(data, value & 0xFFFF);
+	AppendUInt16(data, value >> 16);
+}
+
+// A stored (uncompressed) zip, so building one costs next to nothing and its size is exactly what's sent.
+static std::string MakeZip(const std::vector<std::pair<std::string, std::string>>& entries)
+{
+	std::string zip;
+	std::string centralDirectory;
+
+	for (auto& entry : entries)
+	{
+		auto& name = entry.first;
+		auto& contents = entry.second;
+
+		bool isDirectory = !name.empty() && name.back() == '/';
+		uint32_t crc = (uint32_t)crc32(0, (const Bytef*)contents.data(), (uInt)contents.size());
+		uint32_t offset = (uint32_t)zip.size();
+
+		// Local file header
+		AppendUInt32(zip, 0x04034b50);
+		AppendUInt16(zip, 20);
+		AppendUInt16(zip, 0);
+		AppendUInt16(zip, 0);
+		AppendUInt16(zip, 0);
+		AppendUInt16(zip, 0x21);
+		AppendUInt32(zip, crc);
+		AppendUInt32(zip, (uint32_t)contents.size());
+		AppendUInt32(zip, (uint32_t)contents.size());
+		AppendUInt16(zip, (uint16_t)name.size());
+		AppendUInt16(zip, 0);
+		zip += name;
+		zip += contents;
+
+		// Central directory entry
+		AppendUInt32(centralDirectory, 0x02014b50);
+		AppendUInt16(centralDirectory, (3 << 8) | 20);
+		AppendUInt16(centralDirectory, 20);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0x21);
+		AppendUInt32(centralDirectory, crc);
+		AppendUInt32(centralDirectory, (uint32_t)contents.size());
+		AppendUInt32(centralDirectory, (uint32_t)contents.size());
+		AppendUInt16(centralDirectory, (uint16_t)name.size());
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt16(centralDirectory, 0);
+		AppendUInt32(centralDirectory, isDirectory ? ((040755u << 16) | 0x10) : (0100755u << 16));
+		AppendUInt32(centralDirectory, offset);
+		centralDirectory += name;
+	}
+
+	uint32_t centralDirectoryOffset = (uint32_t)zip.size();
+	zip += centralDirectory;
+
+	// End of central directory
+	AppendUInt32(zip, 0x06054b50);
+	AppendUInt16(zip, 0);
+	AppendUInt16(zip, 0);
+	AppendUInt16(zip, (uint16_t)entries.size());
+	AppendUInt16(zip, (uint16_t)entries.size());
+	AppendUInt32(zip, (uint32_t)centralDirectory.size());
+	AppendUInt32(zip, centralDirectoryOffset);
+	AppendUInt16(zip, 0);
+
+	return zip;
+}
+
+static SyntheticApp MakeApp(int index, const Configuration& configuration, const Identity& identity, const std::vector<std::string>& udids, std::mt19937& random)
+{
+	SyntheticApp app;
+	app.bundleIdentifier = "com.altstore.standin.app" + std::to_string(index);
+	app.profile = MakeProfile(identity, app.bundleIdentifier, udids, random);
+
+	auto name = "StandIn" + std::to_string(index);
+	auto appPath = "Payload/" + name + ".app/";
+
+	plist_t infoPlist = plist_new_dict();
+	plist_dict_set_item(infoPlist, "CFBundleName", plist_new_string(name.c_str()));
+	plist_dict_set_item(infoPlist, "CFBundleExecutable", plist_new_string(name.c_str()));
+	plist_dict_set_item(infoPlist, "CFBundleIdentifier", plist_new_string(app.bundleIdentifier.c_str()));
+	plist_dict_set_item(infoPlist, "CFBundleShortVersionString", plist_new_string("1.0"));
+	plist_dict_set_item(infoPlist, "CFBundleVersion", plist_new_string("1"));
+	plist_dict_set_item(infoPlist, "MinimumOSVersion", plist_new_string("12.0"));
+
+	auto infoPlistXML = XMLString(infoPlist);
+	plist_free(infoPlist);
+
+	// Random, so it's as large on the wire as on disk, like the compiled code and assets making up most of a real app.
+	std::string executable((size_t)configuration.ipaKB * 1024, '\0');
+	RAND_bytes((unsigned char*)&executable[0], (int)executable.size());
+
+	app.ipa = MakeZip({
+		{ "Payload/", "" },
+		{ appPath, "" },
+		{ appPath + "Info.plist", infoPlistXML },
+		{ appPath + "embedded.mobileprovision", app.profile },
+		{ appPath + name, executable },
+	});
+
+	return app;
+}
+
+#pragma mark - Connection -
+
+class Connection
+{
+public:
+	Connection(const Configuration& configuration) : _socket(-1), _timeout(configuration.timeout), _uploadBandwidth(configuration.uploadBandwidth)
+	{
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		struct addrinfo* addresses = nullptr;
+		int result = getaddrinfo(configuration.host.c_str(), std::to_string(configuration.port).c_str(), &hints, &addresses);
+		if (result != 0)
+		{
+			throw RequestError(std::string("connect: ") + gai_strerror(result));
+		}
+
+		int error = 0;
+		for (auto address = addresses; address != nullptr; address = address->ai_next)
+		{
+			_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (_socket < 0)
+			{
+				error = errno;
+				continue;
+			}
+
+			if (connect(_socket, address->ai_addr, address->ai_addrlen) == 0)
+			{
+				break;
+			}
+
+			error = errno;
+			close(_socket);
+			_socket = -1;
+		}
+
+		freeaddrinfo(addresses);
+
+		if (_socket < 0)
+		{
+			throw RequestError(std::string("connect: ") + strerror(error));
+		}
+
+		struct timeval timeout;
+		timeout.tv_sec = _timeout;
+		timeout.tv_usec = 0;
+		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		int noDelay = 1;
+		setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	}
+
+	~Connection()
+	{
+		if (_socket >= 0)
+		{
+			close(_socket);
+		}
+	}
+
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
+
+	// As ClientConnection::SendResponse: a native-endian 32-bit length, then the JSON.
+	void SendFrame(const json::value& value)
+	{
+		auto body = value.serialize();
+
+		int32_t size = (int32_t)body.size();
+		this->Send((const char*)&size, sizeof(size));
+		this->Send(body.data(), body.size());
+	}
+
+	// Returns nullopt once AltServer closes the connection, which it does after each request.
+	std::optional<json::value> ReceiveFrame()
+	{
+		int32_t size = 0;
+		if (!this->Receive((char*)&size, sizeof(size), true))
+		{
+			return std::nullopt;
+		}
+
+		if (size < 0 || size > MAXIMUM_FRAME_SIZE)
+		{
+			throw RequestError("receive: invalid frame size " + std::to_string(size));
+		}
+
+		std::string body(size, '\0');
+		this->Receive(&body[0], size, false);
+
+		try
+		{
+			return json::value::parse(body);
+		}
+		catch (std::exception& exception)
+		{
+			throw RequestError("receive: invalid JSON");
+		}
+	}
+
+	// Paced to --upload-mbps, if set.
+	void Upload(const std::string& data)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t offset = 0; offset < data.size(); offset += UPLOAD_CHUNK_SIZE)
+		{
+			auto length = std::min((size_t)UPLOAD_CHUNK_SIZE, data.size() - offset);
+			this->Send(data.data() + offset, length);
+
+			if (_uploadBandwidth > 0)
+			{
+				auto due = start + std::chrono::microseconds((int64_t)((offset + length) * 8 / _uploadBandwidth));
+				std::this_thread::sleep_until(due);
+			}
+		}
+	}
+
+private:
+	int _socket;
+	int _timeout;
+	double _uploadBandwidth;
+
+	void Send(const char* data, size_t size)
+	{
+		size_t sentBytes = 0;
+		while (sentBytes < size)
+		{
+			ssize_t result = send(_socket, data + sentBytes, size - sentBytes, MSG_NOSIGNAL);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				throw RequestError((errno == EAGAIN || errno == EWOULDBLOCK) ? "send: timed out" : std::string("send: ") + strerror(errno));
+			}
+
+			sentBytes += result;
+		}
+	}
+
+	// Returns false if the connection closed before any byte arrived and that's allowed.
+	bool Receive(char* data, size_t size, bool allowsClose)
+	{
+		size_t receivedBytes = 0;
+		while (receivedBytes < size)
+		{
+			ssize_t result = recv(_socket, data + receivedBytes, size - receivedBytes, 0);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				throw RequestError((errno == EAGAIN || errno == EWOULDBLOCK) ? "receive: timed out" : std::string("receive: ") + strerror(errno));
+			}
+
+			if (result == 0)
+			{
+				if (receivedBytes == 0 && allowsClose)
+				{
+					return false;
+				}
+
+				throw RequestError("receive: connection closed mid-frame");
+			}
+
+			receivedBytes += result;
+		}
+
+		return true;
+	}
+};
+
+#pragma mark - Load Generator -
+
+struct RequestStatistics
+{
+	// Milliseconds, successful requests only.
+	std::vector<double> latencies;
+
+	uint64_t succeeded = 0;
+	uint64_t failed = 0;
+	uint64_t uploadedBytes = 0;
+	double uploadTime = 0;
+};
+
+class AltStoreStandIn
+{
+public:
+	AltStoreStandIn(const Configuration& configuration);
+
+	void Run();
+	void Stop();
+
+	void LogStatistics();
+	bool WriteJSON(const std::string& path);
+
+private:
+	Configuration _configuration;
+	std::vector<std::string> _udids;
+
+	Identity _identity;
+	std::vector<SyntheticApp> _apps;
+
+	std::atomic<int> _nextRequest;
+	std::atomic<bool> _isStopping;
+
+	std::chrono::steady_clock::time_point _start;
+	std::chrono::steady_clock::time_point _end;
+
+	std::mutex _mutex;
+	std::map<RequestType, RequestStatistics> _statistics;
+	std::map<std::string, uint64_t> _errors;
+
+	// Apps installed so far, by device, so RemoveAppRequest targets one that's there.
+	std::map<std::string, std::set<std::string>> _installedApps;
+
+	void RunClient(int client);
+
+	void PrepareApp(Connection& connection, const std::string& udid, const SyntheticApp& app);
+	void RequestAnisetteData(Connection& connection);
+	void InstallProfiles(Connection& connection, const std::string& udid, const SyntheticApp& app);
+	void RemoveApp(Connection& connection, const std::string& udid, const std::string& bundleIdentifier);
+
+	json::value ReceiveResponse(Connection& connection, const std::string& identifier);
+};
+
+AltStoreStandIn::AltStoreStandIn(const Configuration& configuration) : _configuration(configuration), _nextRequest(0), _isStopping(false)
+{
+	_udids = configuration.udids;
+
+	for (int i = (int)_udids.size(); i < configuration.deviceCount; i++)
+	{
+		char udid[32];
+		snprintf(udid, sizeof(udid), "00008101-%016X", i + 1);
+		_udids.push_back(udid);
+	}
+
+	std::mt19937 random((unsigned int)time(NULL));
+	for (int i = 0; i < configuration.apps; i++)
+	{
+		_apps.push_back(MakeApp(i, configuration, _identity, _udids, random));
+	}
+}
+
+void AltStoreStandIn::Run()
+{
+	_start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> clients;
+	for (int i = 0; i < _configuration.clients; i++)
+	{
+		clients.emplace_back([this, i]() {
+			this->RunClient(i);
+		});
+	}
+
+	for (auto& client : clients)
+	{
+		client.join();
+	}
+
+	_end = std::chrono::steady_clock::now();
+}
+
+void AltStoreStandIn::Stop()
+{
+	_isStopping = true;
+}
+
+void AltStoreStandIn::RunClient(int client)
+{
+	std::mt19937 random((unsigned int)time(NULL) + client);
+
+	int totalWeight = 0;
+	for (auto& pair : _configuration.mix)
+	{
+		totalWeight += pair.second;
+	}
+
+	while (!_isStopping)
+	{
+		int index = _nextRequest++;
+		if (_configuration.duration == 0 && index >= _configuration.requests)
+		{
+			break;
+		}
+
+		// Open loop: each request has a time it's due, whether or not earlier ones have finished.
+		auto start = std::chrono::steady_clock::now();
+		if (_configuration.rate > 0)
+		{
+			start = _start + std::chrono::microseconds((int64_t)(index * 1000000.0 / _configuration.rate));
+			std::this_thread::sleep_until(start);
+		}
+
+		if (_configuration.duration > 0 && start - _start >= std::chrono::seconds(_configuration.duration))
+		{
+			break;
+		}
+
+		if (_isStopping)
+		{
+			break;
+		}
+
+		auto type = RequestType::PrepareApp;
+		if (totalWeight > 0)
+		{
+			int choice = (int)(random() % totalWeight);
+			for (auto& pair : _configuration.mix)
+			{
+				if (choice < pair.second)
+				{
+					type = pair.first;
+					break;
+				}
+
+				choice -= pair.second;
+			}
+		}
+
+		auto& udid = _udids[random() % _udids.size()];
+		auto& app = _apps[random() % _apps.size()];
+
+		std::string removedBundleIdentifier;
+		if (type == RequestType::RemoveApp)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			auto& installedApps = _installedApps[udid];
+			if (installedApps.empty())
+			{
+				// Nothing to remove yet, so install something instead.
+				type = RequestType::PrepareApp;
+			}
+			else
+			{
+				auto iterator = installedApps.begin();
+				std::advance(iterator, random() % installedApps.size());
+
+				removedBundleIdentifier = *iterator;
+				installedApps.erase(iterator);
+			}
+		}
+
+		try
+		{
+			Connection connection(_configuration);
+
+			switch (type)
+			{
+			case RequestType::PrepareApp: this->PrepareApp(connection, udid, app); break;
+			case RequestType::AnisetteData: this->RequestAnisetteData(connection); break;
+			case RequestType::InstallProfiles: this->InstallProfiles(connection, udid, app); break;
+			case RequestType::RemoveApp: this->RemoveApp(connection, udid, removedBundleIdentifier); break;
+			}
+
+			auto latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			auto& statistics = _statistics[type];
+			statistics.succeeded++;
+			statistics.latencies.push_back(latency);
+
+			if (type == RequestType::PrepareApp)
+			{
+				_installedApps[udid].insert(app.bundleIdentifier);
+			}
+		}
+		catch (std::exception& exception)
+		{
+			auto error = RequestTypeName(type) + ": " + exception.what();
+			Log("Request " + std::to_string(index) + " failed (" + error + ")");
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			_statistics[type].failed++;
+			_errors[error]++;
+		}
+	}
+}
+
+// Skips progress updates and throws for ErrorResponse, keyed by its error code and description.
+json::value AltStoreStandIn::ReceiveResponse(Connection& connection, const std::string& identifier)
+{
+	while (true)
+	{
+		auto response = connection.ReceiveFrame();
+		if (!response.has_value())
+		{
+			throw RequestError("connection closed before " + identifier);
+		}
+
+		auto responseIdentifier = response->has_field("identifier") ? response->at("identifier").as_string() : "";
+
+		if (responseIdentifier == identifier)
+		{
+			if (identifier != "InstallationProgressResponse" || response->at("progress").as_double() >= 1.0)
+			{
+				return *response;
+			}
+
+			continue;
+		}
+
+		if (responseIdentifier == "InstallationProgressResponse")
+		{
+			continue;
+		}
+
+		if (responseIdentifier == "ErrorResponse")
+		{
+			std::string message = "ErrorResponse " + std::to_string(response->has_field("errorCode") ? response->at("errorCode").as_integer() : 0);
+
+			if (response->has_field("serverError") && response->at("serverError").has_field("userInfo"))
+			{
+				auto userInfo = response->at("serverError").at("userInfo");
+
+				for (auto key : { "NSLocalizedFailureReason", "NSLocalizedDescription" })
+				{
+					if (userInfo.has_field(key) && userInfo.at(key).is_string())
+					{
+						message += ": " + userInfo.at(key).as_string();
+						break;
+					}
+				}
+			}
+
+			throw RequestError(message);
+		}
+
+		throw RequestError("unexpected " + (responseIdentifier.empty() ? std::string("response") : responseIdentifier));
+	}
+}
+
+void AltStoreStandIn::PrepareApp(Connection& connection, const std::string& udid, const SyntheticApp& app)
+{
+	auto request = json::value::object();
+	request["version"] = json::value::number(1);
+	request["identifier"] = json::value::string("PrepareAppRequest");
+	request["udid"] = json::value::string(udid);
+	request["contentSize"] = json::value::number((int64_t)app.ipa.size());
+	connection.SendFrame(request);
+
+	auto uploadStart = std::chrono::steady_clock::now();
+	connection.Upload(app.ipa);
+	auto uploadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - uploadStart).count();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto& statistics = _statistics[RequestType::PrepareApp];
+		statistics.uploadedBytes += app.ipa.size();
+		statistics.uploadTime += uploadTime;
+	}
+
+	// Keep only this app's profile, as AltStore does for apps it doesn't know.
+	auto activeProfiles = json::value::array();
+	activeProfiles[0] = json::value::string(app.bundleIdentifier);
+
+	auto beginRequest = json::value::object();
+	beginRequest["version"] = json::value::number(1);
+	beginRequest["identifier"] = json::value::string("BeginInstallationRequest");
+	beginRequest["activeProfiles"] = activeProfiles;
+	connection.SendFrame(beginRequest);
+
+	this->ReceiveResponse(connection, "InstallationProgressResponse");
+}
+
+void AltStoreStandIn::RequestAnisetteData(Connection& connection)
+{
+	auto request = json::value::object();
+	request["version"] = json::value::number(1);
+	request["identifier"] = json::value::string("AnisetteDataRequest");
+	connection.SendFrame(request);
+
+	auto response = this->ReceiveResponse(connection, "AnisetteDataResponse");
+	if (!response.has_field("anisetteData"))
+	{
+		throw RequestError("AnisetteDataResponse without anisetteData");
+	}
+}
+
+void AltStoreStandIn::InstallProfiles(Connection& connection, const std::string& udid, const SyntheticApp& app)
+{
+	auto profiles = json::value::array();
+	profiles[0] = json::value::string(utility::conversions::to_base64(std::vector<unsigned char>(app.profile.begin(), app.profile.end())));
+
+	auto request = json::value::object();
+	request["version"] = json::value::number(1);
+	request["identifier"] = json::value::string("InstallProvisioningProfilesRequest");
+	request["udid"] = json::value::string(udid);
+	request["provisioningProfiles"] = profiles;
+	connection.SendFrame(request);
+
+	this->ReceiveResponse(connection, "InstallProvisioningProfilesResponse");
+}
+
+void AltStoreStandIn::RemoveApp(Connection& connection, const std::string& udid, const std::string& bundleIdentifier)
+{
+	auto request = json::value::object();
+	request["version"] = json::value::number(1);
+	request["identifier"] = json::value::string("RemoveAppRequest");
+	request["udid"] = json::value::string(udid);
+	request["bundleIdentifier"] = json::value::string(bundleIdentifier);
+	connection.SendFrame(request);
+
+	this->ReceiveResponse(connection, "RemoveAppResponse");
+}
+
+#pragma mark - Statistics -
+
+static double Percentile(const std::vector<double>& sortedValues, double percentile)
+{
+	if (sortedValues.empty())
+	{
+		return 0;
+	}
+
+	auto index = (size_t)(percentile / 100.0 * (sortedValues.size() - 1) + 0.5);
+	return sortedValues[std::min(index, sortedValues.size() - 1)];
+}
+
+static std::string FormatMilliseconds(double milliseconds)
+{
+	std::stringstream ss;
+	ss.setf(std::ios::fixed);
+	ss.precision(1);
+	ss << milliseconds << " ms";
+	return ss.str();
+}
+
+void AltStoreStandIn::LogStatistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto duration = std::chrono::duration<double>(_end - _start).count();
+
+	uint64_t succeeded = 0;
+	uint64_t failed = 0;
+
+	for (auto& pair : RequestTypeNames)
+	{
+		auto iterator = _statistics.find(pair.first);
+		if (iterator == _statistics.end())
+		{
+			continue;
+		}
+
+		auto& statistics = iterator->second;
+		succeeded += statistics.succeeded;
+		failed += statistics.failed;
+
+		auto latencies = statistics.latencies;
+		std::sort(latencies.begin(), latencies.end());
+
+		std::stringstream ss;
+		ss.setf(std::ios::fixed);
+		ss.precision(2);
+		ss << pair.second << ": " << statistics.succeeded << " succeeded, " << statistics.failed << " failed, " << (statistics.succeeded / duration) << " per second";
+
+		if (!latencies.empty())
+		{
+			ss << "; p50 " << FormatMilliseconds(Percentile(latencies, 50)) << ", p90 " << FormatMilliseconds(Percentile(latencies, 90))
+				<< ", p99 " << FormatMilliseconds(Percentile(latencies, 99)) << ", max " << FormatMilliseconds(latencies.back());
+		}
+
+		if (statistics.uploadTime > 0)
+		{
+			ss << "; uploaded " << (statistics.uploadedBytes / 1048576.0) << " MB at " << (statistics.uploadedBytes * 8 / statistics.uploadTime / 1000000.0) << " Mbps per connection";
+		}
+
+		Log(ss.str());
+	}
+
+	std::stringstream ss;
+	ss.setf(std::ios::fixed);
+	ss.precision(2);
+	ss << "Total: " << succeeded << " succeeded, " << failed << " failed in " << duration << " s (" << (succeeded / duration) << " per second)";
+	Log(ss.str());
+
+	for (auto& pair : _errors)
+	{
+		Log("  " + std::to_string(pair.second) + "x " + pair.first);
+	}
+}
+
+bool AltStoreStandIn::WriteJSON(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto duration = std::chrono::duration<double>(_end - _start).count();
+
+	auto config = json::value::object();
+	config["clients"] = json::value::number(_configuration.clients);
+	config["requests"] = json::value::number(_configuration.requests);
+	config["duration_s"] = json::value::number(_configuration.duration);
+	config["rate"] = json::value::number(_configuration.rate);
+	config["devices"] = json::value::number((int)_udids.size());
+	config["apps"] = json::value::number(_configuration.apps);
+	config["ipa_kb"] = json::value::number(_configuration.ipaKB);
+	config["upload_mbps"] = json::value::number(_configuration.uploadBandwidth);
+
+	auto requests = json::value::object();
+	for (auto& pair : RequestTypeNames)
+	{
+		auto& statistics = _statistics[pair.first];
+
+		auto latencies = statistics.latencies;
+		std::sort(latencies.begin(), latencies.end());
+
+		auto result = json::value::object();
+		result["succeeded"] = json::value::number(statistics.succeeded);
+		result["failed"] = json::value::number(statistics.failed);
+		result["per_second"] = json::value::number(statistics.succeeded / duration);
+		result["p50_ms"] = json::value::number(Percentile(latencies, 50));
+		result["p90_ms"] = json::value::number(Percentile(latencies, 90));
+		result["p99_ms"] = json::value::number(Percentile(latencies, 99));
+		result["max_ms"] = json::value::number(latencies.empty() ? 0 : latencies.back());
+
+		if (pair.first == RequestType::PrepareApp)
+		{
+			result["uploaded_bytes"] = json::value::number(statistics.uploadedBytes);
+			result["upload_mbps"] = json::value::number(statistics.uploadTime > 0 ? statistics.uploadedBytes * 8 / statistics.uploadTime / 1000000.0 : 0);
+		}
+
+		requests[pair.second] = result;
+	}
+
+	auto errors = json::value::object();
+	for (auto& pair : _errors)
+	{
+		errors[pair.first] = json::value::number(pair.second);
+	}
+
+	auto result = json::value::object();
+	result["config"] = config;
+	result["total_s"] = json::value::number(duration);
+	result["requests"] = requests;
+	result["errors"] = errors;
+
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	file << result.serialize() << std::endl;
+
+	return file.good();
+}
+
+static bool ParseMix(const std::string& value, std::map<RequestType, int>& mix)
+{
+	std::map<RequestType, int> parsedMix;
+
+	std::stringstream ss(value);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		auto separator = item.find('=');
+		if (separator == std::string::npos)
+		{
+			return false;
+		}
+
+		auto name = item.substr(0, separator);
+		auto type = std::find_if(RequestTypeNames.begin(), RequestTypeNames.end(), [&name](const std::pair<RequestType, std::string>& pair) {
+			return pair.second == name;
+		});
+
+		if (type == RequestTypeNames.end())
+		{
+			return false;
+		}
+
+		parsedMix[type->first] = std::max(0, atoi(item.substr(separator + 1).c_str()));
+	}
+
+	mix = parsedMix;
+	return true;
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--host ADDRESS] [--port N] [--clients N] [--requests N | --duration-s N] [--rate N] [--devices N] [--udid UDID]... "
+		"[--apps N] [--ipa-kb N] [--upload-mbps N] [--mix prepare=N,anisette=N,profiles=N,remove=N] [--timeout-s N] [--json PATH]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+
+	static struct option long_options[] =
+	{
+		{"host",        required_argument, 0, 'h'},
+		{"port",        required_argument, 0, 'p'},
+		{"clients",     required_argument, 0, 'c'},
+		{"requests",    required_argument, 0, 'n'},
+		{"duration-s",  required_argument, 0, 'd'},
+		{"rate",        required_argument, 0, 'r'},
+		{"devices",     required_argument, 0, 'D'},
+		{"udid",        required_argument, 0, 'u'},
+		{"apps",        required_argument, 0, 'a'},
+		{"ipa-kb",      required_argument, 0, 'k'},
+		{"upload-mbps", required_argument, 0, 'b'},
+		{"mix",         required_argument, 0, 'm'},
+		{"timeout-s",   required_argument, 0, 't'},
+		{"json",        required_argument, 0, 'j'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 'h': configuration.host = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'c': configuration.clients = std::max(1, atoi(optarg)); break;
+		case 'n': configuration.requests = std::max(1, atoi(optarg)); break;
+		case 'd': configuration.duration = std::max(0, atoi(optarg)); break;
+		case 'r': configuration.rate = std::max(0.0, atof(optarg)); break;
+		case 'D': configuration.deviceCount = std::max(1, atoi(optarg)); break;
+		case 'u': configuration.udids.push_back(optarg); break;
+		case 'a': configuration.apps = std::max(1, atoi(optarg)); break;
+		case 'k': configuration.ipaKB = std::max(1, atoi(optarg)); break;
+		case 'b': configuration.uploadBandwidth = std::max(0.0, atof(optarg)); break;
+		case 't': configuration.timeout = std::max(1, atoi(optarg)); break;
+		case 'j': configuration.jsonPath = optarg; break;
+		case 'm':
+			if (!ParseMix(optarg, configuration.mix))
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Blocked before any client thread exists so only sigwait below sees them.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	AltStoreStandIn standIn(configuration);
+
+	// Interrupting stops new requests; those in flight still finish or time out before the statistics are printed.
+	std::thread([&standIn, signals]() {
+		int signal = 0;
+		sigwait(&signals, &signal);
+
+		Log("Stopping...");
+		standIn.Stop();
+	}).detach();
+
+	std::stringstream ss;
+	ss << "Sending " << (configuration.duration > 0 ? std::to_string(configuration.duration) + " s of" : std::to_string(configuration.requests)) << " requests to "
+		<< configuration.host << ":" << configuration.port << " over " << configuration.clients << " connections";
+	Log(ss.str());
+
+	standIn.Run();
+	standIn.LogStatistics();
+
+	if (!configuration.jsonPath.empty() && !standIn.WriteJSON(configuration.jsonPath))
+	{
+		std::cerr << "Failed to write " << configuration.jsonPath << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
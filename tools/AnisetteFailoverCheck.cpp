@@ -0,0 +1,329 @@
+//
+//  AnisetteFailoverCheck.cpp
+//  AltServer
+//
+//  Automated check of FailoverAnisetteProvider against AnisetteStandIn
+//  instances it starts itself, each serving a response that names it:
+//
+//  - hedging: once the primary's p95 latency is known, a request to a primary
+//    that turned slow is also sent to the secondary after that delay, and the
+//    secondary's answer wins
+//  - failover: providers that fail are skipped at once, without waiting for
+//    the hedge delay
+//  - circuit: three consecutive failures take a provider out of rotation for
+//    30 seconds, after which one request probes it again and closes the
+//    circuit if it succeeds
+//
+//  Runs in about 40 seconds, mostly waiting for the circuit to close.
+//  `make check` builds the stand-in and runs it; otherwise pass --stand-in.
+//
+
+#include "CheckSupport.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <getopt.h>
+
+#include "AnisetteData.h"
+#include "AnisetteProvider.h"
+#include "Logger.hpp"
+
+namespace fs = std::filesystem;
+
+using namespace web;
+
+struct Configuration
+{
+	std::string standInPath = "./AnisetteStandIn";
+	int port = 16969;
+
+	// Latency of a healthy stand-in, and of the primary once it turns slow.
+	int fastDelay = 50;
+	int slowDelay = 3000;
+
+	std::string workingDirectory = fs::temp_directory_path().append("AnisetteFailoverCheck").string();
+};
+
+static const std::vector<std::string> BackendNames = { "primary", "secondary", "tertiary" };
+
+// Counts requests, so checks can tell which providers FailoverAnisetteProvider asked.
+class CountingProvider : public AnisetteProvider
+{
+public:
+	CountingProvider(std::string url) : _provider(url), _requestCount(0)
+	{
+	}
+
+	virtual std::string name() const
+	{
+		return _provider.name();
+	}
+
+	virtual pplx::task<std::shared_ptr<AnisetteData>> FetchAnisetteData()
+	{
+		_requestCount++;
+		return _provider.FetchAnisetteData();
+	}
+
+	int requestCount() const
+	{
+		return _requestCount;
+	}
+
+private:
+	RemoteAnisetteProvider _provider;
+	std::atomic<int> _requestCount;
+};
+
+struct FetchResult
+{
+	// Name of the stand-in that answered, empty if the request failed.
+	std::string backend;
+	double milliseconds = 0;
+};
+
+class AnisetteFailoverCheck
+{
+public:
+	AnisetteFailoverCheck(const Configuration& configuration, check::Results& results);
+
+	void CheckHedging();
+	void CheckFailover();
+	void CheckCircuit();
+
+private:
+	Configuration _configuration;
+	check::Results& _results;
+
+	std::string responsePath(size_t backend) const;
+
+	std::unique_ptr<check::StandIn> StartStandIn(size_t backend, int delay, int failPercent);
+	std::vector<std::shared_ptr<CountingProvider>> MakeProviders(size_t count);
+
+	FetchResult Fetch(FailoverAnisetteProvider& provider);
+};
+
+AnisetteFailoverCheck::AnisetteFailoverCheck(const Configuration& configuration, check::Results& results) : _configuration(configuration), _results(results)
+{
+	fs::remove_all(configuration.workingDirectory);
+	fs::create_directories(configuration.workingDirectory);
+
+	// Each stand-in reports its name as the device ID, which is how results tell who answered.
+	for (size_t i = 0; i < BackendNames.size(); i++)
+	{
+		auto response = json::value::object();
+		response["X-Apple-I-MD-M"] = json::value::string("AAAA");
+		response["X-Apple-I-MD"] = json::value::string("AAAA");
+		response["X-Apple-I-MD-LU"] = json::value::string("00");
+		response["X-Apple-I-MD-RINFO"] = json::value::string("17106176");
+		response["X-Mme-Device-Id"] = json::value::string(BackendNames[i]);
+		response["X-Apple-I-SRL-NO"] = json::value::string("0");
+		response["X-MMe-Client-Info"] = json::value::string("<MacBookPro13,2> <macOS;13.1;22C65> <com.apple.AuthKit/1 (com.apple.dt.Xcode/3594.4.19)>");
+
+		std::ofstream file(this->responsePath(i));
+		file << response.serialize();
+	}
+}
+
+std::string AnisetteFailoverCheck::responsePath(size_t backend) const
+{
+	return fs::path(_configuration.workingDirectory).append(BackendNames[backend] + ".json").string();
+}
+
+std::unique_ptr<check::StandIn> AnisetteFailoverCheck::StartStandIn(size_t backend, int delay, int failPercent)
+{
+	return std::make_unique<check::StandIn>(_configuration.standInPath, _configuration.port + (int)backend, std::vector<std::string> {
+		"--response", this->responsePath(backend),
+		"--delay-ms", std::to_string(delay),
+		"--fail-percent", std::to_string(failPercent),
+	});
+}
+
+std::vector<std::shared_ptr<CountingProvider>> AnisetteFailoverCheck::MakeProviders(size_t count)
+{
+	std::vector<std::shared_ptr<CountingProvider>> providers;
+	for (size_t i = 0; i < count; i++)
+	{
+		providers.push_back(std::make_shared<CountingProvider>("http://127.0.0.1:" + std::to_string(_configuration.port + (int)i)));
+	}
+
+	return providers;
+}
+
+FetchResult AnisetteFailoverCheck::Fetch(FailoverAnisetteProvider& provider)
+{
+	FetchResult result;
+
+	auto start = std::chrono::steady_clock::now();
+
+	try
+	{
+		auto anisetteData = provider.FetchAnisetteData().get();
+		result.backend = anisetteData->deviceUniqueIdentifier();
+	}
+	catch (std::exception& exception)
+	{
+		std::cout << "Anisette request failed: " << exception.what() << std::endl;
+	}
+
+	result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+void AnisetteFailoverCheck::CheckHedging()
+{
+	auto primary = this->StartStandIn(0, _configuration.fastDelay, 0);
+	auto secondary = this->StartStandIn(1, _configuration.fastDelay, 0);
+
+	auto providers = this->MakeProviders(2);
+	FailoverAnisetteProvider failover({ providers[0], providers[1] });
+
+	// Enough requests for a p95 of the primary's latency; until then the hedge waits DefaultHedgeDelay.
+	bool allFromPrimary = true;
+	for (size_t i = 0; i < FailoverAnisetteProvider::MinimumLatencySampleCount + 3; i++)
+	{
+		allFromPrimary = (this->Fetch(failover).backend == "primary") && allFromPrimary;
+	}
+
+	_results.Expect(allFromPrimary && providers[1]->requestCount() == 0, "hedging: a primary answering in its usual time is never hedged");
+
+	// Restarted, as the stand-in's delay is fixed at launch.
+	primary.reset();
+	primary = this->StartStandIn(0, _configuration.slowDelay, 0);
+
+	auto result = this->Fetch(failover);
+
+	_results.Expect(result.backend == "secondary" && providers[1]->requestCount() == 1,
+		"hedging: a slow primary is hedged with the secondary, which answers (answered by " + (result.backend.empty() ? "nobody" : result.backend) + ")");
+	_results.Expect(result.milliseconds >= FailoverAnisetteProvider::MinimumHedgeDelay.count() && result.milliseconds < _configuration.slowDelay / 2,
+		"hedging: the hedge starts after the primary's p95 latency, bounded below by " + std::to_string(FailoverAnisetteProvider::MinimumHedgeDelay.count()) + " ms (took " + check::FormatMilliseconds(result.milliseconds) + ")");
+
+	// Let the primary's request finish before its provider goes away.
+	std::this_thread::sleep_for(std::chrono::milliseconds(_configuration.slowDelay));
+}
+
+void AnisetteFailoverCheck::CheckFailover()
+{
+	auto primary = this->StartStandIn(0, _configuration.fastDelay, 100);
+	auto secondary = this->StartStandIn(1, _configuration.fastDelay, 100);
+	auto tertiary = this->StartStandIn(2, _configuration.fastDelay, 0);
+
+	auto providers = this->MakeProviders(3);
+	FailoverAnisetteProvider failover({ providers[0], providers[1], providers[2] });
+
+	auto result = this->Fetch(failover);
+
+	_results.Expect(result.backend == "tertiary" && providers[0]->requestCount() == 1 && providers[1]->requestCount() == 1,
+		"failover: failing primary and secondary are each asked once, then the tertiary answers (answered by " + (result.backend.empty() ? "nobody" : result.backend) + ")");
+	_results.Expect(result.milliseconds < FailoverAnisetteProvider::DefaultHedgeDelay.count(),
+		"failover: failures move on at once instead of waiting for the hedge delay (took " + check::FormatMilliseconds(result.milliseconds) + ")");
+}
+
+void AnisetteFailoverCheck::CheckCircuit()
+{
+	auto primary = this->StartStandIn(0, _configuration.fastDelay, 100);
+	auto secondary = this->StartStandIn(1, _configuration.fastDelay, 0);
+
+	auto providers = this->MakeProviders(2);
+	FailoverAnisetteProvider failover({ providers[0], providers[1] });
+
+	bool allFromSecondary = true;
+	for (int i = 0; i < FailoverAnisetteProvider::CircuitFailureThreshold * 2; i++)
+	{
+		allFromSecondary = (this->Fetch(failover).backend == "secondary") && allFromSecondary;
+	}
+
+	_results.Expect(allFromSecondary, "circuit: the secondary answers while the primary fails");
+	_results.Expect(providers[0]->requestCount() == FailoverAnisetteProvider::CircuitFailureThreshold,
+		"circuit: the primary is skipped after " + std::to_string(FailoverAnisetteProvider::CircuitFailureThreshold) + " consecutive failures (asked " + std::to_string(providers[0]->requestCount()) + " times in " + std::to_string(FailoverAnisetteProvider::CircuitFailureThreshold * 2) + " requests)");
+
+	// The primary recovers while its circuit is open.
+	primary.reset();
+	primary = this->StartStandIn(0, _configuration.fastDelay, 0);
+
+	auto result = this->Fetch(failover);
+	_results.Expect(result.backend == "secondary" && providers[0]->requestCount() == FailoverAnisetteProvider::CircuitFailureThreshold,
+		"circuit: the primary stays skipped until its circuit closes, even once it's healthy again");
+
+	std::cout << "Waiting " << FailoverAnisetteProvider::CircuitOpenDuration.count() << " seconds for the primary's circuit to close..." << std::endl;
+	std::this_thread::sleep_for(FailoverAnisetteProvider::CircuitOpenDuration + std::chrono::seconds(1));
+
+	result = this->Fetch(failover);
+	_results.Expect(result.backend == "primary" && providers[0]->requestCount() == FailoverAnisetteProvider::CircuitFailureThreshold + 1,
+		"circuit: after " + std::to_string(FailoverAnisetteProvider::CircuitOpenDuration.count()) + " seconds one request probes the primary again (answered by " + (result.backend.empty() ? "nobody" : result.backend) + ")");
+
+	result = this->Fetch(failover);
+	_results.Expect(result.backend == "primary", "circuit: a successful probe closes the circuit and the primary is preferred again");
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--stand-in PATH] [--port N] [--fast-ms N] [--slow-ms N] [--workdir PATH] [--verbose]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+	bool verbose = false;
+
+	static struct option long_options[] =
+	{
+		{"stand-in", required_argument, 0, 's'},
+		{"port",     required_argument, 0, 'p'},
+		{"fast-ms",  required_argument, 0, 'f'},
+		{"slow-ms",  required_argument, 0, 'l'},
+		{"workdir",  required_argument, 0, 'w'},
+		{"verbose",  no_argument,       0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 's': configuration.standInPath = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'f': configuration.fastDelay = std::max(0, atoi(optarg)); break;
+		case 'l': configuration.slowDelay = std::max(0, atoi(optarg)); break;
+		case 'w': configuration.workingDirectory = optarg; break;
+		case 'v': verbose = true; break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	// The hedged request has to be able to finish well before the slow primary.
+	if (configuration.slowDelay < 4 * (FailoverAnisetteProvider::MinimumHedgeDelay.count() + configuration.fastDelay))
+	{
+		std::cerr << "--slow-ms must be at least 4 times (" << FailoverAnisetteProvider::MinimumHedgeDelay.count() << " + --fast-ms)." << std::endl;
+		return 1;
+	}
+
+	if (!verbose)
+	{
+		Logger::instance()->setLevel(LogLevel::Off);
+	}
+
+	check::Results results;
+
+	try
+	{
+		AnisetteFailoverCheck check(configuration, results);
+		check.CheckHedging();
+		check.CheckFailover();
+		check.CheckCircuit();
+	}
+	catch (std::exception& exception)
+	{
+		results.Expect(false, std::string("ran every check (") + exception.what() + ")");
+	}
+
+	fs::remove_all(configuration.workingDirectory);
+
+	return results.Finish();
+}
@@ -0,0 +1,202 @@
+//
+//  AnisetteStandIn.cpp
+//  AltServer
+//
+//  Local anisette server speaking the same JSON schema as RemoteAnisetteProvider
+//  expects. It replays a response captured from a real server (--response) or,
+//  without one, serves placeholder values that Apple will reject but that are
+//  enough to exercise provider failover. --delay-ms and --fail-percent make it
+//  slow or flaky on purpose.
+//
+//  Point AltServer at it with ALTSERVER_ANISETTE_SERVERS=http://127.0.0.1:6969
+//
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::experimental::listener;
+
+struct Configuration
+{
+	std::string host = "127.0.0.1";
+	int port = 6969;
+	std::string responsePath;
+	int delay = 0;
+	int failPercent = 0;
+};
+
+static std::string RandomHex(std::mt19937& random, size_t length)
+{
+	static const char digits[] = "0123456789ABCDEF";
+
+	std::string hex;
+	for (size_t i = 0; i < length; i++)
+	{
+		hex += digits[random() % 16];
+	}
+
+	return hex;
+}
+
+static std::string RandomBase64(std::mt19937& random, size_t length)
+{
+	std::vector<unsigned char> bytes(length);
+	for (auto& byte : bytes)
+	{
+		byte = (unsigned char)random();
+	}
+
+	return utility::conversions::to_base64(bytes);
+}
+
+static json::value MakePlaceholderResponse()
+{
+	std::mt19937 random((unsigned int)time(NULL));
+
+	auto deviceID = RandomHex(random, 32);
+	deviceID.insert(20, "-").insert(16, "-").insert(12, "-").insert(8, "-");
+
+	json::value response = json::value::object();
+	response["X-Apple-I-MD-M"] = json::value::string(RandomBase64(random, 60));
+	response["X-Apple-I-MD"] = json::value::string(RandomBase64(random, 16));
+	response["X-Apple-I-MD-LU"] = json::value::string(RandomHex(random, 64));
+	response["X-Apple-I-MD-RINFO"] = json::value::string("17106176");
+	response["X-Mme-Device-Id"] = json::value::string(deviceID);
+	response["X-Apple-I-SRL-NO"] = json::value::string("0");
+	response["X-MMe-Client-Info"] = json::value::string("<MacBookPro13,2> <macOS;13.1;22C65> <com.apple.AuthKit/1 (com.apple.dt.Xcode/3594.4.19)>");
+	response["X-Apple-Locale"] = json::value::string("en_US");
+	response["X-Apple-I-TimeZone"] = json::value::string("UTC");
+	return response;
+}
+
+static std::string CurrentClientTime()
+{
+	char buffer[64];
+	time_t now = time(NULL);
+	strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	return buffer;
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--host ADDRESS] [--port N] [--response FILE.json] [--delay-ms N] [--fail-percent N]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+
+	static struct option long_options[] =
+	{
+		{"host",         required_argument, 0, 'h'},
+		{"port",         required_argument, 0, 'p'},
+		{"response",     required_argument, 0, 'r'},
+		{"delay-ms",     required_argument, 0, 'd'},
+		{"fail-percent", required_argument, 0, 'f'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 'h': configuration.host = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'r': configuration.responsePath = optarg; break;
+		case 'd': configuration.delay = std::max(0, atoi(optarg)); break;
+		case 'f': configuration.failPercent = std::min(100, std::max(0, atoi(optarg))); break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	json::value response;
+	if (configuration.responsePath.empty())
+	{
+		response = MakePlaceholderResponse();
+	}
+	else
+	{
+		std::ifstream file(configuration.responsePath);
+		std::stringstream contents;
+		contents << file.rdbuf();
+
+		response = json::value::parse(contents.str());
+	}
+
+	// Blocked before any listener thread exists so only sigwait below sees them.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	std::mutex randomMutex;
+	std::mt19937 random((unsigned int)time(NULL));
+
+	auto url = "http://" + configuration.host + ":" + std::to_string(configuration.port);
+
+	http_listener listener(url);
+	listener.support(methods::GET, [&](http_request request) {
+		bool fail = false;
+		{
+			std::lock_guard<std::mutex> lock(randomMutex);
+			fail = (int)(random() % 100) < configuration.failPercent;
+		}
+
+		auto body = response;
+		body["X-Apple-I-Client-Time"] = json::value::string(CurrentClientTime());
+
+		auto delay = configuration.delay;
+		pplx::create_task([request, body, fail, delay]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+			if (fail)
+			{
+				std::cout << "GET " << request.relative_uri().to_string() << " -> 503" << std::endl;
+				return request.reply(status_codes::ServiceUnavailable);
+			}
+
+			std::cout << "GET " << request.relative_uri().to_string() << " -> 200" << std::endl;
+			return request.reply(status_codes::OK, body);
+		}).then([](pplx::task<void> task) {
+			try
+			{
+				task.get();
+			}
+			catch (std::exception& exception)
+			{
+				std::cout << "Failed to reply: " << exception.what() << std::endl;
+			}
+		});
+	});
+
+	listener.open().wait();
+	std::cout << "Serving anisette data on " << url << std::endl;
+
+	int signal = 0;
+	sigwait(&signals, &signal);
+
+	listener.close().wait();
+
+	return 0;
+}
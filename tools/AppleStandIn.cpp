@@ -0,0 +1,2328 @@
+//
+//  AppleStandIn.cpp
+//  AltServer
+//
+//  Local stand-in for Apple's developer services (the QH65B2 plist API and the
+//  v1 JSON API) and for GSA sign-in, so installs can be run and timed without
+//  a network or a real Apple ID. Every Apple ID that signs in gets a simulated
+//  free team that keeps the devices, certificates, App IDs, app groups and
+//  profiles AltServer creates. Certificates are issued for the CSRs AltServer
+//  sends and profiles are CMS-signed, both by the stand-in's own authority.
+//  Sign-in runs the same SRP-6a handshake as gsa.apple.com, against --password,
+//  and --two-factor CODE asks each account for a verification code once.
+//
+//  --record DIR forwards every request to Apple instead and saves developer
+//  services responses there as <action>.plist; --replay DIR serves saved
+//  responses in place of simulated ones, apart from certificates and profiles,
+//  which have to match AltServer's keys. --latency-ms, --unavailable-percent,
+//  --throttle-rps and --fail ACTION=CODE inject delays and errors.
+//
+//  Point AltServer at it with ALTSERVER_DEVELOPER_SERVICES_URL=http://127.0.0.1:6972/services
+//  and ALTSERVER_GSA_URL=http://localhost:6972 (two host names, so sign-in keeps a rate limit of its own)
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <cpprest/http_client.h>
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+#include <openssl/bn.h>
+#include <openssl/cms.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include <plist/plist.h>
+#include <zlib.h>
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::client;
+using namespace web::http::experimental::listener;
+
+#define DEVELOPER_SERVICES_URL "https://developerservices2.apple.com"
+#define GSA_URL "https://gsa.apple.com"
+
+#define QH65B2_PATH "/services/QH65B2/"
+#define SERVICES_V1_PATH "/services/v1/"
+#define GSA_PATH "/grandslam/GsService2"
+#define GSA_VALIDATE_PATH "/grandslam/GsService2/validate"
+#define TRUSTED_DEVICE_PATH "/auth/verify/trusteddevice"
+
+// Result codes AltSign maps to specific errors.
+#define RESULT_INVALID_PARAMETER 35
+#define RESULT_SESSION_EXPIRED 1100
+#define RESULT_CERTIFICATE_NOT_FOUND 7252
+#define RESULT_PROFILE_NOT_FOUND 8101
+#define RESULT_PROFILE_APP_ID_NOT_FOUND 8201
+#define RESULT_APP_ID_NOT_FOUND 9100
+#define RESULT_ASSIGNED_APP_ID_NOT_FOUND 9115
+#define RESULT_BUNDLE_IDENTIFIER_UNAVAILABLE 9401
+#define RESULT_INVALID_BUNDLE_IDENTIFIER 9412
+#define RESULT_UNKNOWN_ACTION 9999
+
+#define GSA_INVALID_REQUEST -20101
+#define GSA_INCORRECT_CREDENTIALS -22406
+#define GSA_INCORRECT_VERIFICATION_CODE -21669
+
+// The app group capability, as AltSign's AppIDFeatureAppGroups.
+#define APP_GROUPS_FEATURE "APG3427HIY"
+
+// RFC 5054's 2048-bit group, which corecrypto's ccsrp_gp_rfc5054_2048 uses too.
+#define SRP_N "AC6BDB41324A9A9BF166DE5E1389582FAF72B6651987EE07FC3192943DB56050A37329CBB4A099ED8193E0757767A13DD52312AB4B03310DCD7F48A9DA04FD50E8083969EDB767B0CF6095179A163AB3661A05FBD5FAAAE82918A9962F0B93B855F97993EC975EEAA80D740ADBF4FF747359D041D5C33EA71D281E446B14773BCA97B43A23FB801676BD207A436C6481F1D2B9078717461A5B9D32E688F87748544523B524B0D57D5EA77A2775D2ECFA032CFBDBF52FB3786160279004E57AE6AF874E7303CE53299CCC041C7BC308D82A5698F3A8D0C38271AE35F8E9DBFBB694B5C803D89F7AE435DE236D525F54759B65E372FCD68EF20FA7111F9E4AFF73"
+#define SRP_G 2
+#define SRP_LENGTH 256
+
+#define CERTIFICATE_LIFETIME (365 * 24 * 60 * 60)
+#define PROFILE_LIFETIME (7 * 24 * 60 * 60)
+#define TOKEN_LIFETIME (24 * 60 * 60)
+
+// Apple's reference date is 2001-01-01.
+#define APPLE_REFERENCE_DATE 978307200
+
+typedef std::vector<unsigned char> Bytes;
+
+struct Configuration
+{
+	std::string host = "127.0.0.1";
+	int port = 6972;
+
+	std::string password = "altserver";
+	std::string verificationCode;
+	int iterations = 20000;
+
+	std::string replayDirectory;
+	std::string recordDirectory;
+
+	int latency = 0;
+	int unavailablePercent = 0;
+	int requestsPerSecond = 0;
+
+	// Action name (as printed in the statistics) to the result code it fails with.
+	std::map<std::string, int64_t> failures;
+};
+
+struct Request
+{
+	std::string method;
+	std::string path;
+	std::string query;
+	std::map<std::string, std::string> headers;
+	Bytes body;
+
+	// Names are compared in lowercase.
+	std::string header(const std::string& name) const
+	{
+		auto iterator = headers.find(name);
+		return (iterator != headers.end()) ? iterator->second : "";
+	}
+};
+
+struct Response
+{
+	int status = 200;
+	std::string contentType;
+	Bytes body;
+
+	// Shown after the status in the request log, e.g. "replayed".
+	std::string note;
+};
+
+// Becomes a resultCode (developer services) or ec (GSA) in the response.
+class RequestError : public std::runtime_error
+{
+public:
+	RequestError(int64_t code, const std::string& message, int status = 200) : std::runtime_error(message), code(code), status(status)
+	{
+	}
+
+	int64_t code;
+
+	// HTTP status for v1 responses; the plist APIs always answer 200.
+	int status;
+};
+
+static std::mutex _logMutex;
+
+static void Log(const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(_logMutex);
+	std::cout << message << std::endl;
+}
+
+#pragma mark - Plists -
+
+static std::string StringValue(plist_t dictionary, const char* key)
+{
+	auto node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_STRING)
+	{
+		return "";
+	}
+
+	char* value = nullptr;
+	plist_get_string_val(node, &value);
+
+	std::string string = (value != nullptr) ? value : "";
+	free(value);
+
+	return string;
+}
+
+static Bytes DataValue(plist_t dictionary, const char* key)
+{
+	auto node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_DATA)
+	{
+		return Bytes();
+	}
+
+	char* bytes = nullptr;
+	uint64_t length = 0;
+	plist_get_data_val(node, &bytes, &length);
+
+	Bytes data(bytes, bytes + length);
+	free(bytes);
+
+	return data;
+}
+
+// Strings of an array, or a single string.
+static std::vector<std::string> StringValues(plist_t dictionary, const char* key)
+{
+	std::vector<std::string> strings;
+
+	auto node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr)
+	{
+		return strings;
+	}
+
+	if (plist_get_node_type(node) == PLIST_STRING)
+	{
+		strings.push_back(StringValue(dictionary, key));
+		return strings;
+	}
+
+	for (uint32_t i = 0; i < plist_array_get_size(node); i++)
+	{
+		char* value = nullptr;
+		plist_get_string_val(plist_array_get_item(node, i), &value);
+
+		if (value != nullptr)
+		{
+			strings.push_back(value);
+			free(value);
+		}
+	}
+
+	return strings;
+}
+
+static Bytes XMLData(plist_t plist)
+{
+	char* xml = nullptr;
+	uint32_t length = 0;
+	plist_to_xml(plist, &xml, &length);
+
+	Bytes data(xml, xml + length);
+	free(xml);
+
+	return data;
+}
+
+// Always returns a dictionary, empty if data isn't one.
+static plist_t ParsePlist(const Bytes& data)
+{
+	plist_t plist = nullptr;
+	if (!data.empty())
+	{
+		plist_from_xml((const char*)data.data(), (uint32_t)data.size(), &plist);
+	}
+
+	if (plist != nullptr && plist_get_node_type(plist) != PLIST_DICT)
+	{
+		plist_free(plist);
+		plist = nullptr;
+	}
+
+	return (plist != nullptr) ? plist : plist_new_dict();
+}
+
+static Response PlistResponse(plist_t plist)
+{
+	Response response;
+	response.contentType = "text/x-xml-plist";
+	response.body = XMLData(plist);
+	return response;
+}
+
+#pragma mark - Crypto -
+
+static Bytes ToBytes(const std::string& string)
+{
+	return Bytes(string.begin(), string.end());
+}
+
+static Bytes RandomBytes(size_t count)
+{
+	Bytes bytes(count);
+	RAND_bytes(bytes.data(), (int)count);
+	return bytes;
+}
+
+static Bytes Concatenate(std::initializer_list<Bytes> parts)
+{
+	Bytes data;
+	for (auto& part : parts)
+	{
+		data.insert(data.end(), part.begin(), part.end());
+	}
+
+	return data;
+}
+
+static Bytes SHA256Digest(const Bytes& data)
+{
+	Bytes digest(SHA256_DIGEST_LENGTH);
+	SHA256(data.data(), data.size(), digest.data());
+	return digest;
+}
+
+static Bytes HMACSHA256(const Bytes& key, const Bytes& data)
+{
+	Bytes mac(EVP_MAX_MD_SIZE);
+	unsigned int length = 0;
+	HMAC(EVP_sha256(), key.data(), (int)key.size(), data.data(), data.size(), mac.data(), &length);
+
+	mac.resize(length);
+	return mac;
+}
+
+// AES-256-CBC with PKCS#7 padding, as ALTDecryptDataCBC expects.
+static Bytes EncryptCBC(const Bytes& key, const Bytes& iv, const Bytes& plaintext)
+{
+	Bytes ciphertext(plaintext.size() + 16);
+	int length = 0;
+	int finalLength = 0;
+
+	auto context = EVP_CIPHER_CTX_new();
+	EVP_EncryptInit_ex(context, EVP_aes_256_cbc(), NULL, key.data(), iv.data());
+	EVP_EncryptUpdate(context, ciphertext.data(), &length, plaintext.data(), (int)plaintext.size());
+	EVP_EncryptFinal_ex(context, ciphertext.data() + length, &finalLength);
+	EVP_CIPHER_CTX_free(context);
+
+	ciphertext.resize(length + finalLength);
+	return ciphertext;
+}
+
+// AES-256-GCM with a 16-byte IV; returns the ciphertext followed by the 16-byte tag, as ALTDecryptDataGCM expects.
+static Bytes EncryptGCM(const Bytes& key, const Bytes& iv, const Bytes& additionalData, const Bytes& plaintext)
+{
+	Bytes ciphertext(plaintext.size() + 16);
+	int length = 0;
+	int finalLength = 0;
+
+	auto context = EVP_CIPHER_CTX_new();
+	EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, NULL, NULL);
+	EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_IVLEN, (int)iv.size(), NULL);
+	EVP_EncryptInit_ex(context, NULL, NULL, key.data(), iv.data());
+	EVP_EncryptUpdate(context, NULL, &length, additionalData.data(), (int)additionalData.size());
+	EVP_EncryptUpdate(context, ciphertext.data(), &length, plaintext.data(), (int)plaintext.size());
+	EVP_EncryptFinal_ex(context, ciphertext.data() + length, &finalLength);
+	EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, 16, ciphertext.data() + length + finalLength);
+	EVP_CIPHER_CTX_free(context);
+
+	ciphertext.resize(length + finalLength + 16);
+	return ciphertext;
+}
+
+static Bytes Decompress(const Bytes& data)
+{
+	// Responses Apple didn't gzip are saved as they are.
+	if (data.size() < 2 || data[0] != 0x1f || data[1] != 0x8b)
+	{
+		return data;
+	}
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	inflateInit2(&stream, 16 + MAX_WBITS);
+
+	stream.next_in = (Bytef*)data.data();
+	stream.avail_in = (uInt)data.size();
+
+	Bytes output;
+	unsigned char buffer[16384];
+
+	int result = Z_OK;
+	while (result == Z_OK)
+	{
+		stream.next_out = buffer;
+		stream.avail_out = sizeof(buffer);
+
+		result = inflate(&stream, Z_NO_FLUSH);
+		output.insert(output.end(), buffer, buffer + (sizeof(buffer) - stream.avail_out));
+	}
+
+	inflateEnd(&stream);
+
+	return (result == Z_STREAM_END) ? output : data;
+}
+
+#pragma mark - SRP -
+
+class BigNumber
+{
+public:
+	BigNumber() : _value(BN_new())
+	{
+	}
+
+	BigNumber(const Bytes& bytes) : _value(BN_bin2bn(bytes.data(), (int)bytes.size(), NULL))
+	{
+	}
+
+	~BigNumber()
+	{
+		BN_clear_free(_value);
+	}
+
+	BigNumber(const BigNumber&) = delete;
+	BigNumber& operator=(const BigNumber&) = delete;
+
+	BIGNUM* get() const
+	{
+		return _value;
+	}
+
+	// Big-endian, left-padded with zeroes to length if that's longer.
+	Bytes bytes(size_t length = 0) const
+	{
+		Bytes data(std::max(length, (size_t)BN_num_bytes(_value)));
+		BN_bn2binpad(_value, data.data(), (int)data.size());
+		return data;
+	}
+
+private:
+	BIGNUM* _value;
+};
+
+// Server side of the SRP-6a handshake GSA runs with corecrypto's ccsrp: RFC 5054's 2048-bit group,
+// SHA-256, k = H(N | PAD(g)) and x = H(s | H(":" | P)), i.e. without the username.
+class SRPServer
+{
+public:
+	struct Session
+	{
+		Bytes sessionKey;
+		Bytes serverProof;
+	};
+
+	SRPServer() : _context(BN_CTX_new())
+	{
+		auto N = _N.get();
+		BN_hex2bn(&N, SRP_N);
+		BN_set_word(_g.get(), SRP_G);
+
+		_k = SHA256Digest(Concatenate({ _N.bytes(), _g.bytes(SRP_LENGTH) }));
+	}
+
+	~SRPServer()
+	{
+		BN_CTX_free(_context);
+	}
+
+	// P as ALTPBKDF2SRP derives it: s2k uses the password's SHA-256 digest, s2k_fo its lowercase hex.
+	static Bytes PasswordKey(const std::string& protocol, const std::string& password, const Bytes& salt, int iterations)
+	{
+		auto digest = SHA256Digest(ToBytes(password));
+
+		if (protocol == "s2k_fo")
+		{
+			static const char hexCharacters[] = "0123456789abcdef";
+
+			Bytes hex;
+			for (auto byte : digest)
+			{
+				hex.push_back(hexCharacters[byte >> 4]);
+				hex.push_back(hexCharacters[byte & 0x0F]);
+			}
+
+			digest = hex;
+		}
+
+		Bytes key(SHA256_DIGEST_LENGTH);
+		PKCS5_PBKDF2_HMAC((const char*)digest.data(), (int)digest.size(), salt.data(), (int)salt.size(), iterations, EVP_sha256(), (int)key.size(), key.data());
+		return key;
+	}
+
+	Bytes Verifier(const Bytes& salt, const Bytes& passwordKey)
+	{
+		auto innerDigest = SHA256Digest(Concatenate({ ToBytes(":"), passwordKey }));
+		BigNumber x(SHA256Digest(Concatenate({ salt, innerDigest })));
+
+		BigNumber v;
+		BN_mod_exp(v.get(), _g.get(), x.get(), _N.get(), _context);
+		return v.bytes();
+	}
+
+	// B = k * v + g^b, padded to the group's length since ccsrp reads exactly that many bytes.
+	Bytes PublicValue(const Bytes& verifier, const Bytes& privateValue)
+	{
+		BigNumber k(_k);
+		BigNumber v(verifier);
+		BigNumber b(privateValue);
+
+		BigNumber kv;
+		BN_mod_mul(kv.get(), k.get(), v.get(), _N.get(), _context);
+
+		BigNumber gb;
+		BN_mod_exp(gb.get(), _g.get(), b.get(), _N.get(), _context);
+
+		BigNumber B;
+		BN_mod_add(B.get(), kv.get(), gb.get(), _N.get(), _context);
+		return B.bytes(SRP_LENGTH);
+	}
+
+	// Checks the client's proof M1 and returns the session key K and the server's proof M2.
+	std::optional<Session> Verify(const std::string& username, const Bytes& salt, const Bytes& verifier, const Bytes& clientValue,
+		const Bytes& privateValue, const Bytes& serverValue, const Bytes& clientProof)
+	{
+		BigNumber A(clientValue);
+		BigNumber v(verifier);
+		BigNumber b(privateValue);
+
+		BigNumber check;
+		BN_mod(check.get(), A.get(), _N.get(), _context);
+		if (BN_is_zero(check.get()))
+		{
+			return std::nullopt;
+		}
+
+		BigNumber u(SHA256Digest(Concatenate({ A.bytes(SRP_LENGTH), BigNumber(serverValue).bytes(SRP_LENGTH) })));
+
+		// S = (A * v^u)^b
+		BigNumber vu;
+		BN_mod_exp(vu.get(), v.get(), u.get(), _N.get(), _context);
+
+		BigNumber base;
+		BN_mod_mul(base.get(), A.get(), vu.get(), _N.get(), _context);
+
+		BigNumber S;
+		BN_mod_exp(S.get(), base.get(), b.get(), _N.get(), _context);
+
+		auto usernameDigest = SHA256Digest(ToBytes(username));
+		auto modulusDigest = SHA256Digest(_N.bytes());
+
+		// SRP implementations differ in whether g, A, B and S are padded to the group's length before hashing, so accept either.
+		for (bool isGeneratorPadded : { true, false })
+		{
+			auto generatorDigest = SHA256Digest(_g.bytes(isGeneratorPadded ? SRP_LENGTH : 0));
+
+			Bytes groupDigest(SHA256_DIGEST_LENGTH);
+			for (size_t i = 0; i < groupDigest.size(); i++)
+			{
+				groupDigest[i] = modulusDigest[i] ^ generatorDigest[i];
+			}
+
+			for (size_t length : { (size_t)SRP_LENGTH, (size_t)0 })
+			{
+				auto clientBytes = A.bytes(length);
+				auto sessionKey = SHA256Digest(S.bytes(length));
+				auto expectedProof = SHA256Digest(Concatenate({ groupDigest, usernameDigest, salt, clientBytes, BigNumber(serverValue).bytes(length), sessionKey }));
+
+				if (expectedProof.size() == clientProof.size() && CRYPTO_memcmp(expectedProof.data(), clientProof.data(), clientProof.size()) == 0)
+				{
+					Session session;
+					session.sessionKey = sessionKey;
+					session.serverProof = SHA256Digest(Concatenate({ clientBytes, clientProof, sessionKey }));
+					return session;
+				}
+			}
+		}
+
+		return std::nullopt;
+	}
+
+private:
+	BN_CTX* _context;
+
+	BigNumber _N;
+	BigNumber _g;
+	Bytes _k;
+};
+
+#pragma mark - Simulation -
+
+struct SimulatedDevice
+{
+	std::string identifier;
+	std::string name;
+	std::string udid;
+	std::string deviceClass;
+};
+
+struct SimulatedCertificate
+{
+	std::string identifier;
+	std::string name;
+	std::string serialNumber;
+	std::string machineName;
+	std::string machineIdentifier;
+	Bytes data;
+};
+
+struct SimulatedAppID
+{
+	std::string identifier;
+	std::string name;
+	std::string bundleIdentifier;
+
+	// Capability ID to value; enabled capabilities are the ones that aren't false.
+	plist_t features = plist_new_dict();
+	std::vector<std::string> groupIdentifiers;
+
+	SimulatedAppID() = default;
+	SimulatedAppID(const SimulatedAppID&) = delete;
+	SimulatedAppID& operator=(const SimulatedAppID&) = delete;
+
+	~SimulatedAppID()
+	{
+		plist_free(features);
+	}
+};
+
+struct SimulatedAppGroup
+{
+	std::string identifier;
+	std::string name;
+	std::string groupIdentifier;
+};
+
+struct SimulatedTeam
+{
+	std::string identifier;
+	std::string name;
+
+	std::vector<SimulatedDevice> devices;
+	std::vector<SimulatedCertificate> certificates;
+	std::vector<std::shared_ptr<SimulatedAppID>> appIDs;
+	std::vector<SimulatedAppGroup> appGroups;
+
+	// Profile ID to App ID.
+	std::map<std::string, std::string> profiles;
+};
+
+struct SimulatedAccount
+{
+	std::string appleID;
+	std::string dsid;
+	uint64_t personID = 0;
+	std::string firstName;
+	std::string lastName;
+	std::string teamIdentifier;
+
+	// Fixed per account, like Apple's. Verifiers are keyed by protocol (s2k or s2k_fo).
+	Bytes salt;
+	std::map<std::string, Bytes> verifiers;
+
+	bool isVerified = false;
+
+	// From the latest sign-in.
+	std::string idmsToken;
+	Bytes sessionKey;
+
+	// Every app token handed out since launch stays valid.
+	std::set<std::string> authTokens;
+};
+
+struct SRPHandshake
+{
+	std::string appleID;
+	std::string protocol;
+	std::string proposedProtocols;
+	Bytes clientValue;
+	Bytes privateValue;
+	Bytes serverValue;
+};
+
+struct ActionStatistics
+{
+	uint64_t requests = 0;
+	uint64_t replayed = 0;
+	uint64_t injectedFailures = 0;
+};
+
+#pragma mark - AppleStandIn -
+
+class AppleStandIn
+{
+public:
+	AppleStandIn(Configuration configuration);
+	~AppleStandIn();
+
+	pplx::task<Response> Handle(Request request);
+
+	void LogStatistics();
+
+private:
+	Configuration _configuration;
+
+	std::mutex _mutex;
+	std::mt19937 _random;
+
+	SRPServer _srpServer;
+
+	// Issues every certificate and signs every profile.
+	EVP_PKEY* _authorityKey;
+	X509* _authorityCertificate;
+
+	// Accounts are keyed by lowercase Apple ID, handshakes by their cookie.
+	std::map<std::string, std::shared_ptr<SimulatedAccount>> _accounts;
+	std::map<std::string, std::shared_ptr<SimulatedTeam>> _teams;
+	std::map<std::string, SRPHandshake> _handshakes;
+
+	std::map<std::string, ActionStatistics> _statistics;
+
+	std::chrono::steady_clock::time_point _windowStart;
+	int _windowRequests;
+
+	std::optional<http_client> _developerServicesClient;
+	std::optional<http_client> _gsaClient;
+
+	std::string RandomIdentifier(size_t length, const char* characters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+	std::string RandomUUID();
+
+	std::optional<Response> InjectedFailure(const std::string& action);
+
+	pplx::task<Response> Forward(const Request& request, const std::string& action);
+	std::string RecordingPath(const std::string& action) const;
+
+	std::shared_ptr<SimulatedAccount> AccountForAppleID(const std::string& appleID);
+	std::shared_ptr<SimulatedAccount> AccountForDSID(const std::string& dsid) const;
+	std::shared_ptr<SimulatedAccount> AuthenticatedAccount(const Request& request) const;
+	std::shared_ptr<SimulatedTeam> TeamForIdentifier(const std::string& identifier);
+	bool RequiresVerification(const SimulatedAccount& account) const;
+
+	Response HandleDeveloperServicesRequest(const Request& request, const std::string& action);
+	plist_t PerformAction(const std::string& action, plist_t parameters, SimulatedAccount& account);
+
+	Response HandleServicesRequest(const Request& request, const std::string& action);
+
+	Response HandleGSARequest(const Request& request, const std::string& action);
+	plist_t StartHandshake(plist_t request);
+	plist_t CompleteHandshake(plist_t request);
+	plist_t IssueAppTokens(plist_t request);
+
+	Response HandleTrustedDeviceRequest(const Request& request);
+	Response HandleValidateRequest(const Request& request);
+
+	SimulatedCertificate IssueCertificate(const std::string& certificateRequest, const std::string& machineName, const std::string& machineIdentifier,
+		const SimulatedTeam& team, const SimulatedAccount& account);
+	Bytes MakeProfile(const SimulatedTeam& team, const SimulatedAppID& appID, const std::string& uuid);
+};
+
+static std::string Lowercase(std::string string)
+{
+	std::transform(string.begin(), string.end(), string.begin(), ::tolower);
+	return string;
+}
+
+static bool HasPrefix(const std::string& string, const std::string& prefix)
+{
+	return string.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Short name used in statistics, --fail and recordings, e.g. listDevices, certificates or complete.
+static std::string ActionName(const Request& request)
+{
+	if (HasPrefix(request.path, QH65B2_PATH))
+	{
+		auto action = request.path.substr(request.path.rfind('/') + 1);
+
+		auto extension = action.rfind(".action");
+		return (extension != std::string::npos) ? action.substr(0, extension) : action;
+	}
+
+	if (HasPrefix(request.path, SERVICES_V1_PATH))
+	{
+		auto resource = request.path.substr(strlen(SERVICES_V1_PATH));
+		resource = resource.substr(0, resource.find('/'));
+
+		auto method = request.header("x-http-method-override");
+		return (method == methods::DEL) ? resource + ".delete" : resource;
+	}
+
+	if (request.path == GSA_PATH)
+	{
+		auto plist = ParsePlist(request.body);
+		auto operation = StringValue(plist_dict_get_item(plist, "Request"), "o");
+		plist_free(plist);
+
+		return operation.empty() ? "gsa" : operation;
+	}
+
+	if (request.path == GSA_VALIDATE_PATH)
+	{
+		return "validate";
+	}
+
+	if (request.path == TRUSTED_DEVICE_PATH)
+	{
+		return "trusteddevice";
+	}
+
+	return request.path;
+}
+
+AppleStandIn::AppleStandIn(Configuration configuration) : _configuration(configuration), _random((unsigned int)time(NULL)),
+	_authorityKey(nullptr), _authorityCertificate(nullptr), _windowStart(std::chrono::steady_clock::now()), _windowRequests(0)
+{
+	auto context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	EVP_PKEY_keygen_init(context);
+	EVP_PKEY_CTX_set_rsa_keygen_bits(context, 2048);
+	EVP_PKEY_keygen(context, &_authorityKey);
+	EVP_PKEY_CTX_free(context);
+
+	_authorityCertificate = X509_new();
+	X509_set_version(_authorityCertificate, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(_authorityCertificate), 1);
+	X509_gmtime_adj(X509_getm_notBefore(_authorityCertificate), 0);
+	X509_gmtime_adj(X509_getm_notAfter(_authorityCertificate), CERTIFICATE_LIFETIME);
+	X509_set_pubkey(_authorityCertificate, _authorityKey);
+
+	auto name = X509_get_subject_name(_authorityCertificate);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"AppleStandIn Developer Relations Certification Authority", -1, -1, 0);
+	X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char*)"AppleStandIn", -1, -1, 0);
+	X509_set_issuer_name(_authorityCertificate, name);
+	X509_sign(_authorityCertificate, _authorityKey, EVP_sha256());
+
+	if (!_configuration.recordDirectory.empty())
+	{
+		// Like AppleAPI, which doesn't validate gsa.apple.com's certificate either.
+		http_client_config config;
+		config.set_validate_certificates(false);
+
+		_developerServicesClient.emplace(uri(U(DEVELOPER_SERVICES_URL)));
+		_gsaClient.emplace(uri(U(GSA_URL)), config);
+	}
+}
+
+AppleStandIn::~AppleStandIn()
+{
+	X509_free(_authorityCertificate);
+	EVP_PKEY_free(_authorityKey);
+}
+
+std::string AppleStandIn::RandomIdentifier(size_t length, const char* characters)
+{
+	auto count = strlen(characters);
+
+	std::string identifier;
+	for (size_t i = 0; i < length; i++)
+	{
+		identifier += characters[_random() % count];
+	}
+
+	return identifier;
+}
+
+std::string AppleStandIn::RandomUUID()
+{
+	const char* digits = "0123456789ABCDEF";
+	return this->RandomIdentifier(8, digits) + "-" + this->RandomIdentifier(4, digits) + "-" + this->RandomIdentifier(4, digits) + "-" +
+		this->RandomIdentifier(4, digits) + "-" + this->RandomIdentifier(12, digits);
+}
+
+pplx::task<Response> AppleStandIn::Handle(Request request)
+{
+	auto action = ActionName(request);
+
+	auto failure = this->InjectedFailure(action);
+	if (failure.has_value())
+	{
+		return pplx::task_from_result(*failure);
+	}
+
+	if (!_configuration.recordDirectory.empty())
+	{
+		return this->Forward(request, action);
+	}
+
+	Response response;
+
+	if (HasPrefix(request.path, QH65B2_PATH))
+	{
+		response = this->HandleDeveloperServicesRequest(request, action);
+	}
+	else if (HasPrefix(request.path, SERVICES_V1_PATH))
+	{
+		response = this->HandleServicesRequest(request, action);
+	}
+	else if (request.path == GSA_PATH)
+	{
+		response = this->HandleGSARequest(request, action);
+	}
+	else if (request.path == TRUSTED_DEVICE_PATH)
+	{
+		response = this->HandleTrustedDeviceRequest(request);
+	}
+	else if (request.path == GSA_VALIDATE_PATH)
+	{
+		response = this->HandleValidateRequest(request);
+	}
+	else
+	{
+		response.status = status_codes::NotFound;
+	}
+
+	return pplx::task_from_result(response);
+}
+
+// 429 above --throttle-rps and 503 for --unavailable-percent of requests, which the scheduler retries.
+std::optional<Response> AppleStandIn::InjectedFailure(const std::string& action)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto& statistics = _statistics[action];
+	statistics.requests++;
+
+	// Fixed one-second windows, like SchedulerBench's mock server.
+	auto now = std::chrono::steady_clock::now();
+	if (now - _windowStart >= std::chrono::seconds(1))
+	{
+		_windowStart = now;
+		_windowRequests = 0;
+	}
+
+	Response response;
+
+	if (_configuration.requestsPerSecond > 0 && ++_windowRequests > _configuration.requestsPerSecond)
+	{
+		response.status = status_codes::TooManyRequests;
+	}
+	else if ((int)(_random() % 100) < _configuration.unavailablePercent)
+	{
+		response.status = status_codes::ServiceUnavailable;
+	}
+	else
+	{
+		return std::nullopt;
+	}
+
+	statistics.injectedFailures++;
+	return response;
+}
+
+#pragma mark - Recording -
+
+std::string AppleStandIn::RecordingPath(const std::string& action) const
+{
+	auto& directory = _configuration.recordDirectory.empty() ? _configuration.replayDirectory : _configuration.recordDirectory;
+	return directory + "/" + action + ".plist";
+}
+
+pplx::task<Response> AppleStandIn::Forward(const Request& request, const std::string& action)
+{
+	bool isDeveloperServicesRequest = HasPrefix(request.path, QH65B2_PATH) || HasPrefix(request.path, SERVICES_V1_PATH);
+
+	http_request forwardedRequest(request.method);
+	forwardedRequest.set_request_uri(request.path + (request.query.empty() ? "" : "?" + request.query));
+	forwardedRequest.set_body(request.body);
+
+	for (auto& header : request.headers)
+	{
+		if (header.first == "host" || header.first == "content-length" || header.first == "connection")
+		{
+			continue;
+		}
+
+		if (forwardedRequest.headers().has(header.first))
+		{
+			forwardedRequest.headers().remove(header.first);
+		}
+
+		forwardedRequest.headers().add(header.first, header.second);
+	}
+
+	// Only plist responses are saved; GSA's belong to one handshake and v1's are never replayed.
+	std::string recordingPath;
+	if (HasPrefix(request.path, QH65B2_PATH))
+	{
+		recordingPath = this->RecordingPath(action);
+	}
+
+	auto& client = isDeveloperServicesRequest ? *_developerServicesClient : *_gsaClient;
+	return client.request(forwardedRequest)
+	.then([](http_response response) {
+		return response.extract_vector().then([response](std::vector<unsigned char> body) {
+			Response forwardedResponse;
+			forwardedResponse.status = response.status_code();
+			forwardedResponse.contentType = response.headers().content_type();
+			forwardedResponse.body = body;
+			return forwardedResponse;
+		});
+	})
+	.then([recordingPath](Response response) {
+		if (!recordingPath.empty() && response.status == status_codes::OK)
+		{
+			auto data = Decompress(response.body);
+
+			std::ofstream file(recordingPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			file.write((const char*)data.data(), data.size());
+
+			response.note = "recorded to " + recordingPath;
+		}
+
+		return response;
+	});
+}
+
+#pragma mark - Accounts -
+
+std::shared_ptr<SimulatedAccount> AppleStandIn::AccountForAppleID(const std::string& appleID)
+{
+	auto key = Lowercase(appleID);
+
+	auto iterator = _accounts.find(key);
+	if (iterator != _accounts.end())
+	{
+		return iterator->second;
+	}
+
+	auto account = std::make_shared<SimulatedAccount>();
+	account->appleID = appleID;
+	account->dsid = this->RandomIdentifier(6, "0123456789") + "-10-" + Lowercase(this->RandomUUID());
+	account->personID = 10000000000ULL + _random() % 1000000000ULL;
+	account->salt = RandomBytes(16);
+
+	auto localPart = appleID.substr(0, appleID.find('@'));
+	account->firstName = localPart.empty() ? "Stand-In" : localPart;
+	account->firstName[0] = toupper(account->firstName[0]);
+	account->lastName = "Stand-In";
+
+	auto team = std::make_shared<SimulatedTeam>();
+	team->identifier = this->RandomIdentifier(10);
+	team->name = account->firstName + " " + account->lastName;
+	_teams[team->identifier] = team;
+
+	account->teamIdentifier = team->identifier;
+	_accounts[key] = account;
+
+	return account;
+}
+
+std::shared_ptr<SimulatedAccount> AppleStandIn::AccountForDSID(const std::string& dsid) const
+{
+	for (auto& pair : _accounts)
+	{
+		if (pair.second->dsid == dsid)
+		{
+			return pair.second;
+		}
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<SimulatedAccount> AppleStandIn::AuthenticatedAccount(const Request& request) const
+{
+	auto account = this->AccountForDSID(request.header("x-apple-i-identity-id"));
+	if (account == nullptr || account->authTokens.count(request.header("x-apple-gs-token")) == 0)
+	{
+		// Also what a session saved before the stand-in restarted gets, so AltServer signs in again.
+		throw RequestError(RESULT_SESSION_EXPIRED, "Your session has expired. Please log in.", status_codes::Unauthorized);
+	}
+
+	return account;
+}
+
+// Teams are created on first use, so team IDs from replayed responses work too.
+std::shared_ptr<SimulatedTeam> AppleStandIn::TeamForIdentifier(const std::string& identifier)
+{
+	if (identifier.empty())
+	{
+		throw RequestError(RESULT_INVALID_PARAMETER, "Missing teamId.", status_codes::BadRequest);
+	}
+
+	auto iterator = _teams.find(identifier);
+	if (iterator != _teams.end())
+	{
+		return iterator->second;
+	}
+
+	auto team = std::make_shared<SimulatedTeam>();
+	team->identifier = identifier;
+	team->name = "Team " + identifier;
+	_teams[identifier] = team;
+
+	return team;
+}
+
+bool AppleStandIn::RequiresVerification(const SimulatedAccount& account) const
+{
+	return !_configuration.verificationCode.empty() && !account.isVerified;
+}
+
+#pragma mark - Developer Services -
+
+static plist_t DevicePlist(const SimulatedDevice& device)
+{
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "deviceId", plist_new_string(device.identifier.c_str()));
+	plist_dict_set_item(plist, "name", plist_new_string(device.name.c_str()));
+	plist_dict_set_item(plist, "deviceNumber", plist_new_string(device.udid.c_str()));
+	plist_dict_set_item(plist, "deviceClass", plist_new_string(device.deviceClass.c_str()));
+	plist_dict_set_item(plist, "devicePlatform", plist_new_string(device.deviceClass == "tvos" ? "tvos" : "ios"));
+	plist_dict_set_item(plist, "status", plist_new_string("c"));
+	return plist;
+}
+
+static plist_t AppIDPlist(const SimulatedAppID& appID, const std::string& teamIdentifier)
+{
+	plist_t enabledFeatures = plist_new_array();
+
+	plist_dict_iter iterator = nullptr;
+	plist_dict_new_iter(appID.features, &iterator);
+
+	while (true)
+	{
+		char* key = nullptr;
+		plist_t value = nullptr;
+		plist_dict_next_item(appID.features, iterator, &key, &value);
+
+		if (key == nullptr)
+		{
+			break;
+		}
+
+		uint8_t isEnabled = 1;
+		if (plist_get_node_type(value) == PLIST_BOOLEAN)
+		{
+			plist_get_bool_val(value, &isEnabled);
+		}
+
+		if (isEnabled)
+		{
+			plist_array_append_item(enabledFeatures, plist_new_string(key));
+		}
+
+		free(key);
+	}
+
+	free(iterator);
+
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "appIdId", plist_new_string(appID.identifier.c_str()));
+	plist_dict_set_item(plist, "name", plist_new_string(appID.name.c_str()));
+	plist_dict_set_item(plist, "identifier", plist_new_string(appID.bundleIdentifier.c_str()));
+	plist_dict_set_item(plist, "prefix", plist_new_string(teamIdentifier.c_str()));
+	plist_dict_set_item(plist, "isWildCard", plist_new_bool(0));
+	plist_dict_set_item(plist, "features", plist_copy(appID.features));
+	plist_dict_set_item(plist, "enabledFeatures", enabledFeatures);
+	return plist;
+}
+
+static plist_t AppGroupPlist(const SimulatedAppGroup& group, const std::string& teamIdentifier)
+{
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "applicationGroup", plist_new_string(group.identifier.c_str()));
+	plist_dict_set_item(plist, "name", plist_new_string(group.name.c_str()));
+	plist_dict_set_item(plist, "identifier", plist_new_string(group.groupIdentifier.c_str()));
+	plist_dict_set_item(plist, "prefix", plist_new_string(teamIdentifier.c_str()));
+	plist_dict_set_item(plist, "status", plist_new_string("current"));
+	return plist;
+}
+
+static std::shared_ptr<SimulatedAppID> FindAppID(const SimulatedTeam& team, const std::string& identifier)
+{
+	for (auto& appID : team.appIDs)
+	{
+		if (appID->identifier == identifier)
+		{
+			return appID;
+		}
+	}
+
+	return nullptr;
+}
+
+static bool IsValidBundleIdentifier(const std::string& bundleIdentifier)
+{
+	if (bundleIdentifier.empty() || bundleIdentifier.front() == '.' || bundleIdentifier.back() == '.')
+	{
+		return false;
+	}
+
+	return std::all_of(bundleIdentifier.begin(), bundleIdentifier.end(), [](char character) {
+		return isalnum((unsigned char)character) || character == '.' || character == '-';
+	});
+}
+
+Response AppleStandIn::HandleDeveloperServicesRequest(const Request& request, const std::string& action)
+{
+	plist_t parameters = ParsePlist(request.body);
+	plist_t response = nullptr;
+
+	try
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto account = this->AuthenticatedAccount(request);
+
+		auto failure = _configuration.failures.find(action);
+		if (failure != _configuration.failures.end())
+		{
+			_statistics[action].injectedFailures++;
+			throw RequestError(failure->second, "Injected failure.");
+		}
+
+		// Certificates and profiles have to match AltServer's keys, so they are never replayed.
+		if (!_configuration.replayDirectory.empty() && action != "submitDevelopmentCSR" && action != "downloadTeamProvisioningProfile")
+		{
+			std::ifstream file(this->RecordingPath(action), std::ios::in | std::ios::binary);
+			if (file.is_open())
+			{
+				_statistics[action].replayed++;
+				plist_free(parameters);
+
+				Response replayedResponse;
+				replayedResponse.contentType = "text/x-xml-plist";
+				replayedResponse.body = Bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				replayedResponse.note = "replayed";
+				return replayedResponse;
+			}
+		}
+
+		response = this->PerformAction(action, parameters, *account);
+		plist_dict_set_item(response, "resultCode", plist_new_uint(0));
+	}
+	catch (RequestError& error)
+	{
+		response = plist_new_dict();
+		plist_dict_set_item(response, "resultCode", plist_new_uint((uint64_t)error.code));
+		plist_dict_set_item(response, "resultString", plist_new_string(error.what()));
+		plist_dict_set_item(response, "userString", plist_new_string(error.what()));
+	}
+
+	char timestamp[64];
+	time_t now = time(NULL);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	plist_dict_set_item(response, "protocolVersion", plist_new_string("QH65B2"));
+	plist_dict_set_item(response, "requestId", plist_new_string(StringValue(parameters, "requestId").c_str()));
+	plist_dict_set_item(response, "creationTimestamp", plist_new_string(timestamp));
+	plist_dict_set_item(response, "userLocale", plist_new_string("en_US"));
+
+	auto plistResponse = PlistResponse(response);
+
+	plist_free(response);
+	plist_free(parameters);
+
+	return plistResponse;
+}
+
+// Called with _mutex held. Returns the response without its resultCode.
+plist_t AppleStandIn::PerformAction(const std::string& action, plist_t parameters, SimulatedAccount& account)
+{
+	plist_t response = plist_new_dict();
+
+	if (action == "viewDeveloper")
+	{
+		plist_t developer = plist_new_dict();
+		plist_dict_set_item(developer, "email", plist_new_string(account.appleID.c_str()));
+		plist_dict_set_item(developer, "personId", plist_new_uint(account.personID));
+		plist_dict_set_item(developer, "firstName", plist_new_string(account.firstName.c_str()));
+		plist_dict_set_item(developer, "lastName", plist_new_string(account.lastName.c_str()));
+		plist_dict_set_item(developer, "developerStatus", plist_new_string("active"));
+		plist_dict_set_item(response, "developer", developer);
+		return response;
+	}
+
+	if (action == "listTeams")
+	{
+		auto team = this->TeamForIdentifier(account.teamIdentifier);
+
+		plist_t membership = plist_new_dict();
+		plist_dict_set_item(membership, "name", plist_new_string("Xcode Free Provisioning Program"));
+		plist_dict_set_item(membership, "platform", plist_new_string("ios"));
+
+		plist_t memberships = plist_new_array();
+		plist_array_append_item(memberships, membership);
+
+		plist_t teamPlist = plist_new_dict();
+		plist_dict_set_item(teamPlist, "name", plist_new_string(team->name.c_str()));
+		plist_dict_set_item(teamPlist, "teamId", plist_new_string(team->identifier.c_str()));
+		plist_dict_set_item(teamPlist, "type", plist_new_string("Individual"));
+		plist_dict_set_item(teamPlist, "status", plist_new_string("active"));
+		plist_dict_set_item(teamPlist, "memberships", memberships);
+
+		plist_t teams = plist_new_array();
+		plist_array_append_item(teams, teamPlist);
+		plist_dict_set_item(response, "teams", teams);
+		return response;
+	}
+
+	auto team = this->TeamForIdentifier(StringValue(parameters, "teamId"));
+
+	if (action == "listDevices")
+	{
+		plist_t devices = plist_new_array();
+		for (auto& device : team->devices)
+		{
+			plist_array_append_item(devices, DevicePlist(device));
+		}
+
+		plist_dict_set_item(response, "devices", devices);
+	}
+	else if (action == "addDevice")
+	{
+		auto udid = StringValue(parameters, "deviceNumber");
+		if (udid.empty())
+		{
+			throw RequestError(RESULT_INVALID_PARAMETER, "Device number is missing.");
+		}
+
+		auto device = std::find_if(team->devices.begin(), team->devices.end(), [&udid](const SimulatedDevice& device) {
+			return Lowercase(device.udid) == Lowercase(udid);
+		});
+
+		if (device == team->devices.end())
+		{
+			SimulatedDevice newDevice;
+			newDevice.identifier = this->RandomIdentifier(10);
+			newDevice.name = StringValue(parameters, "name");
+			newDevice.udid = udid;
+			newDevice.deviceClass = (StringValue(parameters, "DTDK_Platform") == "tvos") ? "tvos" : "iphone";
+
+			team->devices.push_back(newDevice);
+			device = team->devices.end() - 1;
+		}
+
+		plist_dict_set_item(response, "device", DevicePlist(*device));
+	}
+	else if (action == "submitDevelopmentCSR")
+	{
+		auto certificate = this->IssueCertificate(StringValue(parameters, "csrContent"), StringValue(parameters, "machineName"),
+			StringValue(parameters, "machineId"), *team, account);
+		team->certificates.push_back(certificate);
+
+		plist_t certificateRequest = plist_new_dict();
+		plist_dict_set_item(certificateRequest, "certRequestId", plist_new_string(certificate.identifier.c_str()));
+		plist_dict_set_item(certificateRequest, "name", plist_new_string(certificate.name.c_str()));
+		plist_dict_set_item(certificateRequest, "serialNum", plist_new_string(certificate.serialNumber.c_str()));
+		plist_dict_set_item(certificateRequest, "machineName", plist_new_string(certificate.machineName.c_str()));
+		plist_dict_set_item(certificateRequest, "machineId", plist_new_string(certificate.machineIdentifier.c_str()));
+		plist_dict_set_item(certificateRequest, "statusString", plist_new_string("Approved"));
+		plist_dict_set_item(response, "certRequest", certificateRequest);
+	}
+	else if (action == "listAppIds")
+	{
+		plist_t appIDs = plist_new_array();
+		for (auto& appID : team->appIDs)
+		{
+			plist_array_append_item(appIDs, AppIDPlist(*appID, team->identifier));
+		}
+
+		plist_dict_set_item(response, "appIds", appIDs);
+	}
+	else if (action == "addAppId")
+	{
+		auto name = StringValue(parameters, "name");
+		auto bundleIdentifier = StringValue(parameters, "identifier");
+
+		if (name.empty())
+		{
+			throw RequestError(RESULT_INVALID_PARAMETER, "The App ID name is invalid.");
+		}
+
+		if (!IsValidBundleIdentifier(bundleIdentifier))
+		{
+			throw RequestError(RESULT_INVALID_BUNDLE_IDENTIFIER, "The bundle identifier " + bundleIdentifier + " is invalid.");
+		}
+
+		for (auto& appID : team->appIDs)
+		{
+			if (Lowercase(appID->bundleIdentifier) == Lowercase(bundleIdentifier))
+			{
+				throw RequestError(RESULT_BUNDLE_IDENTIFIER_UNAVAILABLE, "An App ID with Identifier '" + bundleIdentifier + "' is not available. Please enter a different string.");
+			}
+		}
+
+		auto appID = std::make_shared<SimulatedAppID>();
+		appID->identifier = this->RandomIdentifier(10);
+		appID->name = name;
+		appID->bundleIdentifier = bundleIdentifier;
+		plist_dict_set_item(appID->features, APP_GROUPS_FEATURE, plist_new_bool(0));
+		team->appIDs.push_back(appID);
+
+		plist_dict_set_item(response, "appId", AppIDPlist(*appID, team->identifier));
+	}
+	else if (action == "updateAppId")
+	{
+		auto appID = FindAppID(*team, StringValue(parameters, "appIdId"));
+		if (appID == nullptr)
+		{
+			throw RequestError(RESULT_APP_ID_NOT_FOUND, "There is no App ID with that identifier.");
+		}
+
+		// Everything but the request's own keys is a capability to set.
+		static const std::set<std::string> requestKeys = { "clientId", "protocolVersion", "requestId", "teamId", "appIdId", "DTDK_Platform", "subPlatform", "userLocale" };
+
+		plist_dict_iter iterator = nullptr;
+		plist_dict_new_iter(parameters, &iterator);
+
+		while (true)
+		{
+			char* key = nullptr;
+			plist_t value = nullptr;
+			plist_dict_next_item(parameters, iterator, &key, &value);
+
+			if (key == nullptr)
+			{
+				break;
+			}
+
+			if (requestKeys.count(key) == 0)
+			{
+				plist_dict_set_item(appID->features, key, plist_copy(value));
+			}
+
+			free(key);
+		}
+
+		free(iterator);
+
+		plist_dict_set_item(response, "appId", AppIDPlist(*appID, team->identifier));
+	}
+	else if (action == "listApplicationGroups")
+	{
+		plist_t groups = plist_new_array();
+		for (auto& group : team->appGroups)
+		{
+			plist_array_append_item(groups, AppGroupPlist(group, team->identifier));
+		}
+
+		plist_dict_set_item(response, "applicationGroupList", groups);
+	}
+	else if (action == "addApplicationGroup")
+	{
+		auto groupIdentifier = StringValue(parameters, "identifier");
+		if (!HasPrefix(groupIdentifier, "group.") || !IsValidBundleIdentifier(groupIdentifier))
+		{
+			throw RequestError(RESULT_INVALID_PARAMETER, "The app group identifier " + groupIdentifier + " is invalid.");
+		}
+
+		for (auto& group : team->appGroups)
+		{
+			if (group.groupIdentifier == groupIdentifier)
+			{
+				throw RequestError(RESULT_INVALID_PARAMETER, "An App Group with Identifier '" + groupIdentifier + "' is not available.");
+			}
+		}
+
+		SimulatedAppGroup group;
+		group.identifier = this->RandomIdentifier(10);
+		group.name = StringValue(parameters, "name");
+		group.groupIdentifier = groupIdentifier;
+		team->appGroups.push_back(group);
+
+		plist_dict_set_item(response, "applicationGroup", AppGroupPlist(group, team->identifier));
+	}
+	else if (action == "assignApplicationGroupToAppId")
+	{
+		auto appID = FindAppID(*team, StringValue(parameters, "appIdId"));
+		if (appID == nullptr)
+		{
+			throw RequestError(RESULT_ASSIGNED_APP_ID_NOT_FOUND, "There is no App ID with that identifier.");
+		}
+
+		auto groupIdentifiers = StringValues(parameters, "applicationGroups");
+		for (auto& groupIdentifier : groupIdentifiers)
+		{
+			auto group = std::find_if(team->appGroups.begin(), team->appGroups.end(), [&groupIdentifier](const SimulatedAppGroup& group) {
+				return group.identifier == groupIdentifier;
+			});
+
+			if (group == team->appGroups.end())
+			{
+				throw RequestError(RESULT_INVALID_PARAMETER, "There is no app group with identifier " + groupIdentifier + ".");
+			}
+		}
+
+		appID->groupIdentifiers = groupIdentifiers;
+	}
+	else if (action == "downloadTeamProvisioningProfile")
+	{
+		auto appID = FindAppID(*team, StringValue(parameters, "appIdId"));
+		if (appID == nullptr)
+		{
+			throw RequestError(RESULT_PROFILE_APP_ID_NOT_FOUND, "There is no App ID with that identifier.");
+		}
+
+		auto identifier = this->RandomIdentifier(10);
+		auto uuid = this->RandomUUID();
+		auto data = this->MakeProfile(*team, *appID, uuid);
+		team->profiles[identifier] = appID->identifier;
+
+		plist_t profile = plist_new_dict();
+		plist_dict_set_item(profile, "provisioningProfileId", plist_new_string(identifier.c_str()));
+		plist_dict_set_item(profile, "name", plist_new_string(("iOS Team Provisioning Profile: " + appID->bundleIdentifier).c_str()));
+		plist_dict_set_item(profile, "UUID", plist_new_string(uuid.c_str()));
+		plist_dict_set_item(profile, "status", plist_new_string("Active"));
+		plist_dict_set_item(profile, "type", plist_new_string("iOS Development"));
+		plist_dict_set_item(profile, "proProPlatform", plist_new_string("ios"));
+		plist_dict_set_item(profile, "encodedProfile", plist_new_data((const char*)data.data(), data.size()));
+		plist_dict_set_item(response, "provisioningProfile", profile);
+	}
+	else if (action == "deleteProvisioningProfile")
+	{
+		if (team->profiles.erase(StringValue(parameters, "provisioningProfileId")) == 0)
+		{
+			throw RequestError(RESULT_PROFILE_NOT_FOUND, "There is no provisioning profile with that identifier.");
+		}
+	}
+	else
+	{
+		plist_free(response);
+		throw RequestError(RESULT_UNKNOWN_ACTION, "The stand-in doesn't support " + action + ".");
+	}
+
+	return response;
+}
+
+SimulatedCertificate AppleStandIn::IssueCertificate(const std::string& certificateRequest, const std::string& machineName, const std::string& machineIdentifier,
+	const SimulatedTeam& team, const SimulatedAccount& account)
+{
+	BIO* input = BIO_new_mem_buf(certificateRequest.data(), (int)certificateRequest.size());
+	X509_REQ* request = PEM_read_bio_X509_REQ(input, NULL, NULL, NULL);
+	BIO_free(input);
+
+	if (request == nullptr)
+	{
+		throw RequestError(RESULT_INVALID_PARAMETER, "The certificate signing request is invalid.");
+	}
+
+	SimulatedCertificate certificate;
+	certificate.identifier = this->RandomIdentifier(10);
+	certificate.name = "Apple Development: " + account.appleID + " (" + this->RandomIdentifier(10) + ")";
+	certificate.machineName = machineName;
+	certificate.machineIdentifier = machineIdentifier;
+
+	// No leading zero byte, so the serial number reads the same as Certificate::serialNumber() after parsing.
+	auto serialBytes = RandomBytes(8);
+	serialBytes[0] = 0x10 + serialBytes[0] % 0x60;
+
+	BigNumber serial(serialBytes);
+	char* serialNumber = BN_bn2hex(serial.get());
+	certificate.serialNumber = serialNumber;
+	OPENSSL_free(serialNumber);
+
+	EVP_PKEY* publicKey = X509_REQ_get_pubkey(request);
+
+	X509* x509 = X509_new();
+	X509_set_version(x509, 2);
+	BN_to_ASN1_INTEGER(serial.get(), X509_get_serialNumber(x509));
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), CERTIFICATE_LIFETIME);
+	X509_set_pubkey(x509, publicKey);
+
+	auto name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_UTF8, (const unsigned char*)certificate.name.c_str(), -1, -1, 0);
+	X509_NAME_add_entry_by_txt(name, "OU", MBSTRING_UTF8, (const unsigned char*)team.identifier.c_str(), -1, -1, 0);
+	X509_NAME_add_entry_by_txt(name, "O", MBSTRING_UTF8, (const unsigned char*)team.name.c_str(), -1, -1, 0);
+	X509_NAME_add_entry_by_txt(name, "C", MBSTRING_UTF8, (const unsigned char*)"US", -1, -1, 0);
+	X509_set_issuer_name(x509, X509_get_subject_name(_authorityCertificate));
+	X509_sign(x509, _authorityKey, EVP_sha256());
+
+	int length = i2d_X509(x509, NULL);
+	certificate.data.resize(std::max(length, 0));
+
+	unsigned char* bytes = certificate.data.data();
+	i2d_X509(x509, &bytes);
+
+	X509_free(x509);
+	EVP_PKEY_free(publicKey);
+	X509_REQ_free(request);
+
+	return certificate;
+}
+
+// A free team's profile: the App ID's entitlements, the team's devices and certificates, valid for 7 days.
+Bytes AppleStandIn::MakeProfile(const SimulatedTeam& team, const SimulatedAppID& appID, const std::string& uuid)
+{
+	int32_t now = (int32_t)(time(NULL) - APPLE_REFERENCE_DATE);
+
+	plist_t entitlements = plist_new_dict();
+	plist_dict_set_item(entitlements, "application-identifier", plist_new_string((team.identifier + "." + appID.bundleIdentifier).c_str()));
+	plist_dict_set_item(entitlements, "com.apple.developer.team-identifier", plist_new_string(team.identifier.c_str()));
+	plist_dict_set_item(entitlements, "get-task-allow", plist_new_bool(1));
+
+	plist_t keychainGroups = plist_new_array();
+	plist_array_append_item(keychainGroups, plist_new_string((team.identifier + ".*").c_str()));
+	plist_dict_set_item(entitlements, "keychain-access-groups", keychainGroups);
+
+	uint8_t hasAppGroups = 0;
+	auto appGroupsNode = plist_dict_get_item(appID.features, APP_GROUPS_FEATURE);
+	if (appGroupsNode != nullptr && plist_get_node_type(appGroupsNode) == PLIST_BOOLEAN)
+	{
+		plist_get_bool_val(appGroupsNode, &hasAppGroups);
+	}
+
+	if (hasAppGroups)
+	{
+		plist_t groups = plist_new_array();
+		for (auto& groupIdentifier : appID.groupIdentifiers)
+		{
+			for (auto& group : team.appGroups)
+			{
+				if (group.identifier == groupIdentifier)
+				{
+					plist_array_append_item(groups, plist_new_string(group.groupIdentifier.c_str()));
+				}
+			}
+		}
+
+		plist_dict_set_item(entitlements, "com.apple.security.application-groups", groups);
+	}
+
+	plist_t devices = plist_new_array();
+	for (auto& device : team.devices)
+	{
+		plist_array_append_item(devices, plist_new_string(device.udid.c_str()));
+	}
+
+	plist_t certificates = plist_new_array();
+	for (auto& certificate : team.certificates)
+	{
+		plist_array_append_item(certificates, plist_new_data((const char*)certificate.data.data(), certificate.data.size()));
+	}
+
+	plist_t prefixes = plist_new_array();
+	plist_array_append_item(prefixes, plist_new_string(team.identifier.c_str()));
+
+	plist_t teamIdentifiers = plist_new_array();
+	plist_array_append_item(teamIdentifiers, plist_new_string(team.identifier.c_str()));
+
+	plist_t platforms = plist_new_array();
+	plist_array_append_item(platforms, plist_new_string("iOS"));
+
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "AppIDName", plist_new_string(appID.name.c_str()));
+	plist_dict_set_item(plist, "ApplicationIdentifierPrefix", prefixes);
+	plist_dict_set_item(plist, "CreationDate", plist_new_date(now, 0));
+	plist_dict_set_item(plist, "Platform", platforms);
+	plist_dict_set_item(plist, "IsXcodeManaged", plist_new_bool(0));
+	plist_dict_set_item(plist, "DeveloperCertificates", certificates);
+	plist_dict_set_item(plist, "Entitlements", entitlements);
+	plist_dict_set_item(plist, "ExpirationDate", plist_new_date(now + PROFILE_LIFETIME, 0));
+	plist_dict_set_item(plist, "LocalProvision", plist_new_bool(1));
+	plist_dict_set_item(plist, "Name", plist_new_string(("iOS Team Provisioning Profile: " + appID.bundleIdentifier).c_str()));
+	plist_dict_set_item(plist, "ProvisionedDevices", devices);
+	plist_dict_set_item(plist, "TeamIdentifier", teamIdentifiers);
+	plist_dict_set_item(plist, "TeamName", plist_new_string(team.name.c_str()));
+	plist_dict_set_item(plist, "TimeToLive", plist_new_uint(PROFILE_LIFETIME / (24 * 60 * 60)));
+	plist_dict_set_item(plist, "UUID", plist_new_string(uuid.c_str()));
+	plist_dict_set_item(plist, "Version", plist_new_uint(1));
+
+	auto xml = XMLData(plist);
+	plist_free(plist);
+
+	BIO* content = BIO_new_mem_buf(xml.data(), (int)xml.size());
+	CMS_ContentInfo* cms = CMS_sign(_authorityCertificate, _authorityKey, NULL, content, CMS_BINARY | CMS_NOSMIMECAP);
+
+	BIO* output = BIO_new(BIO_s_mem());
+	i2d_CMS_bio(output, cms);
+
+	char* bytes = nullptr;
+	long length = BIO_get_mem_data(output, &bytes);
+	Bytes data(bytes, bytes + length);
+
+	BIO_free(output);
+	CMS_ContentInfo_free(cms);
+	BIO_free(content);
+
+	return data;
+}
+
+#pragma mark - Services (v1) -
+
+static Response JSONResponse(const json::value& value, int status = status_codes::OK)
+{
+	Response response;
+	response.status = status;
+	response.contentType = "application/vnd.api+json";
+	response.body = ToBytes(value.serialize());
+	return response;
+}
+
+Response AppleStandIn::HandleServicesRequest(const Request& request, const std::string& action)
+{
+	// Parameters arrive URL-encoded inside the JSON body rather than in the URL.
+	std::map<std::string, std::string> parameters;
+	try
+	{
+		auto body = json::value::parse(std::string(request.body.begin(), request.body.end()));
+		if (body.has_field(U("urlEncodedQueryParams")))
+		{
+			for (auto& pair : uri::split_query(body[U("urlEncodedQueryParams")].as_string()))
+			{
+				parameters[uri::decode(pair.first)] = uri::decode(pair.second);
+			}
+		}
+	}
+	catch (std::exception& exception)
+	{
+		// Handled as a missing teamId below.
+	}
+
+	auto method = request.header("x-http-method-override");
+	if (method.empty())
+	{
+		method = request.method;
+	}
+
+	auto resource = request.path.substr(strlen(SERVICES_V1_PATH));
+
+	try
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		this->AuthenticatedAccount(request);
+
+		auto failure = _configuration.failures.find(action);
+		if (failure != _configuration.failures.end())
+		{
+			_statistics[action].injectedFailures++;
+			throw RequestError(failure->second, "Injected failure.", status_codes::BadRequest);
+		}
+
+		auto team = this->TeamForIdentifier(parameters["teamId"]);
+
+		if (resource == "certificates" && method == methods::GET)
+		{
+			json::value certificates = json::value::array();
+
+			size_t index = 0;
+			for (auto& certificate : team->certificates)
+			{
+				json::value attributes = json::value::object();
+				attributes[U("name")] = json::value::string(certificate.name);
+				attributes[U("serialNumber")] = json::value::string(certificate.serialNumber);
+				attributes[U("certificateContent")] = json::value::string(utility::conversions::to_base64(certificate.data));
+				attributes[U("machineName")] = json::value::string(certificate.machineName);
+				attributes[U("machineId")] = json::value::string(certificate.machineIdentifier);
+				attributes[U("certificateType")] = json::value::string(U("IOS_DEVELOPMENT"));
+				attributes[U("status")] = json::value::string(U("Issued"));
+
+				json::value value = json::value::object();
+				value[U("id")] = json::value::string(certificate.identifier);
+				value[U("type")] = json::value::string(U("certificates"));
+				value[U("attributes")] = attributes;
+
+				certificates[index++] = value;
+			}
+
+			json::value response = json::value::object();
+			response[U("data")] = certificates;
+			return JSONResponse(response);
+		}
+
+		if (HasPrefix(resource, "certificates/") && method == methods::DEL)
+		{
+			auto identifier = resource.substr(strlen("certificates/"));
+
+			auto certificate = std::find_if(team->certificates.begin(), team->certificates.end(), [&identifier](const SimulatedCertificate& certificate) {
+				return certificate.identifier == identifier;
+			});
+
+			if (certificate == team->certificates.end())
+			{
+				throw RequestError(RESULT_CERTIFICATE_NOT_FOUND, "There is no certificate with identifier " + identifier + ".", status_codes::NotFound);
+			}
+
+			team->certificates.erase(certificate);
+
+			Response response;
+			response.status = status_codes::NoContent;
+			return response;
+		}
+
+		throw RequestError(RESULT_UNKNOWN_ACTION, "The stand-in doesn't support " + method + " " + resource + ".", status_codes::NotFound);
+	}
+	catch (RequestError& error)
+	{
+		json::value detail = json::value::object();
+		detail[U("status")] = json::value::string(std::to_string(error.status));
+		detail[U("detail")] = json::value::string(error.what());
+
+		json::value errors = json::value::array();
+		errors[0] = detail;
+
+		json::value response = json::value::object();
+		response[U("resultCode")] = json::value::number((int)error.code);
+		response[U("userString")] = json::value::string(error.what());
+		response[U("errors")] = errors;
+		return JSONResponse(response, error.status);
+	}
+}
+
+#pragma mark - GSA -
+
+static plist_t StatusDictionary(int64_t code, const std::string& message)
+{
+	plist_t status = plist_new_dict();
+	plist_dict_set_item(status, "ec", plist_new_uint((uint64_t)code));
+	plist_dict_set_item(status, "em", plist_new_string(message.c_str()));
+	plist_dict_set_item(status, "hsc", plist_new_uint(code == 0 ? 200 : 401));
+	return status;
+}
+
+Response AppleStandIn::HandleGSARequest(const Request& request, const std::string& action)
+{
+	plist_t plist = ParsePlist(request.body);
+	plist_t requestDictionary = plist_dict_get_item(plist, "Request");
+
+	plist_t response = nullptr;
+
+	try
+	{
+		auto failure = _configuration.failures.find(action);
+		if (failure != _configuration.failures.end())
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_statistics[action].injectedFailures++;
+
+			throw RequestError(failure->second, "Injected failure.");
+		}
+
+		if (requestDictionary == nullptr || plist_get_node_type(requestDictionary) != PLIST_DICT)
+		{
+			throw RequestError(GSA_INVALID_REQUEST, "Invalid request.");
+		}
+
+		if (action == "init")
+		{
+			response = this->StartHandshake(requestDictionary);
+		}
+		else if (action == "complete")
+		{
+			response = this->CompleteHandshake(requestDictionary);
+		}
+		else if (action == "apptokens")
+		{
+			response = this->IssueAppTokens(requestDictionary);
+		}
+		else
+		{
+			throw RequestError(GSA_INVALID_REQUEST, "The stand-in doesn't support " + action + ".");
+		}
+
+		// CompleteHandshake may have started the status already, to ask for a verification code.
+		auto status = plist_dict_get_item(response, "Status");
+		if (status == nullptr)
+		{
+			plist_dict_set_item(response, "Status", StatusDictionary(0, ""));
+		}
+		else
+		{
+			plist_dict_set_item(status, "ec", plist_new_uint(0));
+			plist_dict_set_item(status, "em", plist_new_string(""));
+			plist_dict_set_item(status, "hsc", plist_new_uint(200));
+		}
+	}
+	catch (RequestError& error)
+	{
+		plist_free(response);
+
+		response = plist_new_dict();
+		plist_dict_set_item(response, "Status", StatusDictionary(error.code, error.what()));
+	}
+
+	plist_t wrapper = plist_new_dict();
+	plist_dict_set_item(wrapper, "Response", response);
+
+	auto plistResponse = PlistResponse(wrapper);
+
+	plist_free(wrapper);
+	plist_free(plist);
+
+	return plistResponse;
+}
+
+plist_t AppleStandIn::StartHandshake(plist_t request)
+{
+	auto appleID = StringValue(request, "u");
+	auto clientValue = DataValue(request, "A2k");
+	auto protocols = StringValues(request, "ps");
+
+	if (appleID.empty() || clientValue.empty())
+	{
+		throw RequestError(GSA_INVALID_REQUEST, "Invalid request.");
+	}
+
+	std::string protocol;
+	if (std::find(protocols.begin(), protocols.end(), "s2k") != protocols.end())
+	{
+		protocol = "s2k";
+	}
+	else if (std::find(protocols.begin(), protocols.end(), "s2k_fo") != protocols.end())
+	{
+		protocol = "s2k_fo";
+	}
+	else
+	{
+		throw RequestError(GSA_INVALID_REQUEST, "None of the proposed protocols are supported.");
+	}
+
+	std::string proposedProtocols;
+	for (auto& proposedProtocol : protocols)
+	{
+		proposedProtocols += (proposedProtocols.empty() ? "" : ",") + proposedProtocol;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto account = this->AccountForAppleID(appleID);
+
+	auto& verifier = account->verifiers[protocol];
+	if (verifier.empty())
+	{
+		auto passwordKey = SRPServer::PasswordKey(protocol, _configuration.password, account->salt, _configuration.iterations);
+		verifier = _srpServer.Verifier(account->salt, passwordKey);
+	}
+
+	SRPHandshake handshake;
+	handshake.appleID = appleID;
+	handshake.protocol = protocol;
+	handshake.proposedProtocols = proposedProtocols;
+	handshake.clientValue = clientValue;
+	handshake.privateValue = RandomBytes(32);
+	handshake.serverValue = _srpServer.PublicValue(verifier, handshake.privateValue);
+
+	auto cookie = this->RandomIdentifier(32, "abcdefghijklmnopqrstuvwxyz0123456789");
+	_handshakes[cookie] = handshake;
+
+	plist_t response = plist_new_dict();
+	plist_dict_set_item(response, "sp", plist_new_string(protocol.c_str()));
+	plist_dict_set_item(response, "s", plist_new_data((const char*)account->salt.data(), account->salt.size()));
+	plist_dict_set_item(response, "i", plist_new_uint(_configuration.iterations));
+	plist_dict_set_item(response, "B", plist_new_data((const char*)handshake.serverValue.data(), handshake.serverValue.size()));
+	plist_dict_set_item(response, "c", plist_new_string(cookie.c_str()));
+	return response;
+}
+
+plist_t AppleStandIn::CompleteHandshake(plist_t request)
+{
+	auto cookie = StringValue(request, "c");
+	auto clientProof = DataValue(request, "M1");
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// One attempt per handshake.
+	auto iterator = _handshakes.find(cookie);
+	if (iterator == _handshakes.end())
+	{
+		throw RequestError(GSA_INCORRECT_CREDENTIALS, "Your Apple ID or password was entered incorrectly.");
+	}
+
+	auto handshake = iterator->second;
+	_handshakes.erase(iterator);
+
+	auto account = this->AccountForAppleID(handshake.appleID);
+
+	auto session = _srpServer.Verify(handshake.appleID, account->salt, account->verifiers[handshake.protocol], handshake.clientValue,
+		handshake.privateValue, handshake.serverValue, clientProof);
+	if (!session.has_value())
+	{
+		throw RequestError(GSA_INCORRECT_CREDENTIALS, "Your Apple ID or password was entered incorrectly.");
+	}
+
+	auto cookieData = RandomBytes(32);
+
+	account->idmsToken = this->RandomIdentifier(64, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+	account->sessionKey = RandomBytes(32);
+
+	plist_t serverData = plist_new_dict();
+	plist_dict_set_item(serverData, "adsid", plist_new_string(account->dsid.c_str()));
+	plist_dict_set_item(serverData, "GsIdmsToken", plist_new_string(account->idmsToken.c_str()));
+	plist_dict_set_item(serverData, "sk", plist_new_data((const char*)account->sessionKey.data(), account->sessionKey.size()));
+	plist_dict_set_item(serverData, "c", plist_new_data((const char*)cookieData.data(), cookieData.size()));
+	plist_dict_set_item(serverData, "acname", plist_new_string(account->appleID.c_str()));
+	plist_dict_set_item(serverData, "fn", plist_new_string(account->firstName.c_str()));
+	plist_dict_set_item(serverData, "ln", plist_new_string(account->lastName.c_str()));
+	plist_dict_set_item(serverData, "DsPrsId", plist_new_uint(account->personID));
+
+	auto key = HMACSHA256(session->sessionKey, ToBytes("extra data key:"));
+	auto iv = HMACSHA256(session->sessionKey, ToBytes("extra data iv:"));
+	iv.resize(16);
+
+	auto spd = EncryptCBC(key, iv, XMLData(serverData));
+	plist_free(serverData);
+
+	// The negotiation hash covers everything both sides proposed and chose, as the client digests it.
+	uint32_t spdLength = (uint32_t)spd.size();
+	Bytes lengthBytes = { (unsigned char)(spdLength), (unsigned char)(spdLength >> 8), (unsigned char)(spdLength >> 16), (unsigned char)(spdLength >> 24) };
+
+	auto negotiation = Concatenate({ ToBytes(handshake.proposedProtocols + "|" + "|" + handshake.protocol + "|"), lengthBytes, spd, ToBytes("||") });
+	auto negotiationHash = HMACSHA256(HMACSHA256(session->sessionKey, ToBytes("HMAC key:")), SHA256Digest(negotiation));
+
+	plist_t response = plist_new_dict();
+	plist_dict_set_item(response, "M2", plist_new_data((const char*)session->serverProof.data(), session->serverProof.size()));
+	plist_dict_set_item(response, "spd", plist_new_data((const char*)spd.data(), spd.size()));
+	plist_dict_set_item(response, "np", plist_new_data((const char*)negotiationHash.data(), negotiationHash.size()));
+
+	if (this->RequiresVerification(*account))
+	{
+		plist_t status = plist_new_dict();
+		plist_dict_set_item(status, "au", plist_new_string("trustedDeviceSecondaryAuth"));
+		plist_dict_set_item(response, "Status", status);
+	}
+
+	return response;
+}
+
+plist_t AppleStandIn::IssueAppTokens(plist_t request)
+{
+	auto dsid = StringValue(request, "u");
+	auto idmsToken = StringValue(request, "t");
+	auto checksum = DataValue(request, "checksum");
+	auto apps = StringValues(request, "app");
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto account = this->AccountForDSID(dsid);
+	if (account == nullptr || account->idmsToken.empty() || account->idmsToken != idmsToken || this->RequiresVerification(*account))
+	{
+		throw RequestError(GSA_INCORRECT_CREDENTIALS, "Your Apple ID or password was entered incorrectly.");
+	}
+
+	// As ALTCreateAppTokensChecksum computes it.
+	auto checksumData = ToBytes("apptokens" + dsid);
+	for (auto& app : apps)
+	{
+		checksumData.insert(checksumData.end(), app.begin(), app.end());
+	}
+
+	auto expectedChecksum = HMACSHA256(account->sessionKey, checksumData);
+	if (checksum.size() != expectedChecksum.size() || CRYPTO_memcmp(checksum.data(), expectedChecksum.data(), checksum.size()) != 0)
+	{
+		throw RequestError(GSA_INVALID_REQUEST, "Invalid checksum.");
+	}
+
+	uint64_t now = (uint64_t)time(NULL) * 1000;
+
+	plist_t tokens = plist_new_dict();
+	for (auto& app : apps)
+	{
+		auto token = this->RandomIdentifier(40, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+		account->authTokens.insert(token);
+
+		plist_t tokenDictionary = plist_new_dict();
+		plist_dict_set_item(tokenDictionary, "token", plist_new_string(token.c_str()));
+		plist_dict_set_item(tokenDictionary, "cts", plist_new_uint(now));
+		plist_dict_set_item(tokenDictionary, "expiry", plist_new_uint(now + (uint64_t)TOKEN_LIFETIME * 1000));
+		plist_dict_set_item(tokens, app.c_str(), tokenDictionary);
+	}
+
+	plist_t plaintext = plist_new_dict();
+	plist_dict_set_item(plaintext, "t", tokens);
+
+	// "XYZ" | IV | ciphertext | tag, with "XYZ" as additional data.
+	auto version = ToBytes("XYZ");
+	auto iv = RandomBytes(16);
+	auto encryptedToken = Concatenate({ version, iv, EncryptGCM(account->sessionKey, iv, version, XMLData(plaintext)) });
+	plist_free(plaintext);
+
+	plist_t response = plist_new_dict();
+	plist_dict_set_item(response, "et", plist_new_data((const char*)encryptedToken.data(), encryptedToken.size()));
+	return response;
+}
+
+static std::shared_ptr<SimulatedAccount> AccountForIdentityToken(const std::string& identityToken, std::function<std::shared_ptr<SimulatedAccount>(const std::string&)> accountForDSID)
+{
+	// base64("<dsid>:<idms token>")
+	std::string decodedToken;
+	try
+	{
+		auto data = utility::conversions::from_base64(identityToken);
+		decodedToken = std::string(data.begin(), data.end());
+	}
+	catch (std::exception& exception)
+	{
+		return nullptr;
+	}
+
+	auto separator = decodedToken.find(':');
+	if (separator == std::string::npos)
+	{
+		return nullptr;
+	}
+
+	auto account = accountForDSID(decodedToken.substr(0, separator));
+	if (account == nullptr || account->idmsToken != decodedToken.substr(separator + 1))
+	{
+		return nullptr;
+	}
+
+	return account;
+}
+
+Response AppleStandIn::HandleTrustedDeviceRequest(const Request& request)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto account = AccountForIdentityToken(request.header("x-apple-identity-token"), [this](const std::string& dsid) {
+		return this->AccountForDSID(dsid);
+	});
+
+	if (account == nullptr)
+	{
+		Response response;
+		response.status = status_codes::Unauthorized;
+		return response;
+	}
+
+	// Stands in for the code appearing on the account's other devices.
+	Log("Verification code for " + account->appleID + ": " + _configuration.verificationCode);
+
+	Response response;
+	response.contentType = "text/x-xml-plist";
+	return response;
+}
+
+Response AppleStandIn::HandleValidateRequest(const Request& request)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto account = AccountForIdentityToken(request.header("x-apple-identity-token"), [this](const std::string& dsid) {
+		return this->AccountForDSID(dsid);
+	});
+
+	plist_t status = nullptr;
+
+	auto failure = _configuration.failures.find("validate");
+	if (failure != _configuration.failures.end())
+	{
+		_statistics["validate"].injectedFailures++;
+		status = StatusDictionary(failure->second, "Injected failure.");
+	}
+	else if (account == nullptr || request.header("security-code") != _configuration.verificationCode)
+	{
+		status = StatusDictionary(GSA_INCORRECT_VERIFICATION_CODE, "Incorrect verification code.");
+	}
+	else
+	{
+		account->isVerified = true;
+		status = StatusDictionary(0, "");
+	}
+
+	auto response = PlistResponse(status);
+	plist_free(status);
+
+	return response;
+}
+
+#pragma mark - Statistics -
+
+void AppleStandIn::LogStatistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto& pair : _statistics)
+	{
+		std::stringstream ss;
+		ss << pair.first << ": " << pair.second.requests << " requests, " << pair.second.replayed << " replayed, " << pair.second.injectedFailures << " injected failures";
+		Log(ss.str());
+	}
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--host ADDRESS] [--port N] [--password PASSWORD] [--two-factor CODE] [--iterations N] [--replay DIR | --record DIR] "
+		"[--latency-ms N] [--unavailable-percent N] [--throttle-rps N] [--fail ACTION=CODE]..." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+
+	static struct option long_options[] =
+	{
+		{"host",                required_argument, 0, 'h'},
+		{"port",                required_argument, 0, 'p'},
+		{"password",            required_argument, 0, 'w'},
+		{"two-factor",          required_argument, 0, 't'},
+		{"iterations",          required_argument, 0, 'i'},
+		{"replay",              required_argument, 0, 'R'},
+		{"record",              required_argument, 0, 'r'},
+		{"latency-ms",          required_argument, 0, 'l'},
+		{"unavailable-percent", required_argument, 0, 'u'},
+		{"throttle-rps",        required_argument, 0, 'T'},
+		{"fail",                required_argument, 0, 'f'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 'h': configuration.host = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'w': configuration.password = optarg; break;
+		case 't': configuration.verificationCode = optarg; break;
+		case 'i': configuration.iterations = std::max(1, atoi(optarg)); break;
+		case 'R': configuration.replayDirectory = optarg; break;
+		case 'r': configuration.recordDirectory = optarg; break;
+		case 'l': configuration.latency = std::max(0, atoi(optarg)); break;
+		case 'u': configuration.unavailablePercent = std::min(100, std::max(0, atoi(optarg))); break;
+		case 'T': configuration.requestsPerSecond = std::max(0, atoi(optarg)); break;
+		case 'f':
+		{
+			std::string failure = optarg;
+
+			auto separator = failure.find('=');
+			if (separator == std::string::npos)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+
+			configuration.failures[failure.substr(0, separator)] = atoll(failure.substr(separator + 1).c_str());
+			break;
+		}
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!configuration.replayDirectory.empty() && !configuration.recordDirectory.empty())
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (!configuration.recordDirectory.empty() && mkdir(configuration.recordDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		std::cerr << "Failed to create " << configuration.recordDirectory << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	// Blocked before any listener thread exists so only sigwait below sees them.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	AppleStandIn standIn(configuration);
+
+	auto url = "http://" + configuration.host + ":" + std::to_string(configuration.port);
+	auto latency = configuration.latency;
+
+	http_listener listener(url);
+	listener.support([&standIn, latency](http_request request) {
+		auto description = request.method() + " " + request.relative_uri().path();
+
+		request.extract_vector()
+		.then([&standIn, request](std::vector<unsigned char> body) {
+			Request standInRequest;
+			standInRequest.method = request.method();
+			standInRequest.path = request.relative_uri().path();
+			standInRequest.query = request.relative_uri().query();
+			standInRequest.body = body;
+
+			for (auto& header : request.headers())
+			{
+				standInRequest.headers[Lowercase(header.first)] = header.second;
+			}
+
+			return standIn.Handle(standInRequest);
+		})
+		.then([request, description, latency](pplx::task<Response> task) {
+			Response response;
+
+			try
+			{
+				response = task.get();
+			}
+			catch (std::exception& exception)
+			{
+				response.status = status_codes::BadGateway;
+				response.note = exception.what();
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+
+			Log(description + " -> " + std::to_string(response.status) + (response.note.empty() ? "" : " (" + response.note + ")"));
+
+			http_response httpResponse(response.status);
+			if (!response.body.empty() || !response.contentType.empty())
+			{
+				httpResponse.set_body(response.body);
+				httpResponse.headers().set_content_type(response.contentType);
+			}
+
+			return request.reply(httpResponse);
+		})
+		.then([](pplx::task<void> task) {
+			try
+			{
+				task.get();
+			}
+			catch (std::exception& exception)
+			{
+				Log(std::string("Failed to reply: ") + exception.what());
+			}
+		});
+	});
+
+	listener.open().wait();
+
+	if (!configuration.recordDirectory.empty())
+	{
+		Log("Forwarding to Apple on " + url + ", recording to " + configuration.recordDirectory);
+	}
+	else
+	{
+		Log("Serving developer services and GSA on " + url);
+	}
+
+	int signal = 0;
+	sigwait(&signals, &signal);
+
+	listener.close().wait();
+	standIn.LogStatistics();
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+//
+//  CheckSupport.hpp
+//  AltServer
+//
+//  Shared by the automated checks in tools/: runs stand-ins as child
+//  processes and collects pass/fail results. Checks print one line per
+//  expectation and exit with 1 if any failed, so `make check` stops there.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+#define STAND_IN_LAUNCH_TIMEOUT 10
+
+namespace check
+{
+
+// A stand-in running as a child process, listening on 127.0.0.1:port. Stopped when destroyed.
+class StandIn
+{
+public:
+	StandIn(const std::string& path, int port, std::vector<std::string> arguments) : _pid(-1), _port(port)
+	{
+		arguments.insert(arguments.begin(), { path, "--port", std::to_string(port) });
+
+		std::vector<char*> argv;
+		for (auto& argument : arguments)
+		{
+			argv.push_back(&argument[0]);
+		}
+		argv.push_back(nullptr);
+
+		// Its request log would bury the results.
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+		int result = posix_spawn(&_pid, path.c_str(), &actions, NULL, argv.data(), environ);
+		posix_spawn_file_actions_destroy(&actions);
+
+		if (result != 0)
+		{
+			_pid = -1;
+			throw std::runtime_error("Failed to start " + path + ": " + strerror(result));
+		}
+
+		this->WaitUntilListening(path);
+	}
+
+	~StandIn()
+	{
+		this->Stop();
+	}
+
+	StandIn(const StandIn&) = delete;
+	StandIn& operator=(const StandIn&) = delete;
+
+	void Stop()
+	{
+		if (_pid < 0)
+		{
+			return;
+		}
+
+		kill(_pid, SIGTERM);
+		waitpid(_pid, NULL, 0);
+
+		_pid = -1;
+	}
+
+	int port() const
+	{
+		return _port;
+	}
+
+	std::string url() const
+	{
+		return "http://127.0.0.1:" + std::to_string(_port);
+	}
+
+private:
+	pid_t _pid;
+	int _port;
+
+	void WaitUntilListening(const std::string& path)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(STAND_IN_LAUNCH_TIMEOUT);
+
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			if (waitpid(_pid, NULL, WNOHANG) == _pid)
+			{
+				_pid = -1;
+				throw std::runtime_error(path + " exited before listening on port " + std::to_string(_port));
+			}
+
+			int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+
+			struct sockaddr_in address;
+			memset(&address, 0, sizeof(address));
+			address.sin_family = AF_INET;
+			address.sin_port = htons(_port);
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			bool isListening = (connect(socket, (struct sockaddr*)&address, sizeof(address)) == 0);
+			close(socket);
+
+			if (isListening)
+			{
+				return;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		this->Stop();
+		throw std::runtime_error(path + " didn't listen on port " + std::to_string(_port) + " within " + std::to_string(STAND_IN_LAUNCH_TIMEOUT) + " seconds");
+	}
+};
+
+class Results
+{
+public:
+	Results() : _passed(0), _failed(0)
+	{
+	}
+
+	void Expect(bool condition, const std::string& description)
+	{
+		if (condition)
+		{
+			_passed++;
+		}
+		else
+		{
+			_failed++;
+		}
+
+		std::cout << (condition ? "ok     " : "FAILED ") << description << std::endl;
+	}
+
+	int Finish() const
+	{
+		std::cout << _passed << " passed, " << _failed << " failed" << std::endl;
+		return (_failed == 0) ? 0 : 1;
+	}
+
+private:
+	int _passed;
+	int _failed;
+};
+
+inline std::string FormatMilliseconds(double milliseconds)
+{
+	std::stringstream ss;
+	ss << (int64_t)milliseconds << " ms";
+	return ss.str();
+}
+
+}
@@ -0,0 +1,2318 @@
+//
+//  DeviceStandIn.cpp
+//  AltServer
+//
+//  Local stand-in for usbmuxd and the device services DeviceManager uses, so
+//  installs can be run and timed without an iPhone. It speaks usbmuxd's plist
+//  protocol on a Unix socket and simulates any number of USB devices, each of
+//  which answers lockdown (without SSL), AFC, installation_proxy, misagent and
+//  notification_proxy from memory. Only Info.plist and embedded.mobileprovision
+//  contents are kept; other uploaded files just count toward their size.
+//
+//  --latency-ms delays every response from a device and --bandwidth-mbps limits
+//  each device's link, which all of its connections share. SIGUSR1 makes every
+//  device ask AltServer for a wired connection (as AltStore does), which is
+//  then forwarded to --altstore HOST:PORT.
+//
+//  Point AltServer at it with USBMUXD_SOCKET_ADDRESS=UNIX:/tmp/DeviceStandIn.sock
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <plist/plist.h>
+
+#define USBMUXD_PLIST_VERSION 1
+#define USBMUXD_PLIST_MESSAGE 8
+
+#define USBMUXD_RESULT_OK 0
+#define USBMUXD_RESULT_BADCOMMAND 1
+#define USBMUXD_RESULT_BADDEV 2
+#define USBMUXD_RESULT_CONNREFUSED 3
+
+#define LOCKDOWN_PORT 62078
+
+// DeviceManager::StartWiredConnection connects here, where AltStore listens.
+#define ALTSTORE_WIRED_PORT 28151
+
+// Real devices start each service on a new port; libimobiledevice only passes it back to Connect, so fixed ones do.
+#define AFC_PORT 49152
+#define INSTALLATION_PROXY_PORT 49153
+#define MISAGENT_PORT 49154
+#define NOTIFICATION_PROXY_PORT 49155
+
+#define AFC_MAGIC "CFA6LPAA"
+
+#define AFC_OP_STATUS 0x01
+#define AFC_OP_DATA 0x02
+#define AFC_OP_READ_DIR 0x03
+#define AFC_OP_TRUNCATE 0x07
+#define AFC_OP_REMOVE_PATH 0x08
+#define AFC_OP_MAKE_DIR 0x09
+#define AFC_OP_GET_FILE_INFO 0x0A
+#define AFC_OP_GET_DEVINFO 0x0B
+#define AFC_OP_FILE_OPEN 0x0D
+#define AFC_OP_FILE_OPEN_RES 0x0E
+#define AFC_OP_FILE_READ 0x0F
+#define AFC_OP_FILE_WRITE 0x10
+#define AFC_OP_FILE_SEEK 0x11
+#define AFC_OP_FILE_TELL 0x12
+#define AFC_OP_FILE_TELL_RES 0x13
+#define AFC_OP_FILE_CLOSE 0x14
+#define AFC_OP_FILE_SET_SIZE 0x15
+#define AFC_OP_RENAME_PATH 0x18
+#define AFC_OP_FILE_LOCK 0x1B
+#define AFC_OP_SET_FILE_MOD_TIME 0x1E
+#define AFC_OP_REMOVE_PATH_AND_CONTENTS 0x22
+
+#define AFC_E_SUCCESS 0
+#define AFC_E_UNKNOWN_ERROR 1
+#define AFC_E_INVALID_ARG 7
+#define AFC_E_OBJECT_NOT_FOUND 8
+#define AFC_E_OBJECT_IS_DIR 9
+#define AFC_E_PERM_DENIED 10
+#define AFC_E_OP_NOT_SUPPORTED 15
+
+#define AFC_FOPEN_RDONLY 1
+#define AFC_FOPEN_WRONLY 3
+#define AFC_FOPEN_WR 4
+#define AFC_FOPEN_APPEND 5
+#define AFC_FOPEN_RDAPPEND 6
+
+// Larger messages are treated as a broken connection.
+#define MAXIMUM_MESSAGE_SIZE (64 * 1024 * 1024)
+
+#define TRANSFER_CHUNK_SIZE (64 * 1024)
+
+#define DEVICE_CAPACITY (64ULL * 1024 * 1024 * 1024)
+
+#define WIRED_SERVER_CONNECTION_START_REQUEST "io.altstore.Request.WiredServerConnectionStart"
+
+struct Configuration
+{
+	std::string socketPath = "/tmp/DeviceStandIn.sock";
+	std::vector<std::string> udids;
+	int deviceCount = 1;
+	int latency = 0;
+	double bandwidth = 0;
+	int installDuration = 500;
+	std::string productVersion = "16.5";
+	std::string altStoreAddress;
+};
+
+static std::mutex _logMutex;
+
+static void Log(const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(_logMutex);
+	std::cout << message << std::endl;
+}
+
+#pragma mark - Plists -
+
+static std::string StringValue(plist_t dictionary, const char* key)
+{
+	plist_t node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_STRING)
+	{
+		return "";
+	}
+
+	char* value = nullptr;
+	plist_get_string_val(node, &value);
+
+	std::string string = (value != nullptr) ? value : "";
+	free(value);
+
+	return string;
+}
+
+static uint64_t UIntValue(plist_t dictionary, const char* key)
+{
+	plist_t node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_UINT)
+	{
+		return 0;
+	}
+
+	uint64_t value = 0;
+	plist_get_uint_val(node, &value);
+	return value;
+}
+
+static std::string DataValue(plist_t dictionary, const char* key)
+{
+	plist_t node = plist_dict_get_item(dictionary, key);
+	if (node == nullptr || plist_get_node_type(node) != PLIST_DATA)
+	{
+		return "";
+	}
+
+	char* bytes = nullptr;
+	uint64_t length = 0;
+	plist_get_data_val(node, &bytes, &length);
+
+	std::string data = (bytes != nullptr) ? std::string(bytes, (size_t)length) : "";
+	free(bytes);
+
+	return data;
+}
+
+static std::string XMLString(plist_t plist)
+{
+	char* xml = nullptr;
+	uint32_t length = 0;
+	plist_to_xml(plist, &xml, &length);
+
+	std::string string = (xml != nullptr) ? std::string(xml, length) : "";
+	free(xml);
+
+	return string;
+}
+
+// Provisioning profiles are CMS-signed, but the plist inside is stored as is.
+static std::string ProfileUUID(const std::string& profileData)
+{
+	auto key = profileData.find("<key>UUID</key>");
+	if (key == std::string::npos)
+	{
+		return "";
+	}
+
+	auto start = profileData.find("<string>", key);
+	auto end = profileData.find("</string>", key);
+	if (start == std::string::npos || end == std::string::npos || end < start)
+	{
+		return "";
+	}
+
+	auto uuid = profileData.substr(start + 8, end - start - 8);
+	std::transform(uuid.begin(), uuid.end(), uuid.begin(), ::tolower);
+	return uuid;
+}
+
+#pragma mark - Devices -
+
+// A device's USB link, shared by all of its connections.
+class Link
+{
+public:
+	Link(double bytesPerSecond) : _bytesPerSecond(bytesPerSecond)
+	{
+	}
+
+	// Returns once bytes would have crossed the link.
+	void Transfer(size_t bytes)
+	{
+		if (_bytesPerSecond <= 0)
+		{
+			return;
+		}
+
+		std::chrono::steady_clock::time_point date;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(bytes / _bytesPerSecond));
+			_availableDate = std::max(_availableDate, std::chrono::steady_clock::now()) + duration;
+			date = _availableDate;
+		}
+
+		std::this_thread::sleep_until(date);
+	}
+
+private:
+	double _bytesPerSecond;
+
+	std::mutex _mutex;
+	std::chrono::steady_clock::time_point _availableDate;
+};
+
+struct FileEntry
+{
+	bool isDirectory = false;
+	uint64_t size = 0;
+	time_t modificationDate = 0;
+
+	// Only for files KeepsContents() is true for.
+	std::string contents;
+};
+
+struct InstalledApp
+{
+	std::string bundleIdentifier;
+	std::string name;
+	std::string version;
+};
+
+class Connection;
+
+struct SimulatedDevice
+{
+	uint32_t deviceID;
+	std::string udid;
+	std::string name;
+	std::string pairRecord;
+
+	Link link;
+
+	std::mutex mutex;
+	std::map<std::string, FileEntry> files;
+	std::map<std::string, InstalledApp> apps;
+	std::map<std::string, std::string> profilesByUUID;
+	std::set<std::shared_ptr<Connection>> notificationConnections;
+
+	std::atomic<uint64_t> connections;
+	std::atomic<uint64_t> uploadedFiles;
+	std::atomic<uint64_t> uploadedBytes;
+	std::atomic<uint64_t> installs;
+	std::atomic<uint64_t> uninstalls;
+	std::atomic<uint64_t> profileChanges;
+
+	SimulatedDevice(double bytesPerSecond) : deviceID(0), link(bytesPerSecond), connections(0), uploadedFiles(0), uploadedBytes(0), installs(0), uninstalls(0), profileChanges(0)
+	{
+	}
+};
+
+static bool KeepsContents(const std::string& path)
+{
+	auto filename = path.substr(path.find_last_of('/') + 1);
+	return filename == "Info.plist" || filename == "embedded.mobileprovision";
+}
+
+// AFC paths relative to the media directory, without "." or empty components; "" is the root.
+static std::string NormalizedPath(const std::string& path)
+{
+	std::vector<std::string> components;
+
+	std::stringstream ss(path);
+	std::string component;
+	while (std::getline(ss, component, '/'))
+	{
+		if (component.empty() || component == ".")
+		{
+			continue;
+		}
+
+		if (component == "..")
+		{
+			if (!components.empty())
+			{
+				components.pop_back();
+			}
+
+			continue;
+		}
+
+		components.push_back(component);
+	}
+
+	std::string normalizedPath;
+	for (auto& component : components)
+	{
+		normalizedPath += (normalizedPath.empty() ? "" : "/") + component;
+	}
+
+	return normalizedPath;
+}
+
+static std::string ParentPath(const std::string& path)
+{
+	auto separator = path.find_last_of('/');
+	return (separator == std::string::npos) ? "" : path.substr(0, separator);
+}
+
+static bool IsDescendant(const std::string& path, const std::string& ancestorPath)
+{
+	if (ancestorPath.empty())
+	{
+		return !path.empty();
+	}
+
+	return path.size() > ancestorPath.size() && path.compare(0, ancestorPath.size(), ancestorPath) == 0 && path[ancestorPath.size()] == '/';
+}
+
+#pragma mark - Connections -
+
+class Connection
+{
+public:
+	Connection(int socket) : _socket(socket)
+	{
+	}
+
+	~Connection()
+	{
+		close(_socket);
+	}
+
+	int socket() const
+	{
+		return _socket;
+	}
+
+	// Once a client connects to a port on a device, everything it sends and receives crosses the device's link.
+	std::shared_ptr<SimulatedDevice> device() const
+	{
+		return _device;
+	}
+
+	void setDevice(std::shared_ptr<SimulatedDevice> device)
+	{
+		_device = device;
+	}
+
+	bool Read(void* buffer, size_t size)
+	{
+		size_t offset = 0;
+		while (offset < size)
+		{
+			auto receivedBytes = this->ReadSome((char*)buffer + offset, size - offset);
+			if (receivedBytes <= 0)
+			{
+				return false;
+			}
+
+			offset += (size_t)receivedBytes;
+		}
+
+		return true;
+	}
+
+	ssize_t ReadSome(void* buffer, size_t size)
+	{
+		ssize_t receivedBytes = 0;
+		do
+		{
+			receivedBytes = recv(_socket, buffer, size, 0);
+		}
+		while (receivedBytes < 0 && errno == EINTR);
+
+		if (receivedBytes > 0 && _device != nullptr)
+		{
+			_device->link.Transfer((size_t)receivedBytes);
+		}
+
+		return receivedBytes;
+	}
+
+	// Whole messages only, so writes from other threads (notification relays) don't interleave with them.
+	bool Write(const std::string& data)
+	{
+		std::lock_guard<std::mutex> lock(_writeMutex);
+
+		size_t offset = 0;
+		while (offset < data.size())
+		{
+			auto size = std::min(data.size() - offset, (size_t)TRANSFER_CHUNK_SIZE);
+			if (_device != nullptr)
+			{
+				_device->link.Transfer(size);
+			}
+
+			ssize_t sentBytes = send(_socket, data.data() + offset, size, MSG_NOSIGNAL);
+			if (sentBytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (sentBytes <= 0)
+			{
+				return false;
+			}
+
+			offset += (size_t)sentBytes;
+		}
+
+		return true;
+	}
+
+	// Guarded by the device's mutex.
+	std::set<std::string> observedNotifications;
+
+private:
+	int _socket;
+	std::shared_ptr<SimulatedDevice> _device;
+
+	std::mutex _writeMutex;
+};
+
+// usbmuxd messages: a little-endian header (length, version, message type, tag), then the plist.
+static plist_t ReceiveMuxMessage(Connection& connection, uint32_t& tag)
+{
+	uint32_t header[4];
+	if (!connection.Read(header, sizeof(header)))
+	{
+		return nullptr;
+	}
+
+	uint32_t length = le32toh(header[0]);
+	uint32_t message = le32toh(header[2]);
+	tag = le32toh(header[3]);
+
+	if (length < sizeof(header) || length > MAXIMUM_MESSAGE_SIZE)
+	{
+		return nullptr;
+	}
+
+	std::string payload(length - sizeof(header), '\0');
+	if (!connection.Read(&payload[0], payload.size()))
+	{
+		return nullptr;
+	}
+
+	if (message != USBMUXD_PLIST_MESSAGE)
+	{
+		Log("Ignoring usbmuxd client using the binary protocol.");
+		return nullptr;
+	}
+
+	plist_t plist = nullptr;
+	plist_from_memory(payload.data(), (uint32_t)payload.size(), &plist);
+	return plist;
+}
+
+static bool SendMuxMessage(Connection& connection, uint32_t tag, plist_t message)
+{
+	auto xml = XMLString(message);
+
+	uint32_t header[4] = { htole32((uint32_t)(sizeof(header) + xml.size())), htole32(USBMUXD_PLIST_VERSION), htole32(USBMUXD_PLIST_MESSAGE), htole32(tag) };
+	return connection.Write(std::string((const char*)header, sizeof(header)) + xml);
+}
+
+static bool SendMuxResult(Connection& connection, uint32_t tag, uint64_t number)
+{
+	plist_t message = plist_new_dict();
+	plist_dict_set_item(message, "MessageType", plist_new_string("Result"));
+	plist_dict_set_item(message, "Number", plist_new_uint(number));
+
+	bool success = SendMuxMessage(connection, tag, message);
+	plist_free(message);
+
+	return success;
+}
+
+// Lockdown and the plist services: a big-endian length, then the plist.
+static plist_t ReceiveServicePlist(Connection& connection)
+{
+	uint32_t length = 0;
+	if (!connection.Read(&length, sizeof(length)))
+	{
+		return nullptr;
+	}
+
+	length = ntohl(length);
+	if (length > MAXIMUM_MESSAGE_SIZE)
+	{
+		return nullptr;
+	}
+
+	std::string payload(length, '\0');
+	if (!connection.Read(&payload[0], payload.size()))
+	{
+		return nullptr;
+	}
+
+	plist_t plist = nullptr;
+	plist_from_memory(payload.data(), (uint32_t)payload.size(), &plist);
+	return plist;
+}
+
+#pragma mark - DeviceStandIn -
+
+class DeviceStandIn
+{
+public:
+	DeviceStandIn(Configuration configuration);
+
+	void Start();
+	void Stop();
+
+	// Relays notification to every notification_proxy client observing it.
+	void PostNotification(std::string notification);
+
+	void LogStatistics();
+
+private:
+	Configuration _configuration;
+	int _listeningSocket;
+
+	std::string _systemBUID;
+	std::vector<std::shared_ptr<SimulatedDevice>> _devices;
+
+	std::shared_ptr<SimulatedDevice> DeviceWithID(uint64_t deviceID) const;
+	std::shared_ptr<SimulatedDevice> DeviceWithUDID(const std::string& udid) const;
+
+	plist_t DeviceProperties(std::shared_ptr<SimulatedDevice> device) const;
+
+	void Delay() const;
+	bool SendServicePlist(Connection& connection, plist_t plist) const;
+
+	void HandleMuxConnection(std::shared_ptr<Connection> connection);
+	void Connect(std::shared_ptr<Connection> connection, uint32_t tag, std::shared_ptr<SimulatedDevice> device, uint16_t port);
+
+	void HandleLockdownConnection(std::shared_ptr<Connection> connection);
+	plist_t LockdownValue(std::shared_ptr<SimulatedDevice> device, const std::string& domain, const std::string& key) const;
+
+	void HandleAFCConnection(std::shared_ptr<Connection> connection);
+	bool SendAFCPacket(Connection& connection, uint64_t packetNumber, uint64_t operation, const std::string& header, const std::string& payload = "") const;
+
+	void HandleInstallationProxyConnection(std::shared_ptr<Connection> connection);
+	bool InstallApp(Connection& connection, const std::string& packagePath);
+	bool UninstallApp(Connection& connection, const std::string& bundleIdentifier);
+	bool SendInstallationStatus(Connection& connection, const char* status, int percentComplete) const;
+
+	void HandleMisagentConnection(std::shared_ptr<Connection> connection);
+	void HandleNotificationProxyConnection(std::shared_ptr<Connection> connection);
+
+	void ForwardWiredConnection(std::shared_ptr<Connection> connection, int altStoreSocket);
+	int ConnectToAltStore() const;
+};
+
+static std::string RandomHexString(std::mt19937& random, int length)
+{
+	std::stringstream ss;
+	for (int i = 0; i < length; i++)
+	{
+		ss << std::hex << std::uppercase << (random() % 16);
+	}
+
+	return ss.str();
+}
+
+static std::string RandomUUID(std::mt19937& random)
+{
+	return RandomHexString(random, 8) + "-" + RandomHexString(random, 4) + "-" + RandomHexString(random, 4) + "-" + RandomHexString(random, 4) + "-" + RandomHexString(random, 12);
+}
+
+DeviceStandIn::DeviceStandIn(Configuration configuration) : _configuration(configuration), _listeningSocket(-1)
+{
+	std::mt19937 random((unsigned int)time(NULL));
+	_systemBUID = RandomUUID(random);
+
+	auto udids = configuration.udids;
+	for (int i = (int)udids.size(); i < configuration.deviceCount; i++)
+	{
+		char udid[32];
+		snprintf(udid, sizeof(udid), "00008101-%016X", i + 1);
+		udids.push_back(udid);
+	}
+
+	for (size_t i = 0; i < udids.size(); i++)
+	{
+		auto device = std::make_shared<SimulatedDevice>(configuration.bandwidth * 1000 * 1000 / 8);
+		device->deviceID = (uint32_t)(i + 1);
+		device->udid = udids[i];
+		device->name = "Simulated iPhone " + std::to_string(i + 1);
+		device->files[""].isDirectory = true;
+
+		// Lockdown sessions run without SSL, so libimobiledevice never reads the certificates.
+		plist_t pairRecord = plist_new_dict();
+		plist_dict_set_item(pairRecord, "HostID", plist_new_string(RandomUUID(random).c_str()));
+		plist_dict_set_item(pairRecord, "SystemBUID", plist_new_string(_systemBUID.c_str()));
+		plist_dict_set_item(pairRecord, "HostCertificate", plist_new_data("", 0));
+		plist_dict_set_item(pairRecord, "HostPrivateKey", plist_new_data("", 0));
+		plist_dict_set_item(pairRecord, "DeviceCertificate", plist_new_data("", 0));
+		plist_dict_set_item(pairRecord, "RootCertificate", plist_new_data("", 0));
+		plist_dict_set_item(pairRecord, "RootPrivateKey", plist_new_data("", 0));
+		plist_dict_set_item(pairRecord, "WiFiMACAddress", plist_new_string("00:00:00:00:00:00"));
+		device->pairRecord = XMLString(pairRecord);
+		plist_free(pairRecord);
+
+		_devices.push_back(device);
+	}
+}
+
+void DeviceStandIn::Start()
+{
+	unlink(_configuration.socketPath.c_str());
+
+	_listeningSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_listeningSocket < 0)
+	{
+		throw std::runtime_error("Failed to create socket.");
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (_configuration.socketPath.size() >= sizeof(address.sun_path))
+	{
+		throw std::runtime_error("Socket path is too long.");
+	}
+
+	strncpy(address.sun_path, _configuration.socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	if (bind(_listeningSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(_listeningSocket, 128) != 0)
+	{
+		throw std::runtime_error("Failed to listen on " + _configuration.socketPath + ": " + strerror(errno));
+	}
+
+	int listeningSocket = _listeningSocket;
+	std::thread([this, listeningSocket]() {
+		while (true)
+		{
+			int socket = accept(listeningSocket, NULL, NULL);
+			if (socket < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+				{
+					continue;
+				}
+
+				break;
+			}
+
+			auto connection = std::make_shared<Connection>(socket);
+			std::thread([this, connection]() {
+				this->HandleMuxConnection(connection);
+			}).detach();
+		}
+	}).detach();
+}
+
+void DeviceStandIn::Stop()
+{
+	unlink(_configuration.socketPath.c_str());
+}
+
+std::shared_ptr<SimulatedDevice> DeviceStandIn::DeviceWithID(uint64_t deviceID) const
+{
+	for (auto& device : _devices)
+	{
+		if (device->deviceID == deviceID)
+		{
+			return device;
+		}
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<SimulatedDevice> DeviceStandIn::DeviceWithUDID(const std::string& udid) const
+{
+	for (auto& device : _devices)
+	{
+		if (device->udid == udid)
+		{
+			return device;
+		}
+	}
+
+	return nullptr;
+}
+
+void DeviceStandIn::Delay() const
+{
+	if (_configuration.latency > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(_configuration.latency));
+	}
+}
+
+bool DeviceStandIn::SendServicePlist(Connection& connection, plist_t plist) const
+{
+	this->Delay();
+
+	auto xml = XMLString(plist);
+
+	uint32_t length = htonl((uint32_t)xml.size());
+	return connection.Write(std::string((const char*)&length, sizeof(length)) + xml);
+}
+
+#pragma mark - usbmuxd -
+
+plist_t DeviceStandIn::DeviceProperties(std::shared_ptr<SimulatedDevice> device) const
+{
+	plist_t properties = plist_new_dict();
+	plist_dict_set_item(properties, "ConnectionType", plist_new_string("USB"));
+	plist_dict_set_item(properties, "DeviceID", plist_new_uint(device->deviceID));
+	plist_dict_set_item(properties, "LocationID", plist_new_uint(0x14100000 + device->deviceID));
+	plist_dict_set_item(properties, "ProductID", plist_new_uint(0x12a8));
+	plist_dict_set_item(properties, "SerialNumber", plist_new_string(device->udid.c_str()));
+	plist_dict_set_item(properties, "ConnectionSpeed", plist_new_uint(480000000));
+	return properties;
+}
+
+void DeviceStandIn::HandleMuxConnection(std::shared_ptr<Connection> connection)
+{
+	while (true)
+	{
+		uint32_t tag = 0;
+
+		plist_t message = ReceiveMuxMessage(*connection, tag);
+		if (message == nullptr)
+		{
+			return;
+		}
+
+		auto messageType = StringValue(message, "MessageType");
+
+		if (messageType == "ListDevices")
+		{
+			plist_t deviceList = plist_new_array();
+			for (auto& device : _devices)
+			{
+				plist_t entry = plist_new_dict();
+				plist_dict_set_item(entry, "DeviceID", plist_new_uint(device->deviceID));
+				plist_dict_set_item(entry, "MessageType", plist_new_string("Attached"));
+				plist_dict_set_item(entry, "Properties", this->DeviceProperties(device));
+				plist_array_append_item(deviceList, entry);
+			}
+
+			plist_t response = plist_new_dict();
+			plist_dict_set_item(response, "DeviceList", deviceList);
+			SendMuxMessage(*connection, tag, response);
+			plist_free(response);
+		}
+		else if (messageType == "Listen")
+		{
+			SendMuxResult(*connection, tag, USBMUXD_RESULT_OK);
+
+			// Devices stay attached, so listeners only hear about them once.
+			for (auto& device : _devices)
+			{
+				plist_t event = plist_new_dict();
+				plist_dict_set_item(event, "MessageType", plist_new_string("Attached"));
+				plist_dict_set_item(event, "DeviceID", plist_new_uint(device->deviceID));
+				plist_dict_set_item(event, "Properties", this->DeviceProperties(device));
+				SendMuxMessage(*connection, 0, event);
+				plist_free(event);
+			}
+		}
+		else if (messageType == "Connect")
+		{
+			auto device = this->DeviceWithID(UIntValue(message, "DeviceID"));
+			auto port = ntohs((uint16_t)UIntValue(message, "PortNumber"));
+			plist_free(message);
+
+			// The connection belongs to the device from here on.
+			this->Connect(connection, tag, device, port);
+			return;
+		}
+		else if (messageType == "ReadBUID")
+		{
+			plist_t response = plist_new_dict();
+			plist_dict_set_item(response, "BUID", plist_new_string(_systemBUID.c_str()));
+			SendMuxMessage(*connection, tag, response);
+			plist_free(response);
+		}
+		else if (messageType == "ReadPairRecord")
+		{
+			auto device = this->DeviceWithUDID(StringValue(message, "PairRecordID"));
+			if (device == nullptr)
+			{
+				SendMuxResult(*connection, tag, USBMUXD_RESULT_BADDEV);
+			}
+			else
+			{
+				std::string pairRecord;
+
+				{
+					std::lock_guard<std::mutex> lock(device->mutex);
+					pairRecord = device->pairRecord;
+				}
+
+				plist_t response = plist_new_dict();
+				plist_dict_set_item(response, "PairRecordData", plist_new_data(pairRecord.data(), pairRecord.size()));
+				SendMuxMessage(*connection, tag, response);
+				plist_free(response);
+			}
+		}
+		else if (messageType == "SavePairRecord")
+		{
+			auto device = this->DeviceWithUDID(StringValue(message, "PairRecordID"));
+			auto pairRecord = DataValue(message, "PairRecordData");
+
+			if (device != nullptr && !pairRecord.empty())
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+				device->pairRecord = pairRecord;
+			}
+
+			SendMuxResult(*connection, tag, device == nullptr ? USBMUXD_RESULT_BADDEV : USBMUXD_RESULT_OK);
+		}
+		else if (messageType == "DeletePairRecord")
+		{
+			SendMuxResult(*connection, tag, USBMUXD_RESULT_OK);
+		}
+		else if (messageType == "ListListeners")
+		{
+			plist_t response = plist_new_dict();
+			plist_dict_set_item(response, "ListenerList", plist_new_array());
+			SendMuxMessage(*connection, tag, response);
+			plist_free(response);
+		}
+		else
+		{
+			Log("Unsupported usbmuxd message: " + messageType);
+			SendMuxResult(*connection, tag, USBMUXD_RESULT_BADCOMMAND);
+		}
+
+		plist_free(message);
+	}
+}
+
+void DeviceStandIn::Connect(std::shared_ptr<Connection> connection, uint32_t tag, std::shared_ptr<SimulatedDevice> device, uint16_t port)
+{
+	if (device == nullptr)
+	{
+		SendMuxResult(*connection, tag, USBMUXD_RESULT_BADDEV);
+		return;
+	}
+
+	int altStoreSocket = -1;
+	if (port == ALTSTORE_WIRED_PORT)
+	{
+		altStoreSocket = this->ConnectToAltStore();
+		if (altStoreSocket < 0)
+		{
+			SendMuxResult(*connection, tag, USBMUXD_RESULT_CONNREFUSED);
+			return;
+		}
+	}
+	else if (port != LOCKDOWN_PORT && port != AFC_PORT && port != INSTALLATION_PROXY_PORT && port != MISAGENT_PORT && port != NOTIFICATION_PROXY_PORT)
+	{
+		SendMuxResult(*connection, tag, USBMUXD_RESULT_CONNREFUSED);
+		return;
+	}
+
+	device->connections++;
+	connection->setDevice(device);
+
+	this->Delay();
+	if (!SendMuxResult(*connection, tag, USBMUXD_RESULT_OK))
+	{
+		if (altStoreSocket >= 0)
+		{
+			close(altStoreSocket);
+		}
+
+		return;
+	}
+
+	switch (port)
+	{
+	case LOCKDOWN_PORT: this->HandleLockdownConnection(connection); break;
+	case AFC_PORT: this->HandleAFCConnection(connection); break;
+	case INSTALLATION_PROXY_PORT: this->HandleInstallationProxyConnection(connection); break;
+	case MISAGENT_PORT: this->HandleMisagentConnection(connection); break;
+	case NOTIFICATION_PROXY_PORT: this->HandleNotificationProxyConnection(connection); break;
+	case ALTSTORE_WIRED_PORT: this->ForwardWiredConnection(connection, altStoreSocket); break;
+	}
+}
+
+#pragma mark - Lockdown -
+
+plist_t DeviceStandIn::LockdownValue(std::shared_ptr<SimulatedDevice> device, const std::string& domain, const std::string& key) const
+{
+	if (!domain.empty())
+	{
+		return nullptr;
+	}
+
+	std::map<std::string, std::string> values = {
+		{ "DeviceName", device->name },
+		{ "UniqueDeviceID", device->udid },
+		{ "SerialNumber", device->udid.substr(device->udid.size() - 12) },
+		{ "ProductVersion", _configuration.productVersion },
+		{ "ProductType", "iPhone13,2" },
+		{ "ProductName", "iPhone OS" },
+		{ "DeviceClass", "iPhone" },
+		{ "HardwareModel", "D53gAP" },
+		{ "CPUArchitecture", "arm64e" },
+		{ "BuildVersion", "20F66" },
+		{ "WiFiAddress", "00:00:00:00:00:00" },
+	};
+
+	if (key.empty())
+	{
+		plist_t dictionary = plist_new_dict();
+		for (auto& pair : values)
+		{
+			plist_dict_set_item(dictionary, pair.first.c_str(), plist_new_string(pair.second.c_str()));
+		}
+
+		return dictionary;
+	}
+
+	auto value = values.find(key);
+	if (value == values.end())
+	{
+		return nullptr;
+	}
+
+	return plist_new_string(value->second.c_str());
+}
+
+void DeviceStandIn::HandleLockdownConnection(std::shared_ptr<Connection> connection)
+{
+	auto device = connection->device();
+
+	plist_t request = nullptr;
+	while ((request = ReceiveServicePlist(*connection)) != nullptr)
+	{
+		auto requestType = StringValue(request, "Request");
+
+		plist_t response = plist_new_dict();
+		plist_dict_set_item(response, "Request", plist_new_string(requestType.c_str()));
+
+		if (requestType == "QueryType")
+		{
+			plist_dict_set_item(response, "Type", plist_new_string("com.apple.mobile.lockdown"));
+		}
+		else if (requestType == "GetValue")
+		{
+			auto key = StringValue(request, "Key");
+			auto domain = StringValue(request, "Domain");
+
+			plist_t value = this->LockdownValue(device, domain, key);
+			if (value == nullptr)
+			{
+				plist_dict_set_item(response, "Error", plist_new_string("MissingValue"));
+			}
+			else
+			{
+				if (!key.empty())
+				{
+					plist_dict_set_item(response, "Key", plist_new_string(key.c_str()));
+				}
+
+				plist_dict_set_item(response, "Value", value);
+			}
+		}
+		else if (requestType == "StartSession")
+		{
+			std::mt19937 random(std::random_device{}());
+			plist_dict_set_item(response, "SessionID", plist_new_string(RandomUUID(random).c_str()));
+			plist_dict_set_item(response, "EnableSessionSSL", plist_new_bool(0));
+		}
+		else if (requestType == "StartService")
+		{
+			auto service = StringValue(request, "Service");
+
+			std::map<std::string, uint16_t> ports = {
+				{ "com.apple.afc", AFC_PORT },
+				{ "com.apple.mobile.installation_proxy", INSTALLATION_PROXY_PORT },
+				{ "com.apple.misagent", MISAGENT_PORT },
+				{ "com.apple.mobile.notification_proxy", NOTIFICATION_PROXY_PORT },
+			};
+
+			plist_dict_set_item(response, "Service", plist_new_string(service.c_str()));
+
+			auto port = ports.find(service);
+			if (port == ports.end())
+			{
+				plist_dict_set_item(response, "Error", plist_new_string("InvalidService"));
+			}
+			else
+			{
+				plist_dict_set_item(response, "Port", plist_new_uint(port->second));
+				plist_dict_set_item(response, "EnableServiceSSL", plist_new_bool(0));
+			}
+		}
+		else if (requestType != "SetValue" && requestType != "RemoveValue" && requestType != "ValidatePair" && requestType != "Pair" &&
+			requestType != "StopSession" && requestType != "Goodbye")
+		{
+			plist_dict_set_item(response, "Error", plist_new_string("InvalidRequest"));
+		}
+
+		bool success = this->SendServicePlist(*connection, response);
+
+		plist_free(response);
+		plist_free(request);
+
+		if (!success || requestType == "Goodbye")
+		{
+			break;
+		}
+	}
+}
+
+#pragma mark - AFC -
+
+struct AFCPacketHeader
+{
+	char magic[8];
+	uint64_t entireLength;
+	uint64_t thisLength;
+	uint64_t packetNumber;
+	uint64_t operation;
+};
+
+struct AFCFileHandle
+{
+	std::string path;
+	uint64_t position = 0;
+};
+
+static uint64_t ReadUInt64(const std::string& data, size_t offset)
+{
+	uint64_t value = 0;
+	if (data.size() >= offset + sizeof(value))
+	{
+		memcpy(&value, data.data() + offset, sizeof(value));
+	}
+
+	return le64toh(value);
+}
+
+static std::string UInt64Data(uint64_t value)
+{
+	value = htole64(value);
+	return std::string((const char*)&value, sizeof(value));
+}
+
+// Path arguments are NUL-terminated strings following any fixed-size ones.
+static std::string PathArgument(const std::string& data, size_t offset, size_t* nextOffset = nullptr)
+{
+	if (offset >= data.size())
+	{
+		return "";
+	}
+
+	auto end = data.find('\0', offset);
+	if (end == std::string::npos)
+	{
+		end = data.size();
+	}
+
+	if (nextOffset != nullptr)
+	{
+		*nextOffset = end + 1;
+	}
+
+	return NormalizedPath(data.substr(offset, end - offset));
+}
+
+bool DeviceStandIn::SendAFCPacket(Connection& connection, uint64_t packetNumber, uint64_t operation, const std::string& header, const std::string& payload) const
+{
+	this->Delay();
+
+	AFCPacketHeader packetHeader;
+	memcpy(packetHeader.magic, AFC_MAGIC, sizeof(packetHeader.magic));
+	packetHeader.entireLength = htole64(sizeof(packetHeader) + header.size() + payload.size());
+	packetHeader.thisLength = htole64(sizeof(packetHeader) + header.size());
+	packetHeader.packetNumber = htole64(packetNumber);
+	packetHeader.operation = htole64(operation);
+
+	return connection.Write(std::string((const char*)&packetHeader, sizeof(packetHeader)) + header + payload);
+}
+
+void DeviceStandIn::HandleAFCConnection(std::shared_ptr<Connection> connection)
+{
+	auto device = connection->device();
+
+	std::map<uint64_t, AFCFileHandle> fileHandles;
+	uint64_t nextFileHandle = 1;
+
+	while (true)
+	{
+		AFCPacketHeader packetHeader;
+		if (!connection->Read(&packetHeader, sizeof(packetHeader)) || memcmp(packetHeader.magic, AFC_MAGIC, sizeof(packetHeader.magic)) != 0)
+		{
+			return;
+		}
+
+		auto entireLength = le64toh(packetHeader.entireLength);
+		auto thisLength = le64toh(packetHeader.thisLength);
+		auto packetNumber = le64toh(packetHeader.packetNumber);
+		auto operation = le64toh(packetHeader.operation);
+
+		if (thisLength < sizeof(packetHeader) || entireLength < thisLength || thisLength > MAXIMUM_MESSAGE_SIZE)
+		{
+			return;
+		}
+
+		std::string header(thisLength - sizeof(packetHeader), '\0');
+		if (!connection->Read(&header[0], header.size()))
+		{
+			return;
+		}
+
+		uint64_t payloadLength = entireLength - thisLength;
+
+		auto status = [&](uint64_t code) {
+			return this->SendAFCPacket(*connection, packetNumber, AFC_OP_STATUS, UInt64Data(code));
+		};
+
+		bool success = true;
+
+		if (operation == AFC_OP_FILE_WRITE)
+		{
+			// Streamed, since it may be a whole file; only kept contents are held onto.
+			auto fileHandle = fileHandles.find(ReadUInt64(header, 0));
+
+			bool keepsContents = (fileHandle != fileHandles.end() && KeepsContents(fileHandle->second.path));
+			std::string contents;
+
+			char buffer[TRANSFER_CHUNK_SIZE];
+			for (uint64_t remaining = payloadLength; remaining > 0;)
+			{
+				auto size = (size_t)std::min<uint64_t>(remaining, sizeof(buffer));
+				if (!connection->Read(buffer, size))
+				{
+					return;
+				}
+
+				if (keepsContents)
+				{
+					contents.append(buffer, size);
+				}
+
+				remaining -= size;
+			}
+
+			if (fileHandle == fileHandles.end())
+			{
+				success = status(AFC_E_INVALID_ARG);
+				continue;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+
+				auto& entry = device->files[fileHandle->second.path];
+				auto position = fileHandle->second.position;
+
+				if (keepsContents)
+				{
+					if (entry.contents.size() < position + contents.size())
+					{
+						entry.contents.resize(position + contents.size());
+					}
+
+					entry.contents.replace(position, contents.size(), contents);
+				}
+
+				entry.size = std::max(entry.size, position + payloadLength);
+				entry.modificationDate = time(NULL);
+			}
+
+			fileHandle->second.position += payloadLength;
+			device->uploadedBytes += payloadLength;
+
+			success = status(AFC_E_SUCCESS);
+			if (!success)
+			{
+				return;
+			}
+
+			continue;
+		}
+
+		if (payloadLength > MAXIMUM_MESSAGE_SIZE)
+		{
+			return;
+		}
+
+		std::string payload(payloadLength, '\0');
+		if (!connection->Read(&payload[0], payload.size()))
+		{
+			return;
+		}
+
+		auto arguments = header + payload;
+
+		std::unique_lock<std::mutex> lock(device->mutex);
+		auto& files = device->files;
+
+		switch (operation)
+		{
+		case AFC_OP_GET_FILE_INFO:
+		{
+			auto path = PathArgument(arguments, 0);
+
+			auto entry = files.find(path);
+			if (entry == files.end())
+			{
+				lock.unlock();
+				success = status(AFC_E_OBJECT_NOT_FOUND);
+				break;
+			}
+
+			uint64_t linkCount = 1;
+			if (entry->second.isDirectory)
+			{
+				linkCount = 2;
+				for (auto& pair : files)
+				{
+					if (pair.second.isDirectory && IsDescendant(pair.first, path) && ParentPath(pair.first) == path)
+					{
+						linkCount++;
+					}
+				}
+			}
+
+			auto modificationDate = std::to_string((uint64_t)entry->second.modificationDate * 1000000000ULL);
+
+			std::string info;
+			for (auto& pair : std::vector<std::pair<std::string, std::string>>({
+				{ "st_size", std::to_string(entry->second.isDirectory ? 64 : entry->second.size) },
+				{ "st_blocks", std::to_string((entry->second.size + 511) / 512) },
+				{ "st_nlink", std::to_string(linkCount) },
+				{ "st_ifmt", entry->second.isDirectory ? "S_IFDIR" : "S_IFREG" },
+				{ "st_mtime", modificationDate },
+				{ "st_birthtime", modificationDate },
+			}))
+			{
+				info += pair.first + '\0' + pair.second + '\0';
+			}
+
+			lock.unlock();
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_DATA, "", info);
+			break;
+		}
+
+		case AFC_OP_READ_DIR:
+		{
+			auto path = PathArgument(arguments, 0);
+
+			auto entry = files.find(path);
+			if (entry == files.end() || !entry->second.isDirectory)
+			{
+				lock.unlock();
+				success = status(entry == files.end() ? AFC_E_OBJECT_NOT_FOUND : AFC_E_INVALID_ARG);
+				break;
+			}
+
+			std::string names = std::string(".") + '\0' + ".." + '\0';
+			for (auto& pair : files)
+			{
+				if (IsDescendant(pair.first, path) && ParentPath(pair.first) == path)
+				{
+					names += pair.first.substr(pair.first.find_last_of('/') + 1) + '\0';
+				}
+			}
+
+			lock.unlock();
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_DATA, "", names);
+			break;
+		}
+
+		case AFC_OP_MAKE_DIR:
+		{
+			auto path = PathArgument(arguments, 0);
+
+			auto entry = files.find(path);
+			if (entry != files.end() && !entry->second.isDirectory)
+			{
+				lock.unlock();
+				success = status(AFC_E_INVALID_ARG);
+				break;
+			}
+
+			// Like mkdir -p.
+			for (auto directoryPath = path; !directoryPath.empty(); directoryPath = ParentPath(directoryPath))
+			{
+				auto& directory = files[directoryPath];
+				if (!directory.isDirectory)
+				{
+					directory.isDirectory = true;
+					directory.modificationDate = time(NULL);
+				}
+			}
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_REMOVE_PATH:
+		case AFC_OP_REMOVE_PATH_AND_CONTENTS:
+		{
+			auto path = PathArgument(arguments, 0);
+
+			auto entry = files.find(path);
+			if (entry == files.end() || path.empty())
+			{
+				lock.unlock();
+				success = status(path.empty() ? AFC_E_PERM_DENIED : AFC_E_OBJECT_NOT_FOUND);
+				break;
+			}
+
+			bool hasContents = false;
+			for (auto& pair : files)
+			{
+				if (IsDescendant(pair.first, path))
+				{
+					hasContents = true;
+					break;
+				}
+			}
+
+			if (hasContents && operation == AFC_OP_REMOVE_PATH)
+			{
+				lock.unlock();
+				success = status(AFC_E_PERM_DENIED);
+				break;
+			}
+
+			for (auto iterator = files.begin(); iterator != files.end();)
+			{
+				if (iterator->first == path || IsDescendant(iterator->first, path))
+				{
+					iterator = files.erase(iterator);
+				}
+				else
+				{
+					iterator++;
+				}
+			}
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_RENAME_PATH:
+		{
+			size_t offset = 0;
+			auto sourcePath = PathArgument(arguments, 0, &offset);
+			auto destinationPath = PathArgument(arguments, offset);
+
+			if (files.count(sourcePath) == 0 || files.count(ParentPath(destinationPath)) == 0 || sourcePath.empty())
+			{
+				lock.unlock();
+				success = status(AFC_E_OBJECT_NOT_FOUND);
+				break;
+			}
+
+			std::map<std::string, FileEntry> movedFiles;
+			for (auto iterator = files.begin(); iterator != files.end();)
+			{
+				if (iterator->first == sourcePath || IsDescendant(iterator->first, sourcePath))
+				{
+					movedFiles[destinationPath + iterator->first.substr(sourcePath.size())] = std::move(iterator->second);
+					iterator = files.erase(iterator);
+				}
+				else
+				{
+					iterator++;
+				}
+			}
+
+			for (auto& pair : movedFiles)
+			{
+				files[pair.first] = std::move(pair.second);
+			}
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_TRUNCATE:
+		{
+			auto size = ReadUInt64(arguments, 0);
+			auto path = PathArgument(arguments, sizeof(uint64_t));
+
+			auto entry = files.find(path);
+			if (entry == files.end() || entry->second.isDirectory)
+			{
+				lock.unlock();
+				success = status(entry == files.end() ? AFC_E_OBJECT_NOT_FOUND : AFC_E_OBJECT_IS_DIR);
+				break;
+			}
+
+			entry->second.size = size;
+			if (entry->second.contents.size() > size)
+			{
+				entry->second.contents.resize(size);
+			}
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_GET_DEVINFO:
+		{
+			uint64_t usedBytes = 0;
+			for (auto& pair : files)
+			{
+				usedBytes += pair.second.size;
+			}
+
+			lock.unlock();
+
+			std::string info;
+			for (auto& pair : std::vector<std::pair<std::string, std::string>>({
+				{ "Model", "iPhone13,2" },
+				{ "FSTotalBytes", std::to_string(DEVICE_CAPACITY) },
+				{ "FSFreeBytes", std::to_string(DEVICE_CAPACITY - std::min<uint64_t>(usedBytes, DEVICE_CAPACITY)) },
+				{ "FSBlockSize", "4096" },
+			}))
+			{
+				info += pair.first + '\0' + pair.second + '\0';
+			}
+
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_DATA, "", info);
+			break;
+		}
+
+		case AFC_OP_FILE_OPEN:
+		{
+			auto mode = ReadUInt64(arguments, 0);
+			auto path = PathArgument(arguments, sizeof(uint64_t));
+
+			auto parent = files.find(ParentPath(path));
+			auto entry = files.find(path);
+
+			if (path.empty() || (entry != files.end() && entry->second.isDirectory))
+			{
+				lock.unlock();
+				success = status(AFC_E_OBJECT_IS_DIR);
+				break;
+			}
+
+			if (parent == files.end() || !parent->second.isDirectory || (entry == files.end() && mode == AFC_FOPEN_RDONLY))
+			{
+				lock.unlock();
+				success = status(AFC_E_OBJECT_NOT_FOUND);
+				break;
+			}
+
+			auto& file = files[path];
+
+			if (entry == files.end() || mode == AFC_FOPEN_WRONLY || mode == AFC_FOPEN_WR)
+			{
+				if (entry == files.end())
+				{
+					device->uploadedFiles++;
+				}
+
+				file.size = 0;
+				file.contents.clear();
+				file.modificationDate = time(NULL);
+			}
+
+			AFCFileHandle fileHandle;
+			fileHandle.path = path;
+			fileHandle.position = (mode == AFC_FOPEN_APPEND || mode == AFC_FOPEN_RDAPPEND) ? file.size : 0;
+
+			lock.unlock();
+
+			auto handle = nextFileHandle++;
+			fileHandles[handle] = fileHandle;
+
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_FILE_OPEN_RES, UInt64Data(handle));
+			break;
+		}
+
+		case AFC_OP_FILE_READ:
+		{
+			auto fileHandle = fileHandles.find(ReadUInt64(arguments, 0));
+			auto length = ReadUInt64(arguments, sizeof(uint64_t));
+
+			auto entry = (fileHandle == fileHandles.end()) ? files.end() : files.find(fileHandle->second.path);
+			if (entry == files.end())
+			{
+				lock.unlock();
+				success = status(AFC_E_INVALID_ARG);
+				break;
+			}
+
+			auto position = fileHandle->second.position;
+			length = std::min<uint64_t>(length, (entry->second.size > position) ? entry->second.size - position : 0);
+			length = std::min<uint64_t>(length, MAXIMUM_MESSAGE_SIZE);
+
+			// Contents that weren't kept read back as zeroes.
+			std::string data((size_t)length, '\0');
+			if (position < entry->second.contents.size())
+			{
+				auto size = std::min<size_t>((size_t)length, entry->second.contents.size() - position);
+				memcpy(&data[0], entry->second.contents.data() + position, size);
+			}
+
+			lock.unlock();
+
+			fileHandle->second.position += length;
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_DATA, "", data);
+			break;
+		}
+
+		case AFC_OP_FILE_SEEK:
+		{
+			auto fileHandle = fileHandles.find(ReadUInt64(arguments, 0));
+			auto whence = ReadUInt64(arguments, sizeof(uint64_t));
+			auto offset = (int64_t)ReadUInt64(arguments, 2 * sizeof(uint64_t));
+
+			auto entry = (fileHandle == fileHandles.end()) ? files.end() : files.find(fileHandle->second.path);
+			if (entry == files.end() || whence > SEEK_END)
+			{
+				lock.unlock();
+				success = status(AFC_E_INVALID_ARG);
+				break;
+			}
+
+			int64_t base = (whence == SEEK_SET) ? 0 : (whence == SEEK_CUR) ? (int64_t)fileHandle->second.position : (int64_t)entry->second.size;
+			fileHandle->second.position = (uint64_t)std::max<int64_t>(0, base + offset);
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_FILE_TELL:
+		{
+			lock.unlock();
+
+			auto fileHandle = fileHandles.find(ReadUInt64(arguments, 0));
+			if (fileHandle == fileHandles.end())
+			{
+				success = status(AFC_E_INVALID_ARG);
+				break;
+			}
+
+			success = this->SendAFCPacket(*connection, packetNumber, AFC_OP_FILE_TELL_RES, UInt64Data(fileHandle->second.position));
+			break;
+		}
+
+		case AFC_OP_FILE_SET_SIZE:
+		{
+			auto fileHandle = fileHandles.find(ReadUInt64(arguments, 0));
+			auto size = ReadUInt64(arguments, sizeof(uint64_t));
+
+			auto entry = (fileHandle == fileHandles.end()) ? files.end() : files.find(fileHandle->second.path);
+			if (entry == files.end())
+			{
+				lock.unlock();
+				success = status(AFC_E_INVALID_ARG);
+				break;
+			}
+
+			entry->second.size = size;
+			if (entry->second.contents.size() > size)
+			{
+				entry->second.contents.resize(size);
+			}
+
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		case AFC_OP_FILE_CLOSE:
+		{
+			lock.unlock();
+
+			auto handle = ReadUInt64(arguments, 0);
+			success = status(fileHandles.erase(handle) > 0 ? AFC_E_SUCCESS : AFC_E_INVALID_ARG);
+			break;
+		}
+
+		case AFC_OP_FILE_LOCK:
+		case AFC_OP_SET_FILE_MOD_TIME:
+		{
+			lock.unlock();
+			success = status(AFC_E_SUCCESS);
+			break;
+		}
+
+		default:
+		{
+			lock.unlock();
+
+			std::stringstream ss;
+			ss << "Unsupported AFC operation 0x" << std::hex << operation;
+			Log(ss.str());
+
+			success = status(AFC_E_OP_NOT_SUPPORTED);
+			break;
+		}
+		}
+
+		if (!success)
+		{
+			return;
+		}
+	}
+}
+
+#pragma mark - installation_proxy -
+
+bool DeviceStandIn::SendInstallationStatus(Connection& connection, const char* status, int percentComplete) const
+{
+	plist_t response = plist_new_dict();
+	plist_dict_set_item(response, "Status", plist_new_string(status));
+
+	// DeviceManager treats a status without progress as the end of the install.
+	if (percentComplete >= 0)
+	{
+		plist_dict_set_item(response, "PercentComplete", plist_new_uint(percentComplete));
+	}
+
+	bool success = this->SendServicePlist(connection, response);
+	plist_free(response);
+
+	return success;
+}
+
+bool DeviceStandIn::InstallApp(Connection& connection, const std::string& packagePath)
+{
+	auto device = connection.device();
+
+	// Real installs report progress before they can fail, and DeviceManager relies on it.
+	if (!this->SendInstallationStatus(connection, "CreatingStagingDirectory", 5))
+	{
+		return false;
+	}
+
+	auto fail = [&](const char* error, const std::string& description) {
+		Log(device->name + ": failed to install " + packagePath + ". " + description);
+
+		plist_t response = plist_new_dict();
+		plist_dict_set_item(response, "Error", plist_new_string(error));
+		plist_dict_set_item(response, "ErrorDescription", plist_new_string(description.c_str()));
+		plist_dict_set_item(response, "ErrorDetail", plist_new_uint(1));
+
+		bool success = this->SendServicePlist(connection, response);
+		plist_free(response);
+
+		return success;
+	};
+
+	auto path = NormalizedPath(packagePath);
+
+	std::string infoPlistData;
+	std::vector<std::string> profiles;
+	uint64_t packageSize = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(device->mutex);
+
+		auto entry = device->files.find(path);
+		if (entry == device->files.end() || !entry->second.isDirectory)
+		{
+			return fail("PackageExtractionFailed", "Package doesn't exist or isn't an app bundle.");
+		}
+
+		for (auto& pair : device->files)
+		{
+			if (!IsDescendant(pair.first, path))
+			{
+				continue;
+			}
+
+			packageSize += pair.second.size;
+
+			if (pair.first == path + "/Info.plist")
+			{
+				infoPlistData = pair.second.contents;
+			}
+			else if (pair.first.substr(pair.first.find_last_of('/') + 1) == "embedded.mobileprovision" && !pair.second.contents.empty())
+			{
+				profiles.push_back(pair.second.contents);
+			}
+		}
+	}
+
+	plist_t infoPlist = nullptr;
+	if (!infoPlistData.empty())
+	{
+		plist_from_memory(infoPlistData.data(), (uint32_t)infoPlistData.size(), &infoPlist);
+	}
+
+	if (infoPlist == nullptr)
+	{
+		return fail("PackageInspectionFailed", "Failed to read Info.plist.");
+	}
+
+	InstalledApp app;
+	app.bundleIdentifier = StringValue(infoPlist, "CFBundleIdentifier");
+	app.name = StringValue(infoPlist, "CFBundleName");
+	app.version = StringValue(infoPlist, "CFBundleShortVersionString");
+	plist_free(infoPlist);
+
+	if (app.bundleIdentifier.empty())
+	{
+		return fail("PackageInspectionFailed", "Info.plist has no CFBundleIdentifier.");
+	}
+
+	std::vector<std::pair<const char*, int>> stages = {
+		{ "ExtractingPackage", 15 },
+		{ "InspectingPackage", 20 },
+		{ "PreflightingApplication", 30 },
+		{ "InstallingEmbeddedProfile", 35 },
+		{ "VerifyingApplication", 40 },
+		{ "CreatingContainer", 50 },
+		{ "InstallingApplication", 60 },
+		{ "PostflightingApplication", 70 },
+		{ "SandboxingApplication", 80 },
+		{ "GeneratingApplicationMap", 90 },
+	};
+
+	for (auto& stage : stages)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(_configuration.installDuration / (int)stages.size()));
+
+		if (!this->SendInstallationStatus(connection, stage.first, stage.second))
+		{
+			return false;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(device->mutex);
+
+		// Installing an app installs the profiles it embeds.
+		for (auto& profile : profiles)
+		{
+			auto uuid = ProfileUUID(profile);
+			if (!uuid.empty())
+			{
+				device->profilesByUUID[uuid] = profile;
+			}
+		}
+
+		device->apps[app.bundleIdentifier] = app;
+
+		// The staged package is consumed by the install.
+		for (auto iterator = device->files.begin(); iterator != device->files.end();)
+		{
+			if (iterator->first == path || IsDescendant(iterator->first, path))
+			{
+				iterator = device->files.erase(iterator);
+			}
+			else
+			{
+				iterator++;
+			}
+		}
+	}
+
+	device->installs++;
+
+	std::stringstream ss;
+	ss << device->name << ": installed " << app.bundleIdentifier << " (" << std::fixed << std::setprecision(1) << packageSize / 1024.0 / 1024.0 << " MB)";
+	Log(ss.str());
+
+	return this->SendInstallationStatus(connection, "Complete", -1);
+}
+
+bool DeviceStandIn::UninstallApp(Connection& connection, const std::string& bundleIdentifier)
+{
+	auto device = connection.device();
+
+	if (!this->SendInstallationStatus(connection, "RemovingApplication", 50) || !this->SendInstallationStatus(connection, "GeneratingApplicationMap", 90))
+	{
+		return false;
+	}
+
+	bool removed = false;
+
+	{
+		std::lock_guard<std::mutex> lock(device->mutex);
+		removed = device->apps.erase(bundleIdentifier) > 0;
+	}
+
+	if (removed)
+	{
+		device->uninstalls++;
+		Log(device->name + ": uninstalled " + bundleIdentifier);
+	}
+
+	return this->SendInstallationStatus(connection, "Complete", -1);
+}
+
+void DeviceStandIn::HandleInstallationProxyConnection(std::shared_ptr<Connection> connection)
+{
+	auto device = connection->device();
+
+	plist_t request = nullptr;
+	while ((request = ReceiveServicePlist(*connection)) != nullptr)
+	{
+		auto command = StringValue(request, "Command");
+		bool success = true;
+
+		if (command == "Install" || command == "Upgrade")
+		{
+			success = this->InstallApp(*connection, StringValue(request, "PackagePath"));
+		}
+		else if (command == "Uninstall")
+		{
+			success = this->UninstallApp(*connection, StringValue(request, "ApplicationIdentifier"));
+		}
+		else if (command == "Browse" || command == "Lookup")
+		{
+			std::vector<InstalledApp> apps;
+
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+				for (auto& pair : device->apps)
+				{
+					apps.push_back(pair.second);
+				}
+			}
+
+			auto appInfo = [](const InstalledApp& app) {
+				plist_t info = plist_new_dict();
+				plist_dict_set_item(info, "CFBundleIdentifier", plist_new_string(app.bundleIdentifier.c_str()));
+				plist_dict_set_item(info, "CFBundleName", plist_new_string(app.name.c_str()));
+				plist_dict_set_item(info, "CFBundleShortVersionString", plist_new_string(app.version.c_str()));
+				plist_dict_set_item(info, "ApplicationType", plist_new_string("User"));
+				return info;
+			};
+
+			plist_t response = plist_new_dict();
+
+			if (command == "Browse")
+			{
+				plist_t currentList = plist_new_array();
+				for (auto& app : apps)
+				{
+					plist_array_append_item(currentList, appInfo(app));
+				}
+
+				plist_dict_set_item(response, "Status", plist_new_string("BrowsingApplications"));
+				plist_dict_set_item(response, "CurrentIndex", plist_new_uint(0));
+				plist_dict_set_item(response, "CurrentAmount", plist_new_uint(apps.size()));
+				plist_dict_set_item(response, "Total", plist_new_uint(apps.size()));
+				plist_dict_set_item(response, "CurrentList", currentList);
+
+				success = this->SendServicePlist(*connection, response) && this->SendInstallationStatus(*connection, "Complete", -1);
+			}
+			else
+			{
+				plist_t lookupResult = plist_new_dict();
+				for (auto& app : apps)
+				{
+					plist_dict_set_item(lookupResult, app.bundleIdentifier.c_str(), appInfo(app));
+				}
+
+				plist_dict_set_item(response, "LookupResult", lookupResult);
+				plist_dict_set_item(response, "Status", plist_new_string("Complete"));
+
+				success = this->SendServicePlist(*connection, response);
+			}
+
+			plist_free(response);
+		}
+		else
+		{
+			Log("Unsupported installation_proxy command: " + command);
+
+			plist_t response = plist_new_dict();
+			plist_dict_set_item(response, "Error", plist_new_string("UnknownCommand"));
+			success = this->SendServicePlist(*connection, response);
+			plist_free(response);
+		}
+
+		plist_free(request);
+
+		if (!success)
+		{
+			break;
+		}
+	}
+}
+
+#pragma mark - misagent -
+
+void DeviceStandIn::HandleMisagentConnection(std::shared_ptr<Connection> connection)
+{
+	auto device = connection->device();
+
+	plist_t request = nullptr;
+	while ((request = ReceiveServicePlist(*connection)) != nullptr)
+	{
+		auto messageType = StringValue(request, "MessageType");
+
+		plist_t response = plist_new_dict();
+		plist_dict_set_item(response, "MessageType", plist_new_string("Response"));
+
+		uint64_t status = 0;
+
+		if (messageType == "Install")
+		{
+			auto profile = DataValue(request, "Profile");
+			auto uuid = ProfileUUID(profile);
+
+			if (uuid.empty())
+			{
+				// MIS's "invalid profile" error.
+				status = 0xe8008012;
+			}
+			else
+			{
+				{
+					std::lock_guard<std::mutex> lock(device->mutex);
+					device->profilesByUUID[uuid] = profile;
+				}
+
+				device->profileChanges++;
+				Log(device->name + ": installed profile " + uuid);
+			}
+		}
+		else if (messageType == "Remove")
+		{
+			auto uuid = StringValue(request, "ProfileID");
+			std::transform(uuid.begin(), uuid.end(), uuid.begin(), ::tolower);
+
+			bool removed = false;
+
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+				removed = device->profilesByUUID.erase(uuid) > 0;
+			}
+
+			if (removed)
+			{
+				device->profileChanges++;
+				Log(device->name + ": removed profile " + uuid);
+			}
+		}
+		else if (messageType == "CopyAll" || messageType == "Copy")
+		{
+			plist_t payload = plist_new_array();
+
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+				for (auto& pair : device->profilesByUUID)
+				{
+					plist_array_append_item(payload, plist_new_data(pair.second.data(), pair.second.size()));
+				}
+			}
+
+			plist_dict_set_item(response, "Payload", payload);
+		}
+		else
+		{
+			Log("Unsupported misagent message: " + messageType);
+			status = 0xe8000001;
+		}
+
+		plist_dict_set_item(response, "Status", plist_new_uint(status));
+
+		bool success = this->SendServicePlist(*connection, response);
+
+		plist_free(response);
+		plist_free(request);
+
+		if (!success)
+		{
+			break;
+		}
+	}
+}
+
+#pragma mark - notification_proxy -
+
+void DeviceStandIn::HandleNotificationProxyConnection(std::shared_ptr<Connection> connection)
+{
+	auto device = connection->device();
+
+	{
+		std::lock_guard<std::mutex> lock(device->mutex);
+		device->notificationConnections.insert(connection);
+	}
+
+	plist_t request = nullptr;
+	while ((request = ReceiveServicePlist(*connection)) != nullptr)
+	{
+		auto command = StringValue(request, "Command");
+		auto name = StringValue(request, "Name");
+		plist_free(request);
+
+		if (command == "ObserveNotification")
+		{
+			std::lock_guard<std::mutex> lock(device->mutex);
+			connection->observedNotifications.insert(name);
+		}
+		else if (command == "PostNotification")
+		{
+			Log(device->name + ": received notification " + name);
+
+			std::vector<std::shared_ptr<Connection>> observers;
+
+			{
+				std::lock_guard<std::mutex> lock(device->mutex);
+				for (auto& notificationConnection : device->notificationConnections)
+				{
+					if (notificationConnection->observedNotifications.count(name) > 0)
+					{
+						observers.push_back(notificationConnection);
+					}
+				}
+			}
+
+			plist_t relay = plist_new_dict();
+			plist_dict_set_item(relay, "Command", plist_new_string("RelayNotification"));
+			plist_dict_set_item(relay, "Name", plist_new_string(name.c_str()));
+
+			for (auto& observer : observers)
+			{
+				this->SendServicePlist(*observer, relay);
+			}
+
+			plist_free(relay);
+		}
+		else if (command == "Shutdown")
+		{
+			plist_t response = plist_new_dict();
+			plist_dict_set_item(response, "Command", plist_new_string("ProxyDeath"));
+			this->SendServicePlist(*connection, response);
+			plist_free(response);
+
+			break;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(device->mutex);
+	device->notificationConnections.erase(connection);
+}
+
+void DeviceStandIn::PostNotification(std::string notification)
+{
+	plist_t relay = plist_new_dict();
+	plist_dict_set_item(relay, "Command", plist_new_string("RelayNotification"));
+	plist_dict_set_item(relay, "Name", plist_new_string(notification.c_str()));
+
+	for (auto& device : _devices)
+	{
+		std::vector<std::shared_ptr<Connection>> observers;
+
+		{
+			std::lock_guard<std::mutex> lock(device->mutex);
+			for (auto& connection : device->notificationConnections)
+			{
+				if (connection->observedNotifications.count(notification) > 0)
+				{
+					observers.push_back(connection);
+				}
+			}
+		}
+
+		for (auto& observer : observers)
+		{
+			this->SendServicePlist(*observer, relay);
+		}
+
+		if (!observers.empty())
+		{
+			Log(device->name + ": posted " + notification);
+		}
+	}
+
+	plist_free(relay);
+}
+
+#pragma mark - Wired Connections -
+
+int DeviceStandIn::ConnectToAltStore() const
+{
+	auto separator = _configuration.altStoreAddress.find_last_of(':');
+	if (separator == std::string::npos)
+	{
+		return -1;
+	}
+
+	auto host = _configuration.altStoreAddress.substr(0, separator);
+	auto port = _configuration.altStoreAddress.substr(separator + 1);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+	{
+		return -1;
+	}
+
+	int altStoreSocket = -1;
+	for (auto address = addresses; address != nullptr; address = address->ai_next)
+	{
+		altStoreSocket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (altStoreSocket < 0)
+		{
+			continue;
+		}
+
+		if (connect(altStoreSocket, address->ai_addr, address->ai_addrlen) == 0)
+		{
+			break;
+		}
+
+		close(altStoreSocket);
+		altStoreSocket = -1;
+	}
+
+	freeaddrinfo(addresses);
+
+	if (altStoreSocket < 0)
+	{
+		Log("Failed to connect to AltStore at " + _configuration.altStoreAddress);
+	}
+
+	return altStoreSocket;
+}
+
+void DeviceStandIn::ForwardWiredConnection(std::shared_ptr<Connection> connection, int altStoreSocket)
+{
+	auto device = connection->device();
+	Log(device->name + ": forwarding wired connection to " + _configuration.altStoreAddress);
+
+	// AltServer -> AltStore.
+	std::thread forwarder([connection, altStoreSocket]() {
+		char buffer[TRANSFER_CHUNK_SIZE];
+
+		ssize_t receivedBytes = 0;
+		while ((receivedBytes = connection->ReadSome(buffer, sizeof(buffer))) > 0)
+		{
+			if (send(altStoreSocket, buffer, (size_t)receivedBytes, MSG_NOSIGNAL) != receivedBytes)
+			{
+				break;
+			}
+		}
+
+		shutdown(altStoreSocket, SHUT_WR);
+	});
+
+	// AltStore -> AltServer.
+	char buffer[TRANSFER_CHUNK_SIZE];
+
+	ssize_t receivedBytes = 0;
+	while ((receivedBytes = recv(altStoreSocket, buffer, sizeof(buffer), 0)) > 0 || (receivedBytes < 0 && errno == EINTR))
+	{
+		if (receivedBytes > 0 && !connection->Write(std::string(buffer, (size_t)receivedBytes)))
+		{
+			break;
+		}
+	}
+
+	shutdown(connection->socket(), SHUT_WR);
+	forwarder.join();
+
+	close(altStoreSocket);
+
+	Log(device->name + ": wired connection closed");
+}
+
+#pragma mark - Statistics -
+
+void DeviceStandIn::LogStatistics()
+{
+	for (auto& device : _devices)
+	{
+		std::stringstream ss;
+		ss << device->name << " (" << device->udid << "): " << device->connections << " connections, " << device->uploadedFiles << " files ("
+			<< std::fixed << std::setprecision(1) << device->uploadedBytes / 1024.0 / 1024.0 << " MB) uploaded, "
+			<< device->installs << " installs, " << device->uninstalls << " uninstalls, " << device->profileChanges << " profile changes";
+		Log(ss.str());
+	}
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--socket PATH] [--devices N] [--udid UDID]... [--latency-ms N] [--bandwidth-mbps N] [--install-ms N] [--ios-version VERSION] [--altstore HOST:PORT]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+
+	static struct option long_options[] =
+	{
+		{"socket",          required_argument, 0, 's'},
+		{"devices",         required_argument, 0, 'n'},
+		{"udid",            required_argument, 0, 'u'},
+		{"latency-ms",      required_argument, 0, 'l'},
+		{"bandwidth-mbps",  required_argument, 0, 'b'},
+		{"install-ms",      required_argument, 0, 'i'},
+		{"ios-version",     required_argument, 0, 'v'},
+		{"altstore",        required_argument, 0, 'a'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 's': configuration.socketPath = optarg; break;
+		case 'n': configuration.deviceCount = std::max(0, atoi(optarg)); break;
+		case 'u': configuration.udids.push_back(optarg); break;
+		case 'l': configuration.latency = std::max(0, atoi(optarg)); break;
+		case 'b': configuration.bandwidth = std::max(0.0, atof(optarg)); break;
+		case 'i': configuration.installDuration = std::max(0, atoi(optarg)); break;
+		case 'v': configuration.productVersion = optarg; break;
+		case 'a': configuration.altStoreAddress = optarg; break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Blocked before any connection thread exists so only sigwait below sees them.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	DeviceStandIn standIn(configuration);
+
+	try
+	{
+		standIn.Start();
+	}
+	catch (std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+		return 1;
+	}
+
+	auto deviceCount = std::max((size_t)configuration.deviceCount, configuration.udids.size());
+	Log("Simulating " + std::to_string(deviceCount) + " devices on " + configuration.socketPath);
+
+	while (true)
+	{
+		int signal = 0;
+		sigwait(&signals, &signal);
+
+		if (signal == SIGUSR1)
+		{
+			standIn.PostNotification(WIRED_SERVER_CONNECTION_START_REQUEST);
+			continue;
+		}
+
+		break;
+	}
+
+	standIn.LogStatistics();
+	standIn.Stop();
+
+	return 0;
+}
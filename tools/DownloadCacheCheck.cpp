@@ -0,0 +1,263 @@
+//
+//  DownloadCacheCheck.cpp
+//  AltServer
+//
+//  Automated check of AppDownloadCache against a DownloadStandIn it starts
+//  itself, serving a file whose contents and SHA-256 the check knows. The
+//  stand-in cuts its first response short, then in order:
+//
+//  - interrupted: the failed download leaves a partial copy behind
+//  - resumed: the next download asks for the rest with Range and If-Range,
+//    gets 206 and appends only the missing bytes
+//  - revalidated: the one after that sends If-None-Match, gets 304 and reuses
+//    the stored copy without transferring it
+//  - corrupted: a download whose SHA-256 doesn't match the expected one is
+//    discarded, and the next one transfers the whole file again
+//
+//  Byte counts come from AppDownloadCache's statistics, and every copy is
+//  compared with the original. `make check` builds the stand-in and runs it;
+//  otherwise pass --stand-in.
+//
+
+#include "CheckSupport.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <getopt.h>
+
+#include "AppDownloadCache.h"
+#include "Digest.hpp"
+#include "InstallError.hpp"
+#include "Logger.hpp"
+
+namespace fs = std::filesystem;
+
+struct Configuration
+{
+	std::string standInPath = "./DownloadStandIn";
+	int port = 16981;
+
+	int size = 1024;
+	int interruptAfter = 256;
+
+	std::string workingDirectory = fs::temp_directory_path().append("DownloadCacheCheck").string();
+};
+
+static std::string ReadFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Result of one AppDownloadCache::Download call, with the statistics it changed.
+struct DownloadResult
+{
+	std::optional<std::string> path;
+	std::optional<InstallErrorCode> error;
+
+	AppDownloadCacheStatistics statistics;
+};
+
+static DownloadResult Download(const std::string& url, std::optional<std::string> expectedSHA256)
+{
+	auto before = AppDownloadCache::instance()->statistics();
+
+	DownloadResult result;
+
+	try
+	{
+		result.path = AppDownloadCache::instance()->Download(url, expectedSHA256).get();
+	}
+	catch (InstallError& error)
+	{
+		result.error = (InstallErrorCode)error.code();
+	}
+	catch (std::exception& exception)
+	{
+		std::cout << "Download failed: " << exception.what() << std::endl;
+	}
+
+	auto after = AppDownloadCache::instance()->statistics();
+	result.statistics.notModifiedResponses = after.notModifiedResponses - before.notModifiedResponses;
+	result.statistics.completeDownloads = after.completeDownloads - before.completeDownloads;
+	result.statistics.resumedDownloads = after.resumedDownloads - before.resumedDownloads;
+	result.statistics.sharedDownloads = after.sharedDownloads - before.sharedDownloads;
+	result.statistics.bytesDownloaded = after.bytesDownloaded - before.bytesDownloaded;
+	result.statistics.bytesReused = after.bytesReused - before.bytesReused;
+
+	return result;
+}
+
+// Files AppDownloadCache keeps under ./AltServerData with the given extension.
+static std::vector<fs::path> FindFiles(const std::string& extension)
+{
+	std::vector<fs::path> paths;
+
+	for (auto& entry : fs::recursive_directory_iterator("AltServerData"))
+	{
+		if (entry.path().extension() == extension)
+		{
+			paths.push_back(entry.path());
+		}
+	}
+
+	return paths;
+}
+
+static std::string DescribeBytes(uint64_t downloaded, uint64_t reused)
+{
+	return "downloaded " + std::to_string(downloaded) + " bytes, reused " + std::to_string(reused);
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--stand-in PATH] [--port N] [--size-kb N] [--interrupt-after-kb N] [--workdir PATH] [--verbose]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+	bool verbose = false;
+
+	static struct option long_options[] =
+	{
+		{"stand-in",           required_argument, 0, 's'},
+		{"port",               required_argument, 0, 'p'},
+		{"size-kb",            required_argument, 0, 'k'},
+		{"interrupt-after-kb", required_argument, 0, 'i'},
+		{"workdir",            required_argument, 0, 'w'},
+		{"verbose",            no_argument,       0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 's': configuration.standInPath = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'k': configuration.size = std::max(2, atoi(optarg)); break;
+		case 'i': configuration.interruptAfter = std::max(1, atoi(optarg)); break;
+		case 'w': configuration.workingDirectory = optarg; break;
+		case 'v': verbose = true; break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (configuration.interruptAfter >= configuration.size)
+	{
+		std::cerr << "--interrupt-after-kb must be less than --size-kb." << std::endl;
+		return 1;
+	}
+
+	if (!verbose)
+	{
+		Logger::instance()->setLevel(LogLevel::Off);
+	}
+
+	auto standInPath = fs::absolute(configuration.standInPath).string();
+
+	// AltServer keeps downloads under ./AltServerData, so run where they can be thrown away.
+	// Without certificate keys to generate in the background, since no install needs them.
+	setenv("ALTSERVER_KEY_POOL_SIZE", "0", 1);
+
+	fs::remove_all(configuration.workingDirectory);
+	fs::create_directories(configuration.workingDirectory);
+	fs::current_path(configuration.workingDirectory);
+
+	std::mt19937 random(1);
+	std::string contents((size_t)configuration.size * 1024, '\0');
+	for (auto& byte : contents)
+	{
+		byte = (char)random();
+	}
+
+	auto sha256 = SHA256HexString(contents);
+	auto size = (uint64_t)contents.size();
+
+	auto filePath = fs::path(configuration.workingDirectory).append("AltStore.ipa").string();
+	{
+		std::ofstream file(filePath, std::ios::binary);
+		file << contents;
+	}
+
+	check::Results results;
+
+	try
+	{
+		check::StandIn standIn(standInPath, configuration.port, {
+			"--file", filePath,
+			"--interrupt-after-kb", std::to_string(configuration.interruptAfter),
+			"--interrupt-count", "1",
+		});
+
+		auto url = standIn.url() + "/altstore.ipa";
+
+		// Interrupted
+		auto result = Download(url, sha256);
+
+		auto partialPaths = FindFiles(".partial");
+		uint64_t partialSize = partialPaths.empty() ? 0 : fs::file_size(partialPaths[0]);
+
+		results.Expect(result.error == InstallErrorCode::DownloadFailed && result.statistics.completeDownloads == 0,
+			"interrupted: a download cut short fails with DownloadFailed");
+		results.Expect(partialPaths.size() == 1 && partialSize > 0 && partialSize <= (uint64_t)configuration.interruptAfter * 1024 &&
+			contents.compare(0, partialSize, ReadFile(partialPaths.empty() ? "" : partialPaths[0].string())) == 0,
+			"interrupted: the bytes received are kept as a partial copy (" + std::to_string(partialSize) + " bytes)");
+
+		// Resumed
+		result = Download(url, sha256);
+
+		results.Expect(result.path.has_value() && result.statistics.resumedDownloads == 1 && result.statistics.completeDownloads == 0,
+			"resumed: the next download resumes the partial copy with a 206");
+		results.Expect(result.statistics.bytesDownloaded == size - partialSize && result.statistics.bytesReused == partialSize,
+			"resumed: only the missing bytes are transferred (" + DescribeBytes(result.statistics.bytesDownloaded, result.statistics.bytesReused) + ", expected " + DescribeBytes(size - partialSize, partialSize) + ")");
+		results.Expect(result.path.has_value() && ReadFile(*result.path) == contents && FindFiles(".partial").empty(),
+			"resumed: the appended copy matches the original");
+
+		// Revalidated
+		result = Download(url, sha256);
+
+		results.Expect(result.path.has_value() && result.statistics.notModifiedResponses == 1,
+			"revalidated: a stored copy is revalidated with If-None-Match and answered 304");
+		results.Expect(result.statistics.bytesDownloaded == 0 && result.statistics.bytesReused == size,
+			"revalidated: nothing is transferred (" + DescribeBytes(result.statistics.bytesDownloaded, result.statistics.bytesReused) + ")");
+		results.Expect(result.path.has_value() && ReadFile(*result.path) == contents, "revalidated: the stored copy is unchanged");
+
+		// Corrupted
+		auto storedPath = result.path.value_or("");
+		auto wrongSHA256 = SHA256HexString("not AltStore");
+
+		result = Download(url, wrongSHA256);
+
+		results.Expect(result.error == InstallErrorCode::DownloadCorrupted,
+			"corrupted: a download with an unexpected SHA-256 fails with DownloadCorrupted");
+		results.Expect(result.statistics.notModifiedResponses == 0 && result.statistics.bytesDownloaded == size && result.statistics.bytesReused == 0,
+			"corrupted: the stored copy isn't used for another SHA-256, so the whole file is transferred (" + DescribeBytes(result.statistics.bytesDownloaded, result.statistics.bytesReused) + ")");
+		results.Expect(result.statistics.completeDownloads == 0 && FindFiles(".partial").empty() && FindFiles(".plist").empty(),
+			"corrupted: the mismatched download and its metadata are discarded");
+
+		result = Download(url, sha256);
+
+		results.Expect(result.path.has_value() && result.statistics.completeDownloads == 1 && result.statistics.notModifiedResponses == 0 &&
+			result.statistics.bytesDownloaded == size && result.statistics.bytesReused == 0,
+			"corrupted: after a discarded download the whole file is transferred again (" + DescribeBytes(result.statistics.bytesDownloaded, result.statistics.bytesReused) + ")");
+		results.Expect(result.path.has_value() && *result.path == storedPath && ReadFile(*result.path) == contents,
+			"corrupted: the new copy replaces the stored one and matches the original");
+	}
+	catch (std::exception& exception)
+	{
+		results.Expect(false, std::string("ran every check (") + exception.what() + ")");
+	}
+
+	fs::current_path(fs::temp_directory_path());
+	fs::remove_all(configuration.workingDirectory);
+
+	return results.Finish();
+}
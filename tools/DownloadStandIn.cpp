@@ -0,0 +1,254 @@
+//
+//  DownloadStandIn.cpp
+//  AltServer
+//
+//  Local stand-in for the AltStore CDN that speaks enough HTTP to exercise
+//  AppDownloadCache: it sends an ETag and Last-Modified date, answers 304 to
+//  matching If-None-Match/If-Modified-Since requests, and 206 to Range requests
+//  (honoring If-Range). --interrupt-after-kb cuts the first responses short so
+//  the next install has to resume. It serves --file, or random data without one.
+//
+//  Point AltServer at it with ALTSERVER_ALTSTORE_URL=http://127.0.0.1:6971/altstore.ipa
+//
+
+#include <algorithm>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <cpprest/http_listener.h>
+#include <cpprest/containerstream.h>
+
+#include <openssl/sha.h>
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::experimental::listener;
+
+struct Configuration
+{
+	std::string host = "127.0.0.1";
+	int port = 6971;
+	std::string filePath;
+	int size = 4096;
+	int interruptAfter = 0;
+	int interruptCount = 1;
+};
+
+static std::string HTTPDate(time_t date)
+{
+	char buffer[64];
+	strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&date));
+	return buffer;
+}
+
+static std::string MakeETag(const std::vector<unsigned char>& contents)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256(contents.data(), contents.size(), digest);
+
+	std::stringstream ss;
+	ss << "\"";
+	for (int i = 0; i < 8; i++)
+	{
+		ss << std::hex << std::setw(2) << std::setfill('0') << (int)digest[i];
+	}
+	ss << "\"";
+
+	return ss.str();
+}
+
+static void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--host ADDRESS] [--port N] [--file FILE.ipa | --size-kb N] [--interrupt-after-kb N] [--interrupt-count N]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Configuration configuration;
+
+	static struct option long_options[] =
+	{
+		{"host",               required_argument, 0, 'h'},
+		{"port",               required_argument, 0, 'p'},
+		{"file",               required_argument, 0, 'f'},
+		{"size-kb",            required_argument, 0, 's'},
+		{"interrupt-after-kb", required_argument, 0, 'i'},
+		{"interrupt-count",    required_argument, 0, 'c'},
+		{0, 0, 0, 0}
+	};
+
+	while (1)
+	{
+		int c = getopt_long(argc, argv, "", long_options, NULL);
+		if (c == -1) break;
+
+		switch (c)
+		{
+		case 'h': configuration.host = optarg; break;
+		case 'p': configuration.port = atoi(optarg); break;
+		case 'f': configuration.filePath = optarg; break;
+		case 's': configuration.size = std::max(1, atoi(optarg)); break;
+		case 'i': configuration.interruptAfter = std::max(0, atoi(optarg)); break;
+		case 'c': configuration.interruptCount = std::max(0, atoi(optarg)); break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<unsigned char> contents;
+	time_t modificationDate = time(NULL);
+
+	if (configuration.filePath.empty())
+	{
+		std::mt19937 random((unsigned int)time(NULL));
+
+		contents.resize((size_t)configuration.size * 1024);
+		for (auto& byte : contents)
+		{
+			byte = (unsigned char)random();
+		}
+	}
+	else
+	{
+		std::ifstream file(configuration.filePath, std::ios::in | std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Failed to open " << configuration.filePath << std::endl;
+			return 1;
+		}
+
+		contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+		struct stat attributes;
+		if (stat(configuration.filePath.c_str(), &attributes) == 0)
+		{
+			modificationDate = attributes.st_mtime;
+		}
+	}
+
+	auto etag = MakeETag(contents);
+	auto lastModified = HTTPDate(modificationDate);
+
+	// Blocked before any listener thread exists so only sigwait below sees them.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	std::mutex interruptionsMutex;
+	int remainingInterruptions = (configuration.interruptAfter > 0) ? configuration.interruptCount : 0;
+
+	auto url = "http://" + configuration.host + ":" + std::to_string(configuration.port);
+
+	http_listener listener(url);
+	listener.support(methods::GET, [&](http_request request) {
+		auto& headers = request.headers();
+		auto path = request.relative_uri().to_string();
+
+		auto header = [&headers](const std::string& name) -> std::string {
+			return headers.has(name) ? headers[name] : "";
+		};
+
+		bool isCurrent = headers.has(header_names::if_none_match) ? (header(header_names::if_none_match) == etag) :
+			(headers.has(header_names::if_modified_since) && header(header_names::if_modified_since) == lastModified);
+
+		if (isCurrent)
+		{
+			std::cout << "GET " << path << " -> 304" << std::endl;
+
+			http_response response(status_codes::NotModified);
+			response.headers().add(header_names::etag, etag);
+			response.headers().add(header_names::last_modified, lastModified);
+			request.reply(response);
+			return;
+		}
+
+		size_t offset = 0;
+
+		// Only "bytes=N-", which is all AppDownloadCache sends.
+		auto range = header(header_names::range);
+		auto ifRange = header(header_names::if_range);
+
+		unsigned long long start = 0;
+		if (!range.empty() && sscanf(range.c_str(), "bytes=%llu-", &start) == 1 && (ifRange.empty() || ifRange == etag || ifRange == lastModified))
+		{
+			if (start >= contents.size())
+			{
+				std::cout << "GET " << path << " (" << range << ") -> 416" << std::endl;
+
+				http_response response(416);
+				response.headers().add(header_names::content_range, "bytes */" + std::to_string(contents.size()));
+				request.reply(response);
+				return;
+			}
+
+			offset = (size_t)start;
+		}
+
+		http_response response(offset > 0 ? status_codes::PartialContent : status_codes::OK);
+		response.headers().add(header_names::etag, etag);
+		response.headers().add(header_names::last_modified, lastModified);
+		response.headers().add(header_names::accept_ranges, "bytes");
+
+		if (offset > 0)
+		{
+			response.headers().add(header_names::content_range, "bytes " + std::to_string(offset) + "-" + std::to_string(contents.size() - 1) + "/" + std::to_string(contents.size()));
+		}
+
+		std::vector<unsigned char> body(contents.begin() + offset, contents.end());
+		auto length = body.size();
+
+		bool interrupt = false;
+		{
+			std::lock_guard<std::mutex> lock(interruptionsMutex);
+			if (remainingInterruptions > 0 && body.size() > (size_t)configuration.interruptAfter * 1024)
+			{
+				remainingInterruptions--;
+				interrupt = true;
+			}
+		}
+
+		if (interrupt)
+		{
+			// Promise the whole body but stop early, like a dropped connection.
+			body.resize((size_t)configuration.interruptAfter * 1024);
+		}
+
+		std::cout << "GET " << path << (range.empty() ? "" : " (" + range + ")") << " -> " << response.status_code()
+			<< (interrupt ? " interrupted after " + std::to_string(body.size()) + " bytes" : "") << std::endl;
+
+		response.set_body(concurrency::streams::bytestream::open_istream(std::move(body)), length, "application/octet-stream");
+
+		request.reply(response).then([](pplx::task<void> task) {
+			try
+			{
+				task.get();
+			}
+			catch (std::exception& exception)
+			{
+				std::cout << "Reply ended: " << exception.what() << std::endl;
+			}
+		});
+	});
+
+	listener.open().wait();
+	std::cout << "Serving " << contents.size() << " bytes (ETag " << etag << ") on " << url << std::endl;
+
+	int signal = 0;
+	sigwait(&signals, &signal);
+
+	listener.close().wait();
+
+	return 0;
+}